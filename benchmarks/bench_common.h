@@ -0,0 +1,69 @@
+#ifndef BENCHMARKS_BENCH_COMMON_H
+#define BENCHMARKS_BENCH_COMMON_H
+
+#include <cstddef>
+#include <random>
+#include <string>
+#include <vector>
+
+struct SyntheticPackage {
+    std::string name;
+    std::vector<std::string> files;
+};
+
+// Generates a dpkg-like set of packages with their files. The defaults are
+// close to a desktop installation (~2k packages, ~150k paths) with the usual
+// mix of shared directories, shared libraries, documentation and deeper
+// data trees. The output is deterministic.
+inline std::vector<SyntheticPackage>
+make_synthetic_packages(std::size_t count = 2000,
+                        std::size_t files_per_package = 75) {
+    static std::vector<std::string> const kExtensions{
+        ".R", ".so", ".h", ".png", ".html", ".gz", ".py", ".txt", ".mo"};
+
+    std::mt19937 rng{42};
+    std::vector<SyntheticPackage> packages;
+    packages.reserve(count);
+
+    for (std::size_t i = 0; i < count; ++i) {
+        SyntheticPackage pkg{.name = "pkg" + std::to_string(i), .files = {}};
+        auto& files = pkg.files;
+
+        files.emplace_back("/.");
+        files.emplace_back("/usr");
+        files.emplace_back("/usr/share");
+        files.emplace_back("/usr/share/doc");
+        files.emplace_back("/usr/share/doc/" + pkg.name);
+        files.emplace_back("/usr/share/doc/" + pkg.name + "/copyright");
+        files.emplace_back("/usr/share/doc/" + pkg.name +
+                           "/changelog.Debian.gz");
+        files.emplace_back("/usr/lib/x86_64-linux-gnu/lib" + pkg.name +
+                           ".so.1");
+
+        while (files.size() < files_per_package) {
+            std::string path = "/usr/share/" + pkg.name;
+            auto depth = 1 + rng() % 4;
+            for (std::size_t d = 0; d < depth; ++d) {
+                path += "/dir" + std::to_string(rng() % 8);
+            }
+            path += "/file" + std::to_string(files.size()) +
+                    kExtensions[rng() % kExtensions.size()];
+            files.push_back(std::move(path));
+        }
+
+        packages.push_back(std::move(pkg));
+    }
+
+    return packages;
+}
+
+inline std::vector<std::string>
+all_paths(std::vector<SyntheticPackage> const& packages) {
+    std::vector<std::string> paths;
+    for (auto const& pkg : packages) {
+        paths.insert(paths.end(), pkg.files.begin(), pkg.files.end());
+    }
+    return paths;
+}
+
+#endif // BENCHMARKS_BENCH_COMMON_H
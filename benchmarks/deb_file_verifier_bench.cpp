@@ -0,0 +1,97 @@
+#include "deb_file_verifier.h"
+#include "dpkg_database.h"
+#include "util.h"
+#include "util_fs.h"
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Up to 10k of the regular files installed by the packages of this system
+// (the ones with md5sums) together with their owners.
+class InstalledFiles {
+  public:
+    static constexpr std::size_t kMaxFiles = 10'000;
+
+    InstalledFiles() : db_{DpkgDatabase::system_database()} {
+        std::string buffer;
+        for (auto const& entry : fs::directory_iterator{kDpkgInfoDir}) {
+            if (entry.path().extension() != ".md5sums") {
+                continue;
+            }
+            auto const* pkg = db_.lookup_by_name(entry.path().stem());
+            if (pkg == nullptr) {
+                continue;
+            }
+
+            read_from_file(entry.path(), buffer);
+            std::string_view data{buffer};
+            while (!data.empty() && paths_.size() < kMaxFiles) {
+                auto line = string_pop_line(data);
+                if (line.size() > 34) {
+                    paths_.emplace_back("/" + std::string{line.substr(34)});
+                    owners_.push_back(pkg);
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] std::vector<DebFileVerifier::File> files() const {
+        std::vector<DebFileVerifier::File> files;
+        for (std::size_t i = 0; i < paths_.size(); ++i) {
+            files.push_back({.path = &paths_[i],
+                             .dpkg_path = paths_[i].native(),
+                             .package = owners_[i]});
+        }
+        return files;
+    }
+
+  private:
+    DpkgDatabase db_;
+    std::vector<fs::path> paths_;
+    std::vector<DebPackage const*> owners_;
+};
+
+InstalledFiles const& installed_files() {
+    static InstalledFiles files;
+    return files;
+}
+
+} // namespace
+
+// the argument is the number of threads, 0 is one per core
+static void BM_DebFileVerifierNoCache(benchmark::State& state) {
+    auto files = installed_files().files();
+    auto jobs = static_cast<unsigned>(state.range(0));
+
+    for (auto _ : state) {
+        DebFileVerifier verifier{fs::path{kDpkgInfoDir}, {}, jobs};
+        auto result = verifier.verify(files);
+        benchmark::DoNotOptimize(result);
+    }
+
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<std::int64_t>(files.size()));
+}
+BENCHMARK(BM_DebFileVerifierNoCache)
+    ->Arg(1)
+    ->Arg(0)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+static void BM_DebFileVerifierCached(benchmark::State& state) {
+    auto files = installed_files().files();
+    TempFile cache_file{"r4r-bench-md5sums", ".cache"};
+    DebFileVerifier{fs::path{kDpkgInfoDir}, *cache_file}.verify(files);
+
+    for (auto _ : state) {
+        DebFileVerifier verifier{fs::path{kDpkgInfoDir}, *cache_file};
+        auto result = verifier.verify(files);
+        benchmark::DoNotOptimize(result);
+    }
+
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<std::int64_t>(files.size()));
+}
+BENCHMARK(BM_DebFileVerifierCached)->Unit(benchmark::kMillisecond);
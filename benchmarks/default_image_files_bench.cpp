@@ -0,0 +1,35 @@
+#include "bench_common.h"
+#include "default_image_files.h"
+#include <benchmark/benchmark.h>
+#include <sstream>
+
+static void BM_DefaultImageFilesFromStream(benchmark::State& state) {
+    // a base image has ~20k-50k files
+    std::vector<ImageFileInfo> files;
+    for (auto const& path : all_paths(make_synthetic_packages(500, 80))) {
+        files.push_back(ImageFileInfo{
+            .path = path,
+            .user = "root",
+            .group = "root",
+            .permissions = 644,
+            .size = path.size() * 100,
+            .sha1 = "da39a3ee5e6b4b0d3255bfef95601890afd80709",
+        });
+    }
+
+    std::ostringstream out;
+    DefaultImageFiles{files}.save(out);
+    auto data = out.str();
+
+    for (auto _ : state) {
+        std::istringstream input{data};
+        auto result = DefaultImageFiles::from_stream(input);
+        benchmark::DoNotOptimize(result);
+    }
+
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(files.size()));
+    state.SetBytesProcessed(state.iterations() *
+                            static_cast<int64_t>(data.size()));
+}
+BENCHMARK(BM_DefaultImageFilesFromStream)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,75 @@
+#include "bench_common.h"
+#include "dpkg_database.h"
+#include "util_fs.h"
+#include <benchmark/benchmark.h>
+#include <fstream>
+#include <utility>
+
+namespace {
+
+// A fixture mimicking /var/lib/dpkg/info with one .list file per package
+class DpkgInfoFixture {
+  public:
+    DpkgInfoFixture() {
+        for (auto const& pkg : make_synthetic_packages()) {
+            std::ofstream out{dir_ / (pkg.name + ".list")};
+            for (auto const& file : pkg.files) {
+                out << file << '\n';
+            }
+            names_.push_back(pkg.name);
+        }
+    }
+
+    [[nodiscard]] fs::path const& dir() const { return dir_; }
+
+    [[nodiscard]] DebPackages packages() const {
+        DebPackages packages;
+        for (auto const& name : names_) {
+            packages.emplace(name, std::make_unique<DebPackage>(name, "1.0"));
+        }
+        return packages;
+    }
+
+  private:
+    TempDir tmp_{"r4r-bench-dpkg-"};
+    fs::path const& dir_{*tmp_};
+    std::vector<std::string> names_;
+};
+
+} // namespace
+
+// the argument is the number of threads, 0 is one per core
+static void BM_DpkgDatabaseFromPath(benchmark::State& state) {
+    DpkgInfoFixture fixture;
+    auto jobs = static_cast<unsigned>(state.range(0));
+
+    for (auto _ : state) {
+        // from_path takes the packages over, building them is not measured
+        state.PauseTiming();
+        auto packages = fixture.packages();
+        state.ResumeTiming();
+
+        auto db = DpkgDatabase::from_path(fixture.dir(), std::move(packages),
+                                          jobs);
+        benchmark::DoNotOptimize(db);
+    }
+}
+BENCHMARK(BM_DpkgDatabaseFromPath)
+    ->Arg(1)
+    ->Arg(4)
+    ->Arg(0)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+static void BM_DpkgDatabaseFromCache(benchmark::State& state) {
+    DpkgInfoFixture fixture;
+    auto cache_file = fixture.dir() / "dpkg.trie";
+    DpkgDatabase::from_path(fixture.dir(), fixture.packages())
+        .save(cache_file, 1);
+
+    for (auto _ : state) {
+        auto db = DpkgDatabase::from_cache(cache_file, 1);
+        benchmark::DoNotOptimize(db);
+    }
+}
+BENCHMARK(BM_DpkgDatabaseFromCache)->Unit(benchmark::kMillisecond);
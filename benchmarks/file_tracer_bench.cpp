@@ -0,0 +1,60 @@
+#include "file_tracer.h"
+#include "util_fs.h"
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <fstream>
+#include <unistd.h>
+
+// Feeds FileTracer with a synthetic syscall stream from this very process
+// (so the paths can be read with process_vm_readv). For every openat there
+// are a number of syscalls without a handler, which is the common case.
+static void BM_FileTracerDispatch(benchmark::State& state) {
+    TempFile file{"r4r-bench", ".txt"};
+    std::ofstream{*file} << "content";
+    std::string path = file->string();
+    std::string missing = path + ".missing";
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        state.SkipWithError("Failed to open the temporary file");
+        return;
+    }
+
+    pid_t pid = getpid();
+    auto unhandled = static_cast<std::size_t>(state.range(0));
+
+    auto address = [](std::string const& s) {
+        return static_cast<std::uint64_t>(reinterpret_cast<uintptr_t>(s.data()));
+    };
+
+    SyscallArgs open_existing{static_cast<std::uint64_t>(AT_FDCWD),
+                              address(path), O_RDONLY, 0, 0, 0};
+    SyscallArgs open_missing{static_cast<std::uint64_t>(AT_FDCWD),
+                             address(missing), O_RDONLY, 0, 0, 0};
+    SyscallArgs read_args{static_cast<std::uint64_t>(fd), 0, 0, 0, 0, 0};
+
+    for (auto _ : state) {
+        FileTracer tracer{};
+
+        for (std::size_t i = 0; i < 100; ++i) {
+            for (std::size_t j = 0; j < unhandled; ++j) {
+                tracer.on_syscall_entry(pid, __NR_read, read_args);
+                tracer.on_syscall_exit(pid, 0, false);
+            }
+
+            tracer.on_syscall_entry(pid, __NR_openat, open_existing);
+            tracer.on_syscall_exit(pid, fd, false);
+
+            tracer.on_syscall_entry(pid, __NR_openat, open_missing);
+            tracer.on_syscall_exit(pid, -ENOENT, true);
+        }
+
+        benchmark::DoNotOptimize(tracer.files());
+    }
+
+    close(fd);
+
+    state.SetItemsProcessed(state.iterations() * 100 *
+                            static_cast<int64_t>(unhandled + 2));
+}
+BENCHMARK(BM_FileTracerDispatch)->Arg(0)->Arg(10);
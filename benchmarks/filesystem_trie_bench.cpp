@@ -0,0 +1,123 @@
+#include "bench_common.h"
+#include "filesystem_trie.h"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <string_view>
+#include <vector>
+
+static void BM_FileSystemTrieInsert(benchmark::State& state) {
+    auto paths = all_paths(make_synthetic_packages());
+
+    for (auto _ : state) {
+        FileSystemTrie<int> trie;
+        int value = 0;
+        for (auto const& path : paths) {
+            trie.insert(path, value++ % 2000);
+        }
+        benchmark::DoNotOptimize(trie);
+    }
+
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(paths.size()));
+}
+BENCHMARK(BM_FileSystemTrieInsert)->Unit(benchmark::kMillisecond);
+
+static void BM_FileSystemTrieFind(benchmark::State& state) {
+    auto paths = all_paths(make_synthetic_packages());
+
+    FileSystemTrie<int> trie;
+    int value = 0;
+    for (auto const& path : paths) {
+        trie.insert(path, value++ % 2000);
+    }
+
+    // every other lookup misses
+    std::vector<std::string> lookups;
+    for (std::size_t i = 0; i < paths.size(); i += 2) {
+        lookups.push_back(paths[i]);
+        lookups.push_back(paths[i] + ".missing");
+    }
+
+    for (auto _ : state) {
+        for (auto const& path : lookups) {
+            benchmark::DoNotOptimize(trie.find(path));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(lookups.size()));
+}
+BENCHMARK(BM_FileSystemTrieFind)->Unit(benchmark::kMillisecond);
+
+static void BM_FileSystemTrieFindLastMatching(benchmark::State& state) {
+    auto packages = make_synthetic_packages();
+
+    // like R packages: one entry per package directory
+    FileSystemTrie<int> trie;
+    int value = 0;
+    for (auto const& pkg : packages) {
+        trie.insert("/usr/share/" + pkg.name, value++);
+    }
+
+    auto lookups = all_paths(packages);
+
+    for (auto _ : state) {
+        for (auto const& path : lookups) {
+            benchmark::DoNotOptimize(trie.find_last_matching(path));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(lookups.size()));
+}
+BENCHMARK(BM_FileSystemTrieFindLastMatching)->Unit(benchmark::kMillisecond);
+
+static void BM_FileSystemTrieFindSorted(benchmark::State& state) {
+    auto paths = all_paths(make_synthetic_packages());
+
+    FileSystemTrie<int> trie;
+    int value = 0;
+    for (auto const& path : paths) {
+        trie.insert(path, value++ % 2000);
+    }
+
+    // the same lookups as BM_FileSystemTrieFind, sorted
+    std::vector<std::string> lookups;
+    for (std::size_t i = 0; i < paths.size(); i += 2) {
+        lookups.push_back(paths[i]);
+        lookups.push_back(paths[i] + ".missing");
+    }
+    std::ranges::sort(lookups);
+    std::vector<std::string_view> views{lookups.begin(), lookups.end()};
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(trie.find_sorted(views));
+    }
+
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(lookups.size()));
+}
+BENCHMARK(BM_FileSystemTrieFindSorted)->Unit(benchmark::kMillisecond);
+
+static void BM_FileSystemTrieFindLastMatchingSorted(benchmark::State& state) {
+    auto packages = make_synthetic_packages();
+
+    FileSystemTrie<int> trie;
+    int value = 0;
+    for (auto const& pkg : packages) {
+        trie.insert("/usr/share/" + pkg.name, value++);
+    }
+
+    auto lookups = all_paths(packages);
+    std::ranges::sort(lookups);
+    std::vector<std::string_view> views{lookups.begin(), lookups.end()};
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(trie.find_last_matching_sorted(views));
+    }
+
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(lookups.size()));
+}
+BENCHMARK(BM_FileSystemTrieFindLastMatchingSorted)
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,42 @@
+#include "bench_common.h"
+#include "ignore_file_map.h"
+#include <benchmark/benchmark.h>
+
+static void BM_IgnoreFileMapIgnore(benchmark::State& state) {
+    auto packages = make_synthetic_packages();
+
+    // the default patterns plus the files of the base image (every fourth
+    // package is part of it)
+    IgnoreFileMap map;
+    for (auto const* p : {"/dev", "/etc/ld.so.cache", "/etc/nsswitch.conf",
+                          "/etc/passwd", "/proc", "/sys", "/var/cache"}) {
+        map.add_wildcard(p);
+    }
+    map.add_file("/");
+    map.add_custom(ignore_font_uuid_files);
+
+    for (std::size_t i = 0; i < packages.size(); i += 4) {
+        for (auto const& file : packages[i].files) {
+            map.add_file(file);
+        }
+    }
+
+    std::vector<fs::path> lookups;
+    for (std::size_t i = 0; i < packages.size(); i += 2) {
+        for (auto const& file : packages[i].files) {
+            lookups.emplace_back(file);
+        }
+    }
+    lookups.emplace_back("/proc/self/maps");
+    lookups.emplace_back("/dev/null");
+
+    for (auto _ : state) {
+        for (auto const& path : lookups) {
+            benchmark::DoNotOptimize(map.ignore(path));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(lookups.size()));
+}
+BENCHMARK(BM_IgnoreFileMapIgnore)->Unit(benchmark::kMillisecond);
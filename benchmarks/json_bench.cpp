@@ -0,0 +1,65 @@
+#include "json.h"
+#include "json_view.h"
+#include <benchmark/benchmark.h>
+#include <sstream>
+
+// a response of the posit package manager sysreqs API
+static std::string make_sysreqs_response(std::size_t requirements) {
+    std::ostringstream out;
+    out << R"({"name":"pkg","requirements":[)";
+    for (std::size_t i = 0; i < requirements; ++i) {
+        if (i > 0) {
+            out << ',';
+        }
+        out << R"({"name":"lib)" << i << R"(","requirements":{"packages":)"
+            << R"(["lib)" << i << R"(-dev","pkg-config"],)"
+            << R"("install_scripts":["apt-get install -y lib)" << i
+            << R"(-dev pkg-config"],"pre_install":[{"command":)"
+            << R"("apt-get update \"-y\"","script":null}],"post_install":[],)"
+            << R"("priority":)" << i << R"(,"weight":1.5,"optional":false}})";
+    }
+    out << "]}";
+    return out.str();
+}
+
+static void BM_JsonParserParse(benchmark::State& state) {
+    auto data = make_sysreqs_response(static_cast<std::size_t>(state.range(0)));
+
+    for (auto _ : state) {
+        auto json = JsonParser::parse(data);
+        benchmark::DoNotOptimize(json);
+    }
+
+    state.SetBytesProcessed(state.iterations() *
+                            static_cast<int64_t>(data.size()));
+}
+BENCHMARK(BM_JsonParserParse)->Arg(1)->Arg(10)->Arg(1000);
+
+static void BM_JsonDocumentParse(benchmark::State& state) {
+    auto data = make_sysreqs_response(static_cast<std::size_t>(state.range(0)));
+
+    for (auto _ : state) {
+        auto doc = JsonDocument::parse(data);
+        benchmark::DoNotOptimize(doc);
+    }
+
+    state.SetBytesProcessed(state.iterations() *
+                            static_cast<int64_t>(data.size()));
+}
+BENCHMARK(BM_JsonDocumentParse)->Arg(1)->Arg(10)->Arg(1000);
+
+// what get_system_dependencies extracts from a response
+static void BM_JsonPathQueryPackages(benchmark::State& state) {
+    auto data = make_sysreqs_response(static_cast<std::size_t>(state.range(0)));
+    JsonPathQuery query{"requirements.*.requirements.packages.*"};
+
+    for (auto _ : state) {
+        std::size_t packages = 0;
+        query.run(data, [&](auto, JsonScalar const&) { ++packages; });
+        benchmark::DoNotOptimize(packages);
+    }
+
+    state.SetBytesProcessed(state.iterations() *
+                            static_cast<int64_t>(data.size()));
+}
+BENCHMARK(BM_JsonPathQueryPackages)->Arg(1)->Arg(10)->Arg(1000);
@@ -0,0 +1,125 @@
+#include "rpkg_database.h"
+#include <benchmark/benchmark.h>
+#include <fstream>
+#include <sstream>
+
+// the output of installed.packages() as produced by RpkgDatabase::from_R
+static std::string make_installed_packages(std::size_t count) {
+    std::ostringstream out;
+
+    for (std::size_t i = 0; i < count; ++i) {
+        std::string deps;
+        for (std::size_t d = 1; d <= 5 && d <= i; ++d) {
+            deps += "pkg" + std::to_string(i - d) + " (>= 1.0." +
+                    std::to_string(d) + "), ";
+        }
+        if (!deps.empty()) {
+            deps.resize(deps.size() - 2);
+        } else {
+            deps = "NA";
+        }
+
+        bool github = i % 20 == 0;
+
+        // clang-format off
+        out << "pkg" << i << NBSP
+            << "/home/user/R/library/4.4" << NBSP
+            << "1.0." << i << NBSP
+            << "R (>= 3.5.0)" << NBSP
+            << deps << NBSP
+            << (i % 3 == 0 && i > 0 ? "pkg0" : "NA") << NBSP
+            << "NA" << NBSP
+            << (i % 3 == 0 ? "yes" : "no") << NBSP
+            << (github ? "github" : "NA") << NBSP
+            << (github ? "r-lib" : "NA") << NBSP
+            << (github ? "pkg" + std::to_string(i) : "NA") << NBSP
+            << (github ? "main" : "NA") << '\n';
+        // clang-format on
+    }
+
+    return out.str();
+}
+
+static void BM_RpkgDatabaseFromStream(benchmark::State& state) {
+    auto data =
+        make_installed_packages(static_cast<std::size_t>(state.range(0)));
+
+    for (auto _ : state) {
+        std::istringstream input{data};
+        auto db = RpkgDatabase::from_stream(input);
+        benchmark::DoNotOptimize(db);
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_RpkgDatabaseFromStream)
+    ->Arg(1000)
+    ->Arg(5000)
+    ->Unit(benchmark::kMillisecond);
+
+namespace {
+
+// R libraries with the DESCRIPTION files of the installed packages
+class RLibrariesFixture {
+  public:
+    explicit RLibrariesFixture(std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            // a few libraries as in .libPaths()
+            auto lib = dir_ / ("lib" + std::to_string(i % 3));
+            auto name = "pkg" + std::to_string(i);
+            fs::create_directories(lib / name);
+
+            std::ofstream out{lib / name / "DESCRIPTION"};
+            out << "Package: " << name << "\nType: Package\n"
+                << "Title: A synthetic package\nVersion: 1.0." << i << '\n'
+                << "Authors@R: person(\"A\", \"B\", role = c(\"aut\", "
+                   "\"cre\"))\n"
+                << "Description: Lorem ipsum dolor sit amet, consectetur\n"
+                << "    adipiscing elit, sed do eiusmod tempor incididunt.\n"
+                << "License: MIT + file LICENSE\nDepends: R (>= 3.5.0)\n";
+            if (i > 0) {
+                out << "Imports:";
+                for (std::size_t d = 1; d <= 5 && d <= i; ++d) {
+                    out << (d > 1 ? ",\n   " : " ") << "pkg" << i - d
+                        << " (>= 1.0)";
+                }
+                out << '\n';
+            }
+            out << "NeedsCompilation: " << (i % 3 == 0 ? "yes" : "no")
+                << "\nPackaged: 2024-01-01 00:00:00 UTC; user\n"
+                << "Built: R 4.4.2; ; 2025-01-01 00:00:00 UTC; unix\n";
+        }
+        for (int i = 0; i < 3; ++i) {
+            lib_paths_.push_back(dir_ / ("lib" + std::to_string(i)));
+        }
+    }
+
+    [[nodiscard]] std::vector<fs::path> const& lib_paths() const {
+        return lib_paths_;
+    }
+
+  private:
+    TempDir tmp_{"r4r-bench-rlib-"};
+    fs::path const& dir_{*tmp_};
+    std::vector<fs::path> lib_paths_;
+};
+
+} // namespace
+
+// 1500 packages, the argument is the number of threads (0 is one per core)
+static void BM_RpkgDatabaseFromLibPaths(benchmark::State& state) {
+    RLibrariesFixture fixture{1500};
+    auto jobs = static_cast<unsigned>(state.range(0));
+
+    for (auto _ : state) {
+        auto db = RpkgDatabase::from_lib_paths(fixture.lib_paths(), jobs);
+        benchmark::DoNotOptimize(db);
+    }
+
+    state.SetItemsProcessed(state.iterations() * 1500);
+}
+BENCHMARK(BM_RpkgDatabaseFromLibPaths)
+    ->Arg(1)
+    ->Arg(0)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,313 @@
+// Measures the slowdown caused by tracing a program with the SyscallMonitor
+// and the FileTracer. It runs each workload of the tracing_workload program
+// natively and under the tracer and reports the ratio of the (best) wall
+// clock times. It exits with a non-zero code when any of the slowdowns
+// exceeds its threshold so it can guard against regressions in CI.
+
+#include "argparser.h"
+#include "common.h"
+#include "file_tracer.h"
+#include "ignore_file_map.h"
+#include "json.h"
+#include "process.h"
+#include "syscall_monitor.h"
+#include "util_io.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <span>
+#include <streambuf>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct Workload {
+    std::string name;
+    long count;
+    // the maximum allowed traced/native wall time ratio
+    double max_slowdown;
+};
+
+// The thresholds are deliberately loose, they are meant to catch
+// regressions in orders of magnitude, not noise of shared CI runners.
+std::vector<Workload> const kWorkloads{
+    {"open-existing", 20'000, 60},
+    {"open-missing", 20'000, 50},
+    {"deep-paths", 10'000, 50},
+    {"fork", 500, 10},
+    {"clone", 500, 10},
+    {"exec-chain", 200, 10},
+    {"stdout", 200'000, 10},
+};
+
+struct Measurement {
+    Workload workload;
+    double native_ms{std::numeric_limits<double>::max()};
+    double traced_ms{std::numeric_limits<double>::max()};
+    std::uint64_t syscalls{};
+    std::size_t files{};
+
+    [[nodiscard]] double slowdown() const { return traced_ms / native_ms; }
+    [[nodiscard]] bool ok() const {
+        return slowdown() <= workload.max_slowdown;
+    }
+};
+
+struct Options {
+    fs::path workload_binary;
+    int repetitions{3};
+    double scale{1.0};
+    std::optional<double> max_slowdown;
+    std::unordered_map<std::string, double> max_slowdowns;
+    fs::path output;
+    std::vector<std::string> workloads;
+};
+
+// discards everything written to it
+class NullStreamBuf : public std::streambuf {
+  protected:
+    int overflow(int c) override { return traits_type::not_eof(c); }
+    std::streamsize xsputn(char const*, std::streamsize n) override {
+        return n;
+    }
+};
+
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+}
+
+// the same patterns the tracer uses by default
+IgnoreFileMap const& ignore_file_map() {
+    static IgnoreFileMap const map = [] {
+        IgnoreFileMap m;
+        for (auto const* p : {"/dev", "/etc/ld.so.cache", "/etc/nsswitch.conf",
+                              "/etc/passwd", "/proc", "/sys",
+                              "/usr/lib/locale/locale-archive", "/var/cache"}) {
+            m.add_wildcard(p);
+        }
+        m.add_file("/");
+        return m;
+    }();
+    return map;
+}
+
+double run_native(fs::path const& binary, std::string const& workload,
+                  long count) {
+    auto start = Clock::now();
+
+    auto child = Command(binary)
+                     .arg(workload)
+                     .arg(std::to_string(count))
+                     .set_stdout(Stdio::Pipe)
+                     .spawn();
+
+    NullStreamBuf buf;
+    std::ostream null{&buf};
+    forward_output(child.stdout_fd(), null);
+
+    if (int exit_code = child.wait(); exit_code != 0) {
+        throw std::runtime_error(STR("Workload " << workload
+                                                 << " failed with exit code: "
+                                                 << exit_code));
+    }
+
+    return elapsed_ms(start);
+}
+
+double run_traced(fs::path const& binary, std::string const& workload,
+                  long count, Measurement& m) {
+    auto start = Clock::now();
+
+    FileTracer tracer{&ignore_file_map()};
+    SyscallMonitor monitor{
+        {binary.string(), workload, std::to_string(count)}, tracer};
+
+    NullStreamBuf buf;
+    std::ostream null{&buf};
+    monitor.redirect_stdout(null);
+
+    auto result = monitor.start();
+    if (result.kind != SyscallMonitor::Result::Exit || result.detail != 0) {
+        throw std::runtime_error(STR("Traced workload " << workload
+                                                        << " failed"));
+    }
+
+    auto ms = elapsed_ms(start);
+
+    m.syscalls = tracer.syscalls_count();
+    m.files = tracer.files().size();
+
+    return ms;
+}
+
+Measurement measure(Options const& opts, Workload const& workload) {
+    Measurement m{.workload = workload};
+    auto count = std::max(1L, static_cast<long>(
+                                  static_cast<double>(workload.count) *
+                                  opts.scale));
+    m.workload.count = count;
+
+    for (int i = 0; i < opts.repetitions; ++i) {
+        m.native_ms = std::min(
+            m.native_ms, run_native(opts.workload_binary, workload.name, count));
+        m.traced_ms =
+            std::min(m.traced_ms, run_traced(opts.workload_binary,
+                                             workload.name, count, m));
+    }
+
+    return m;
+}
+
+JsonValue to_json(std::vector<Measurement> const& measurements) {
+    JsonArray results;
+    for (auto const& m : measurements) {
+        results.emplace_back(JsonObject{
+            {"name", m.workload.name},
+            {"count", static_cast<double>(m.workload.count)},
+            {"native_ms", m.native_ms},
+            {"traced_ms", m.traced_ms},
+            {"slowdown", m.slowdown()},
+            {"max_slowdown", m.workload.max_slowdown},
+            {"syscalls", static_cast<double>(m.syscalls)},
+            {"files", static_cast<double>(m.files)},
+            {"ok", m.ok()},
+        });
+    }
+    return JsonObject{{"workloads", std::move(results)}};
+}
+
+void print(std::ostream& out, std::vector<Measurement> const& measurements) {
+    out << std::left << std::setw(16) << "workload" << std::right
+        << std::setw(10) << "count" << std::setw(12) << "native ms"
+        << std::setw(12) << "traced ms" << std::setw(10) << "slowdown"
+        << std::setw(8) << "max" << std::setw(12) << "syscalls" << '\n';
+
+    out << std::fixed << std::setprecision(1);
+    for (auto const& m : measurements) {
+        out << std::left << std::setw(16) << m.workload.name << std::right
+            << std::setw(10) << m.workload.count << std::setw(12)
+            << m.native_ms << std::setw(12) << m.traced_ms << std::setw(9)
+            << m.slowdown() << 'x' << std::setw(7) << m.workload.max_slowdown
+            << 'x' << std::setw(12) << m.syscalls
+            << (m.ok() ? "" : "  REGRESSION") << '\n';
+    }
+}
+
+void parse_max_slowdown(Options& opts, std::string const& arg) {
+    auto eq = arg.find('=');
+    if (eq == std::string::npos) {
+        opts.max_slowdown = std::stod(arg);
+    } else {
+        opts.max_slowdowns[arg.substr(0, eq)] = std::stod(arg.substr(eq + 1));
+    }
+}
+
+Options parse_cmd_args(std::span<char const*> args) {
+    Options opts;
+    opts.workload_binary =
+        fs::read_symlink("/proc/self/exe").parent_path() /
+        "r4r_tracing_workload";
+
+    ArgumentParser parser{"r4r_tracing_overhead",
+                          "Measure the slowdown caused by tracing"};
+
+    parser.add_option("workload-binary")
+        .with_help("Path to the r4r_tracing_workload program")
+        .with_default(opts.workload_binary)
+        .with_argument("PATH")
+        .with_callback([&](auto& arg) { opts.workload_binary = arg; });
+    parser.add_option("repetitions")
+        .with_help("How many times to run each workload (best time is used)")
+        .with_default(std::to_string(opts.repetitions))
+        .with_argument("N")
+        .with_callback([&](auto& arg) { opts.repetitions = std::stoi(arg); });
+    parser.add_option("scale")
+        .with_help("Multiply the size of each workload")
+        .with_default("1")
+        .with_argument("FACTOR")
+        .with_callback([&](auto& arg) { opts.scale = std::stod(arg); });
+    parser.add_option("max-slowdown")
+        .with_help("Override the slowdown threshold (of a given workload)")
+        .with_argument("[WORKLOAD=]FACTOR")
+        .with_callback([&](auto& arg) { parse_max_slowdown(opts, arg); });
+    parser.add_option("output")
+        .with_help("Write the results as JSON to a file")
+        .with_argument("PATH")
+        .with_callback([&](auto& arg) { opts.output = arg; });
+    parser.add_option("help")
+        .with_help("Print this message")
+        .with_callback([&](auto&) {
+            std::cout << parser.help();
+            exit(0);
+        });
+    parser.add_positional("workload")
+        .multiple()
+        .with_help("The workloads to run (all by default)")
+        .with_callback([&](auto& arg) { opts.workloads.push_back(arg); });
+
+    parser.parse(args);
+
+    return opts;
+}
+
+std::vector<Workload> select_workloads(Options const& opts) {
+    std::vector<Workload> selected;
+
+    for (auto const& name : opts.workloads) {
+        auto it = std::ranges::find(kWorkloads, name, &Workload::name);
+        if (it == kWorkloads.end()) {
+            throw std::runtime_error("Unknown workload: " + name);
+        }
+        selected.push_back(*it);
+    }
+    if (opts.workloads.empty()) {
+        selected = kWorkloads;
+    }
+
+    for (auto& w : selected) {
+        if (auto it = opts.max_slowdowns.find(w.name);
+            it != opts.max_slowdowns.end()) {
+            w.max_slowdown = it->second;
+        } else if (opts.max_slowdown) {
+            w.max_slowdown = *opts.max_slowdown;
+        }
+    }
+
+    return selected;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        std::span<char const*> args(const_cast<char const**>(argv), argc);
+        auto opts = parse_cmd_args(args);
+
+        std::vector<Measurement> measurements;
+        for (auto const& workload : select_workloads(opts)) {
+            std::cerr << "Running " << workload.name << "...\n";
+            measurements.push_back(measure(opts, workload));
+        }
+
+        print(std::cout, measurements);
+
+        if (!opts.output.empty()) {
+            std::ofstream out{opts.output};
+            out << to_json(measurements) << '\n';
+        }
+
+        return std::ranges::all_of(measurements, &Measurement::ok) ? 0 : 1;
+    } catch (std::exception const& e) {
+        std::cerr << "r4r_tracing_overhead: " << e.what() << '\n';
+        return 2;
+    }
+}
@@ -0,0 +1,207 @@
+// A synthetic program used to measure the overhead of tracing.
+// Each workload stresses a different part of the tracer:
+//
+//   open-existing N  open(2) and close(2) an existing file N times
+//   open-missing N   open(2) a missing file N times
+//   deep-paths N     open(2) a file using a deep relative path N times
+//   fork N           fork(2) and wait for a child N times
+//   clone N          create and join a thread N times
+//   exec-chain N     execve(2) itself N times in a row
+//   stdout N         write N lines to the standard output
+//
+// It only depends on libc so it runs on any Linux box.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr int kPathDepth = 16;
+
+[[noreturn]] void fail(std::string const& message) {
+    std::cerr << "tracing_workload: " << message << ": " << std::strerror(errno)
+              << '\n';
+    std::exit(1);
+}
+
+class ScratchDir {
+  public:
+    ScratchDir() {
+        std::string tmpl = (fs::temp_directory_path() / "r4r-workload-XXXXXX");
+        if (mkdtemp(tmpl.data()) == nullptr) {
+            fail("mkdtemp");
+        }
+        path_ = tmpl;
+    }
+
+    ~ScratchDir() {
+        std::error_code ec;
+        fs::remove_all(path_, ec);
+    }
+
+    ScratchDir(ScratchDir const&) = delete;
+    ScratchDir& operator=(ScratchDir const&) = delete;
+
+    [[nodiscard]] fs::path const& path() const { return path_; }
+
+  private:
+    fs::path path_;
+};
+
+void open_file(char const* path, bool must_exist) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        close(fd);
+    } else if (must_exist) {
+        fail(std::string("open ") + path);
+    }
+}
+
+void open_existing(long n) {
+    ScratchDir dir;
+    auto file = dir.path() / "file";
+    std::FILE* f = std::fopen(file.c_str(), "w");
+    if (f == nullptr) {
+        fail("fopen");
+    }
+    std::fclose(f);
+
+    for (long i = 0; i < n; ++i) {
+        open_file(file.c_str(), true);
+    }
+}
+
+void open_missing(long n) {
+    ScratchDir dir;
+    auto file = dir.path() / "missing";
+
+    for (long i = 0; i < n; ++i) {
+        open_file(file.c_str(), false);
+    }
+}
+
+void deep_paths(long n) {
+    ScratchDir dir;
+
+    // <dir>/d0/d1/.../d15/file, opened from the deepest directory as
+    // ../../(16x)/d0/d1/.../d15/file
+    fs::path deepest = dir.path();
+    std::string down;
+    for (int i = 0; i < kPathDepth; ++i) {
+        auto name = "d" + std::to_string(i);
+        deepest /= name;
+        down += name + "/";
+    }
+    fs::create_directories(deepest);
+
+    std::FILE* f = std::fopen((deepest / "file").c_str(), "w");
+    if (f == nullptr) {
+        fail("fopen");
+    }
+    std::fclose(f);
+
+    std::string path;
+    for (int i = 0; i < kPathDepth; ++i) {
+        path += "../";
+    }
+    path += down + "file";
+
+    auto cwd = fs::current_path();
+    fs::current_path(deepest);
+    for (long i = 0; i < n; ++i) {
+        open_file(path.c_str(), true);
+    }
+    fs::current_path(cwd);
+}
+
+void fork_storm(long n) {
+    for (long i = 0; i < n; ++i) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            fail("fork");
+        }
+        if (pid == 0) {
+            _exit(0);
+        }
+        int status{};
+        if (waitpid(pid, &status, 0) == -1) {
+            fail("waitpid");
+        }
+    }
+}
+
+void clone_storm(long n) {
+    long counter = 0;
+    for (long i = 0; i < n; ++i) {
+        std::thread t{[&counter] { ++counter; }};
+        t.join();
+    }
+    if (counter != n) {
+        std::exit(1);
+    }
+}
+
+void exec_chain(char const* self, long n) {
+    if (n <= 0) {
+        return;
+    }
+    auto next = std::to_string(n - 1);
+    execl(self, self, "exec-chain", next.c_str(),
+          nullptr); // NOLINT(*-pro-type-vararg)
+    fail("execl");
+}
+
+void stdout_flood(long n) {
+    std::string line(99, 'x');
+    line += '\n';
+    for (long i = 0; i < n; ++i) {
+        std::fwrite(line.data(), 1, line.size(), stdout);
+    }
+    std::fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " WORKLOAD COUNT\n";
+        return 2;
+    }
+
+    std::string_view workload = argv[1];
+    long n = std::strtol(argv[2], nullptr, 10);
+
+    if (workload == "open-existing") {
+        open_existing(n);
+    } else if (workload == "open-missing") {
+        open_missing(n);
+    } else if (workload == "deep-paths") {
+        deep_paths(n);
+    } else if (workload == "fork") {
+        fork_storm(n);
+    } else if (workload == "clone") {
+        clone_storm(n);
+    } else if (workload == "exec-chain") {
+        // /proc/self/exe so it works regardless of how it was started
+        exec_chain("/proc/self/exe", n);
+    } else if (workload == "stdout") {
+        stdout_flood(n);
+    } else {
+        std::cerr << "Unknown workload: " << workload << '\n';
+        return 2;
+    }
+
+    return 0;
+}
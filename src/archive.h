@@ -3,7 +3,12 @@
 
 #include "process.h"
 #include "util_fs.h"
+#include <algorithm>
+#include <cstddef>
+#include <deque>
 #include <fstream>
+#include <utility>
+#include <vector>
 
 template <typename FileCollection>
 void create_tar_archive(fs::path const& archive, FileCollection const& files) {
@@ -31,4 +36,61 @@ void create_tar_archive(fs::path const& archive, FileCollection const& files) {
     out.check_success(STR("Error creating tar archive: " << archive));
 }
 
+// Packs the installed R packages (their directories in an R library) into the
+// gzipped tarballs R CMD INSTALL --build makes, running up to parallel tar
+// processes at once. The tarballs that failed are removed, returns the number
+// of the created ones.
+inline std::size_t create_r_binary_tarballs(
+    std::vector<std::pair<fs::path, fs::path>> const& packages,
+    std::size_t parallel) {
+    std::deque<std::pair<Child, std::size_t>> running;
+    std::size_t created = 0;
+
+    auto wait_next = [&] {
+        auto [child, i] = std::move(running.front());
+        running.pop_front();
+
+        auto err = child.read_stderr();
+        auto const& [dir, tarball] = packages[i];
+        if (child.wait() == 0) {
+            ++created;
+            return;
+        }
+        LOG(WARN) << "Failed to pack " << dir << " into " << tarball << ": "
+                  << string_trim(err);
+        std::error_code ec;
+        fs::remove(tarball, ec);
+    };
+
+    for (std::size_t i = 0; i < packages.size(); ++i) {
+        if (running.size() >= std::max<std::size_t>(parallel, 1)) {
+            wait_next();
+        }
+
+        auto const& [dir, tarball] = packages[i];
+        LOG(DEBUG) << "Packing " << dir << " into " << tarball;
+        auto child = Command("tar")
+                         .arg("-c")
+                         .arg("-z")
+                         .arg("-f")
+                         .arg(tarball.string())
+                         .arg("--owner=0")
+                         .arg("--group=0")
+                         .arg("--numeric-owner")
+                         .arg("-C")
+                         .arg(dir.parent_path().string())
+                         .arg(dir.filename().string())
+                         .set_stdout(Stdio::Inherit)
+                         .set_stderr(Stdio::Pipe)
+                         .spawn();
+        running.emplace_back(std::move(child), i);
+    }
+
+    while (!running.empty()) {
+        wait_next();
+    }
+
+    return created;
+}
+
 #endif // ARCHIVE_H
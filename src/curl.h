@@ -3,14 +3,24 @@
 
 #include "logger.h"
 #include "util.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <curl/curl.h>
 #include <curl/multi.h>
+#include <filesystem>
+#include <fstream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <queue>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <utility>
 #include <variant>
+#include <vector>
 
 class CURLGlobalInitializer {
   public:
@@ -24,6 +34,53 @@ class CURLGlobalInitializer {
     ~CURLGlobalInitializer() { curl_global_cleanup(); }
 };
 
+// The DNS cache and the TLS sessions shared by all the transfers in the
+// process, so a new CURLMultipleTransfer does not start from scratch. The
+// connections are not shared, libcurl does not support that across threads,
+// but each multi handle keeps its own pool.
+class CURLShare {
+  public:
+    static CURLSH* handle() {
+        static CURLShare instance;
+        return instance.share_;
+    }
+
+    CURLShare(CURLShare const&) = delete;
+    CURLShare& operator=(CURLShare const&) = delete;
+
+  private:
+    CURLShare() {
+        // libcurl has to be initialized before any of its handles
+        CURLGlobalInitializer::instance();
+
+        share_ = curl_share_init();
+        if (!share_) {
+            throw std::runtime_error("curl_share_init failed");
+        }
+
+        curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, lock);
+        curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, unlock);
+        curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share_, CURLSHOPT_SHARE,
+                          CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    ~CURLShare() { curl_share_cleanup(share_); }
+
+    static void lock(CURL* /*unused*/, curl_lock_data data,
+                     curl_lock_access /*unused*/, void* self) {
+        static_cast<CURLShare*>(self)->mutexes_[data].lock();
+    }
+
+    static void unlock(CURL* /*unused*/, curl_lock_data data, void* self) {
+        static_cast<CURLShare*>(self)->mutexes_[data].unlock();
+    }
+
+    CURLSH* share_{};
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> mutexes_;
+};
+
 struct HttpResult {
     int http_code;
     std::string message;
@@ -31,93 +88,203 @@ struct HttpResult {
 
 using CURLResult = std::variant<std::string, HttpResult>;
 
+// Transfers that fail with a 5xx (or 429) response or a transient network
+// error are retried after an exponentially growing delay.
+struct CURLRetryPolicy {
+    unsigned max_retries{3};
+    std::chrono::milliseconds initial_backoff{500};
+    std::chrono::milliseconds max_backoff{8000};
+};
+
+// Runs the transfers at most `parallel` at a time. As soon as a transfer
+// finishes, the next one takes its slot; the transfers to the same host are
+// multiplexed over HTTP/2 when the server supports it.
 template <typename T>
 class CURLMultipleTransfer {
   public:
-    explicit CURLMultipleTransfer(size_t parallel);
+    explicit CURLMultipleTransfer(size_t parallel,
+                                  CURLRetryPolicy retry_policy = {});
     CURLMultipleTransfer(CURLMultipleTransfer const&) = delete;
     CURLMultipleTransfer& operator=(CURLMultipleTransfer const&) = delete;
     ~CURLMultipleTransfer();
 
     void add(T key, std::string const& url);
+    // The response goes into the file (replaced by each attempt) instead of
+    // the message of the result, so large downloads are not kept in memory.
+    void add(T key, std::string const& url, std::filesystem::path file);
     std::unordered_map<T, CURLResult> run();
 
   private:
+    using Clock = std::chrono::steady_clock;
+
+    struct EasyHandleDeleter {
+        void operator()(CURL* handle) const { curl_easy_cleanup(handle); }
+    };
+
     struct Request {
         T key;
-        std::string response;
+        std::string url;
+        std::filesystem::path file{};
+        std::string response{};
+        std::ofstream out{};
+        unsigned attempt{0};
+        std::unique_ptr<CURL, EasyHandleDeleter> handle{};
+    };
+
+    struct Retry {
+        Clock::time_point when;
+        Request* req;
+
+        bool operator>(Retry const& other) const { return when > other.when; }
     };
 
     CURLResult process_curl_message(CURLMsg* msg, Request* req);
+    [[nodiscard]] bool should_retry(CURLcode code, CURLResult const& result,
+                                    Request const& req) const;
+    [[nodiscard]] std::chrono::milliseconds backoff(unsigned attempt) const;
     static size_t write_callback(char* ptr, size_t size, size_t nmemb,
-                                 std::string* data);
-    void add_transfer(T key, std::string const& url);
+                                 Request* req);
+    void start(Request* req);
+    void fill(Clock::time_point now);
 
-    CURLM* cm_;
+    CURLM* cm_{};
     size_t parallel_;
-    std::queue<std::pair<T, std::string>> pending_;
+    CURLRetryPolicy retry_policy_;
+    std::queue<Request> pending_;
+    // the transfers that are running or waiting for a retry
     std::map<T, std::unique_ptr<Request>> requests_;
+    size_t running_{0};
+    std::priority_queue<Retry, std::vector<Retry>, std::greater<>> retries_;
 };
 
 template <typename T>
-inline CURLMultipleTransfer<T>::CURLMultipleTransfer(size_t parallel)
-    : cm_(curl_multi_init()), parallel_(parallel) {
+inline CURLMultipleTransfer<T>::CURLMultipleTransfer(
+    size_t parallel, CURLRetryPolicy retry_policy)
+    : parallel_(std::max<size_t>(parallel, 1)), retry_policy_{retry_policy} {
     CURLGlobalInitializer::instance();
 
+    cm_ = curl_multi_init();
     if (!cm_) {
         throw std::runtime_error("curl_multi_init failed");
     }
+
+    curl_multi_setopt(cm_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(cm_, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                      static_cast<long>(parallel_));
 }
 
 template <typename T>
 inline CURLMultipleTransfer<T>::~CURLMultipleTransfer() {
+    // the easy handles must be removed before they are cleaned up
+    for (auto& [_, req] : requests_) {
+        curl_multi_remove_handle(cm_, req->handle.get());
+    }
+    requests_.clear();
     curl_multi_cleanup(cm_);
 }
 
 template <typename T>
 inline void CURLMultipleTransfer<T>::add(T key, std::string const& url) {
-    pending_.emplace(key, url);
+    pending_.push({.key = key, .url = url});
 }
 
 template <typename T>
-inline std::unordered_map<T, CURLResult> CURLMultipleTransfer<T>::run() {
-    std::unordered_map<T, CURLResult> results;
+inline void CURLMultipleTransfer<T>::add(T key, std::string const& url,
+                                         std::filesystem::path file) {
+    pending_.push({.key = key, .url = url, .file = std::move(file)});
+}
+
+// The due retries go first, then the new transfers.
+template <typename T>
+inline void CURLMultipleTransfer<T>::fill(Clock::time_point now) {
+    while (running_ < parallel_ && !retries_.empty() &&
+           retries_.top().when <= now) {
+        auto* req = retries_.top().req;
+        retries_.pop();
+        start(req);
+    }
 
-    while (requests_.size() < parallel_ && !pending_.empty()) {
-        auto [key, url] = pending_.front();
+    while (running_ < parallel_ && !pending_.empty()) {
+        auto req = std::make_unique<Request>(std::move(pending_.front()));
         pending_.pop();
-        add_transfer(key, url);
+
+        if (requests_.contains(req->key)) {
+            LOG(WARN) << "Skipping duplicate CURL task: " << req->url;
+            continue;
+        }
+        auto [it, _] = requests_.emplace(req->key, std::move(req));
+        start(it->second.get());
     }
+}
 
-    int is_running{1};
+template <typename T>
+inline std::unordered_map<T, CURLResult> CURLMultipleTransfer<T>::run() {
+    std::unordered_map<T, CURLResult> results;
 
-    LOG(TRACE) << "Starting CURL batch, size: " << requests_.size()
+    LOG(TRACE) << "Starting CURL batch, size: " << pending_.size()
                << " parallel: " << parallel_;
 
-    while (is_running && !requests_.empty()) {
-        curl_multi_perform(cm_, &is_running);
+    fill(Clock::now());
+
+    while (!requests_.empty()) {
+        int is_running{0};
+        if (auto rc = curl_multi_perform(cm_, &is_running); rc != CURLM_OK) {
+            throw std::runtime_error(
+                STR("curl_multi_perform failed: " << curl_multi_strerror(rc)));
+        }
 
         CURLMsg* msg{nullptr};
         int msgs_left{0};
 
         while ((msg = curl_multi_info_read(cm_, &msgs_left))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+
             Request* req{};
             curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &req);
 
-            results.emplace(req->key, process_curl_message(msg, req));
-
+            // msg is not valid once the handle is removed
+            auto code = msg->data.result;
+            auto result = process_curl_message(msg, req);
             curl_multi_remove_handle(cm_, msg->easy_handle);
-            requests_.erase(req->key);
+            --running_;
+
+            if (should_retry(code, result, *req)) {
+                auto delay = backoff(req->attempt);
+                LOG(DEBUG) << "Retrying CURL task: " << req->url << " in "
+                           << delay.count() << "ms";
+                retries_.push({Clock::now() + delay, req});
+                continue;
+            }
+
+            auto key = req->key;
+            requests_.erase(key);
+            results.insert_or_assign(std::move(key), std::move(result));
         }
 
-        if (!pending_.empty()) {
-            auto [key, url] = pending_.front();
-            pending_.pop();
-            add_transfer(key, url);
+        auto now = Clock::now();
+        fill(now);
+
+        if (requests_.empty()) {
+            break;
         }
 
-        if (!requests_.empty()) {
-            curl_multi_wait(cm_, nullptr, 0, 1000, nullptr);
+        // wake up for the socket activity, the libcurl timers or the next
+        // retry, whichever comes first
+        auto timeout = std::chrono::milliseconds{1000};
+        if (!retries_.empty()) {
+            timeout = std::clamp(
+                std::chrono::ceil<std::chrono::milliseconds>(
+                    retries_.top().when - now),
+                std::chrono::milliseconds{0}, timeout);
+        }
+
+        if (running_ > 0) {
+            curl_multi_poll(cm_, nullptr, 0, static_cast<int>(timeout.count()),
+                            nullptr);
+        } else {
+            std::this_thread::sleep_for(timeout);
         }
     }
 
@@ -127,12 +294,13 @@ inline std::unordered_map<T, CURLResult> CURLMultipleTransfer<T>::run() {
 template <typename T>
 inline CURLResult CURLMultipleTransfer<T>::process_curl_message(CURLMsg* msg,
                                                                 Request* req) {
-    if (msg->msg != CURLMSG_DONE) {
-        char const* error = curl_easy_strerror(msg->data.result);
+    if (req->out.is_open()) {
+        req->out.close();
+    }
 
-        char* url{};
-        curl_easy_getinfo(msg->easy_handle, CURLINFO_EFFECTIVE_URL, &url);
-        LOG(WARN) << "Failed CURL task: " << url << " in " << error;
+    if (msg->data.result != CURLE_OK) {
+        char const* error = curl_easy_strerror(msg->data.result);
+        LOG(WARN) << "Failed CURL task: " << req->url << " in " << error;
 
         return std::string{error};
     }
@@ -141,49 +309,113 @@ inline CURLResult CURLMultipleTransfer<T>::process_curl_message(CURLMsg* msg,
     curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &http_code);
 
     if (Logger::get().is_enabled(TRACE)) {
-        char* url{};
-        curl_easy_getinfo(msg->easy_handle, CURLINFO_EFFECTIVE_URL, &url);
-
         curl_off_t total{};
         curl_easy_getinfo(msg->easy_handle, CURLINFO_TOTAL_TIME_T, &total);
 
         std::chrono::microseconds total_chrono{total};
 
-        LOG(TRACE) << "Finished CURL task: " << url << " in "
-                   << format_elapsed_time(total_chrono);
+        LOG(TRACE) << "Finished CURL task: " << req->url << " (" << http_code
+                   << ") in " << format_elapsed_time(total_chrono);
+    }
+
+    return HttpResult{static_cast<int>(http_code), std::move(req->response)};
+}
+
+template <typename T>
+inline bool CURLMultipleTransfer<T>::should_retry(CURLcode code,
+                                                  CURLResult const& result,
+                                                  Request const& req) const {
+    if (req.attempt > retry_policy_.max_retries) {
+        return false;
+    }
+
+    if (auto const* hr = std::get_if<HttpResult>(&result)) {
+        return hr->http_code >= 500 || hr->http_code == 429;
     }
 
-    return HttpResult{static_cast<int>(http_code), req->response};
+    switch (code) {
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+template <typename T>
+inline std::chrono::milliseconds
+CURLMultipleTransfer<T>::backoff(unsigned attempt) const {
+    auto delay = retry_policy_.initial_backoff;
+    for (unsigned i = 1; i < attempt && delay < retry_policy_.max_backoff;
+         ++i) {
+        delay *= 2;
+    }
+    return std::min(delay, retry_policy_.max_backoff);
 }
 
 template <typename T>
 inline size_t CURLMultipleTransfer<T>::write_callback(char* ptr, size_t size,
                                                       size_t nmemb,
-                                                      std::string* data) {
-    data->append(ptr, size * nmemb);
+                                                      Request* req) {
+    if (req->file.empty()) {
+        req->response.append(ptr, size * nmemb);
+        return size * nmemb;
+    }
+
+    // anything short of the whole chunk fails the transfer
+    if (!req->out.write(ptr, static_cast<std::streamsize>(size * nmemb))) {
+        return 0;
+    }
     return size * nmemb;
 }
 
+// The easy handle is created on the first attempt and reused by the retries.
 template <typename T>
-inline void CURLMultipleTransfer<T>::add_transfer(T key,
-                                                  std::string const& url) {
-    LOG(TRACE) << "Adding CURL task: " << url;
+inline void CURLMultipleTransfer<T>::start(Request* req) {
+    LOG(TRACE) << "Adding CURL task: " << req->url;
+
+    if (!req->handle) {
+        req->handle.reset(curl_easy_init());
+        auto* handle = req->handle.get();
+        if (!handle) {
+            throw std::runtime_error("curl_easy_init failed");
+        }
 
-    auto req = std::make_unique<Request>(key, "");
-    CURL* handle = curl_easy_init();
-    if (!handle) {
-        throw std::runtime_error("curl_easy_init failed");
+        curl_easy_setopt(handle, CURLOPT_URL, req->url.c_str());
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_callback);
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, req);
+        curl_easy_setopt(handle, CURLOPT_PRIVATE, req);
+        curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(handle, CURLOPT_SHARE, CURLShare::handle());
+        curl_easy_setopt(handle, CURLOPT_HTTP_VERSION,
+                         CURL_HTTP_VERSION_2TLS);
+        // wait for a connection to multiplex over rather than opening a new
+        // one
+        curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+        curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, 30L);
+        // a stalled transfer is a timeout, and so retried
+        curl_easy_setopt(handle, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        curl_easy_setopt(handle, CURLOPT_LOW_SPEED_TIME, 60L);
     }
 
-    curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &req->response);
-    curl_easy_setopt(handle, CURLOPT_PRIVATE, req.get());
-    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
-
-    curl_multi_add_handle(cm_, handle);
+    req->response.clear();
+    if (!req->file.empty()) {
+        req->out.open(req->file, std::ios::binary | std::ios::trunc);
+    }
+    ++req->attempt;
 
-    requests_.emplace(key, std::move(req));
+    if (auto rc = curl_multi_add_handle(cm_, req->handle.get());
+        rc != CURLM_OK) {
+        throw std::runtime_error(
+            STR("curl_multi_add_handle failed: " << curl_multi_strerror(rc)));
+    }
+    ++running_;
 }
 
 #endif // CURL_H
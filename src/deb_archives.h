@@ -0,0 +1,274 @@
+#ifndef DEB_ARCHIVES_H
+#define DEB_ARCHIVES_H
+
+#include "common.h"
+#include "dpkg_database.h"
+#include "logger.h"
+#include "process.h"
+#include "util.h"
+#include "util_fs.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+constexpr std::string_view kAptArchivesDir = "/var/cache/apt/archives/";
+
+// Collects the .deb archives of the installed packages so they can be
+// installed without downloading them. An archive is taken from the apt cache
+// when it is there, otherwise it is rebuilt from the installed files and the
+// dpkg database the way dpkg-repack does it.
+class DebArchives {
+  public:
+    // 0 jobs means one per core
+    explicit DebArchives(fs::path archives_dir = fs::path{kAptArchivesDir},
+                         fs::path info_dir = fs::path{kDpkgInfoDir},
+                         unsigned jobs = 0)
+        : archives_dir_{std::move(archives_dir)},
+          info_dir_{std::move(info_dir)}, jobs_{jobs} {}
+
+    // The archive file name apt uses, i.e. <name>_<version>_<arch>.deb with
+    // the epoch colon escaped.
+    [[nodiscard]] static std::string archive_name(DebPackage const& pkg);
+
+    // Puts the archives of the packages into dir, returns the packages that
+    // have them. The ones that could not be found nor rebuilt are left out.
+    [[nodiscard]] std::unordered_set<DebPackage const*>
+    collect(std::vector<DebPackage const*> const& packages,
+            fs::path const& dir) const;
+
+    // Rebuilds the archive of the installed package into the given file,
+    // staging its files in the directory next to it. The files not owned by
+    // root keep their owners (and modes) the way dpkg-repack does it, under
+    // fakeroot unless running as root.
+    void repack(DebPackage const& pkg, fs::path const& archive) const;
+
+  private:
+    // the files of the control archive dpkg keeps in its info directory
+    static constexpr std::array kControlFiles{
+        "preinst",  "postinst", "prerm",   "postrm",  "config",   "templates",
+        "triggers", "shlibs",   "symbols", "md5sums", "conffiles"};
+
+    // the status of the package without the fields only the installed
+    // packages have
+    static std::string control(DebPackage const& pkg);
+
+    static fs::path staging_dir(fs::path const& archive) {
+        auto root = archive;
+        root += ".root";
+        return root;
+    }
+
+    fs::path archives_dir_;
+    fs::path info_dir_;
+    unsigned jobs_;
+};
+
+inline std::string DebArchives::archive_name(DebPackage const& pkg) {
+    auto name = pkg.name.substr(0, pkg.name.find(':'));
+    auto version = pkg.version;
+    if (auto pos = version.find(':'); pos != std::string::npos) {
+        version.replace(pos, 1, "%3a");
+    }
+    return name + "_" + version + "_" + pkg.architecture + ".deb";
+}
+
+inline std::string DebArchives::control(DebPackage const& pkg) {
+    auto out = Command("dpkg-query").arg("--status").arg(pkg.name).output();
+    out.check_success(STR("Failed to query dpkg for " << pkg.name));
+
+    std::istringstream in{out.stdout_data};
+    std::ostringstream control;
+    bool skip = false;
+    for (std::string line; std::getline(in, line);) {
+        if (line.empty()) {
+            continue;
+        }
+        // the continuation lines belong to the previous field
+        if (line.front() != ' ' && line.front() != '\t') {
+            skip = line.starts_with("Status:") ||
+                   line.starts_with("Conffiles:") ||
+                   line.starts_with("Config-Version:");
+        }
+        if (!skip) {
+            control << line << '\n';
+        }
+    }
+    return control.str();
+}
+
+inline void DebArchives::repack(DebPackage const& pkg,
+                                fs::path const& archive) const {
+    auto root = staging_dir(archive);
+    fs::remove_all(root);
+    auto debian = root / "DEBIAN";
+    fs::create_directories(debian);
+    fs::permissions(debian, fs::perms{0755});
+
+    write_to_file(debian / "control", control(pkg));
+    for (auto const* file : kControlFiles) {
+        auto src = info_dir_ / (pkg.name + "." + file);
+        std::error_code ec;
+        if (fs::exists(src, ec)) {
+            fs::copy_file(src, debian / file);
+        }
+    }
+
+    std::ifstream list{info_dir_ / (pkg.name + ".list")};
+    if (!list) {
+        throw std::runtime_error(
+            STR("Failed to read the files of " << pkg.name));
+    }
+    // the commands restoring the owners of the staged files, chown clears
+    // the setuid and setgid bits so the modes are set again
+    std::ostringstream owners;
+    for (std::string line; std::getline(list, line);) {
+        fs::path src{line};
+        if (line.empty() || src == "/.") {
+            continue;
+        }
+        auto dest = root / src.relative_path();
+
+        struct stat info {};
+        if (lstat(src.c_str(), &info) != 0) {
+            // e.g. excluded by dpkg path-exclude
+            LOG(DEBUG) << "Missing file " << src << " of " << pkg.name;
+            continue;
+        }
+        bool symlink = S_ISLNK(info.st_mode);
+        if (info.st_uid != 0 || info.st_gid != 0) {
+            auto path = escape_cmd_arg(dest.string());
+            owners << "chown -h " << info.st_uid << ":" << info.st_gid << " "
+                   << path << '\n';
+            if (!symlink) {
+                owners << "chmod " << std::oct << (info.st_mode & 07777)
+                       << std::dec << " " << path << '\n';
+            }
+        }
+
+        // the directories behind symlinks (e.g. /lib with merged /usr) stay
+        // directories so the archive does not replace them
+        std::error_code ec;
+        if (fs::is_directory(src, ec)) {
+            fs::create_directories(dest);
+            fs::permissions(dest, fs::status(src).permissions() |
+                                      fs::perms::owner_all);
+        } else if (symlink) {
+            fs::create_directories(dest.parent_path());
+            fs::create_symlink(fs::read_symlink(src), dest);
+        } else {
+            fs::create_directories(dest.parent_path());
+            fs::copy_file(src, dest);
+        }
+    }
+
+    if (owners.tellp() == 0) {
+        auto out = Command("dpkg-deb")
+                       .arg("--root-owner-group")
+                       .arg("-Zgzip")
+                       .arg("-z1")
+                       .arg("--build")
+                       .arg(root.string())
+                       .arg(archive.string())
+                       .output(true);
+        fs::remove_all(root);
+        out.check_success(STR("Failed to build " << archive));
+        return;
+    }
+
+    // the owners only last in the fakeroot session that builds the archive
+    TempFile script{"r4r-repack-", ".sh"};
+    write_to_file(*script, STR(owners.str()
+                              << "dpkg-deb -Zgzip -z1 --build "
+                              << escape_cmd_arg(root.string()) << " "
+                              << escape_cmd_arg(archive.string()) << '\n'));
+    auto cmd = geteuid() == 0 ? Command("sh") : Command("fakeroot").arg("sh");
+    auto out = cmd.arg("-e").arg(script->string()).output(true);
+    fs::remove_all(root);
+    out.check_success(STR("Failed to build " << archive << " keeping the "
+                                             << "owners of its files"));
+}
+
+inline std::unordered_set<DebPackage const*>
+DebArchives::collect(std::vector<DebPackage const*> const& packages,
+                     fs::path const& dir) const {
+    fs::create_directories(dir);
+
+    std::unordered_set<DebPackage const*> collected;
+    std::vector<DebPackage const*> missing;
+    for (auto const* pkg : packages) {
+        auto name = archive_name(*pkg);
+        auto cached = archives_dir_ / name;
+        std::error_code ec;
+        if (!fs::is_regular_file(cached, ec)) {
+            missing.push_back(pkg);
+            continue;
+        }
+        fs::create_hard_link(cached, dir / name, ec);
+        if (ec) {
+            fs::copy_file(cached, dir / name,
+                          fs::copy_options::overwrite_existing, ec);
+        }
+        if (ec) {
+            missing.push_back(pkg);
+        } else {
+            collected.insert(pkg);
+        }
+    }
+
+    LOG(DEBUG) << "Found " << collected.size() << " deb archives in "
+               << archives_dir_ << ", repacking " << missing.size();
+
+    auto jobs = jobs_ == 0 ? std::max(1U, std::thread::hardware_concurrency())
+                           : jobs_;
+    jobs = static_cast<unsigned>(
+        std::clamp<std::size_t>(missing.size(), 1, jobs));
+
+    // the packages differ a lot in size so the jobs take the next one
+    // instead of a fixed range
+    std::atomic<std::size_t> next{0};
+    std::mutex mutex;
+    auto repack_next = [&] {
+        for (auto i = next++; i < missing.size(); i = next++) {
+            auto const* pkg = missing[i];
+            auto archive = dir / archive_name(*pkg);
+            try {
+                repack(*pkg, archive);
+                std::lock_guard lock{mutex};
+                collected.insert(pkg);
+            } catch (std::exception const& e) {
+                LOG(WARN) << "Failed to repack " << pkg->name << ": "
+                          << e.what();
+                std::error_code ec;
+                fs::remove_all(staging_dir(archive), ec);
+                fs::remove(archive, ec);
+            }
+        }
+    };
+
+    {
+        std::vector<std::jthread> threads;
+        for (unsigned job = 1; job < jobs; ++job) {
+            threads.emplace_back(repack_next);
+        }
+        repack_next();
+    }
+
+    return collected;
+}
+
+#endif // DEB_ARCHIVES_H
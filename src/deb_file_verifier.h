@@ -0,0 +1,311 @@
+#ifndef DEB_FILE_VERIFIER_H
+#define DEB_FILE_VERIFIER_H
+
+#include "common.h"
+#include "dpkg_database.h"
+#include "logger.h"
+#include "md5.h"
+#include "util.h"
+#include "util_fs.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Checks that the files owned by deb packages are still the ones the
+// packages installed, using the md5sums dpkg keeps for each package
+// (<info dir>/<package>.md5sums) and for its conffiles (the status file).
+// Only the regular files with a known md5sum are hashed, the rest is taken
+// as it is. The hashes are cached by the device, inode, size and mtime of
+// the files so a file is only read again once it has changed. The entries
+// not used for kMaxAge are dropped from the cache.
+class DebFileVerifier {
+  public:
+    struct File {
+        // the file as it was traced
+        fs::path const* path;
+        // the file as the package lists it, i.e. one of the path aliases
+        std::string_view dpkg_path;
+        DebPackage const* package;
+    };
+
+    // Empty cache_file disables the cache, 0 jobs means one per core.
+    explicit DebFileVerifier(fs::path info_dir = fs::path{kDpkgInfoDir},
+                             fs::path cache_file = {}, unsigned jobs = 0)
+        : info_dir_{std::move(info_dir)}, cache_file_{std::move(cache_file)},
+          jobs_{jobs} {}
+
+    // Returns for each of the files whether it is unchanged.
+    std::vector<bool> verify(std::vector<File> const& files);
+
+  private:
+    struct FileKey {
+        std::uint64_t dev;
+        std::uint64_t ino;
+        std::uint64_t size;
+        std::int64_t mtime_ns;
+
+        bool operator==(FileKey const& other) const = default;
+    };
+
+    struct FileKeyHash {
+        std::size_t operator()(FileKey const& key) const noexcept {
+            auto combine = [](std::size_t h, std::uint64_t v) {
+                return h ^ (std::hash<std::uint64_t>{}(v) +
+                            0x9e3779b97f4a7c15 + (h << 6) + (h >> 2));
+            };
+            auto h = combine(0, key.ino);
+            h = combine(h, key.dev);
+            h = combine(h, static_cast<std::uint64_t>(key.mtime_ns));
+            return combine(h, key.size);
+        }
+    };
+
+    struct CachedHash {
+        std::string md5sum;
+        // seconds since the epoch
+        std::int64_t last_used;
+    };
+
+    using HashCache = std::unordered_map<FileKey, CachedHash, FileKeyHash>;
+
+    // below this, the threads are not worth it
+    static constexpr std::size_t kMinFilesPerJob = 16;
+    // the files of the other projects stay cached for as long
+    static constexpr std::chrono::seconds kMaxAge = std::chrono::days{30};
+    // the last use of the cached hashes is only written once a day so the
+    // runs that hash nothing need not rewrite the cache
+    static constexpr std::chrono::seconds kLastUsedPrecision =
+        std::chrono::days{1};
+
+    [[nodiscard]] std::vector<std::string>
+    expected_md5sums(std::vector<File> const& files) const;
+    [[nodiscard]] HashCache load_cache() const;
+    void save_cache(HashCache const& cache) const;
+
+    fs::path info_dir_;
+    fs::path cache_file_;
+    unsigned jobs_;
+};
+
+// The md5sums files are only read for the packages of the given files and
+// each of them only once. Files without a md5sum get an empty one.
+inline std::vector<std::string>
+DebFileVerifier::expected_md5sums(std::vector<File> const& files) const {
+    std::vector<std::string> result(files.size());
+
+    // package -> dpkg path -> indices of the files
+    std::unordered_map<
+        DebPackage const*,
+        std::unordered_map<std::string_view, std::vector<std::size_t>>>
+        wanted;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        wanted[files[i].package][files[i].dpkg_path].push_back(i);
+    }
+
+    auto set = [&](auto const& paths, std::string_view path,
+                   std::string_view md5sum) {
+        if (auto it = paths.find(path); it != paths.end()) {
+            for (auto i : it->second) {
+                result[i] = md5sum;
+            }
+        }
+    };
+
+    std::string buffer;
+    for (auto const& [pkg, paths] : wanted) {
+        for (auto const& conffile : pkg->conffiles) {
+            set(paths, conffile.path, conffile.md5sum);
+        }
+
+        auto md5sums_file = info_dir_ / (pkg->name + ".md5sums");
+        try {
+            read_from_file(md5sums_file, buffer);
+        } catch (std::system_error const& e) {
+            LOG(DEBUG) << "No md5sums for " << pkg->name << ": " << e.what();
+            continue;
+        }
+
+        // <md5sum>  <path relative to />
+        std::string path{"/"};
+        std::string_view data{buffer};
+        while (!data.empty()) {
+            auto line = string_pop_line(data);
+            if (line.size() < 35 || line.substr(32, 2) != "  ") {
+                continue;
+            }
+            path.resize(1);
+            path += line.substr(34);
+            set(paths, path, line.substr(0, 32));
+        }
+    }
+
+    return result;
+}
+
+inline std::vector<bool>
+DebFileVerifier::verify(std::vector<File> const& files) {
+    std::vector<bool> result(files.size(), true);
+    auto expected = expected_md5sums(files);
+
+    auto now = std::chrono::duration_cast<std::chrono::seconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+                   .count();
+    auto cache = load_cache();
+    bool changed = std::erase_if(cache, [&](auto const& entry) {
+                       return now - entry.second.last_used > kMaxAge.count();
+                   }) > 0;
+
+    // the files that need hashing
+    struct Work {
+        std::size_t file;
+        FileKey key;
+        std::string md5sum{};
+        bool failed{};
+    };
+    std::vector<Work> work;
+
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (expected[i].empty()) {
+            continue;
+        }
+
+        struct stat st{};
+        if (::stat(files[i].path->c_str(), &st) != 0 ||
+            !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        FileKey key{
+            .dev = static_cast<std::uint64_t>(st.st_dev),
+            .ino = static_cast<std::uint64_t>(st.st_ino),
+            .size = static_cast<std::uint64_t>(st.st_size),
+            .mtime_ns = std::int64_t{st.st_mtim.tv_sec} * 1'000'000'000 +
+                        st.st_mtim.tv_nsec,
+        };
+
+        if (auto it = cache.find(key); it != cache.end()) {
+            auto& cached = it->second;
+            result[i] = cached.md5sum == expected[i];
+            if (now - cached.last_used >= kLastUsedPrecision.count()) {
+                cached.last_used = now;
+                changed = true;
+            }
+        } else {
+            work.push_back({.file = i, .key = key});
+        }
+    }
+
+    LOG(DEBUG) << "Verifying " << files.size() << " deb package files, "
+               << work.size() << " of them need hashing";
+
+    auto jobs = jobs_ != 0 ? jobs_
+                           : std::max(1U, std::thread::hardware_concurrency());
+    jobs = static_cast<unsigned>(
+        std::clamp<std::size_t>(work.size() / kMinFilesPerJob, 1, jobs));
+
+    // the files differ a lot in size so they are taken one by one
+    std::atomic<std::size_t> next{0};
+    auto hash = [&] {
+        std::string buffer;
+        for (auto i = next++; i < work.size(); i = next++) {
+            auto& w = work[i];
+            try {
+                w.md5sum = md5_file(*files[w.file].path, buffer);
+            } catch (std::system_error const& e) {
+                LOG(DEBUG) << "Failed to hash " << *files[w.file].path << ": "
+                           << e.what();
+                w.failed = true;
+            }
+        }
+    };
+
+    {
+        std::vector<std::jthread> threads;
+        for (unsigned job = 1; job < jobs; ++job) {
+            threads.emplace_back(hash);
+        }
+        hash();
+    }
+
+    for (auto& w : work) {
+        // the ones that cannot be read are left to the package
+        if (w.failed) {
+            continue;
+        }
+        result[w.file] = w.md5sum == expected[w.file];
+        cache.insert_or_assign(
+            w.key, CachedHash{.md5sum = std::move(w.md5sum), .last_used = now});
+        changed = true;
+    }
+
+    if (changed) {
+        save_cache(cache);
+    }
+
+    return result;
+}
+
+// one file per line: dev ino size mtime_ns md5sum last_used
+inline DebFileVerifier::HashCache DebFileVerifier::load_cache() const {
+    HashCache cache;
+    if (cache_file_.empty() || !fs::exists(cache_file_)) {
+        return cache;
+    }
+
+    // the lines of an older format are skipped, they are hashed again
+    std::ifstream in{cache_file_};
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields{line};
+        FileKey key{};
+        CachedHash hash{};
+        if (fields >> key.dev >> key.ino >> key.size >> key.mtime_ns >>
+            hash.md5sum >> hash.last_used) {
+            cache.emplace(key, std::move(hash));
+        }
+    }
+
+    LOG(DEBUG) << "Loaded " << cache.size() << " file hashes from "
+               << cache_file_;
+    return cache;
+}
+
+inline void DebFileVerifier::save_cache(HashCache const& cache) const {
+    if (cache_file_.empty()) {
+        return;
+    }
+
+    std::ostringstream out;
+    for (auto const& [key, hash] : cache) {
+        out << key.dev << ' ' << key.ino << ' ' << key.size << ' '
+            << key.mtime_ns << ' ' << hash.md5sum << ' ' << hash.last_used
+            << '\n';
+    }
+
+    auto tmp = cache_file_;
+    tmp += ".tmp";
+
+    try {
+        fs::create_directories(cache_file_.parent_path());
+        std::ofstream{tmp} << out.str();
+        fs::rename(tmp, cache_file_);
+    } catch (std::exception const& e) {
+        LOG(WARN) << "Failed to store file hashes to " << cache_file_ << ": "
+                  << e.what();
+    }
+}
+
+#endif // DEB_FILE_VERIFIER_H
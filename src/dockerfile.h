@@ -39,14 +39,34 @@ class DockerFile {
     std::vector<fs::path> copied_files_;
 };
 
+// A directory of the build context a RUN command reads from target.
+struct BindMount {
+    fs::path source;
+    std::string target;
+};
+
 class DockerFileBuilder {
   public:
-    explicit DockerFileBuilder(std::string base_image, fs::path context_dir)
+    // buildkit generates a Dockerfile that needs BuildKit, allowing the RUN
+    // cache mounts
+    explicit DockerFileBuilder(std::string base_image, fs::path context_dir,
+                               bool buildkit = false)
         : base_image_{std::move(base_image)},
-          context_dir_{std::move(context_dir)} {}
+          context_dir_{std::move(context_dir)}, buildkit_{buildkit} {}
 
     DockerFileBuilder& run(std::string const& command);
     DockerFileBuilder& run(std::vector<std::string> const& commands);
+    // The cache_dirs are mounted as BuildKit caches kept between the builds,
+    // without BuildKit the commands run without them.
+    DockerFileBuilder& run(std::vector<std::string> const& commands,
+                           std::vector<std::string> const& cache_dirs);
+    // The bind_mounts are mounted read-write (the writes are discarded)
+    // with BuildKit so they never get into the image. Without BuildKit they
+    // are copied before the commands and removed after them, their size
+    // still stays in the layer of the COPY.
+    DockerFileBuilder& run(std::vector<std::string> const& commands,
+                           std::vector<std::string> const& cache_dirs,
+                           std::vector<BindMount> const& bind_mounts);
     DockerFileBuilder& run_script_once(fs::path const& path);
     DockerFileBuilder& cmd(std::vector<std::string> const& commands);
     DockerFileBuilder& env(std::string const& key, std::string const& value);
@@ -63,13 +83,29 @@ class DockerFileBuilder {
 
     [[nodiscard]] DockerFile build() const;
 
+    [[nodiscard]] bool buildkit() const { return buildkit_; }
+
   private:
+    // the path of src relative to the context directory
+    [[nodiscard]] std::string context_path(fs::path const& src) const;
+
     std::string base_image_;
     fs::path context_dir_;
+    bool buildkit_;
     std::vector<std::string> commands_;
     std::vector<fs::path> copied_files_;
 };
 
+inline std::string DockerFileBuilder::context_path(fs::path const& src) const {
+    if (!is_sub_path(src, context_dir_)) {
+        throw std::runtime_error(
+            STR("Source path " << src
+                               << " is not a subpath of context directory "
+                               << context_dir_));
+    }
+    return fs::relative(src, context_dir_).string();
+}
+
 inline DockerFileBuilder& DockerFileBuilder::run(std::string const& command) {
     run(std::vector{command});
     return *this;
@@ -77,8 +113,39 @@ inline DockerFileBuilder& DockerFileBuilder::run(std::string const& command) {
 
 inline DockerFileBuilder&
 DockerFileBuilder::run(std::vector<std::string> const& commands) {
-    std::string cmds = string_join(commands, " && \\\n  ");
-    commands_.emplace_back("RUN " + cmds);
+    return run(commands, {});
+}
+
+inline DockerFileBuilder&
+DockerFileBuilder::run(std::vector<std::string> const& commands,
+                       std::vector<std::string> const& cache_dirs) {
+    return run(commands, cache_dirs, {});
+}
+
+inline DockerFileBuilder&
+DockerFileBuilder::run(std::vector<std::string> const& commands,
+                       std::vector<std::string> const& cache_dirs,
+                       std::vector<BindMount> const& bind_mounts) {
+    std::string mounts;
+    auto cmds = commands;
+    if (buildkit_) {
+        for (auto const& [source, target] : bind_mounts) {
+            mounts += "--mount=type=bind,source=" + context_path(source) +
+                      ",target=" + target + ",rw \\\n  ";
+            copied_files_.push_back(source);
+        }
+        // locked as apt does not allow concurrent access
+        for (auto const& dir : cache_dirs) {
+            mounts += "--mount=type=cache,target=" + dir +
+                      ",sharing=locked \\\n  ";
+        }
+    } else {
+        for (auto const& [source, target] : bind_mounts) {
+            copy({source}, target + "/");
+            cmds.push_back("rm -rf " + target);
+        }
+    }
+    commands_.emplace_back("RUN " + mounts + string_join(cmds, " && \\\n  "));
     return *this;
 }
 
@@ -142,13 +209,7 @@ DockerFileBuilder::copy(std::vector<fs::path> const& srcs,
     names.reserve(srcs.size());
 
     for (auto const& src : srcs) {
-        if (!is_sub_path(src, context_dir_)) {
-            throw std::runtime_error(
-                STR("Source path " << src
-                                   << " is not a subpath of context directory "
-                                   << context_dir_));
-        }
-        names.push_back(fs::relative(src, context_dir_).string());
+        names.push_back(context_path(src));
         copied_files_.push_back(src);
     }
 
@@ -186,6 +247,9 @@ inline DockerFileBuilder& DockerFileBuilder::nl() {
 
 inline DockerFile DockerFileBuilder::build() const {
     std::ostringstream dockerfile;
+    if (buildkit_) {
+        dockerfile << "# syntax=docker/dockerfile:1\n";
+    }
     dockerfile << "FROM " << base_image_ << "\n";
     for (auto const& cmd : commands_) {
         dockerfile << cmd << "\n\n";
@@ -3,20 +3,51 @@
 
 #include "filesystem_trie.h"
 #include "logger.h"
+#include "mapped_filesystem_trie.h"
 #include "process.h"
+#include "util.h"
+#include "util_fs.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iterator>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <span>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
+
+struct DebConffile {
+    std::string path;
+    std::string md5sum;
+
+    bool operator==(DebConffile const& other) const = default;
+};
 
 struct DebPackage {
+    // as dpkg names it, i.e. with the architecture for Multi-Arch: same
+    // packages (e.g. libc6:amd64)
     std::string name;
     std::string version;
+    std::string architecture{};
+    std::string multi_arch{};
+    // in KiB
+    std::uint64_t installed_size{};
+    std::string depends{};
+    // the source package, without the version; empty if it is the name
+    std::string source{};
+    std::vector<DebConffile> conffiles{};
 
     bool operator==(DebPackage const& other) const = default;
 };
@@ -32,10 +63,24 @@ struct std::hash<DebPackage> {
 using DebPackages =
     std::unordered_map<std::string, std::unique_ptr<DebPackage>>;
 
+constexpr std::string_view kDpkgStatusFile = "/var/lib/dpkg/status";
+constexpr std::string_view kDpkgInfoDir = "/var/lib/dpkg/info/";
+
 class DpkgDatabase {
   public:
-    static DpkgDatabase system_database();
+    // If cache_dir is given, the file trie is kept there together with the
+    // list of packages and reused as long as the dpkg database is unchanged.
+    static DpkgDatabase system_database(fs::path const& cache_dir = {});
     static DpkgDatabase from_path(fs::path const& path);
+    // The .list files are read by the given number of threads (0 means one
+    // per core).
+    static DpkgDatabase from_path(fs::path const& path, DebPackages packages,
+                                  unsigned jobs = 0);
+    // Returns nothing if the cache does not exist or is stale.
+    static std::optional<DpkgDatabase>
+    from_cache(fs::path const& cache_file, std::uint64_t fingerprint);
+
+    void save(fs::path const& cache_file, std::uint64_t fingerprint) const;
 
     DpkgDatabase(DpkgDatabase const&) = delete;
     DpkgDatabase(DpkgDatabase&&) = default;
@@ -43,21 +88,135 @@ class DpkgDatabase {
     DpkgDatabase& operator=(DpkgDatabase const&) = delete;
 
     DebPackage const* lookup_by_path(fs::path const& path) const;
+    // lookup_by_path of each of the paths, faster if they are sorted
+    std::vector<DebPackage const*>
+    lookup_by_paths(std::span<std::string_view const> paths) const;
     DebPackage const* lookup_by_name(std::string const& name) const;
 
+    [[nodiscard]] DebPackages const& packages() const { return packages_; }
+
   private:
-    DpkgDatabase(DebPackages packages, FileSystemTrie<DebPackage const*> files)
-        : packages_{std::move(packages)}, files_{std::move(files)} {}
+    // The trie maps the files to indices into the packages vector so it can
+    // be stored on disk. The packages are stored along as the trie metadata.
+    using FilesTrie = MappedFileSystemTrie<std::uint32_t>;
+
+    DpkgDatabase(DebPackages packages, std::vector<DebPackage const*> by_index,
+                 FilesTrie files);
 
     static DebPackages load_installed_packages();
-    static void
-    process_package_list_file(FileSystemTrie<DebPackage const*>& trie,
-                              fs::path const& file, DebPackage const* pkg);
+    static void write_metadata(std::string& out, DebPackage const& pkg);
+    static std::unique_ptr<DebPackage> read_metadata(std::string_view line);
+
+    // below this, the threads are not worth it
+    static constexpr std::size_t kMinPackagesPerJob = 64;
+    // part of the cache fingerprint, bumped whenever the metadata format
+    // changes so the older caches are rebuilt
+    static constexpr std::uint64_t kMetadataVersion = 2;
+
+    static void process_package_list_file(FileSystemTrie<std::uint32_t>& trie,
+                                          fs::path const& file,
+                                          std::uint32_t pkg,
+                                          std::string& buffer);
 
     DebPackages packages_;
-    FileSystemTrie<DebPackage const*> files_;
+    std::vector<DebPackage const*> by_index_;
+    FilesTrie files_;
+    // the architecture of dpkg itself
+    std::string native_arch_;
 };
 
+// Parses the dpkg status database (/var/lib/dpkg/status), a sequence of
+// RFC822 like stanzas separated by empty lines, keeping only the installed
+// packages.
+inline DebPackages parse_dpkg_status(std::string_view status) {
+    DebPackages packages;
+    DebPackage pkg;
+    std::string_view state;
+    std::string_view field;
+
+    auto trim = [](std::string_view s) {
+        auto begin = s.find_first_not_of(" \t");
+        if (begin == std::string_view::npos) {
+            return std::string_view{};
+        }
+        return s.substr(begin, s.find_last_not_of(" \t") - begin + 1);
+    };
+
+    // the same packages as the ii and hi lines of dpkg -l
+    auto installed = [&](std::string_view s) {
+        return (s.starts_with("install ") || s.starts_with("hold ")) &&
+               s.ends_with(" installed");
+    };
+
+    auto finish = [&] {
+        if (!pkg.name.empty() && installed(state)) {
+            if (pkg.multi_arch == "same" && !pkg.architecture.empty()) {
+                pkg.name += ":" + pkg.architecture;
+            }
+            auto name = pkg.name;
+            packages.emplace(std::move(name),
+                             std::make_unique<DebPackage>(std::move(pkg)));
+        }
+        pkg = {};
+        state = {};
+        field = {};
+    };
+
+    while (!status.empty()) {
+        auto line = string_pop_line(status);
+
+        if (line.empty()) {
+            finish();
+            continue;
+        }
+
+        if (line.front() == ' ' || line.front() == '\t') {
+            // a continuation of a multi line field
+            if (field == "Conffiles") {
+                // path md5sum [obsolete|remove-on-upgrade]
+                auto entry = trim(line);
+                auto path = entry.substr(0, entry.find(' '));
+                auto md5sum = trim(entry.substr(path.size()));
+                md5sum = md5sum.substr(0, md5sum.find(' '));
+                pkg.conffiles.push_back(
+                    {.path = std::string{path}, .md5sum = std::string{md5sum}});
+            }
+            continue;
+        }
+
+        auto colon = line.find(':');
+        if (colon == std::string_view::npos) {
+            LOG(WARN) << "Failed to parse line from dpkg status: " << line;
+            continue;
+        }
+
+        field = line.substr(0, colon);
+        auto value = trim(line.substr(colon + 1));
+
+        if (field == "Package") {
+            pkg.name = value;
+        } else if (field == "Status") {
+            state = value;
+        } else if (field == "Version") {
+            pkg.version = value;
+        } else if (field == "Architecture") {
+            pkg.architecture = value;
+        } else if (field == "Multi-Arch") {
+            pkg.multi_arch = value;
+        } else if (field == "Installed-Size") {
+            pkg.installed_size = to_number<std::uint64_t>(value).value_or(0);
+        } else if (field == "Depends") {
+            pkg.depends = value;
+        } else if (field == "Source") {
+            // Source: name (version)
+            pkg.source = value.substr(0, value.find(' '));
+        }
+    }
+    finish();
+
+    return packages;
+}
+
 inline DebPackages parse_dpkg_list_output(std::istream& dpkg_output) {
     DebPackages packages;
     std::string line;
@@ -90,6 +249,14 @@ inline DebPackages parse_dpkg_list_output(std::istream& dpkg_output) {
 }
 
 inline DebPackages DpkgDatabase::load_installed_packages() {
+    try {
+        MappedFile status{fs::path{kDpkgStatusFile}};
+        return parse_dpkg_status(status.view());
+    } catch (std::system_error const& e) {
+        LOG(WARN) << "Failed to read " << kDpkgStatusFile
+                  << ", falling back to 'dpkg -l': " << e.what();
+    }
+
     auto const out = Command("dpkg").arg("-l").output();
     out.check_success("Unable to execute 'dpkg -l'");
 
@@ -98,47 +265,225 @@ inline DebPackages DpkgDatabase::load_installed_packages() {
 }
 
 inline void
-DpkgDatabase::process_package_list_file(FileSystemTrie<DebPackage const*>& trie,
+DpkgDatabase::process_package_list_file(FileSystemTrie<std::uint32_t>& trie,
                                         fs::path const& file,
-                                        DebPackage const* pkg) {
-    std::ifstream infile(file);
-    if (!infile.is_open()) {
-        throw std::runtime_error("Error opening file: " + file.string());
+                                        std::uint32_t pkg,
+                                        std::string& buffer) {
+    read_from_file(file, buffer);
+    char const* data = buffer.data();
+    char const* end = data + buffer.size();
+
+    while (data < end) {
+        auto const* eol = static_cast<char const*>(
+            std::memchr(data, '\n', static_cast<std::size_t>(end - data)));
+        if (eol == nullptr) {
+            eol = end;
+        }
+        if (eol != data) {
+            trie.insert({data, static_cast<std::size_t>(eol - data)}, pkg);
+        }
+        data = eol + 1;
     }
+}
 
-    std::string line;
-    while (std::getline(infile, line)) {
-        if (!line.empty()) {
-            trie.insert(line, pkg);
+inline DpkgDatabase
+DpkgDatabase::system_database(fs::path const& cache_dir) {
+    fs::path const info_dir{kDpkgInfoDir};
+
+    if (cache_dir.empty()) {
+        return DpkgDatabase::from_path(info_dir);
+    }
+
+    auto cache_file = cache_dir / "dpkg.trie";
+    auto fingerprint = file_fingerprint({kDpkgStatusFile, info_dir}) ^
+                       kMetadataVersion;
+
+    if (auto db = from_cache(cache_file, fingerprint); db) {
+        LOG(DEBUG) << "Loaded dpkg database from " << cache_file;
+        return std::move(*db);
+    }
+
+    auto db = DpkgDatabase::from_path(info_dir);
+    try {
+        fs::create_directories(cache_dir);
+        db.save(cache_file, fingerprint);
+    } catch (std::exception const& e) {
+        LOG(WARN) << "Failed to store dpkg database to " << cache_file << ": "
+                  << e.what();
+    }
+
+    return db;
+}
+
+inline DpkgDatabase DpkgDatabase::from_path(fs::path const& path) {
+    return from_path(path, load_installed_packages());
+}
+
+inline DpkgDatabase DpkgDatabase::from_path(fs::path const& path,
+                                            DebPackages packages,
+                                            unsigned jobs) {
+    std::vector<DebPackage const*> by_index;
+    std::string metadata;
+
+    for (auto& [_, pkg] : packages) {
+        by_index.push_back(pkg.get());
+        write_metadata(metadata, *pkg);
+    }
+
+    if (jobs == 0) {
+        jobs = std::max(1U, std::thread::hardware_concurrency());
+    }
+    jobs = static_cast<unsigned>(std::clamp<std::size_t>(
+        by_index.size() / kMinPackagesPerJob, 1, jobs));
+
+    // each job reads a contiguous range of the packages into its own trie,
+    // merging them in order gives the same trie as reading them one by one
+    std::vector<FileSystemTrie<std::uint32_t>> tries(jobs);
+    std::vector<std::exception_ptr> errors(jobs);
+
+    auto load = [&](unsigned job) {
+        try {
+            std::string buffer;
+            auto begin = by_index.size() * job / jobs;
+            auto end = by_index.size() * (job + 1) / jobs;
+
+            for (auto i = begin; i < end; ++i) {
+                auto const& pkg_name = by_index[i]->name;
+                auto list_file = path / (pkg_name + ".list");
+                if (fs::is_regular_file(list_file)) {
+                    process_package_list_file(tries[job], list_file,
+                                              static_cast<std::uint32_t>(i),
+                                              buffer);
+                } else {
+                    LOG(WARN) << "Package " << pkg_name << " list file "
+                              << list_file << " does not exist";
+                }
+            }
+        } catch (...) {
+            errors[job] = std::current_exception();
+        }
+    };
+
+    {
+        std::vector<std::jthread> threads;
+        for (unsigned job = 1; job < jobs; ++job) {
+            threads.emplace_back(load, job);
+        }
+        load(0);
+    }
+
+    for (auto const& e : errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+
+    auto& trie = tries.front();
+    for (unsigned job = 1; job < jobs; ++job) {
+        trie.merge(tries[job]);
+    }
+
+    return DpkgDatabase{std::move(packages), std::move(by_index),
+                        FilesTrie::from_trie(trie, metadata)};
+}
+
+inline std::optional<DpkgDatabase>
+DpkgDatabase::from_cache(fs::path const& cache_file,
+                         std::uint64_t fingerprint) {
+    auto files = FilesTrie::load(cache_file, fingerprint);
+    if (!files) {
+        return std::nullopt;
+    }
+
+    DebPackages packages;
+    std::vector<DebPackage const*> by_index;
+
+    std::string_view metadata = files->metadata();
+    while (!metadata.empty()) {
+        auto pkg = read_metadata(string_pop_line(metadata));
+        if (!pkg) {
+            LOG(WARN) << "Invalid dpkg database cache " << cache_file;
+            return std::nullopt;
         }
+
+        by_index.push_back(pkg.get());
+        packages.emplace(pkg->name, std::move(pkg));
     }
+
+    return DpkgDatabase{std::move(packages), std::move(by_index),
+                        std::move(*files)};
 }
 
-inline DpkgDatabase DpkgDatabase::system_database() {
-    return DpkgDatabase::from_path("/var/lib/dpkg/info/");
+// one line per package with tab separated fields, the conffiles (path and
+// md5sum separated by a space) last
+inline void DpkgDatabase::write_metadata(std::string& out,
+                                         DebPackage const& pkg) {
+    out += pkg.name + '\t' + pkg.version + '\t' + pkg.architecture + '\t' +
+           pkg.multi_arch + '\t' + std::to_string(pkg.installed_size) + '\t' +
+           pkg.depends + '\t' + pkg.source;
+    for (auto const& f : pkg.conffiles) {
+        out += '\t' + f.path + ' ' + f.md5sum;
+    }
+    out += '\n';
 }
 
-inline DpkgDatabase DpkgDatabase::from_path(fs::path const& path) {
-    FileSystemTrie<DebPackage const*> trie;
+inline std::unique_ptr<DebPackage>
+DpkgDatabase::read_metadata(std::string_view line) {
+    std::vector<std::string> fields;
+    while (true) {
+        auto tab = line.find('\t');
+        fields.emplace_back(line.substr(0, tab));
+        if (tab == std::string_view::npos) {
+            break;
+        }
+        line.remove_prefix(tab + 1);
+    }
 
-    auto packages = load_installed_packages();
-    for (auto& [pkg_name, pkg] : packages) {
-        auto list_file = path / (pkg_name + ".list");
-        if (fs::is_regular_file(list_file)) {
-            process_package_list_file(trie, list_file, pkg.get());
+    if (fields.size() < 7) {
+        return nullptr;
+    }
+
+    auto pkg = std::make_unique<DebPackage>();
+    pkg->name = std::move(fields[0]);
+    pkg->version = std::move(fields[1]);
+    pkg->architecture = std::move(fields[2]);
+    pkg->multi_arch = std::move(fields[3]);
+    pkg->installed_size = to_number<std::uint64_t>(fields[4]).value_or(0);
+    pkg->depends = std::move(fields[5]);
+    pkg->source = std::move(fields[6]);
+    for (auto it = fields.begin() + 7; it != fields.end(); ++it) {
+        auto space = it->rfind(' ');
+        if (space == std::string::npos) {
+            pkg->conffiles.push_back({.path = std::move(*it), .md5sum = {}});
         } else {
-            LOG(WARN) << "Package " << pkg_name << " list file " << list_file
-                      << " does not exist";
+            pkg->conffiles.push_back({.path = it->substr(0, space),
+                                      .md5sum = it->substr(space + 1)});
         }
     }
 
-    return DpkgDatabase{std::move(packages), std::move(trie)};
+    return pkg;
+}
+
+inline void DpkgDatabase::save(fs::path const& cache_file,
+                               std::uint64_t fingerprint) const {
+    files_.save(cache_file, fingerprint);
 }
 
 inline DebPackage const*
 DpkgDatabase::lookup_by_path(fs::path const& path) const {
-    auto const* r = files_.find(path);
-    return r != nullptr ? *r : nullptr;
+    auto const* r = files_.find(path.native());
+    return r != nullptr && *r < by_index_.size() ? by_index_[*r] : nullptr;
+}
+
+inline std::vector<DebPackage const*>
+DpkgDatabase::lookup_by_paths(std::span<std::string_view const> paths) const {
+    std::vector<DebPackage const*> result;
+    result.reserve(paths.size());
+    for (auto const* r : files_.find_sorted(paths)) {
+        result.push_back(r != nullptr && *r < by_index_.size() ? by_index_[*r]
+                                                               : nullptr);
+    }
+    return result;
 }
 
 constexpr std::string_view kDpkgArch =
@@ -148,6 +493,17 @@ constexpr std::string_view kDpkgArch =
     "";
 #endif
 
+inline DpkgDatabase::DpkgDatabase(DebPackages packages,
+                                  std::vector<DebPackage const*> by_index,
+                                  FilesTrie files)
+    : packages_{std::move(packages)}, by_index_{std::move(by_index)},
+      files_{std::move(files)}, native_arch_{kDpkgArch} {
+    if (auto it = packages_.find("dpkg");
+        it != packages_.end() && !it->second->architecture.empty()) {
+        native_arch_ = it->second->architecture;
+    }
+}
+
 inline DebPackage const*
 DpkgDatabase::lookup_by_name(std::string const& name) const {
 
@@ -155,7 +511,7 @@ DpkgDatabase::lookup_by_name(std::string const& name) const {
 
     if (it == packages_.end()) {
         // try multiarch name
-        it = packages_.find(STR(name << ":" << kDpkgArch));
+        it = packages_.find(STR(name << ":" << native_arch_));
     }
 
     return it == packages_.end() ? nullptr : it->second.get();
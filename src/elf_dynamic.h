@@ -0,0 +1,290 @@
+#ifndef ELF_DYNAMIC_H
+#define ELF_DYNAMIC_H
+
+#include "common.h"
+#include "logger.h"
+#include "util_fs.h"
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <elf.h>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// The dynamic linking information of an ELF shared object or executable.
+struct ElfDynamicInfo {
+    std::uint16_t machine{};
+    bool is_64bit{};
+    // DT_NEEDED, the sonames in the order of the dynamic section
+    std::vector<std::string> needed;
+    // DT_RUNPATH or DT_RPATH split at ':' ($ORIGIN is not expanded)
+    std::vector<std::string> runpath;
+};
+
+namespace elf {
+
+template <typename T>
+inline T read(std::string_view data, std::size_t offset) {
+    if (offset > data.size() || data.size() - offset < sizeof(T)) {
+        throw std::runtime_error("Truncated ELF file");
+    }
+    T value;
+    std::memcpy(&value, data.data() + offset, sizeof(T));
+    return value;
+}
+
+inline std::string_view string_at(std::string_view strtab,
+                                  std::size_t offset) {
+    if (offset >= strtab.size()) {
+        throw std::runtime_error("Invalid ELF string offset");
+    }
+    auto s = strtab.substr(offset);
+    return s.substr(0, s.find('\0'));
+}
+
+// Works on the section headers: the dynamic section links to its string
+// table, so no virtual addresses need to be mapped back to file offsets.
+template <typename Ehdr, typename Shdr, typename Dyn>
+inline void read_dynamic(std::string_view data, ElfDynamicInfo& info) {
+    auto ehdr = read<Ehdr>(data, 0);
+    info.machine = ehdr.e_machine;
+
+    auto section = [&](std::size_t index) {
+        if (index >= ehdr.e_shnum) {
+            throw std::runtime_error("Invalid ELF section index");
+        }
+        return read<Shdr>(data, ehdr.e_shoff + index * ehdr.e_shentsize);
+    };
+    auto contents = [&](Shdr const& shdr) {
+        if (shdr.sh_offset > data.size() ||
+            data.size() - shdr.sh_offset < shdr.sh_size) {
+            throw std::runtime_error("Truncated ELF section");
+        }
+        return data.substr(shdr.sh_offset, shdr.sh_size);
+    };
+
+    for (std::size_t i = 0; i < ehdr.e_shnum; ++i) {
+        auto shdr = section(i);
+        if (shdr.sh_type != SHT_DYNAMIC) {
+            continue;
+        }
+
+        auto dynamic = contents(shdr);
+        auto strtab = contents(section(shdr.sh_link));
+        std::string_view rpath;
+        std::string_view runpath;
+
+        for (std::size_t off = 0; off + sizeof(Dyn) <= dynamic.size();
+             off += sizeof(Dyn)) {
+            auto dyn = read<Dyn>(dynamic, off);
+            if (dyn.d_tag == DT_NULL) {
+                break;
+            }
+            auto value = static_cast<std::size_t>(dyn.d_un.d_val);
+            if (dyn.d_tag == DT_NEEDED) {
+                info.needed.emplace_back(string_at(strtab, value));
+            } else if (dyn.d_tag == DT_RUNPATH) {
+                runpath = string_at(strtab, value);
+            } else if (dyn.d_tag == DT_RPATH) {
+                rpath = string_at(strtab, value);
+            }
+        }
+
+        // RPATH is ignored by ld.so if there is a RUNPATH
+        auto path = runpath.empty() ? rpath : runpath;
+        while (!path.empty()) {
+            auto colon = path.find(':');
+            if (auto dir = path.substr(0, colon); !dir.empty()) {
+                info.runpath.emplace_back(dir);
+            }
+            path = colon == std::string_view::npos ? std::string_view{}
+                                                   : path.substr(colon + 1);
+        }
+        return;
+    }
+}
+
+// Replaces each $ORIGIN and ${ORIGIN} in a runpath entry with the
+// directory of the object.
+inline std::string expand_origin(std::string_view dir,
+                                 std::string_view origin) {
+    std::string result;
+    while (!dir.empty()) {
+        if (dir.starts_with("$ORIGIN")) {
+            result += origin;
+            dir.remove_prefix(7);
+        } else if (dir.starts_with("${ORIGIN}")) {
+            result += origin;
+            dir.remove_prefix(9);
+        } else {
+            result += dir.front();
+            dir.remove_prefix(1);
+        }
+    }
+    return result;
+}
+
+} // namespace elf
+
+// Returns nothing if the file is not an ELF file of the host byte order.
+// Throws std::runtime_error for malformed ones and std::system_error if
+// the file cannot be read.
+inline std::optional<ElfDynamicInfo> read_elf_dynamic(std::string_view data) {
+    if (data.size() < EI_NIDENT || data.substr(0, SELFMAG) != ELFMAG) {
+        return std::nullopt;
+    }
+
+    constexpr unsigned char kHostData =
+        std::endian::native == std::endian::little ? ELFDATA2LSB : ELFDATA2MSB;
+    if (static_cast<unsigned char>(data[EI_DATA]) != kHostData) {
+        return std::nullopt;
+    }
+
+    ElfDynamicInfo info;
+    switch (data[EI_CLASS]) {
+    case ELFCLASS64:
+        info.is_64bit = true;
+        elf::read_dynamic<Elf64_Ehdr, Elf64_Shdr, Elf64_Dyn>(data, info);
+        break;
+    case ELFCLASS32:
+        elf::read_dynamic<Elf32_Ehdr, Elf32_Shdr, Elf32_Dyn>(data, info);
+        break;
+    default:
+        return std::nullopt;
+    }
+    return info;
+}
+
+inline std::optional<ElfDynamicInfo> read_elf_dynamic(fs::path const& path) {
+    MappedFile file{path};
+    return read_elf_dynamic(file.view());
+}
+
+constexpr std::string_view kLdSoCacheFile = "/etc/ld.so.cache";
+
+// The sonames known to the dynamic linker, read from its cache the way
+// ld.so does (the glibc-ld.so.cache1.1 format, alone or after the old
+// ld.so-1.7.0 one) and falling back to the default library directories.
+class LdSoCache {
+  public:
+    // An unreadable or unknown cache leaves only the default directories.
+    LdSoCache() : LdSoCache(fs::path{kLdSoCacheFile}) {}
+    explicit LdSoCache(fs::path const& cache_file);
+
+    static LdSoCache from_data(std::string_view data);
+
+    // Finds the library of the given soname for an object of the given
+    // machine and class, looking first into its runpath.
+    [[nodiscard]] std::optional<fs::path>
+    resolve(std::string const& soname, ElfDynamicInfo const& from,
+            fs::path const& from_path) const;
+
+    [[nodiscard]] std::size_t size() const { return libraries_.size(); }
+
+  private:
+    struct Empty {};
+    explicit LdSoCache(Empty) {}
+
+    void parse(std::string_view data);
+    static bool matches(fs::path const& library, ElfDynamicInfo const& from);
+
+    // soname -> paths, in the order of the cache
+    std::unordered_map<std::string, std::vector<fs::path>> libraries_;
+};
+
+inline LdSoCache::LdSoCache(fs::path const& cache_file) {
+    try {
+        MappedFile file{cache_file};
+        parse(file.view());
+    } catch (std::exception const& e) {
+        LOG(DEBUG) << "Failed to read " << cache_file << ": " << e.what();
+    }
+}
+
+inline LdSoCache LdSoCache::from_data(std::string_view data) {
+    LdSoCache cache{Empty{}};
+    cache.parse(data);
+    return cache;
+}
+
+inline void LdSoCache::parse(std::string_view data) {
+    static constexpr std::string_view kOldMagic = "ld.so-1.7.0";
+    static constexpr std::string_view kNewMagic = "glibc-ld.so.cache1.1";
+    // magic, nlibs, len_strings, flags, padding, extension offset, unused
+    static constexpr std::size_t kNewHeaderSize = 48;
+    // flags, key, value, osversion, hwcap
+    static constexpr std::size_t kNewEntrySize = 24;
+
+    if (data.starts_with(kOldMagic)) {
+        auto nlibs = elf::read<std::uint32_t>(data, 12);
+        // the old entries are flags, key and value, the new format is
+        // aligned to 8 bytes after them
+        auto offset = 16 + std::size_t{nlibs} * 12;
+        offset = (offset + 7) & ~std::size_t{7};
+        data = offset < data.size() ? data.substr(offset) : std::string_view{};
+    }
+
+    if (!data.starts_with(kNewMagic)) {
+        throw std::runtime_error("Unknown ld.so.cache format");
+    }
+
+    // the string offsets are relative to the new header
+    auto nlibs = elf::read<std::uint32_t>(data, kNewMagic.size());
+    for (std::size_t i = 0; i < nlibs; ++i) {
+        auto entry = kNewHeaderSize + i * kNewEntrySize;
+        auto key = elf::read<std::uint32_t>(data, entry + 4);
+        auto value = elf::read<std::uint32_t>(data, entry + 8);
+        libraries_[std::string{elf::string_at(data, key)}].emplace_back(
+            elf::string_at(data, value));
+    }
+}
+
+inline bool LdSoCache::matches(fs::path const& library,
+                               ElfDynamicInfo const& from) {
+    try {
+        auto info = read_elf_dynamic(library);
+        return info && info->machine == from.machine &&
+               info->is_64bit == from.is_64bit;
+    } catch (std::exception const&) {
+        return false;
+    }
+}
+
+inline std::optional<fs::path>
+LdSoCache::resolve(std::string const& soname, ElfDynamicInfo const& from,
+                   fs::path const& from_path) const {
+    std::error_code ec;
+
+    auto origin = from_path.parent_path().string();
+    for (auto const& dir : from.runpath) {
+        if (auto p = fs::path{elf::expand_origin(dir, origin)} / soname;
+            fs::exists(p, ec) && matches(p, from)) {
+            return p;
+        }
+    }
+
+    if (auto it = libraries_.find(soname); it != libraries_.end()) {
+        for (auto const& p : it->second) {
+            if (matches(p, from)) {
+                return p;
+            }
+        }
+    }
+
+    for (auto const* dir : {"/lib64", "/usr/lib64", "/lib", "/usr/lib"}) {
+        if (auto p = fs::path{dir} / soname;
+            fs::exists(p, ec) && matches(p, from)) {
+            return p;
+        }
+    }
+
+    return std::nullopt;
+}
+
+#endif // ELF_DYNAMIC_H
@@ -3,7 +3,10 @@
 
 #include "ignore_file_map.h"
 #include "logger.h"
+#include "process_tree.h"
 #include "syscall_monitor.h"
+#include "tracing_status.h"
+#include <cmath>
 #include <fcntl.h>
 #include <filesystem>
 #include <system_error>
@@ -37,16 +40,46 @@ class FileTracer : public SyscallListener {
 
     void on_syscall_exit(pid_t pid, SyscallRet ret_val, bool is_error) override;
 
+    void on_process_spawn(pid_t parent, pid_t child) override;
+
+    void on_process_exit(pid_t pid, int status, rusage const& usage) override;
+
+    void on_tick() override { report_status(true); }
+
     Files const& files() const { return files_; }
     std::map<fs::path, fs::path> symlinks() const { return symlinks_; }
 
     std::uint64_t syscalls_count() const { return syscalls_count_; }
 
+    ProcessTree& process_tree() { return process_tree_; }
+    ProcessTree const& process_tree() const { return process_tree_; }
+
+    // the status file is updated from the syscall handler and the monitor
+    // ticks at most once per its interval
+    void set_status_file(TracingStatusFile* status_file) {
+        status_file_ = status_file;
+    }
+
+    // writes the current status (if there is a status file)
+    void report_status(bool running);
+
+    [[nodiscard]] JsonValue status(bool running) const;
+
   private:
     static inline IgnoreFileMap const kDefaultIgnoreFiles_;
+    static constexpr std::size_t kMaxExecArgs{1024};
+    // how often (in syscalls) to check whether the status is due
+    static constexpr std::uint64_t kStatusCheckPeriod{256};
+    static constexpr std::size_t kStatusTopProcesses{10};
+
+    struct ExecInfo {
+        std::string exe;
+        std::vector<std::string> argv;
+        std::optional<FileInfo> file;
+    };
 
     using Warnings = std::vector<std::string>;
-    using SyscallState = std::variant<std::monostate, FileInfo>;
+    using SyscallState = std::variant<std::monostate, FileInfo, ExecInfo>;
     using PidState = std::pair<int, SyscallState>;
 
     struct SyscallHandler {
@@ -54,7 +87,7 @@ class FileTracer : public SyscallListener {
         void (FileTracer::*exit)(pid_t, SyscallRet, bool, SyscallState const&);
     };
 
-    void register_file(FileInfo info);
+    void register_file(pid_t pid, FileInfo info);
 
     std::optional<fs::path> resolve_path_at(pid_t pid, int dirfd,
                                             fs::path const& path);
@@ -84,8 +117,8 @@ class FileTracer : public SyscallListener {
 
     void syscall_execve_entry(pid_t pid, SyscallArgs args, SyscallState& state);
 
-    void syscall_execve_exit(pid_t /*unused*/, SyscallRet /*unused*/,
-                             bool is_error, SyscallState const& state);
+    void syscall_execve_exit(pid_t pid, SyscallRet /*unused*/, bool is_error,
+                             SyscallState const& state);
 
     void syscall_readlink_entry(pid_t pid, SyscallArgs args,
                                 SyscallState& state);
@@ -133,6 +166,12 @@ class FileTracer : public SyscallListener {
     std::unordered_map<pid_t, PidState> state_;
     Files files_;
     std::map<fs::path, fs::path> symlinks_;
+    ProcessTree process_tree_;
+    std::uintmax_t files_size_{0};
+    TracingStatusFile* status_file_{};
+    ProcessTree::Clock::time_point start_{ProcessTree::Clock::now()};
+    ProcessTree::Clock::time_point last_status_{start_};
+    std::uint64_t last_status_syscalls_{0};
     Warnings warnings_;
 };
 
@@ -141,6 +180,11 @@ inline void FileTracer::on_syscall_entry(pid_t pid, std::uint64_t syscall,
     LOG(TRACE) << "Syscall entry: " << syscall << " pid: " << pid;
 
     syscalls_count_++;
+    process_tree_.on_syscall(pid);
+
+    if (status_file_ != nullptr && syscalls_count_ % kStatusCheckPeriod == 0) {
+        report_status(true);
+    }
 
     auto it = kHandlers_.find(syscall);
     if (it == kHandlers_.end()) {
@@ -176,7 +220,22 @@ inline void FileTracer::on_syscall_exit(pid_t pid, SyscallRet ret_val,
     }
 }
 
-inline void FileTracer::register_file(FileInfo info) {
+inline void FileTracer::on_process_spawn(pid_t parent, pid_t child) {
+    LOG(TRACE) << "Process spawn: " << child << " parent: " << parent;
+
+    process_tree_.on_spawn(parent, child);
+}
+
+inline void FileTracer::on_process_exit(pid_t pid, int status,
+                                        rusage const& usage) {
+    LOG(TRACE) << "Process exit: " << pid;
+
+    // the process could have been killed in the middle of a syscall
+    state_.erase(pid);
+    process_tree_.on_exit(pid, status, usage);
+}
+
+inline void FileTracer::register_file(pid_t pid, FileInfo info) {
     std::error_code ec;
     auto& path = info.path;
     if (!path.is_absolute()) {
@@ -198,7 +257,66 @@ inline void FileTracer::register_file(FileInfo info) {
         }
     }
 
-    files_.try_emplace(path, info);
+    if (files_.try_emplace(path, info).second) {
+        process_tree_.on_file(pid);
+        files_size_ += info.size.value_or(0);
+    }
+}
+
+inline void FileTracer::report_status(bool running) {
+    if (status_file_ == nullptr) {
+        return;
+    }
+
+    auto now = ProcessTree::Clock::now();
+    if (running && !status_file_->due(now)) {
+        return;
+    }
+
+    auto status = this->status(running);
+
+    // the rate is since the last report
+    std::chrono::duration<double> elapsed = now - last_status_;
+    double rate = 0;
+    if (elapsed.count() > 0) {
+        rate = static_cast<double>(syscalls_count_ - last_status_syscalls_) /
+               elapsed.count();
+    }
+    std::get<JsonObject>(status).emplace("syscalls_per_second",
+                                         std::round(rate));
+
+    last_status_ = now;
+    last_status_syscalls_ = syscalls_count_;
+
+    status_file_->write(status, now);
+}
+
+inline JsonValue FileTracer::status(bool running) const {
+    std::chrono::duration<double> elapsed =
+        ProcessTree::Clock::now() - start_;
+
+    JsonArray top;
+    for (auto const* p : process_tree_.top_by_syscalls(kStatusTopProcesses)) {
+        top.emplace_back(JsonObject{
+            {"pid", p->pid},
+            {"exe", p->exe},
+            {"syscalls", static_cast<double>(p->syscalls)},
+            {"files", static_cast<double>(p->files)},
+            {"running", !p->end.has_value()},
+        });
+    }
+
+    return JsonObject{
+        {"running", running},
+        {"elapsed_s", std::round(elapsed.count() * 10) / 10},
+        {"syscalls", static_cast<double>(syscalls_count_)},
+        {"active_tracees", static_cast<double>(process_tree_.running())},
+        {"processes", static_cast<double>(process_tree_.processes().size())},
+        {"files", static_cast<double>(files_.size())},
+        {"files_bytes", static_cast<double>(files_size_)},
+        {"symlinks", static_cast<double>(symlinks_.size())},
+        {"top_processes", std::move(top)},
+    };
 }
 
 inline std::optional<fs::path>
@@ -270,8 +388,9 @@ inline void FileTracer::generic_open_entry(pid_t pid, int dirfd,
     state = FileInfo{.path = *result, .size = {}, .existed_before = exists};
 }
 
-void FileTracer::generic_open_exit(pid_t pid, SyscallRet ret_val, bool is_error,
-                                   FileTracer::SyscallState const& state) {
+inline void
+FileTracer::generic_open_exit(pid_t pid, SyscallRet ret_val, bool is_error,
+                              FileTracer::SyscallState const& state) {
     if (is_error) {
         return;
     }
@@ -312,7 +431,7 @@ void FileTracer::generic_open_exit(pid_t pid, SyscallRet ret_val, bool is_error,
                           << " vs " << *exit_file;
             }
         } else {
-            register_file(info);
+            register_file(pid, info);
         }
     }
 }
@@ -391,30 +510,44 @@ inline void FileTracer::syscall_execve_entry(pid_t pid, SyscallArgs args,
                                              SyscallState& state) {
     auto path =
         SyscallMonitor::read_string_from_process(pid, args[0], PATH_MAX);
-    auto result = resolve_path_at(pid, AT_FDCWD, path);
-    if (!result) {
-        return;
+    auto argv = SyscallMonitor::read_string_array_from_process(
+        pid, args[1], kMaxExecArgs, PATH_MAX);
+
+    ExecInfo exec{.exe = path, .argv = std::move(argv), .file = {}};
+
+    // it could have been ignored
+    if (auto result = resolve_path_at(pid, AT_FDCWD, path); result) {
+        exec.exe = result->string();
+        exec.file =
+            FileInfo{.path = *result, .size = {}, .existed_before = false};
     }
 
-    state = FileInfo{.path = *result, .size = {}, .existed_before = false};
+    state = std::move(exec);
 }
 
-inline void FileTracer::syscall_execve_exit(pid_t, SyscallRet, bool is_error,
+inline void FileTracer::syscall_execve_exit(pid_t pid, SyscallRet,
+                                            bool is_error,
                                             SyscallState const& state) {
     if (is_error) {
         return;
     }
 
-    if (std::holds_alternative<FileInfo>(state)) {
-        auto info = std::get<FileInfo>(state);
-        // it succeeded so it has to exist
-        info.existed_before = true;
+    if (!std::holds_alternative<ExecInfo>(state)) {
+        return;
+    }
+
+    auto const& exec = std::get<ExecInfo>(state);
 
-        LOG(DEBUG) << "Syscall execve " << info.path;
+    LOG(DEBUG) << "Syscall execve " << exec.exe;
 
-        register_file(info);
+    process_tree_.on_exec(pid, exec.exe, exec.argv);
+
+    if (exec.file) {
+        auto info = *exec.file;
+        // it succeeded so it has to exist
+        info.existed_before = true;
+        register_file(pid, info);
     }
-    // no else - it could have been ignored
 }
 
 inline void FileTracer::syscall_readlink_entry(pid_t pid, SyscallArgs args,
@@ -452,7 +585,7 @@ inline void FileTracer::syscall_newfstatat_entry(pid_t pid, SyscallArgs args,
     generic_open_entry(pid, static_cast<int>(args[0]), path, state);
 }
 
-inline void FileTracer::syscall_newfstatat_exit(pid_t, SyscallRet,
+inline void FileTracer::syscall_newfstatat_exit(pid_t pid, SyscallRet,
                                                 bool is_error,
                                                 SyscallState const& state) {
     if (is_error) {
@@ -479,7 +612,7 @@ inline void FileTracer::syscall_newfstatat_exit(pid_t, SyscallRet,
         return;
     }
 
-    register_file(info);
+    register_file(pid, info);
 }
 
 #endif // FILE_TRACER_H
@@ -1,29 +1,478 @@
 #ifndef FILESYSTEM_TRIE_H
 #define FILESYSTEM_TRIE_H
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <limits>
 #include <memory>
+#include <numeric>
+#include <ostream>
 #include <optional>
 #include <set>
+#include <span>
+#include <stdexcept>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace fs = std::filesystem;
 
+namespace filesystem_trie {
+
+using NodeId = std::uint32_t;
+using ComponentId = std::uint32_t;
+
+inline constexpr NodeId kNoNode = std::numeric_limits<NodeId>::max();
+
+// Splits a path into its components without allocating. Like fs::path, the
+// root directory of an absolute path is reported as "/" and the empty
+// components (repeated or trailing slashes) are skipped.
+class PathComponents {
+  public:
+    explicit PathComponents(std::string_view path)
+        : path_{path}, root_{path.starts_with('/')} {}
+
+    bool next(std::string_view& component) {
+        if (root_) {
+            root_ = false;
+            component = path_.substr(0, 1);
+            return true;
+        }
+
+        while (pos_ < path_.size() && path_[pos_] == '/') {
+            pos_++;
+        }
+        if (pos_ == path_.size()) {
+            return false;
+        }
+
+        auto end = std::min(path_.find('/', pos_), path_.size());
+        component = path_.substr(pos_, end - pos_);
+        pos_ = end;
+        return true;
+    }
+
+  private:
+    std::string_view path_;
+    std::size_t pos_{0};
+    bool root_;
+};
+
+// Resolves a sequence of paths in a trie reusing the nodes matched for the
+// common prefix with the previous path, so sorted paths sharing deep
+// directories (e.g. /usr/lib/R/site-library) only walk them once. The
+// matched components are views into the previous path which therefore has
+// to outlive the next call.
+template <typename Id, typename Child>
+class PrefixWalker {
+  public:
+    PrefixWalker(Id root, Id none, Child child)
+        : root_{root}, none_{none}, child_{std::move(child)} {}
+
+    // Returns the deepest node matching a prefix of the path and whether it
+    // matched the whole path.
+    std::pair<Id, bool> walk(std::string_view path) {
+        PathComponents parts{path};
+        std::string_view part;
+        std::size_t depth = 0;
+        bool more = false;
+
+        while ((more = parts.next(part)) && depth < matched_.size() &&
+               matched_[depth].first == part) {
+            depth++;
+        }
+        matched_.resize(depth);
+
+        for (; more; more = parts.next(part)) {
+            auto id = child_(current(), part);
+            if (id == none_) {
+                return {current(), false};
+            }
+            matched_.emplace_back(part, id);
+        }
+
+        return {current(), true};
+    }
+
+  private:
+    Id current() const {
+        return matched_.empty() ? root_ : matched_.back().second;
+    }
+
+    Id root_;
+    Id none_;
+    Child child_;
+    std::vector<std::pair<std::string_view, Id>> matched_;
+};
+
+// Interns path components (file and directory names) so that each distinct
+// name is stored once and nodes only keep a 32-bit id. The characters live in
+// fixed size blocks so the views handed out stay valid when the table grows
+// or is moved.
+class ComponentTable {
+  public:
+    ComponentTable() = default;
+
+    ComponentTable(ComponentTable const& other) { *this = other; }
+    ComponentTable(ComponentTable&&) noexcept = default;
+
+    ComponentTable& operator=(ComponentTable const& other) {
+        if (this != &other) {
+            clear();
+            for (auto name : other.names_) {
+                intern(name);
+            }
+        }
+        return *this;
+    }
+    ComponentTable& operator=(ComponentTable&&) noexcept = default;
+
+    ComponentId intern(std::string_view name) {
+        if (ids_.empty() || (names_.size() + 1) * 4 > ids_.size() * 3) {
+            grow();
+        }
+
+        auto h = hash(name);
+        auto i = lookup(name, h);
+        if (ids_[i].id != kNone) {
+            return ids_[i].id;
+        }
+
+        auto id = static_cast<ComponentId>(names_.size());
+        names_.push_back(store(name));
+        ids_[i] = {id, static_cast<std::uint32_t>(h)};
+        return id;
+    }
+
+    [[nodiscard]] std::optional<ComponentId> find(std::string_view name) const {
+        if (ids_.empty()) {
+            return {};
+        }
+
+        auto const& slot = ids_[lookup(name, hash(name))];
+        if (slot.id == kNone) {
+            return {};
+        }
+        return slot.id;
+    }
+
+    [[nodiscard]] std::string_view name(ComponentId id) const {
+        return names_[id];
+    }
+
+    [[nodiscard]] std::size_t size() const { return names_.size(); }
+
+  private:
+    static constexpr std::size_t kBlockSize = 64 * 1024;
+    static constexpr ComponentId kNone = std::numeric_limits<ComponentId>::max();
+
+    // open addressing, the hash is kept to skip most of the string compares
+    struct Slot {
+        ComponentId id{kNone};
+        std::uint32_t hash{};
+    };
+
+    static std::size_t hash(std::string_view name) {
+        return std::hash<std::string_view>{}(name);
+    }
+
+    // the slot with the name or the empty slot where it should go
+    [[nodiscard]] std::size_t lookup(std::string_view name,
+                                     std::size_t h) const {
+        auto mask = ids_.size() - 1;
+        auto h32 = static_cast<std::uint32_t>(h);
+        for (auto i = h & mask;; i = (i + 1) & mask) {
+            auto const& slot = ids_[i];
+            if (slot.id == kNone ||
+                (slot.hash == h32 && names_[slot.id] == name)) {
+                return i;
+            }
+        }
+    }
+
+    void grow() {
+        std::vector<Slot> slots(ids_.empty() ? 64 : ids_.size() * 2);
+        auto mask = slots.size() - 1;
+        for (auto const& slot : ids_) {
+            if (slot.id == kNone) {
+                continue;
+            }
+            // only the low 32 bits of the hash are kept
+            auto i = hash(names_[slot.id]) & mask;
+            while (slots[i].id != kNone) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = slot;
+        }
+        ids_ = std::move(slots);
+    }
+
+    void clear() {
+        blocks_.clear();
+        names_.clear();
+        ids_.clear();
+        current_ = nullptr;
+        remaining_ = 0;
+    }
+
+    std::string_view store(std::string_view name) {
+        if (name.size() > kBlockSize / 4) {
+            // long names get a block of their own
+            auto& block = blocks_.emplace_back(new char[name.size()]);
+            std::memcpy(block.get(), name.data(), name.size());
+            return {block.get(), name.size()};
+        }
+
+        if (name.size() > remaining_) {
+            current_ = blocks_.emplace_back(new char[kBlockSize]).get();
+            remaining_ = kBlockSize;
+        }
+
+        char* dst = current_;
+        std::memcpy(dst, name.data(), name.size());
+        current_ += name.size();
+        remaining_ -= name.size();
+        return {dst, name.size()};
+    }
+
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    char* current_{};
+    std::size_t remaining_{0};
+    std::vector<std::string_view> names_;
+    std::vector<Slot> ids_;
+};
+
+// Open addressing hash table mapping (parent node, component) to the child
+// node. One table for the whole trie instead of a map per node.
+class ChildTable {
+  public:
+    [[nodiscard]] NodeId find(NodeId parent, ComponentId name) const {
+        if (slots_.empty()) {
+            return kNoNode;
+        }
+
+        auto key = make_key(parent, name);
+        for (auto i = hash(key) & mask();; i = (i + 1) & mask()) {
+            auto const& slot = slots_[i];
+            if (slot.key == key) {
+                return slot.child;
+            }
+            if (slot.key == kEmpty) {
+                return kNoNode;
+            }
+        }
+    }
+
+    void insert(NodeId parent, ComponentId name, NodeId child) {
+        if ((size_ + 1) * 4 > slots_.size() * 3) {
+            grow();
+        }
+        put(make_key(parent, name), child);
+        size_++;
+    }
+
+    [[nodiscard]] std::size_t size() const { return size_; }
+
+  private:
+    static constexpr std::uint64_t kEmpty =
+        std::numeric_limits<std::uint64_t>::max();
+
+    struct Slot {
+        std::uint64_t key{kEmpty};
+        NodeId child{kNoNode};
+    };
+
+    static std::uint64_t make_key(NodeId parent, ComponentId name) {
+        return (static_cast<std::uint64_t>(parent) << 32) | name;
+    }
+
+    // the finalizer of splitmix64
+    static std::size_t hash(std::uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return static_cast<std::size_t>(x);
+    }
+
+    [[nodiscard]] std::size_t mask() const { return slots_.size() - 1; }
+
+    void put(std::uint64_t key, NodeId child) {
+        auto i = hash(key) & mask();
+        while (slots_[i].key != kEmpty) {
+            i = (i + 1) & mask();
+        }
+        slots_[i] = {key, child};
+    }
+
+    void grow() {
+        auto old = std::move(slots_);
+        slots_.assign(old.empty() ? 16 : old.size() * 2, Slot{});
+        for (auto const& slot : old) {
+            if (slot.key != kEmpty) {
+                put(slot.key, slot.child);
+            }
+        }
+    }
+
+    std::vector<Slot> slots_;
+    std::size_t size_{0};
+};
+
+// The on-disk layout written by FileSystemTrie::save and read in place by
+// MappedFileSystemTrie. All offsets are relative to the start of the file so
+// it can be mapped anywhere. The sections are 8 byte aligned:
+//
+// - components: the component names sorted, as (offset, length) into strings
+//   so a component id is its rank and ids compare like the names,
+// - strings: the characters of the component names,
+// - index: open addressing hash table of component ids (id + 1, 0 is empty),
+// - nodes: in breadth first order, the children of a node are a contiguous
+//   range sorted by the component id,
+// - values: the values referred to by the nodes,
+// - metadata: an opaque blob stored by the owner of the trie.
+namespace file {
+
+inline constexpr std::array<char, 8> kMagic{'R', '4', 'R', 'T',
+                                            'R', 'I', 'E', '\0'};
+inline constexpr std::uint32_t kVersion = 1;
+inline constexpr std::uint32_t kNoValue =
+    std::numeric_limits<std::uint32_t>::max();
+
+struct Section {
+    std::uint64_t offset;
+    std::uint64_t size;
+};
+
+struct Header {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t value_size;
+    std::uint64_t fingerprint;
+    std::uint64_t file_size;
+    std::uint32_t node_count;
+    std::uint32_t component_count;
+    std::uint32_t value_count;
+    std::uint32_t index_size;
+    Section components;
+    Section strings;
+    Section index;
+    Section nodes;
+    Section values;
+    Section metadata;
+};
+
+struct Component {
+    std::uint32_t offset;
+    std::uint32_t length;
+};
+
+struct Node {
+    std::uint32_t name;
+    std::uint32_t first_child;
+    std::uint32_t child_count;
+    std::uint32_t value;
+};
+
+// FNV-1a, stable across runs unlike std::hash
+inline std::uint64_t hash(std::string_view name) {
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    for (auto c : name) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+} // namespace file
+
+} // namespace filesystem_trie
+
+// A trie keyed by path components.
+//
+// The nodes are allocated from an arena (fixed size blocks so the addresses
+// of the values stay stable), the component names are interned and the
+// children are kept in a single hash table keyed by (parent id, name id).
+// Trivially copyable values (pointers, bools, small structs) are stored
+// inline in the nodes, other values are deduplicated in a set and the nodes
+// only point to them.
 template <typename T>
 class FileSystemTrie {
+    using NodeId = filesystem_trie::NodeId;
+    using ComponentId = filesystem_trie::ComponentId;
+    static constexpr NodeId kNoNode = filesystem_trie::kNoNode;
+    static constexpr NodeId kRoot = 0;
+
+    static constexpr bool kInlineValues = std::is_trivially_copyable_v<T>;
+    using StoredValue = std::conditional_t<kInlineValues, T, T const*>;
+
     struct Node {
-        std::unordered_map<std::string, std::unique_ptr<Node>> children;
-        std::optional<T const*> value;
-
-        Node() : value{} {};
-        explicit Node(T const* value) : value{value} {};
-        Node(Node const&) = delete;
-        Node(Node&&) noexcept = delete;
-        Node& operator=(Node const&) = delete;
-        Node& operator=(Node&&) noexcept = delete;
+        ComponentId name{};
+        NodeId first_child{kNoNode};
+        NodeId next_sibling{kNoNode};
+        std::optional<StoredValue> value;
+
+        [[nodiscard]] T const* get() const {
+            if (!value) {
+                return nullptr;
+            }
+            if constexpr (kInlineValues) {
+                return &*value;
+            } else {
+                return *value;
+            }
+        }
+    };
+
+    // the nodes are never freed nor moved while the trie lives
+    class NodeArena {
+        static constexpr std::size_t kBlockBits = 12;
+        static constexpr std::size_t kBlockSize = 1 << kBlockBits;
+
+      public:
+        NodeArena() = default;
+        NodeArena(NodeArena const& other) { *this = other; }
+        NodeArena(NodeArena&&) noexcept = default;
+
+        NodeArena& operator=(NodeArena const& other) {
+            if (this != &other) {
+                blocks_.clear();
+                size_ = 0;
+                for (NodeId id = 0; id < other.size_; ++id) {
+                    add() = other[id];
+                }
+            }
+            return *this;
+        }
+        NodeArena& operator=(NodeArena&&) noexcept = default;
+
+        Node& add() {
+            if ((size_ & (kBlockSize - 1)) == 0) {
+                blocks_.emplace_back(new Node[kBlockSize]);
+            }
+            return (*this)[size_++];
+        }
+
+        Node& operator[](NodeId id) {
+            return blocks_[id >> kBlockBits][id & (kBlockSize - 1)];
+        }
+        Node const& operator[](NodeId id) const {
+            return blocks_[id >> kBlockBits][id & (kBlockSize - 1)];
+        }
+
+        [[nodiscard]] NodeId size() const { return size_; }
+
+      private:
+        std::vector<std::unique_ptr<Node[]>> blocks_;
+        NodeId size_{0};
     };
 
     struct NodeView {
@@ -46,7 +495,8 @@ class FileSystemTrie {
 
     class ConstIterator {
         static inline NodeView const kEndSentinel{"", nullptr};
-        std::vector<std::pair<fs::path, Node const*>> stack_;
+        FileSystemTrie const* trie_{};
+        std::vector<std::pair<fs::path, NodeId>> stack_;
         NodeView current_;
 
         void advance();
@@ -61,8 +511,8 @@ class FileSystemTrie {
         /// Default constructor creates an "end" iterator.
         ConstIterator() : current_{kEndSentinel} {}
 
-        /// Construct an iterator starting at a given root.
-        explicit ConstIterator(Node const* root);
+        /// Construct an iterator starting at the root of a given trie.
+        explicit ConstIterator(FileSystemTrie const* trie);
 
         reference operator*() const { return current_; }
         pointer operator->() const { return &current_; }
@@ -75,53 +525,94 @@ class FileSystemTrie {
         bool operator==(ConstIterator const& other) const = default;
     };
 
-    void insert(fs::path const& path, T const* value);
+    NodeId child(NodeId parent, std::string_view name) const;
+    NodeId add_child(NodeId parent, std::string_view name);
+    std::vector<T const*>
+    lookup_sorted(std::span<std::string_view const> paths,
+                  bool last_matching) const;
+    void set_value(Node& node, T const& value);
 
     std::set<T> unique_values_;
-    std::unique_ptr<Node> root_{std::make_unique<Node>()};
+    filesystem_trie::ComponentTable components_;
+    filesystem_trie::ChildTable children_;
+    NodeArena nodes_;
     size_t size_{0};
 
   public:
-    FileSystemTrie() = default;
-
-    FileSystemTrie(FileSystemTrie const& other) : unique_values_{} {
-        for (auto const& info : other) {
-            this->insert(info.path, *info.value);
+    FileSystemTrie() { nodes_.add(); }
+
+    FileSystemTrie(FileSystemTrie const& other)
+        : unique_values_{other.unique_values_},
+          components_{other.components_}, children_{other.children_},
+          nodes_{other.nodes_}, size_{other.size_} {
+        if constexpr (!kInlineValues) {
+            // point to our own copies of the values
+            for (NodeId id = 0; id < nodes_.size(); ++id) {
+                auto& value = nodes_[id].value;
+                if (value) {
+                    value = &*unique_values_.find(**value);
+                }
+            }
         }
     };
 
     FileSystemTrie(FileSystemTrie&& other) noexcept = default;
 
     FileSystemTrie& operator=(FileSystemTrie const& other) {
-        size_ = 0;
-        unique_values_.clear();
-
-        for (auto const& info : other) {
-            this->insert(info.path, *info.value);
+        if (this != &other) {
+            *this = FileSystemTrie{other};
         }
+        return *this;
     }
 
     FileSystemTrie& operator=(FileSystemTrie&&) noexcept = default;
 
-    ConstIterator begin() const { return ConstIterator{root_.get()}; }
+    ConstIterator begin() const { return ConstIterator{this}; }
     ConstIterator end() const { return ConstIterator{}; }
 
-    void insert(fs::path const& path, T const& value);
+    // The paths are split on '/', use path.native() to pass a fs::path.
+    void insert(std::string_view path, T const& value);
+
+    // Inserts all the values of the other trie, replacing the existing ones.
+    void merge(FileSystemTrie const& other);
+
+    [[nodiscard]] T const* find(std::string_view path) const;
 
-    [[nodiscard]] T const* find(fs::path const& path) const;
+    [[nodiscard]] T const* find_last_matching(std::string_view path) const;
 
-    [[nodiscard]] T const* find_last_matching(fs::path const& path) const;
+    // The same as find / find_last_matching of each of the paths, but the
+    // trie is walked only once for the common prefixes of consecutive paths
+    // so it is much faster when the paths are sorted.
+    [[nodiscard]] std::vector<T const*>
+    find_sorted(std::span<std::string_view const> paths) const {
+        return lookup_sorted(paths, false);
+    }
+    [[nodiscard]] std::vector<T const*>
+    find_last_matching_sorted(std::span<std::string_view const> paths) const {
+        return lookup_sorted(paths, true);
+    }
+
+    // Writes the trie in the position independent layout described in
+    // filesystem_trie::file so it can be used by MappedFileSystemTrie without
+    // any parsing. Only trivially copyable values can be saved.
+    void save(std::ostream& out, std::uint64_t fingerprint = 0,
+              std::string_view metadata = {}) const;
 
-    bool is_empty() { return root_->children.empty(); }
+    // Atomically replaces the file (write to a temporary and rename).
+    void save(fs::path const& path, std::uint64_t fingerprint = 0,
+              std::string_view metadata = {}) const;
+
+    bool is_empty() { return nodes_[kRoot].first_child == kNoNode; }
 
     [[nodiscard]] size_t size() { return size_; }
 };
 
 template <typename T>
-FileSystemTrie<T>::ConstIterator::ConstIterator(Node const* root) {
-    assert(root != nullptr && "Node should not be null");
+FileSystemTrie<T>::ConstIterator::ConstIterator(FileSystemTrie const* trie)
+    : trie_{trie} {
+    assert(trie != nullptr && "Trie should not be null");
 
-    stack_.push_back({"", root});
+    stack_.push_back({"", kRoot});
 
     advance();
 }
@@ -129,95 +620,297 @@ FileSystemTrie<T>::ConstIterator::ConstIterator(Node const* root) {
 template <typename T>
 void FileSystemTrie<T>::ConstIterator::advance() {
     while (!stack_.empty()) {
-        auto [path, node] = stack_.back();
+        auto [path, id] = std::move(stack_.back());
         stack_.pop_back();
 
-        for (auto const& [key, value] : node->children) {
-            stack_.push_back({path / key, value.get()});
+        auto const& node = trie_->nodes_[id];
+        for (auto c = node.first_child; c != kNoNode;
+             c = trie_->nodes_[c].next_sibling) {
+            stack_.push_back(
+                {path / trie_->components_.name(trie_->nodes_[c].name), c});
         }
 
-        if (node->value) {
-            current_.path = path;
-            current_.value = *(node->value);
+        if (node.value) {
+            current_.path = std::move(path);
+            current_.value = node.get();
             return;
         }
     }
 
+    trie_ = nullptr;
     current_ = kEndSentinel;
 }
 
 template <typename T>
-void FileSystemTrie<T>::insert(fs::path const& path, T const* value) {
-    Node* node = root_.get();
-    bool inserted = false;
+typename FileSystemTrie<T>::NodeId
+FileSystemTrie<T>::child(NodeId parent, std::string_view name) const {
+    auto id = components_.find(name);
+    return id ? children_.find(parent, *id) : kNoNode;
+}
 
-    for (auto const& path_part : path) {
-        auto part = path_part.string();
+template <typename T>
+typename FileSystemTrie<T>::NodeId
+FileSystemTrie<T>::add_child(NodeId parent, std::string_view name) {
+    auto name_id = components_.intern(name);
 
-        if (part.empty()) {
-            continue;
-        }
+    if (auto existing = children_.find(parent, name_id); existing != kNoNode) {
+        return existing;
+    }
+
+    auto id = nodes_.size();
+    auto& node = nodes_.add();
+    auto& parent_node = nodes_[parent];
+    node.name = name_id;
+    node.next_sibling = parent_node.first_child;
+    parent_node.first_child = id;
+
+    children_.insert(parent, name_id, id);
+
+    return id;
+}
+
+template <typename T>
+void FileSystemTrie<T>::set_value(Node& node, T const& value) {
+    if (!node.value) {
+        size_++;
+    }
+
+    if constexpr (kInlineValues) {
+        node.value = value;
+    } else {
+        auto [it, _] = unique_values_.insert(value);
+        node.value = &*it;
+    }
+}
+
+template <typename T>
+void FileSystemTrie<T>::insert(std::string_view path, T const& value) {
+    NodeId id = kRoot;
 
-        auto [it, ins] =
-            node->children.try_emplace(part, std::make_unique<Node>());
-        node = it->second.get();
-        inserted |= ins;
+    filesystem_trie::PathComponents parts{path};
+    for (std::string_view part; parts.next(part);) {
+        id = add_child(id, part);
     }
 
     // FIXME: Handle the case when this is already set
     // ideally there should be some closure which
     // would handle it? checking if it is a directory or
     // a file? reporting an error if it is a file?
-    node->value = value;
-    if (inserted) {
-        size_++;
-    }
+    set_value(nodes_[id], value);
 }
 
 template <typename T>
-void FileSystemTrie<T>::insert(fs::path const& path, T const& value) {
-    auto [it, _] = unique_values_.insert(std::move(value));
-    insert(path, &(*it));
+void FileSystemTrie<T>::merge(FileSystemTrie const& other) {
+    // pairs of (node in other, the same node in this)
+    std::vector<std::pair<NodeId, NodeId>> stack{{kRoot, kRoot}};
+
+    while (!stack.empty()) {
+        auto [from, to] = stack.back();
+        stack.pop_back();
+
+        auto const& node = other.nodes_[from];
+        if (auto const* value = node.get(); value) {
+            set_value(nodes_[to], *value);
+        }
+
+        for (auto c = node.first_child; c != kNoNode;
+             c = other.nodes_[c].next_sibling) {
+            auto name = other.components_.name(other.nodes_[c].name);
+            stack.emplace_back(c, add_child(to, name));
+        }
+    }
 }
 
 template <typename T>
-T const* FileSystemTrie<T>::find(fs::path const& path) const {
-    Node* node = root_.get();
+T const* FileSystemTrie<T>::find(std::string_view path) const {
+    NodeId id = kRoot;
+
+    filesystem_trie::PathComponents parts{path};
+    for (std::string_view part; parts.next(part);) {
+        id = child(id, part);
+        if (id == kNoNode) {
+            return nullptr;
+        }
+    }
 
-    for (auto const& path_part : path) {
-        auto part = path_part.string();
+    return nodes_[id].get();
+}
 
-        if (part.empty()) {
-            continue;
-        }
-        if (!node->children.contains(part)) {
-            return {};
+template <typename T>
+T const*
+FileSystemTrie<T>::find_last_matching(std::string_view path) const {
+    NodeId id = kRoot;
+
+    filesystem_trie::PathComponents parts{path};
+    for (std::string_view part; parts.next(part);) {
+        auto next = child(id, part);
+        if (next == kNoNode) {
+            break;
         }
-        node = node->children[part].get();
+        id = next;
     }
 
-    return node->value.value_or(nullptr);
+    return nodes_[id].get();
 }
 
 template <typename T>
-T const* FileSystemTrie<T>::find_last_matching(fs::path const& path) const {
-    Node* node = root_.get();
+std::vector<T const*>
+FileSystemTrie<T>::lookup_sorted(std::span<std::string_view const> paths,
+                                 bool last_matching) const {
+    filesystem_trie::PrefixWalker walker{
+        kRoot, kNoNode,
+        [this](NodeId parent, std::string_view name) {
+            return child(parent, name);
+        }};
+
+    std::vector<T const*> result;
+    result.reserve(paths.size());
+    for (auto path : paths) {
+        auto [id, complete] = walker.walk(path);
+        result.push_back(complete || last_matching ? nodes_[id].get()
+                                                   : nullptr);
+    }
 
-    for (auto const& it : path) {
-        auto part = it.string();
+    return result;
+}
+
+template <typename T>
+void FileSystemTrie<T>::save(std::ostream& out, std::uint64_t fingerprint,
+                             std::string_view metadata) const {
+    static_assert(kInlineValues, "Only trivially copyable values can be saved");
+    namespace file = filesystem_trie::file;
+
+    // the component ids in the file are their ranks in the sorted order
+    auto component_count = static_cast<std::uint32_t>(components_.size());
+    std::vector<ComponentId> sorted(component_count);
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::ranges::sort(sorted, {},
+                      [&](ComponentId id) { return components_.name(id); });
+
+    std::vector<std::uint32_t> rank(component_count);
+    std::vector<file::Component> components;
+    components.reserve(component_count);
+    std::string strings;
+    for (std::uint32_t i = 0; i < component_count; ++i) {
+        auto name = components_.name(sorted[i]);
+        rank[sorted[i]] = i;
+        components.push_back({static_cast<std::uint32_t>(strings.size()),
+                              static_cast<std::uint32_t>(name.size())});
+        strings += name;
+    }
 
-        if (part.empty()) {
-            continue;
+    std::uint32_t index_size = 1;
+    while (index_size < component_count * 2) {
+        index_size <<= 1;
+    }
+    std::vector<std::uint32_t> index(index_size, 0);
+    for (std::uint32_t i = 0; i < component_count; ++i) {
+        auto slot = file::hash(components_.name(sorted[i])) & (index_size - 1);
+        while (index[slot] != 0) {
+            slot = (slot + 1) & (index_size - 1);
         }
+        index[slot] = i + 1;
+    }
 
-        if (!node->children.contains(part)) {
-            return node->value.value_or(nullptr);
+    // breadth first so the children of each node are contiguous
+    std::vector<NodeId> order{kRoot};
+    order.reserve(nodes_.size());
+    std::vector<file::Node> nodes;
+    nodes.reserve(nodes_.size());
+    // raw bytes, std::vector<bool> has no data()
+    std::vector<char> values;
+    std::uint32_t value_count = 0;
+    std::vector<NodeId> children;
+
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        auto const& node = nodes_[order[i]];
+
+        children.clear();
+        for (auto c = node.first_child; c != kNoNode;
+             c = nodes_[c].next_sibling) {
+            children.push_back(c);
         }
+        std::ranges::sort(children, {},
+                          [&](NodeId c) { return rank[nodes_[c].name]; });
+
+        file::Node& entry = nodes.emplace_back();
+        entry.name = i == 0 ? 0 : rank[node.name];
+        entry.first_child = static_cast<std::uint32_t>(order.size());
+        entry.child_count = static_cast<std::uint32_t>(children.size());
+        entry.value = file::kNoValue;
+        if (node.value) {
+            entry.value = value_count++;
+            values.resize(values.size() + sizeof(T));
+            std::memcpy(values.data() + values.size() - sizeof(T),
+                        &*node.value, sizeof(T));
+        }
+
+        order.insert(order.end(), children.begin(), children.end());
+    }
+
+    file::Header header{};
+    header.magic = file::kMagic;
+    header.version = file::kVersion;
+    header.value_size = sizeof(T);
+    header.fingerprint = fingerprint;
+    header.node_count = static_cast<std::uint32_t>(nodes.size());
+    header.component_count = component_count;
+    header.value_count = value_count;
+    header.index_size = index_size;
+
+    std::uint64_t offset = sizeof(header);
+    auto section = [&offset](std::size_t size) {
+        file::Section s{(offset + 7) & ~std::uint64_t{7}, size};
+        offset = s.offset + s.size;
+        return s;
+    };
+
+    header.components = section(components.size() * sizeof(file::Component));
+    header.strings = section(strings.size());
+    header.index = section(index.size() * sizeof(std::uint32_t));
+    header.nodes = section(nodes.size() * sizeof(file::Node));
+    header.values = section(values.size());
+    header.metadata = section(metadata.size());
+    header.file_size = offset;
+
+    std::uint64_t written = 0;
+    auto write = [&](file::Section const& s, void const* data) {
+        static constexpr std::array<char, 8> kPadding{};
+        out.write(kPadding.data(),
+                  static_cast<std::streamsize>(s.offset - written));
+        out.write(static_cast<char const*>(data),
+                  static_cast<std::streamsize>(s.size));
+        written = s.offset + s.size;
+    };
+
+    out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    written = sizeof(header);
+    write(header.components, components.data());
+    write(header.strings, strings.data());
+    write(header.index, index.data());
+    write(header.nodes, nodes.data());
+    write(header.values, values.data());
+    write(header.metadata, metadata.data());
+}
 
-        node = node->children[part].get();
+template <typename T>
+void FileSystemTrie<T>::save(fs::path const& path, std::uint64_t fingerprint,
+                             std::string_view metadata) const {
+    auto tmp = path;
+    tmp += ".tmp";
+
+    {
+        std::ofstream out{tmp, std::ios::binary | std::ios::trunc};
+        if (!out) {
+            throw std::runtime_error("Failed to open: " + tmp.string());
+        }
+        save(out, fingerprint, metadata);
+        if (!out.flush()) {
+            throw std::runtime_error("Failed to write: " + tmp.string());
+        }
     }
 
-    return node->value.value_or(nullptr);
+    fs::rename(tmp, path);
 }
 
 #endif // FILESYSTEM_TRIE_H
@@ -4,6 +4,7 @@
 #include "common.h"
 #include "filesystem_trie.h"
 #include "logger.h"
+#include "mapped_filesystem_trie.h"
 #include "util_fs.h"
 #include <functional>
 #include <vector>
@@ -12,6 +13,8 @@ class IgnoreFileMap {
   public:
     void add_wildcard(fs::path const& path);
     void add_file(fs::path const& path);
+    // adds a prebuilt set of files (e.g. a cached one)
+    void add_files(MappedFileSystemTrie<bool> files);
     void add_custom(std::function<bool(fs::path const&)> fun);
 
     bool ignore(fs::path const& path) const;
@@ -19,16 +22,21 @@ class IgnoreFileMap {
   private:
     FileSystemTrie<bool> wildcards_;
     FileSystemTrie<bool> files_;
+    std::vector<MappedFileSystemTrie<bool>> file_sets_;
     std::vector<std::function<bool(fs::path const&)>> custom_;
     SymlinkResolver symlink_resolver;
 };
 
 inline void IgnoreFileMap::add_wildcard(fs::path const& path) {
-    wildcards_.insert(path, true);
+    wildcards_.insert(path.native(), true);
 }
 
 inline void IgnoreFileMap::add_file(fs::path const& path) {
-    files_.insert(path, true);
+    files_.insert(path.native(), true);
+}
+
+inline void IgnoreFileMap::add_files(MappedFileSystemTrie<bool> files) {
+    file_sets_.push_back(std::move(files));
 }
 
 inline void
@@ -37,14 +45,20 @@ IgnoreFileMap::add_custom(std::function<bool(fs::path const&)> fun) {
 }
 
 inline bool IgnoreFileMap::ignore(fs::path const& path) const {
-    if (auto const* it = wildcards_.find_last_matching(path); it && *it) {
+    if (auto const* it = wildcards_.find_last_matching(path.native());
+        it && *it) {
         return true;
     }
 
     for (auto const& p : symlink_resolver.resolve_symlinks(path)) {
-        if (auto const* it = files_.find(p); it && *it) {
+        if (auto const* it = files_.find(p.native()); it && *it) {
             return true;
         }
+        for (auto const& set : file_sets_) {
+            if (auto const* it = set.find(p.native()); it && *it) {
+                return true;
+            }
+        }
     }
 
     for (auto const& p : custom_) {
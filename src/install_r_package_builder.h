@@ -2,9 +2,67 @@
 #define INSTALL_R_PACKAGE_BUILDER_H
 
 #include "rpkg_database.h"
+#include <algorithm>
+#include <fstream>
 #include <iterator>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+enum class InstallSchedule {
+    // the levels of the plan one after the other, each waiting for the
+    // slowest of its packages
+    Levels,
+    // a package starts as soon as its dependencies are installed, the ones
+    // with the longest chain of (slow) dependents first
+    CriticalPath
+};
+
+// The seconds it took to install the R packages, by name. The file has a
+// <name> <seconds> line per package, as the installation script records it.
+using RInstallTimes = std::unordered_map<std::string, double>;
+
+// where the installation script records them in the image
+constexpr char const* kRInstallTimesFile = "/tmp/r4r-install-times.tsv";
+
+inline RInstallTimes load_r_install_times(fs::path const& file) {
+    std::ifstream input{file};
+    if (!input) {
+        throw make_system_error(errno, STR("Failed to open " << file));
+    }
+
+    RInstallTimes times;
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream fields{line};
+        std::string name;
+        double seconds{};
+        if (fields >> name >> seconds && !name.starts_with('#')) {
+            times[name] = seconds;
+        }
+    }
+    return times;
+}
+
+inline void save_r_install_times(RInstallTimes const& times,
+                                 fs::path const& file) {
+    std::vector<std::pair<std::string, double>> sorted{times.begin(),
+                                                       times.end()};
+    std::ranges::sort(sorted);
+
+    std::ofstream output{file};
+    if (!output) {
+        throw make_system_error(errno, STR("Failed to open " << file));
+    }
+    for (auto const& [name, seconds] : sorted) {
+        output << name << '\t' << seconds << '\n';
+    }
+}
+
 // TODO: parameterize - CRAN mirror, temp folder
 class InstallRPackageScriptBuilder {
   public:
@@ -19,26 +77,131 @@ class InstallRPackageScriptBuilder {
         return *this;
     }
 
+    // 0 means as many as the cores and memory of the machine allow, only
+    // with the critical path schedule
     InstallRPackageScriptBuilder& set_max_parallel(std::size_t max_parallel) {
         max_parallel_ = max_parallel;
         return *this;
     }
 
+    InstallRPackageScriptBuilder& set_schedule(InstallSchedule schedule) {
+        schedule_ = schedule;
+        return *this;
+    }
+
+    // the historical install times weighting the critical path
+    InstallRPackageScriptBuilder& set_install_times(RInstallTimes times) {
+        install_times_ = std::move(times);
+        return *this;
+    }
+
+    // the packages are installed from the binary repository instead of
+    // being compiled
+    InstallRPackageScriptBuilder&
+    set_binary_repository(std::string repository,
+                          std::unordered_set<RPackage const*> packages) {
+        binary_repository_ = std::move(repository);
+        binary_packages_ = std::move(packages);
+        return *this;
+    }
+
+    // the packages are installed from their source tarballs with R CMD
+    // INSTALL, only with the critical path schedule; the ones without URLs
+    // are expected in the tarball directory
+    InstallRPackageScriptBuilder& set_source_tarballs(
+        std::unordered_map<RPackage const*, RSourceTarball> tarballs) {
+        source_tarballs_ = std::move(tarballs);
+        return *this;
+    }
+
+    [[nodiscard]] static std::string tarball_name(RPackage const& pkg) {
+        return pkg.name + "_" + pkg.version + ".tar.gz";
+    }
+
+    [[nodiscard]] std::string const& tarball_dir() const {
+        return tarball_dir_;
+    }
+
     void build() {
-        if (max_parallel_ == 0) {
+        if (max_parallel_ == 0 && schedule_ == InstallSchedule::Levels) {
             throw std::runtime_error("Error: max_parallel cannot be zero.");
         }
         if (!out_) {
             throw std::runtime_error("Error: output is not set.");
         }
 
+        if (schedule_ == InstallSchedule::CriticalPath) {
+            write_scheduled_script();
+            return;
+        }
+
         // expand the plan so that no batch exceeds the max_parallel_ limit.
         expand_plan();
 
         write_script();
     }
 
+    // The packages (except the base ones) ordered by the length of their
+    // critical path, i.e. their estimated install time plus the longest one
+    // of the packages that (transitively) depend on them, with the indices
+    // of their dependencies.
+    [[nodiscard]] std::vector<
+        std::pair<RPackage const*, std::vector<std::size_t>>>
+    critical_path_order() const;
+
   private:
+    // without any history, compiling a package takes an order of magnitude
+    // longer than installing a pure R one
+    static constexpr double kDefaultInstallTime = 5;
+    static constexpr double kDefaultCompileTime = 60;
+
+    [[nodiscard]] double install_time(RPackage const& pkg) const {
+        if (auto it = install_times_.find(pkg.name);
+            it != install_times_.end()) {
+            return it->second;
+        }
+        return pkg.needs_compilation ? kDefaultCompileTime
+                                     : kDefaultInstallTime;
+    }
+
+    static std::string log_file(RPackage const& pkg) {
+        return "/tmp/r4r-install-" + pkg.name + "-" + pkg.version + ".log";
+    }
+
+    // the R code installing the package
+    [[nodiscard]] std::string install_expression(RPackage const& pkg) const {
+        std::ostringstream out;
+        if (binary_packages_.contains(&pkg)) {
+            // the package manager serves binaries to R user agents only
+            out << "options(HTTPUserAgent = sprintf('R/%s R (%s)', "
+                   "getRversion(), paste(getRversion(), R.version['platform'], "
+                   "R.version['arch'], R.version['os'])));"
+                << "install.packages('" << pkg.name << "', repos = '"
+                << binary_repository_ << "', dependencies = FALSE)";
+            return out.str();
+        }
+
+        out << "require('remotes', lib.loc = '" << tmp_lib_dir_ << "');";
+        std::visit(
+            overloaded{
+                [&](RPackage::GitHub const& gh) {
+                    out << "remotes::install_github('" << gh.org << "/"
+                        << gh.name << "', ref = '" << gh.ref
+                        << "', upgrade = 'never', dependencies = FALSE)";
+                },
+                [&](RPackage::CRAN const&) {
+                    out << "remotes::install_version('" << pkg.name << "', '"
+                        << pkg.version
+                        << "', upgrade = 'never', dependencies = FALSE)";
+                },
+            },
+            pkg.repository);
+        return out.str();
+    }
+
+    void write_scheduled_script();
+    void write_verification(RPackage const& pkg);
+
     void expand_plan() {
         expanded_plan_.clear();
         expanded_plan_.reserve(plan_.size());
@@ -91,7 +254,7 @@ class InstallRPackageScriptBuilder {
         "cat('############################################################\\n')"
         "\n";
 
-    void write_header() {
+    void write_header(bool remotes = true) {
         *out_ << "#!/usr/bin/env Rscript\n\n";
 
         // ASCII box greeting
@@ -101,11 +264,15 @@ class InstallRPackageScriptBuilder {
         *out_ << "\n";
 
         // install the parallels package
-        *out_ << "options(Ncpus=min(parallel::detectCores(), 32))\n\n"
-              << "dir.create('" << tmp_lib_dir_ << "', recursive=TRUE)\n"
-              << "install.packages('remotes', lib = '" << tmp_lib_dir_ << "')\n"
-              << "on.exit(unlink('" << tmp_lib_dir_ << "', recursive = TRUE))\n"
-              << "\n\n";
+        *out_ << "options(Ncpus=min(parallel::detectCores(), 32))\n\n";
+        if (remotes) {
+            *out_ << "dir.create('" << tmp_lib_dir_ << "', recursive=TRUE)\n"
+                  << "install.packages('remotes', lib = '" << tmp_lib_dir_
+                  << "')\n"
+                  << "on.exit(unlink('" << tmp_lib_dir_
+                  << "', recursive = TRUE))\n";
+        }
+        *out_ << "\n\n";
     }
 
     void write_batch(size_t batch_index, size_t total_batches,
@@ -128,31 +295,8 @@ class InstallRPackageScriptBuilder {
         // (background jobs + wait).
         std::ostringstream shell_cmd;
         for (RPackage const* pkg : batch_vec) {
-            std::string log_file =
-                "/tmp/r4r-install-" + pkg->name + "-" + pkg->version + ".log";
-            shell_cmd << "Rscript -e \\\"";
-
-            std::visit(
-                overloaded{
-                    [&](RPackage::GitHub const& gh) {
-                        shell_cmd << "require('remotes', lib.loc = '"
-                                  << tmp_lib_dir_ << "');";
-                        shell_cmd
-                            << "remotes::install_github('" << gh.org << "/"
-                            << gh.name << "', ref = '" << gh.ref
-                            << "', upgrade = 'never', dependencies = FALSE)\n";
-                    },
-                    [&](RPackage::CRAN const&) {
-                        shell_cmd << "require('remotes', lib.loc = '"
-                                  << tmp_lib_dir_ << "');";
-                        shell_cmd
-                            << "remotes::install_version('" << pkg->name
-                            << "', '" << pkg->version
-                            << "', upgrade = 'never', dependencies = FALSE)\n";
-                    },
-                },
-                pkg->repository);
-
+            std::string log_file = this->log_file(*pkg);
+            shell_cmd << "Rscript -e \\\"" << install_expression(*pkg) << "\n";
             shell_cmd << "\\\"";
             shell_cmd << " > " + log_file + " 2>&1 & ";
         }
@@ -170,8 +314,7 @@ class InstallRPackageScriptBuilder {
 
         // Print logs for each package
         for (RPackage const* pkg : batch_vec) {
-            std::string log_file =
-                "/tmp/r4r-install-" + pkg->name + "-" + pkg->version + ".log";
+            std::string log_file = this->log_file(*pkg);
             *out_ << "  " << kRHeader;
             *out_ << "  cat('# Logs for package " << pkg->name << " version "
                   << pkg->version << " (" << log_file << ")" << "\\n');\n";
@@ -186,32 +329,7 @@ class InstallRPackageScriptBuilder {
 
         // Verify each package installed is the correct version.
         for (RPackage const* pkg : batch_vec) {
-            std::string log_file =
-                "/tmp/r4r-install-" + pkg->name + "-" + pkg->version + ".log";
-
-            *out_ << "{\n"
-                  << "  pkg_name <- '" << pkg->name << "'\n"
-                  << "  pkg_ver  <- '" << pkg->version
-                  << "'\n"
-                  // clang-format off
-                  << "  installed_ver <- tryCatch(as.character(packageVersion(pkg_name)), error = function(e) NA)\n"
-                  // clang-format on
-                  << "  if (is.na(installed_ver)) {\n";
-            *out_ << "    " << kRHeader;
-            *out_ << "    cat('# Error: Failed to install ', pkg_name, ' ', "
-                     "pkg_ver, '\\n');\n";
-            *out_ << "    " << kRHeader;
-            *out_ << "    cat(readLines('" << log_file << "'), sep='\\n')\n"
-                  << "    cat('\\n')\n"
-                  << "    quit(status = 1)\n"
-                  << "} else if (installed_ver != pkg_ver) {\n";
-            *out_ << "    " << kRHeader;
-            *out_ << "    cat('# Warning: Different version of ', pkg_name, ' "
-                     "installed. Expected: ', pkg_ver, ', installed: ', "
-                     "installed_ver, '\\n');\n";
-            *out_ << "    " << kRHeader;
-            *out_ << "  }\n"
-                  << "}\n\n";
+            write_verification(*pkg);
         }
     }
 
@@ -220,7 +338,10 @@ class InstallRPackageScriptBuilder {
         for (auto const& batch : expanded_plan_) {
             n += batch.size();
         }
+        write_footer(n);
+    }
 
+    void write_footer(size_t n) {
         *out_ << kRHeader;
         *out_ << "cat('# All " << n
               << " packages installed successfully.\\n');\n";
@@ -233,7 +354,309 @@ class InstallRPackageScriptBuilder {
     std::string out_path_;
     std::ostream* out_{};
     std::size_t max_parallel_{1};
+    InstallSchedule schedule_{InstallSchedule::Levels};
+    RInstallTimes install_times_;
+    std::string binary_repository_;
+    std::unordered_set<RPackage const*> binary_packages_;
+    std::unordered_map<RPackage const*, RSourceTarball> source_tarballs_;
+    std::string tarball_dir_{"/tmp/r4r-tarballs"};
     std::string tmp_lib_dir_{"/tmp/r4r-lib"};
 };
 
+inline std::vector<std::pair<RPackage const*, std::vector<std::size_t>>>
+InstallRPackageScriptBuilder::critical_path_order() const {
+    // the plan is in a topological order
+    std::vector<RPackage const*> pkgs;
+    for (auto const& batch : plan_) {
+        std::ranges::copy_if(batch, std::back_inserter(pkgs),
+                             [](auto const* pkg) { return !pkg->is_base; });
+    }
+
+    std::unordered_map<std::string, std::size_t> index;
+    for (std::size_t i = 0; i < pkgs.size(); ++i) {
+        index.emplace(pkgs[i]->name, i);
+    }
+
+    std::vector<std::vector<std::size_t>> dependencies(pkgs.size());
+    for (std::size_t i = 0; i < pkgs.size(); ++i) {
+        for (auto const& name : pkgs[i]->dependencies) {
+            if (auto it = index.find(name); it != index.end()) {
+                dependencies[i].push_back(it->second);
+            }
+        }
+    }
+
+    // the dependents come before their dependencies in the reverse order
+    std::vector<double> critical_path(pkgs.size());
+    std::vector<double> longest_dependent(pkgs.size());
+    for (std::size_t i = pkgs.size(); i-- > 0;) {
+        critical_path[i] = install_time(*pkgs[i]) + longest_dependent[i];
+        for (auto d : dependencies[i]) {
+            longest_dependent[d] =
+                std::max(longest_dependent[d], critical_path[i]);
+        }
+    }
+
+    std::vector<std::size_t> order(pkgs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::ranges::stable_sort(order, [&](auto a, auto b) {
+        return critical_path[a] > critical_path[b];
+    });
+
+    std::vector<std::size_t> position(pkgs.size());
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        position[order[i]] = i;
+    }
+
+    std::vector<std::pair<RPackage const*, std::vector<std::size_t>>> result;
+    result.reserve(pkgs.size());
+    for (auto i : order) {
+        std::vector<std::size_t> deps;
+        for (auto d : dependencies[i]) {
+            deps.push_back(position[d]);
+        }
+        std::ranges::sort(deps);
+        result.emplace_back(pkgs[i], std::move(deps));
+    }
+    return result;
+}
+
+inline void InstallRPackageScriptBuilder::write_verification(
+    RPackage const& pkg) {
+    std::string log_file = this->log_file(pkg);
+
+    *out_ << "{\n"
+          << "  pkg_name <- '" << pkg.name << "'\n"
+          << "  pkg_ver  <- '" << pkg.version
+          << "'\n"
+          // clang-format off
+          << "  installed_ver <- tryCatch(as.character(packageVersion(pkg_name)), error = function(e) NA)\n"
+          // clang-format on
+          << "  if (is.na(installed_ver)) {\n";
+    *out_ << "    " << kRHeader;
+    *out_ << "    cat('# Error: Failed to install ', pkg_name, ' ', "
+             "pkg_ver, '\\n');\n";
+    *out_ << "    " << kRHeader;
+    *out_ << "    cat(readLines('" << log_file << "'), sep='\\n')\n"
+          << "    cat('\\n')\n"
+          << "    quit(status = 1)\n"
+          << "} else if (installed_ver != pkg_ver) {\n";
+    *out_ << "    " << kRHeader;
+    *out_ << "    cat('# Warning: Different version of ', pkg_name, ' "
+             "installed. Expected: ', pkg_ver, ', installed: ', "
+             "installed_ver, '\\n');\n";
+    *out_ << "    " << kRHeader;
+    *out_ << "  }\n"
+          << "}\n\n";
+}
+
+// Downloads the source tarballs of the packages (pkg_url) concurrently,
+// trying the next URL of the ones that failed. The ones already there (e.g.
+// in a build cache) are kept.
+constexpr char const* kRDownloadTarballs = R"(
+is_tarball <- function(file) {
+  file.exists(file) &&
+    identical(readBin(file, 'raw', 2L), as.raw(c(0x1f, 0x8b)))
+}
+
+local({
+  dir.create(unique(dirname(pkg_tarball)), recursive = TRUE,
+             showWarnings = FALSE)
+  todo <- which(lengths(pkg_url) > 0 &
+                 !vapply(pkg_tarball, is_tarball, logical(1)))
+  attempt <- 1
+  while (length(todo) > 0) {
+    todo <- todo[lengths(pkg_url[todo]) >= attempt]
+    if (length(todo) == 0) {
+      break
+    }
+    urls <- vapply(pkg_url[todo], function(u) u[[attempt]], character(1))
+    suppressWarnings(tryCatch(
+      download.file(urls, pkg_tarball[todo], method = 'libcurl',
+                    quiet = TRUE, mode = 'wb'),
+      error = function(e) NULL))
+    todo <- todo[!vapply(pkg_tarball[todo], is_tarball, logical(1))]
+    attempt <- attempt + 1
+  }
+})
+)";
+
+// Runs the packages (pkg_*) as mcparallel jobs, starting the first ready one
+// in their order whenever a job slot is free. A package is installed from
+// its tarball or by its R expression. Once a package fails, no new ones are
+// started. Records the install times for the next builds.
+constexpr char const* kRInstallScheduler = R"(
+install_package <- function(i) {
+  if (is.na(pkg_expr[i])) {
+    system2(file.path(R.home('bin'), 'R'),
+            c('CMD', 'INSTALL', shQuote(pkg_tarball[i])),
+            stdout = pkg_log[i], stderr = pkg_log[i])
+  } else {
+    system2('Rscript', c('-e', shQuote(pkg_expr[i])),
+            stdout = pkg_log[i], stderr = pkg_log[i])
+  }
+}
+
+state <- rep('pending', length(pkg_name))
+started <- rep(Sys.time(), length(pkg_name))
+elapsed <- rep(NA_real_, length(pkg_name))
+jobs <- list()
+failed <- integer(0)
+
+repeat {
+  if (length(failed) == 0) {
+    installed <- vapply(pkg_deps, function(d) all(state[d] == 'done'),
+                        logical(1))
+    ready <- which(state == 'pending' & installed)
+    for (i in head(ready, max_jobs - length(jobs))) {
+      cat('# Installing', pkg_name[i], pkg_version[i], '\n')
+      state[i] <- 'running'
+      started[i] <- Sys.time()
+      jobs[[as.character(i)]] <- parallel::mcparallel(install_package(i),
+                                                      name = as.character(i))
+    }
+  }
+  if (length(jobs) == 0) {
+    break
+  }
+
+  done <- parallel::mccollect(jobs, wait = FALSE, timeout = 1)
+  for (key in names(done)) {
+    i <- as.integer(key)
+    jobs[[key]] <- NULL
+    elapsed[i] <- as.numeric(difftime(Sys.time(), started[i], units = 'secs'))
+    if (isTRUE(done[[key]] == 0)) {
+      state[i] <- 'done'
+    } else {
+      state[i] <- 'failed'
+      failed <- c(failed, i)
+    }
+  }
+}
+
+writeLines(sprintf('%s\t%.1f', pkg_name, elapsed)[!is.na(elapsed)],
+           '/tmp/r4r-install-times.tsv')
+
+for (i in failed) {
+  cat('# Failed to install', pkg_name[i], pkg_version[i],
+      '(', pkg_log[i], ')\n')
+  cat(readLines(pkg_log[i]), sep = '\n')
+  cat('\n')
+}
+if (length(failed) > 0) {
+  quit(status = 1)
+}
+
+)";
+
+inline void InstallRPackageScriptBuilder::write_scheduled_script() {
+    auto pkgs = critical_path_order();
+
+    // remotes is only needed by the packages without tarballs (or binaries)
+    write_header(std::ranges::any_of(pkgs, [&](auto const& p) {
+        return !source_tarballs_.contains(p.first) &&
+               !binary_packages_.contains(p.first);
+    }));
+
+    auto write_vector = [&](std::string const& name, auto&& value) {
+        *out_ << name << " <- c(\n";
+        for (std::size_t i = 0; i < pkgs.size(); ++i) {
+            *out_ << "  " << value(pkgs[i]) << (i + 1 < pkgs.size() ? "," : "")
+                  << "\n";
+        }
+        *out_ << ")\n";
+    };
+
+    *out_ << "# the packages ordered by their critical path\n";
+    write_vector("pkg_name",
+                 [](auto const& p) { return "'" + p.first->name + "'"; });
+    write_vector("pkg_version",
+                 [](auto const& p) { return "'" + p.first->version + "'"; });
+    write_vector("pkg_log", [](auto const& p) {
+        return "'" + log_file(*p.first) + "'";
+    });
+    // NA for the ones installed from their tarballs
+    write_vector("pkg_expr", [&](auto const& p) -> std::string {
+        if (source_tarballs_.contains(p.first)) {
+            return "NA";
+        }
+        return "\"" + install_expression(*p.first) + "\"";
+    });
+    write_vector("pkg_tarball", [&](auto const& p) {
+        return "'" + tarball_dir_ + "/" + tarball_name(*p.first) + "'";
+    });
+    *out_ << "pkg_url <- list(\n";
+    for (std::size_t i = 0; i < pkgs.size(); ++i) {
+        *out_ << "  ";
+        if (auto it = source_tarballs_.find(pkgs[i].first);
+            it != source_tarballs_.end() && !it->second.urls.empty()) {
+            auto const& urls = it->second.urls;
+            *out_ << "c(";
+            for (std::size_t j = 0; j < urls.size(); ++j) {
+                *out_ << (j > 0 ? ", " : "") << "'" << urls[j] << "'";
+            }
+            *out_ << ")";
+        } else {
+            *out_ << "character(0)";
+        }
+        *out_ << (i + 1 < pkgs.size() ? "," : "") << "\n";
+    }
+    *out_ << ")\n";
+    // 1-based indices into pkg_name
+    *out_ << "pkg_deps <- list(\n";
+    for (std::size_t i = 0; i < pkgs.size(); ++i) {
+        auto const& deps = pkgs[i].second;
+        *out_ << "  ";
+        if (deps.empty()) {
+            *out_ << "integer(0)";
+        } else {
+            *out_ << "c(";
+            for (std::size_t j = 0; j < deps.size(); ++j) {
+                *out_ << (j > 0 ? ", " : "") << deps[j] + 1 << "L";
+            }
+            *out_ << ")";
+        }
+        *out_ << (i + 1 < pkgs.size() ? "," : "") << "\n";
+    }
+    *out_ << ")\n\n";
+
+    if (max_parallel_ > 0) {
+        *out_ << "max_jobs <- " << max_parallel_ << "\n";
+    } else {
+        // a compilation can take about a GiB of memory
+        *out_ << "max_jobs <- local({\n"
+              << "  jobs <- parallel::detectCores()\n"
+              << "  meminfo <- tryCatch(readLines('/proc/meminfo'), "
+                 "error = function(e) character(0))\n"
+              << "  available <- grep('^MemAvailable:', meminfo, "
+                 "value = TRUE)\n"
+              << "  if (length(available) == 1) {\n"
+              << "    gib <- as.numeric(gsub('[^0-9]', '', available)) / "
+                 "1024^2\n"
+              << "    jobs <- min(jobs, floor(gib))\n"
+              << "  }\n"
+              << "  max(1, jobs)\n"
+              << "})\n";
+    }
+
+    *out_ << kRHeader;
+    *out_ << "cat('# Installing', length(pkg_name), 'packages with up to', "
+             "max_jobs, 'jobs...\\n')\n";
+    *out_ << kRHeader;
+    *out_ << "\n";
+
+    if (std::ranges::any_of(source_tarballs_, [](auto const& t) {
+            return !t.second.urls.empty();
+        })) {
+        *out_ << kRDownloadTarballs;
+    }
+    *out_ << kRInstallScheduler;
+
+    for (auto const& [pkg, _] : pkgs) {
+        write_verification(*pkg);
+    }
+
+    write_footer(pkgs.size());
+}
+
 #endif // INSTALL_R_PACKAGE_BUILDER_H
@@ -4,6 +4,7 @@
 #include "common.h"
 #include "util.h"
 #include <cctype>
+#include <cmath>
 #include <charconv>
 #include <iomanip>
 #include <map>
@@ -121,6 +122,8 @@ class JsonParser {
 std::ostream& operator<<(std::ostream& os, JsonValue const& jv);
 
 struct JsonValuePrinter {
+    // 2^53, the largest integer stored exactly in a double
+    static constexpr double kMaxExactInteger{9007199254740992.0};
 
     // NOLINTNEXTLINE(cppcoreguidelines-avoid-const-or-ref-data-members)
     std::ostream& os;
@@ -131,7 +134,15 @@ struct JsonValuePrinter {
 
     void operator()(int i) const { os << i; }
 
-    void operator()(double d) const { os << d; }
+    void operator()(double d) const {
+        // integral values (e.g., timestamps) would otherwise be printed in the
+        // scientific notation with the default precision
+        if (std::trunc(d) == d && std::abs(d) < kMaxExactInteger) {
+            os << static_cast<long long>(d);
+        } else {
+            os << d;
+        }
+    }
 
     void operator()(std::string const& s) const {
         os << '"';
@@ -197,6 +208,7 @@ struct JsonValuePrinter {
 
 inline JsonValue JsonParser::parse() {
     JsonValue value = parse_value();
+    skip_whitespace();
     if (!eof()) {
         throw JsonParseError(STR("Unexpected reminder after JSON value parsed: "
                                  << input_.substr(pos_)),
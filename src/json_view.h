@@ -0,0 +1,963 @@
+#ifndef JSON_VIEW_H
+#define JSON_VIEW_H
+
+#include "common.h"
+#include "json.h"
+#include "util.h"
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+// A JSON parser for large inputs, next to the JsonParser/JsonValue tree:
+//
+//   - JsonSaxParser reports the values as events, nothing is allocated,
+//   - JsonDocument is a read-only tree built from the events, allocated in an
+//     arena with the objects stored as flat arrays of members,
+//   - JsonPathQuery extracts the values at some paths in a single pass,
+//     skipping everything else.
+//
+// All of them work on a string_view. The strings and numbers are views into
+// the input, so it has to outlive them; strings are only unescaped when
+// they are read and contain an escape.
+
+// Appends the unescaped content of a JSON string (without the quotes).
+inline void json_unescape(std::string_view raw, std::string& out) {
+    auto hex4 = [&](std::size_t pos) {
+        std::uint32_t value{};
+        if (pos + 4 > raw.size() ||
+            std::from_chars(raw.data() + pos, raw.data() + pos + 4, value, 16)
+                    .ptr != raw.data() + pos + 4) {
+            throw JsonParseError("Invalid unicode escape", pos);
+        }
+        return value;
+    };
+
+    auto utf8 = [&](std::uint32_t cp) {
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xc0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        } else if (cp < 0x10000) {
+            out += static_cast<char>(0xe0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        } else {
+            out += static_cast<char>(0xf0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+    };
+
+    for (std::size_t i = 0; i < raw.size(); ++i) {
+        if (raw[i] != '\\') {
+            out += raw[i];
+            continue;
+        }
+
+        if (++i == raw.size()) {
+            throw JsonParseError("Invalid escape character", i);
+        }
+        switch (raw[i]) {
+        case '"':
+        case '\\':
+        case '/':
+            out += raw[i];
+            break;
+        case 'b':
+            out += '\b';
+            break;
+        case 'f':
+            out += '\f';
+            break;
+        case 'n':
+            out += '\n';
+            break;
+        case 'r':
+            out += '\r';
+            break;
+        case 't':
+            out += '\t';
+            break;
+        case 'u': {
+            auto cp = hex4(i + 1);
+            i += 4;
+            // a surrogate pair
+            if (cp >= 0xd800 && cp < 0xdc00 && raw.substr(i + 1, 2) == "\\u") {
+                auto low = hex4(i + 3);
+                if (low >= 0xdc00 && low < 0xe000) {
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                    i += 6;
+                }
+            }
+            utf8(cp);
+            break;
+        }
+        default:
+            throw JsonParseError("Invalid escape character", i);
+        }
+    }
+}
+
+// The events of a JsonSaxParser. The strings are raw, escaped tells whether
+// they need json_unescape. Returning false from start_object or start_array
+// skips the container (its content is then only checked for balanced
+// brackets and terminated strings).
+template <typename T>
+concept JsonSaxHandler =
+    requires(T& h, std::string_view raw, bool escaped, bool boolean) {
+        { h.start_object() } -> std::same_as<bool>;
+        h.key(raw, escaped);
+        h.end_object();
+        { h.start_array() } -> std::same_as<bool>;
+        h.end_array();
+        h.string(raw, escaped);
+        h.number(raw);
+        h.boolean(boolean);
+        h.null();
+    };
+
+template <JsonSaxHandler Handler>
+class JsonSaxParser {
+  public:
+    static void parse(std::string_view input, Handler& handler) {
+        JsonSaxParser parser{input, handler};
+        parser.parse_value(0);
+        parser.skip_whitespace();
+        if (parser.pos_ != input.size()) {
+            throw JsonParseError("Unexpected reminder after JSON value parsed",
+                                 parser.pos_);
+        }
+    }
+
+  private:
+    // deeper nesting would risk the stack
+    static constexpr std::size_t kMaxDepth = 512;
+
+    JsonSaxParser(std::string_view input, Handler& handler)
+        : input_{input}, handler_{handler} {}
+
+    [[nodiscard]] char current() const {
+        return pos_ < input_.size() ? input_[pos_] : '\0';
+    }
+
+    void skip_whitespace() {
+        while (pos_ < input_.size()) {
+            char c = input_[pos_];
+            if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+                break;
+            }
+            ++pos_;
+        }
+    }
+
+    void expect(char c, char const* message) {
+        skip_whitespace();
+        if (current() != c) {
+            throw JsonParseError(message, pos_);
+        }
+        ++pos_;
+    }
+
+    void parse_value(std::size_t depth);
+    void parse_object(std::size_t depth);
+    void parse_array(std::size_t depth);
+    std::string_view parse_string(bool& escaped);
+    void parse_number();
+    void parse_literal(std::string_view literal);
+    void skip_container();
+
+    std::string_view input_;
+    Handler& handler_;
+    std::size_t pos_{};
+};
+
+template <JsonSaxHandler Handler>
+inline void JsonSaxParser<Handler>::parse_value(std::size_t depth) {
+    skip_whitespace();
+
+    switch (char const c = current()) {
+    case '{':
+        parse_object(depth + 1);
+        break;
+    case '[':
+        parse_array(depth + 1);
+        break;
+    case '"': {
+        bool escaped{};
+        auto raw = parse_string(escaped);
+        handler_.string(raw, escaped);
+        break;
+    }
+    case 't':
+        parse_literal("true");
+        handler_.boolean(true);
+        break;
+    case 'f':
+        parse_literal("false");
+        handler_.boolean(false);
+        break;
+    case 'n':
+        parse_literal("null");
+        handler_.null();
+        break;
+    default:
+        if (c == '-' || (c >= '0' && c <= '9')) {
+            parse_number();
+            break;
+        }
+        throw JsonParseError(STR("Unexpected character '" << c << "'"), pos_);
+    }
+}
+
+template <JsonSaxHandler Handler>
+inline void JsonSaxParser<Handler>::parse_object(std::size_t depth) {
+    if (depth > kMaxDepth) {
+        throw JsonParseError("Too deeply nested", pos_);
+    }
+    if (!handler_.start_object()) {
+        skip_container();
+        return;
+    }
+    ++pos_; // skip '{'
+
+    skip_whitespace();
+    if (current() == '}') {
+        ++pos_;
+        handler_.end_object();
+        return;
+    }
+
+    while (true) {
+        skip_whitespace();
+        if (current() != '"') {
+            throw JsonParseError("Expected a key", pos_);
+        }
+        bool escaped{};
+        auto key = parse_string(escaped);
+        handler_.key(key, escaped);
+
+        expect(':', "Expected ':'");
+        parse_value(depth);
+
+        skip_whitespace();
+        if (current() == ',') {
+            ++pos_;
+        } else if (current() == '}') {
+            ++pos_;
+            break;
+        } else {
+            throw JsonParseError("Expected ',' or '}'", pos_);
+        }
+    }
+
+    handler_.end_object();
+}
+
+template <JsonSaxHandler Handler>
+inline void JsonSaxParser<Handler>::parse_array(std::size_t depth) {
+    if (depth > kMaxDepth) {
+        throw JsonParseError("Too deeply nested", pos_);
+    }
+    if (!handler_.start_array()) {
+        skip_container();
+        return;
+    }
+    ++pos_; // skip '['
+
+    skip_whitespace();
+    if (current() == ']') {
+        ++pos_;
+        handler_.end_array();
+        return;
+    }
+
+    while (true) {
+        parse_value(depth);
+
+        skip_whitespace();
+        if (current() == ',') {
+            ++pos_;
+        } else if (current() == ']') {
+            ++pos_;
+            break;
+        } else {
+            throw JsonParseError("Expected ',' or ']'", pos_);
+        }
+    }
+
+    handler_.end_array();
+}
+
+// Returns the content between the quotes, the escapes are only skipped.
+template <JsonSaxHandler Handler>
+inline std::string_view
+JsonSaxParser<Handler>::parse_string(bool& escaped) {
+    auto start = ++pos_; // skip '"'
+    escaped = false;
+
+    while (pos_ < input_.size()) {
+        auto c = static_cast<unsigned char>(input_[pos_]);
+        if (c == '"') {
+            return input_.substr(start, pos_++ - start);
+        }
+        if (c == '\\') {
+            escaped = true;
+            pos_ += 2;
+        } else if (c < 0x20) {
+            throw JsonParseError("Control character in string", pos_);
+        } else {
+            ++pos_;
+        }
+    }
+
+    throw JsonParseError("Unterminated string", start);
+}
+
+// Like JsonParser, leading zeros are tolerated.
+template <JsonSaxHandler Handler>
+inline void JsonSaxParser<Handler>::parse_number() {
+    auto start = pos_;
+    auto digits = [&] {
+        auto from = pos_;
+        while (current() >= '0' && current() <= '9') {
+            ++pos_;
+        }
+        if (pos_ == from) {
+            throw JsonParseError("Invalid number format", start);
+        }
+    };
+
+    if (current() == '-') {
+        ++pos_;
+    }
+    digits();
+    if (current() == '.') {
+        ++pos_;
+        digits();
+    }
+    if (current() == 'e' || current() == 'E') {
+        ++pos_;
+        if (current() == '+' || current() == '-') {
+            ++pos_;
+        }
+        digits();
+    }
+
+    handler_.number(input_.substr(start, pos_ - start));
+}
+
+template <JsonSaxHandler Handler>
+inline void JsonSaxParser<Handler>::parse_literal(std::string_view literal) {
+    if (input_.substr(pos_, literal.size()) != literal) {
+        throw JsonParseError(STR("Expected " << literal), pos_);
+    }
+    pos_ += literal.size();
+}
+
+template <JsonSaxHandler Handler>
+inline void JsonSaxParser<Handler>::skip_container() {
+    auto start = pos_;
+    std::size_t depth = 0;
+    while (pos_ < input_.size()) {
+        switch (input_[pos_]) {
+        case '"': {
+            bool escaped{};
+            parse_string(escaped);
+            continue;
+        }
+        case '{':
+        case '[':
+            ++depth;
+            break;
+        case '}':
+        case ']':
+            if (--depth == 0) {
+                ++pos_;
+                return;
+            }
+            break;
+        default:
+            break;
+        }
+        ++pos_;
+    }
+    throw JsonParseError("Unterminated container", start);
+}
+
+// Hands out memory from blocks that are all freed at once, each one twice
+// the size of the previous one (up to a limit). Only meant for trivially
+// destructible types.
+class JsonArena {
+  public:
+    explicit JsonArena(std::size_t block_size = 1024)
+        : block_size_{block_size} {}
+
+    template <typename T>
+    T* copy(std::span<T const> items) {
+        static_assert(std::is_trivially_destructible_v<T>);
+        if (items.empty()) {
+            return nullptr;
+        }
+        auto* p = static_cast<T*>(allocate(items.size_bytes(), alignof(T)));
+        std::uninitialized_copy(items.begin(), items.end(), p);
+        return p;
+    }
+
+    std::string_view copy(std::string_view s) {
+        auto* p = static_cast<char*>(allocate(s.size(), 1));
+        std::memcpy(p, s.data(), s.size());
+        return {p, s.size()};
+    }
+
+  private:
+    void* allocate(std::size_t size, std::size_t align) {
+        void* p = next_;
+        if (std::align(align, size, p, left_) == nullptr) {
+            auto block = std::max(block_size_, size + align);
+            block_size_ = std::min(block_size_ * 2, kMaxBlockSize);
+            blocks_.push_back(
+                std::make_unique_for_overwrite<std::byte[]>(block));
+            p = blocks_.back().get();
+            left_ = block;
+            std::align(align, size, p, left_);
+        }
+        next_ = static_cast<std::byte*>(p) + size;
+        left_ -= size;
+        return p;
+    }
+
+    static constexpr std::size_t kMaxBlockSize = 1024 * 1024;
+
+    std::size_t block_size_;
+    std::vector<std::unique_ptr<std::byte[]>> blocks_;
+    void* next_{nullptr};
+    std::size_t left_{0};
+};
+
+enum class JsonType : std::uint8_t {
+    Null,
+    Boolean,
+    Number,
+    String,
+    Array,
+    Object
+};
+
+namespace json_view {
+
+struct Member;
+
+struct Node {
+    JsonType type{JsonType::Null};
+    // a string that still needs json_unescape
+    bool escaped{false};
+    // the length of strings and numbers, the number of items or members
+    std::uint32_t size{0};
+    union {
+        bool boolean;
+        char const* text{nullptr};
+        Node* items;
+        Member* members;
+    };
+};
+
+struct Member {
+    std::string_view key;
+    bool key_escaped;
+    Node value;
+};
+
+template <typename T>
+T parse_number(std::string_view raw) {
+    T value{};
+    auto const* last = raw.data() + raw.size();
+    auto [end, ec] = std::from_chars(raw.data(), last, value);
+    if (ec != std::errc{} || end != last) {
+        throw std::invalid_argument(STR("Invalid number: " << raw));
+    }
+    return value;
+}
+
+} // namespace json_view
+
+// A value of a JsonDocument, a cheap handle valid as long as the document.
+// The accessors throw std::invalid_argument for a different type, like
+// json_query.
+class JsonElement {
+  public:
+    JsonElement(json_view::Node* node, JsonArena* arena)
+        : node_{node}, arena_{arena} {}
+
+    [[nodiscard]] JsonType type() const { return node_->type; }
+    [[nodiscard]] bool is_null() const { return type() == JsonType::Null; }
+
+    [[nodiscard]] bool as_bool() const {
+        check(JsonType::Boolean);
+        return node_->boolean;
+    }
+
+    template <typename T>
+    [[nodiscard]] T as_number() const {
+        check(JsonType::Number);
+        return json_view::parse_number<T>({node_->text, node_->size});
+    }
+
+    // Unescaped on the first call, if needed.
+    [[nodiscard]] std::string_view as_string() const;
+
+    // the number of items of an array or members of an object
+    [[nodiscard]] std::size_t size() const {
+        if (type() != JsonType::Array && type() != JsonType::Object) {
+            throw std::invalid_argument("Invalid type");
+        }
+        return node_->size;
+    }
+
+    // an array item, throws std::out_of_range
+    [[nodiscard]] JsonElement operator[](std::size_t index) const {
+        check(JsonType::Array);
+        if (index >= node_->size) {
+            throw std::out_of_range("Array index out of range");
+        }
+        return {node_->items + index, arena_};
+    }
+
+    // the value of the member, searched linearly
+    [[nodiscard]] std::optional<JsonElement> find(std::string_view key) const;
+
+    [[nodiscard]] JsonElement at(std::string_view key) const {
+        if (auto value = find(key)) {
+            return *value;
+        }
+        throw std::invalid_argument(STR("Missing key: " << key));
+    }
+
+    template <typename Func>
+    void for_each_item(Func&& func) const {
+        check(JsonType::Array);
+        for (std::uint32_t i = 0; i < node_->size; ++i) {
+            func(JsonElement{node_->items + i, arena_});
+        }
+    }
+
+    template <typename Func>
+    void for_each_member(Func&& func) const {
+        check(JsonType::Object);
+        std::string key;
+        for (std::uint32_t i = 0; i < node_->size; ++i) {
+            auto& m = node_->members[i];
+            if (m.key_escaped) {
+                key.clear();
+                json_unescape(m.key, key);
+                func(std::string_view{key}, JsonElement{&m.value, arena_});
+            } else {
+                func(m.key, JsonElement{&m.value, arena_});
+            }
+        }
+    }
+
+  private:
+    void check(JsonType type) const {
+        if (node_->type != type) {
+            throw std::invalid_argument("Invalid type");
+        }
+    }
+
+    json_view::Node* node_;
+    JsonArena* arena_;
+};
+
+inline std::string_view JsonElement::as_string() const {
+    check(JsonType::String);
+    if (node_->escaped) {
+        std::string unescaped;
+        json_unescape({node_->text, node_->size}, unescaped);
+        auto copy = arena_->copy(unescaped);
+        node_->text = copy.data();
+        node_->size = static_cast<std::uint32_t>(copy.size());
+        node_->escaped = false;
+    }
+    return {node_->text, node_->size};
+}
+
+inline std::optional<JsonElement>
+JsonElement::find(std::string_view key) const {
+    check(JsonType::Object);
+    std::string unescaped;
+    for (std::uint32_t i = 0; i < node_->size; ++i) {
+        auto& m = node_->members[i];
+        if (m.key_escaped) {
+            unescaped.clear();
+            json_unescape(m.key, unescaped);
+            if (unescaped == key) {
+                return JsonElement{&m.value, arena_};
+            }
+        } else if (m.key == key) {
+            return JsonElement{&m.value, arena_};
+        }
+    }
+    return std::nullopt;
+}
+
+class JsonDocument {
+  public:
+    // The input must outlive the document.
+    static JsonDocument parse(std::string_view input);
+
+    [[nodiscard]] JsonElement root() { return {root_, arena_.get()}; }
+
+  private:
+    class Builder;
+
+    JsonDocument() = default;
+
+    std::unique_ptr<JsonArena> arena_{std::make_unique<JsonArena>()};
+    json_view::Node* root_{};
+};
+
+// Collects the items and members of the open containers on two stacks and
+// moves them to the arena once a container closes.
+class JsonDocument::Builder {
+  public:
+    explicit Builder(JsonArena& arena) : arena_{arena} {
+        frames_.push_back({.object = false, .start = 0});
+    }
+
+    bool start_object() {
+        frames_.push_back({.object = true, .start = members_.size()});
+        return true;
+    }
+
+    void key(std::string_view raw, bool escaped) {
+        frames_.back().key = raw;
+        frames_.back().key_escaped = escaped;
+    }
+
+    void end_object() {
+        auto frame = frames_.back();
+        frames_.pop_back();
+
+        std::span<json_view::Member const> members{
+            members_.begin() + static_cast<std::ptrdiff_t>(frame.start),
+            members_.end()};
+        json_view::Node node;
+        node.type = JsonType::Object;
+        node.size = static_cast<std::uint32_t>(members.size());
+        node.members = arena_.copy(members);
+        members_.resize(frame.start);
+        add(node);
+    }
+
+    bool start_array() {
+        frames_.push_back({.object = false, .start = items_.size()});
+        return true;
+    }
+
+    void end_array() {
+        auto frame = frames_.back();
+        frames_.pop_back();
+
+        std::span<json_view::Node const> items{
+            items_.begin() + static_cast<std::ptrdiff_t>(frame.start),
+            items_.end()};
+        json_view::Node node;
+        node.type = JsonType::Array;
+        node.size = static_cast<std::uint32_t>(items.size());
+        node.items = arena_.copy(items);
+        items_.resize(frame.start);
+        add(node);
+    }
+
+    void string(std::string_view raw, bool escaped) {
+        json_view::Node node;
+        node.type = JsonType::String;
+        node.escaped = escaped;
+        node.size = static_cast<std::uint32_t>(raw.size());
+        node.text = raw.data();
+        add(node);
+    }
+
+    void number(std::string_view raw) {
+        json_view::Node node;
+        node.type = JsonType::Number;
+        node.size = static_cast<std::uint32_t>(raw.size());
+        node.text = raw.data();
+        add(node);
+    }
+
+    void boolean(bool value) {
+        json_view::Node node;
+        node.type = JsonType::Boolean;
+        node.boolean = value;
+        add(node);
+    }
+
+    void null() { add(json_view::Node{}); }
+
+    // the single item of the outermost frame
+    json_view::Node* finish() {
+        return arena_.copy(std::span<json_view::Node const>{items_});
+    }
+
+  private:
+    struct Frame {
+        bool object;
+        std::size_t start;
+        std::string_view key{};
+        bool key_escaped{};
+    };
+
+    void add(json_view::Node const& node) {
+        auto const& frame = frames_.back();
+        if (frame.object) {
+            members_.push_back({.key = frame.key,
+                                .key_escaped = frame.key_escaped,
+                                .value = node});
+        } else {
+            items_.push_back(node);
+        }
+    }
+
+    JsonArena& arena_;
+    std::vector<Frame> frames_;
+    std::vector<json_view::Node> items_;
+    std::vector<json_view::Member> members_;
+};
+
+inline JsonDocument JsonDocument::parse(std::string_view input) {
+    JsonDocument doc;
+    Builder builder{*doc.arena_};
+    JsonSaxParser<Builder>::parse(input, builder);
+    doc.root_ = builder.finish();
+    return doc;
+}
+
+// A scalar value found by a JsonPathQuery, a view into the input.
+struct JsonScalar {
+    JsonType type;
+    std::string_view raw;
+    bool escaped{false};
+
+    [[nodiscard]] std::string string() const {
+        if (type != JsonType::String) {
+            throw std::invalid_argument("Invalid type");
+        }
+        if (!escaped) {
+            return std::string{raw};
+        }
+        std::string s;
+        json_unescape(raw, s);
+        return s;
+    }
+
+    template <typename T>
+    [[nodiscard]] T number() const {
+        if (type != JsonType::Number) {
+            throw std::invalid_argument("Invalid type");
+        }
+        return json_view::parse_number<T>(raw);
+    }
+
+    [[nodiscard]] bool boolean() const {
+        if (type != JsonType::Boolean) {
+            throw std::invalid_argument("Invalid type");
+        }
+        return raw == "true";
+    }
+};
+
+// Paths in the json_query syntax, plus '*' for any key or index (e.g.
+// "requirements.*.requirements.packages.*"), compiled once and matched in a
+// single pass over the input without building a tree. Only scalars are
+// reported, containers no path leads into are skipped unparsed.
+class JsonPathQuery {
+  public:
+    static constexpr std::size_t kMaxPaths = 64;
+
+    JsonPathQuery(std::initializer_list<std::string_view> paths);
+
+    // Calls callback(path index, JsonScalar) for each match, in the input
+    // order. Returns a bit for each of the paths that matched any value,
+    // including an array or an object the callback does not get.
+    template <typename Callback>
+    std::uint64_t run(std::string_view input, Callback&& callback) const;
+
+  private:
+    struct Step {
+        bool wildcard{false};
+        std::string key;
+        std::optional<std::size_t> index;
+    };
+
+    template <typename Callback>
+    class Matcher;
+
+    [[nodiscard]] bool matches(Step const& step, bool array, std::size_t index,
+                               std::string_view key) const {
+        if (step.wildcard) {
+            return true;
+        }
+        return array ? step.index == index : step.key == key;
+    }
+
+    std::vector<std::vector<Step>> paths_;
+    std::uint64_t all_{0};
+};
+
+inline JsonPathQuery::JsonPathQuery(
+    std::initializer_list<std::string_view> paths) {
+    if (paths.size() > kMaxPaths) {
+        throw std::invalid_argument("Too many JSON paths");
+    }
+
+    for (auto path : paths) {
+        std::vector<Step> steps;
+        for (auto const& part : string_split(std::string{path}, '.')) {
+            if (part.empty()) {
+                throw std::invalid_argument(STR("Invalid path: " << path));
+            }
+            Step step;
+            if (part == "*") {
+                step.wildcard = true;
+            } else {
+                step.key = part;
+                step.index = to_number<std::size_t>(part);
+            }
+            steps.push_back(std::move(step));
+        }
+        if (steps.empty() || path.back() == '.') {
+            throw std::invalid_argument(STR("Invalid path: " << path));
+        }
+        all_ |= std::uint64_t{1} << paths_.size();
+        paths_.push_back(std::move(steps));
+    }
+}
+
+// Keeps for each open container the set (bitmask) of the paths that still
+// match it.
+template <typename Callback>
+class JsonPathQuery::Matcher {
+  public:
+    Matcher(JsonPathQuery const& query, Callback& callback)
+        : query_{query}, callback_{callback} {}
+
+    bool start_object() { return start(false); }
+    bool start_array() { return start(true); }
+    void end_object() { frames_.pop_back(); }
+    void end_array() { frames_.pop_back(); }
+
+    void key(std::string_view raw, bool escaped) {
+        auto& frame = frames_.back();
+        if (escaped) {
+            frame.key.clear();
+            json_unescape(raw, frame.key);
+            frame.key_view = frame.key;
+        } else {
+            frame.key_view = raw;
+        }
+    }
+
+    void string(std::string_view raw, bool escaped) {
+        scalar({.type = JsonType::String, .raw = raw, .escaped = escaped});
+    }
+    void number(std::string_view raw) {
+        scalar({.type = JsonType::Number, .raw = raw});
+    }
+    void boolean(bool value) {
+        scalar({.type = JsonType::Boolean, .raw = value ? "true" : "false"});
+    }
+    void null() { scalar({.type = JsonType::Null, .raw = "null"}); }
+
+    [[nodiscard]] std::uint64_t matched() const { return matched_; }
+
+  private:
+    struct Frame {
+        bool array;
+        std::uint64_t paths;
+        std::size_t index{0};
+        std::string_view key_view{};
+        std::string key{};
+    };
+
+    // the paths matching the next value with their length
+    template <typename Func>
+    void next_value(Func&& func) {
+        if (frames_.empty()) {
+            return;
+        }
+
+        auto& frame = frames_.back();
+        auto depth = frames_.size() - 1;
+        auto index = frame.index++;
+        for (auto paths = frame.paths; paths != 0; paths &= paths - 1) {
+            auto p = static_cast<std::size_t>(std::countr_zero(paths));
+            auto const& steps = query_.paths_[p];
+            if (query_.matches(steps[depth], frame.array, index,
+                               frame.key_view)) {
+                func(p, steps.size() - depth - 1);
+            }
+        }
+    }
+
+    bool start(bool array) {
+        std::uint64_t paths = 0;
+        if (frames_.empty()) {
+            paths = query_.all_;
+        } else {
+            next_value([&](std::size_t p, std::size_t remaining) {
+                if (remaining > 0) {
+                    paths |= std::uint64_t{1} << p;
+                } else {
+                    matched_ |= std::uint64_t{1} << p;
+                }
+            });
+        }
+
+        if (paths == 0) {
+            return false;
+        }
+        frames_.push_back({.array = array, .paths = paths});
+        return true;
+    }
+
+    void scalar(JsonScalar const& value) {
+        next_value([&](std::size_t p, std::size_t remaining) {
+            if (remaining == 0) {
+                matched_ |= std::uint64_t{1} << p;
+                callback_(p, value);
+            }
+        });
+    }
+
+    JsonPathQuery const& query_;
+    Callback& callback_;
+    std::vector<Frame> frames_;
+    std::uint64_t matched_{0};
+};
+
+template <typename Callback>
+inline std::uint64_t JsonPathQuery::run(std::string_view input,
+                                        Callback&& callback) const {
+    Matcher<std::remove_reference_t<Callback>> matcher{*this, callback};
+    JsonSaxParser<Matcher<std::remove_reference_t<Callback>>>::parse(input,
+                                                                     matcher);
+    return matcher.matched();
+}
+
+#endif // JSON_VIEW_H
@@ -173,6 +173,7 @@ inline bool Logger::is_enabled(LogLevel level) const {
 
 inline std::unique_ptr<LogSink>
 Logger::set_sink(std::unique_ptr<LogSink> sink) {
+    std::lock_guard lock(mutex_);
     sink_.swap(sink);
     return sink;
 }
@@ -39,10 +39,93 @@ static void parse_cmd_args(Options& opts, std::span<char const*> args) {
     parser.add_option("skip-manifest")
         .with_help("Do not generate the manifest")
         .with_callback([&](auto&) { opts.skip_manifest = true; });
+    parser.add_option("r-lib-path")
+        .with_help("An R library path (allow multiple, default .libPaths())")
+        .with_argument("PATH")
+        .with_callback([&](auto& arg) { opts.r_lib_paths.emplace_back(arg); });
+    parser.add_option("r-package-database")
+        .with_help("Load the R packages from their DESCRIPTION files "
+                   "(native), from R or from both comparing them (verify)")
+        .with_default("native")
+        .with_argument("native|R|verify")
+        .with_callback([&](auto& arg) {
+            if (arg == "native") {
+                opts.rpkg_database_source = RpkgDatabaseSource::Native;
+            } else if (arg == "R") {
+                opts.rpkg_database_source = RpkgDatabaseSource::R;
+            } else if (arg == "verify") {
+                opts.rpkg_database_source = RpkgDatabaseSource::Verify;
+            } else {
+                throw ArgumentParserException(
+                    "Invalid R package database source: " + arg);
+            }
+        });
+    parser.add_option("skip-deb-verification")
+        .with_help("Do not check the files of deb packages against their "
+                   "md5sums")
+        .with_callback([&](auto&) { opts.verify_deb_files = false; });
+    parser.add_option("skip-sysreqs-query")
+        .with_help("Only use the bundled rules for the system requirements of "
+                   "R packages, do not query the Posit package manager")
+        .with_callback([&](auto&) { opts.query_sysreqs = false; });
+    parser.add_option("r-install-times")
+        .with_help("The seconds each R package took to install (<name> "
+                   "<seconds> lines, as the image records them in "
+                   "/tmp/r4r-install-times.tsv) to prioritize the slow ones, "
+                   "by default the ones of the images built before (kept in "
+                   "the cache directory)")
+        .with_argument("PATH")
+        .with_callback([&](auto& arg) { opts.r_install_times = arg; });
+    parser.add_option("r-binary-snapshot")
+        .with_help("Install the R packages available in the given snapshot "
+                   "(a date like 2024-06-03 or latest) of the binary "
+                   "repository, only compile the rest")
+        .with_argument("SNAPSHOT")
+        .with_callback([&](auto& arg) { opts.r_binary_snapshot = arg; });
+    parser.add_option("r-binary-mirror")
+        .with_help("The Posit package manager compatible CRAN mirror of the "
+                   "binary R packages")
+        .with_argument("URL")
+        .with_callback([&](auto& arg) { opts.r_binary_mirror = arg; });
+    parser.add_option("cran-mirror")
+        .with_help("The CRAN mirror to download the R package sources from")
+        .with_argument("URL")
+        .with_callback([&](auto& arg) { opts.cran_mirror = arg; });
+    parser.add_option("prefetch-r-sources")
+        .with_help("Download the R package sources on the host (cached "
+                   "between builds) instead of in the image")
+        .with_callback([&](auto&) { opts.prefetch_r_sources = true; });
+    parser.add_option("ship-r-binaries")
+        .with_help("Ship the R packages installed on the host instead of "
+                   "compiling them in the image (the base image must run the "
+                   "host's release)")
+        .with_callback([&](auto&) { opts.ship_r_binaries = true; });
+    parser.add_option("ship-deb-archives")
+        .with_help("Ship the .deb archives of the host packages (from the apt "
+                   "cache or repacked) instead of downloading them in the "
+                   "image")
+        .with_callback([&](auto&) { opts.ship_deb_archives = true; });
+    parser.add_option("buildkit")
+        .with_help("Generate the Dockerfile for BuildKit, caching the apt and "
+                   "R downloads and the compiled objects between the builds "
+                   "and mounting the shipped archives instead of copying "
+                   "them into the image")
+        .with_callback([&](auto&) { opts.buildkit = true; });
+    parser.add_option("status-file")
+        .with_help("Periodically write the tracing progress (JSON) to a file")
+        .with_argument("PATH")
+        .with_callback([&](auto& arg) { opts.status_file = arg; });
     parser.add_option("default-image-file")
         .with_help("Path to the default image file")
         .with_argument("PATH")
         .with_callback([&](auto& arg) { opts.default_image_file = arg; });
+    parser.add_option("cache-dir")
+        .with_help("Directory for the caches shared between runs")
+        .with_argument("PATH")
+        .with_callback([&](auto& arg) { opts.cache_dir = arg; });
+    parser.add_option("no-cache")
+        .with_help("Do not keep any caches between runs")
+        .with_callback([&](auto&) { opts.cache_dir.clear(); });
 
     parser.add_option("help")
         .with_help("Print this message")
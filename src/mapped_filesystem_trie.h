@@ -0,0 +1,374 @@
+#ifndef MAPPED_FILESYSTEM_TRIE_H
+#define MAPPED_FILESYSTEM_TRIE_H
+
+#include "common.h"
+#include "filesystem_trie.h"
+#include "logger.h"
+#include "util_fs.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+// A read-only FileSystemTrie used directly from its serialized form (see
+// filesystem_trie::file). Loading is a single mmap, there is no parsing and
+// no allocation, so large tries (the dpkg database) can be cached on disk
+// and reused across runs. The lookups have the same semantics as the ones
+// of FileSystemTrie.
+template <typename T>
+class MappedFileSystemTrie {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Only trivially copyable values can be mapped");
+    static_assert(alignof(T) <= 8, "The sections are only 8 byte aligned");
+
+    static constexpr std::uint32_t kNoId =
+        std::numeric_limits<std::uint32_t>::max();
+
+  public:
+    MappedFileSystemTrie() = default;
+
+    // Maps a file written by FileSystemTrie::save. Returns nothing if the
+    // file does not exist, is not a valid trie of T or its fingerprint does
+    // not match the expected one.
+    static std::optional<MappedFileSystemTrie>
+    load(fs::path const& path,
+         std::optional<std::uint64_t> fingerprint = std::nullopt);
+
+    static MappedFileSystemTrie from_trie(FileSystemTrie<T> const& trie,
+                                          std::string_view metadata = {});
+
+    // Atomically writes the trie to a file that can be later loaded.
+    void save(fs::path const& path, std::uint64_t fingerprint = 0) const;
+
+    [[nodiscard]] T const* find(std::string_view path) const;
+    [[nodiscard]] T const* find_last_matching(std::string_view path) const;
+
+    // See FileSystemTrie::find_sorted.
+    [[nodiscard]] std::vector<T const*>
+    find_sorted(std::span<std::string_view const> paths) const {
+        return lookup_sorted(paths, false);
+    }
+    [[nodiscard]] std::vector<T const*>
+    find_last_matching_sorted(std::span<std::string_view const> paths) const {
+        return lookup_sorted(paths, true);
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return header_ != nullptr ? header_->value_count : 0;
+    }
+
+    [[nodiscard]] std::string_view metadata() const {
+        return header_ != nullptr ? section(header_->metadata)
+                                  : std::string_view{};
+    }
+
+  private:
+    using Header = filesystem_trie::file::Header;
+    using Node = filesystem_trie::file::Node;
+    using Component = filesystem_trie::file::Component;
+    using Section = filesystem_trie::file::Section;
+
+    // the data never change so copies share them
+    template <typename Storage>
+    explicit MappedFileSystemTrie(Storage storage, char const* base)
+        : storage_{std::make_shared<Storage>(std::move(storage))},
+          base_{base}, header_{reinterpret_cast<Header const*>(base)} {}
+
+    static bool is_valid(std::string_view data,
+                         std::optional<std::uint64_t> fingerprint);
+
+    [[nodiscard]] std::string_view section(Section const& s) const {
+        return {base_ + s.offset, s.size};
+    }
+
+    template <typename U>
+    [[nodiscard]] static std::span<U const> array(char const* base,
+                                                  Section const& s) {
+        return {reinterpret_cast<U const*>(base + s.offset),
+                s.size / sizeof(U)};
+    }
+
+    template <typename U>
+    [[nodiscard]] std::span<U const> array(Section const& s) const {
+        return array<U>(base_, s);
+    }
+
+    [[nodiscard]] std::uint32_t component(std::string_view name) const;
+    [[nodiscard]] std::uint32_t child(std::uint32_t parent,
+                                      std::string_view name) const;
+    [[nodiscard]] T const* value(std::uint32_t node) const;
+    [[nodiscard]] std::vector<T const*>
+    lookup_sorted(std::span<std::string_view const> paths,
+                  bool last_matching) const;
+
+    // either a MappedFile or a std::vector<std::uint64_t>, both keep the
+    // data at the same address when moved
+    std::shared_ptr<void const> storage_;
+    char const* base_{};
+    Header const* header_{};
+};
+
+template <typename T>
+bool MappedFileSystemTrie<T>::is_valid(
+    std::string_view data, std::optional<std::uint64_t> fingerprint) {
+    if (data.size() < sizeof(Header)) {
+        return false;
+    }
+
+    Header header;
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    if (header.magic != filesystem_trie::file::kMagic ||
+        header.version != filesystem_trie::file::kVersion ||
+        header.value_size != sizeof(T) || header.file_size != data.size()) {
+        return false;
+    }
+    if (fingerprint && header.fingerprint != *fingerprint) {
+        return false;
+    }
+
+    auto fits = [&](Section const& s, std::uint64_t expected_size) {
+        return s.offset % 8 == 0 && s.size == expected_size &&
+               s.offset <= data.size() && s.size <= data.size() - s.offset;
+    };
+
+    if (!(header.node_count > 0 && header.index_size > 0 &&
+          (header.index_size & (header.index_size - 1)) == 0 &&
+          fits(header.components,
+               std::uint64_t{header.component_count} * sizeof(Component)) &&
+          fits(header.strings, header.strings.size) &&
+          fits(header.index,
+               std::uint64_t{header.index_size} * sizeof(std::uint32_t)) &&
+          fits(header.nodes, std::uint64_t{header.node_count} * sizeof(Node)) &&
+          fits(header.values, std::uint64_t{header.value_count} * sizeof(T)) &&
+          fits(header.metadata, header.metadata.size))) {
+        return false;
+    }
+
+    // the references between the sections must stay in range too, a corrupt
+    // file would otherwise make the lookups read out of bounds
+    // an empty slot ends the probing of the missing components
+    bool has_empty_slot = false;
+    for (auto id : array<std::uint32_t>(data.data(), header.index)) {
+        if (id > header.component_count) {
+            return false;
+        }
+        has_empty_slot = has_empty_slot || id == 0;
+    }
+    if (!has_empty_slot) {
+        return false;
+    }
+
+    for (auto const& c : array<Component>(data.data(), header.components)) {
+        if (std::uint64_t{c.offset} + c.length > header.strings.size) {
+            return false;
+        }
+    }
+
+    for (auto const& node : array<Node>(data.data(), header.nodes)) {
+        if (std::uint64_t{node.first_child} + node.child_count >
+                header.node_count ||
+            (node.value != filesystem_trie::file::kNoValue &&
+             node.value >= header.value_count)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <typename T>
+std::optional<MappedFileSystemTrie<T>>
+MappedFileSystemTrie<T>::load(fs::path const& path,
+                              std::optional<std::uint64_t> fingerprint) {
+    MappedFile file;
+    try {
+        file = MappedFile{path};
+    } catch (std::system_error const& e) {
+        LOG(DEBUG) << "Unable to map trie " << path << ": " << e.what();
+        return std::nullopt;
+    }
+
+    if (!is_valid(file.view(), fingerprint)) {
+        LOG(DEBUG) << "Trie " << path << " is stale or invalid";
+        return std::nullopt;
+    }
+
+    auto const* base = file.data();
+    return MappedFileSystemTrie{std::move(file), base};
+}
+
+template <typename T>
+MappedFileSystemTrie<T>
+MappedFileSystemTrie<T>::from_trie(FileSystemTrie<T> const& trie,
+                                   std::string_view metadata) {
+    std::ostringstream out;
+    trie.save(out, 0, metadata);
+    auto data = std::move(out).str();
+
+    std::vector<std::uint64_t> buffer((data.size() + 7) / 8);
+    std::memcpy(buffer.data(), data.data(), data.size());
+
+    auto const* base = reinterpret_cast<char const*>(buffer.data());
+    return MappedFileSystemTrie{std::move(buffer), base};
+}
+
+template <typename T>
+void MappedFileSystemTrie<T>::save(fs::path const& path,
+                                   std::uint64_t fingerprint) const {
+    if (header_ == nullptr) {
+        FileSystemTrie<T>{}.save(path, fingerprint);
+        return;
+    }
+
+    auto header = *header_;
+    header.fingerprint = fingerprint;
+
+    auto tmp = path;
+    tmp += ".tmp";
+
+    {
+        std::ofstream out{tmp, std::ios::binary | std::ios::trunc};
+        if (!out) {
+            throw std::runtime_error("Failed to open: " + tmp.string());
+        }
+        out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        out.write(base_ + sizeof(header),
+                  static_cast<std::streamsize>(header.file_size -
+                                               sizeof(header)));
+        if (!out.flush()) {
+            throw std::runtime_error("Failed to write: " + tmp.string());
+        }
+    }
+
+    fs::rename(tmp, path);
+}
+
+template <typename T>
+std::uint32_t
+MappedFileSystemTrie<T>::component(std::string_view name) const {
+    auto index = array<std::uint32_t>(header_->index);
+    auto components = array<Component>(header_->components);
+    auto strings = section(header_->strings);
+    auto mask = index.size() - 1;
+
+    for (auto slot = filesystem_trie::file::hash(name) & mask;;
+         slot = (slot + 1) & mask) {
+        auto id = index[slot];
+        if (id == 0) {
+            return kNoId;
+        }
+        auto const& c = components[id - 1];
+        if (strings.substr(c.offset, c.length) == name) {
+            return id - 1;
+        }
+    }
+}
+
+template <typename T>
+std::uint32_t MappedFileSystemTrie<T>::child(std::uint32_t parent,
+                                             std::string_view name) const {
+    auto id = component(name);
+    if (id == kNoId) {
+        return kNoId;
+    }
+
+    auto nodes = array<Node>(header_->nodes);
+    auto const& node = nodes[parent];
+    auto children = nodes.subspan(node.first_child, node.child_count);
+
+    auto it = std::ranges::lower_bound(children, id, {}, &Node::name);
+    if (it == children.end() || it->name != id) {
+        return kNoId;
+    }
+
+    return node.first_child +
+           static_cast<std::uint32_t>(it - children.begin());
+}
+
+template <typename T>
+T const* MappedFileSystemTrie<T>::value(std::uint32_t node) const {
+    auto v = array<Node>(header_->nodes)[node].value;
+    if (v == filesystem_trie::file::kNoValue) {
+        return nullptr;
+    }
+    return &array<T>(header_->values)[v];
+}
+
+template <typename T>
+std::vector<T const*>
+MappedFileSystemTrie<T>::lookup_sorted(std::span<std::string_view const> paths,
+                                       bool last_matching) const {
+    if (header_ == nullptr) {
+        return std::vector<T const*>(paths.size(), nullptr);
+    }
+
+    filesystem_trie::PrefixWalker walker{
+        std::uint32_t{0}, kNoId,
+        [this](std::uint32_t parent, std::string_view name) {
+            return child(parent, name);
+        }};
+
+    std::vector<T const*> result;
+    result.reserve(paths.size());
+    for (auto path : paths) {
+        auto [id, complete] = walker.walk(path);
+        result.push_back(complete || last_matching ? value(id) : nullptr);
+    }
+
+    return result;
+}
+
+template <typename T>
+T const* MappedFileSystemTrie<T>::find(std::string_view path) const {
+    if (header_ == nullptr) {
+        return nullptr;
+    }
+
+    std::uint32_t id = 0;
+
+    filesystem_trie::PathComponents parts{path};
+    for (std::string_view part; parts.next(part);) {
+        id = child(id, part);
+        if (id == kNoId) {
+            return nullptr;
+        }
+    }
+
+    return value(id);
+}
+
+template <typename T>
+T const*
+MappedFileSystemTrie<T>::find_last_matching(std::string_view path) const {
+    if (header_ == nullptr) {
+        return nullptr;
+    }
+
+    std::uint32_t id = 0;
+
+    filesystem_trie::PathComponents parts{path};
+    for (std::string_view part; parts.next(part);) {
+        auto next = child(id, part);
+        if (next == kNoId) {
+            break;
+        }
+        id = next;
+    }
+
+    return value(id);
+}
+
+#endif // MAPPED_FILESYSTEM_TRIE_H
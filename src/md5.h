@@ -0,0 +1,210 @@
+#ifndef MD5_H
+#define MD5_H
+
+#include "common.h"
+#include "util.h"
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <utility>
+
+// MD5 (RFC 1321), only used to compare files with the dpkg and CRAN
+// md5sums so there is no need for anything stronger. The rounds are
+// unrolled at compile time.
+class Md5 {
+  public:
+    using Digest = std::array<std::uint8_t, 16>;
+
+    void update(void const* data, std::size_t size);
+    // the object must not be updated afterwards
+    Digest finish();
+
+    static std::string to_hex(Digest const& digest);
+
+    static std::string hash(std::string_view data) {
+        Md5 md5;
+        md5.update(data.data(), data.size());
+        return to_hex(md5.finish());
+    }
+
+  private:
+    static constexpr std::size_t kBlockSize = 64;
+
+    void transform(std::uint8_t const* block);
+
+    std::array<std::uint32_t, 4> state_{0x67452301, 0xefcdab89, 0x98badcfe,
+                                        0x10325476};
+    std::array<std::uint8_t, kBlockSize> buffer_{};
+    std::uint64_t length_{};
+};
+
+namespace md5 {
+
+constexpr std::array<std::uint32_t, 64> kSines{
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+constexpr std::array<int, 16> kShifts{7, 12, 17, 22, 5, 9,  14, 20,
+                                      4, 11, 16, 23, 6, 10, 15, 21};
+
+using Words = std::array<std::uint32_t, 16>;
+
+template <std::size_t I>
+inline void step(std::uint32_t& a, std::uint32_t b, std::uint32_t c,
+                 std::uint32_t d, Words const& m) {
+    constexpr std::size_t kRound = I / 16;
+
+    std::uint32_t f = 0;
+    std::size_t g = 0;
+    if constexpr (kRound == 0) {
+        f = (b & c) | (~b & d);
+        g = I;
+    } else if constexpr (kRound == 1) {
+        f = (d & b) | (~d & c);
+        g = (5 * I + 1) % 16;
+    } else if constexpr (kRound == 2) {
+        f = b ^ c ^ d;
+        g = (3 * I + 5) % 16;
+    } else {
+        f = c ^ (b | ~d);
+        g = (7 * I) % 16;
+    }
+
+    constexpr int kShift = kShifts[kRound * 4 + I % 4];
+    f += a + kSines[I] + m[g];
+    a = b + ((f << kShift) | (f >> (32 - kShift)));
+}
+
+// the (a, b, c, d) rotation is done by the order of the arguments
+template <std::size_t... I>
+inline void steps(std::array<std::uint32_t, 4>& s, Words const& m,
+                  std::index_sequence<I...> /*unused*/) {
+    ((step<I * 4 + 0>(s[0], s[1], s[2], s[3], m),
+      step<I * 4 + 1>(s[3], s[0], s[1], s[2], m),
+      step<I * 4 + 2>(s[2], s[3], s[0], s[1], m),
+      step<I * 4 + 3>(s[1], s[2], s[3], s[0], m)),
+     ...);
+}
+
+} // namespace md5
+
+inline void Md5::transform(std::uint8_t const* block) {
+    md5::Words m;
+    for (std::size_t i = 0; i < m.size(); ++i) {
+        auto const* p = block + i * 4;
+        m[i] = std::uint32_t{p[0]} | (std::uint32_t{p[1]} << 8) |
+               (std::uint32_t{p[2]} << 16) | (std::uint32_t{p[3]} << 24);
+    }
+
+    auto s = state_;
+    md5::steps(s, m, std::make_index_sequence<16>{});
+
+    for (std::size_t i = 0; i < state_.size(); ++i) {
+        state_[i] += s[i];
+    }
+}
+
+inline void Md5::update(void const* data, std::size_t size) {
+    auto const* p = static_cast<std::uint8_t const*>(data);
+    auto used = static_cast<std::size_t>(length_ % kBlockSize);
+    length_ += size;
+
+    if (used > 0) {
+        auto n = std::min(size, kBlockSize - used);
+        std::memcpy(buffer_.data() + used, p, n);
+        p += n;
+        size -= n;
+        if (used + n < kBlockSize) {
+            return;
+        }
+        transform(buffer_.data());
+    }
+
+    for (; size >= kBlockSize; p += kBlockSize, size -= kBlockSize) {
+        transform(p);
+    }
+
+    std::memcpy(buffer_.data(), p, size);
+}
+
+inline Md5::Digest Md5::finish() {
+    auto bits = length_ * 8;
+
+    // 0x80, zeros up to 56 bytes mod 64 and the length in bits
+    static constexpr std::array<std::uint8_t, kBlockSize> kPadding{0x80};
+    auto used = static_cast<std::size_t>(length_ % kBlockSize);
+    update(kPadding.data(), used < 56 ? 56 - used : 120 - used);
+
+    std::array<std::uint8_t, 8> length{};
+    for (std::size_t i = 0; i < length.size(); ++i) {
+        length[i] = static_cast<std::uint8_t>(bits >> (8 * i));
+    }
+    update(length.data(), length.size());
+
+    Digest digest;
+    for (std::size_t i = 0; i < digest.size(); ++i) {
+        digest[i] = static_cast<std::uint8_t>(state_[i / 4] >> (8 * (i % 4)));
+    }
+    return digest;
+}
+
+inline std::string Md5::to_hex(Digest const& digest) {
+    static constexpr std::string_view kHex = "0123456789abcdef";
+
+    std::string hex;
+    hex.reserve(digest.size() * 2);
+    for (auto b : digest) {
+        hex += kHex[b >> 4];
+        hex += kHex[b & 0xf];
+    }
+    return hex;
+}
+
+// The buffer is reused for reading so hashing many files does not allocate.
+inline std::string md5_file(fs::path const& path, std::string& buffer) {
+    static constexpr std::size_t kChunkSize = 256 * 1024;
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw make_system_error(errno, STR("Failed to open " << path));
+    }
+
+    buffer.resize(kChunkSize);
+    Md5 md5;
+    while (true) {
+        auto n = ::read(fd, buffer.data(), buffer.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            auto error = errno;
+            ::close(fd);
+            throw make_system_error(error, STR("Failed to read " << path));
+        }
+        if (n == 0) {
+            break;
+        }
+        md5.update(buffer.data(), static_cast<std::size_t>(n));
+    }
+
+    ::close(fd);
+    return Md5::to_hex(md5.finish());
+}
+
+#endif // MD5_H
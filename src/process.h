@@ -4,8 +4,11 @@
 #include "common.h"
 #include "logger.h"
 #include "util.h"
+#include <fcntl.h>
 #include <filesystem>
 #include <optional>
+#include <string>
+#include <string_view>
 #include <sys/wait.h>
 #include <system_error>
 #include <thread>
@@ -39,7 +42,9 @@ class Pipe {
 
 inline Pipe::Pipe() {
     std::array<int, 2> fds{};
-    if (::pipe(fds.data()) < 0) {
+    // not to leak the pipe into the processes spawned concurrently from other
+    // threads, dup2 clears the flag on the redirected stdio
+    if (::pipe2(fds.data(), O_CLOEXEC) < 0) {
         throw make_system_error(errno, "Failed to create pipe");
     }
     read_fd = fds[0];
@@ -286,6 +291,27 @@ inline Child Command::spawn() {
         set_stderr(Stdio::Inherit);
     }
 
+    LOG(TRACE) << "Running command: " << string_join(args_, ' ');
+
+    // everything the child needs is prepared before fork as other threads
+    // might hold the allocator or the logger locks
+    std::vector<char*> argv = collection_to_c_array(args_);
+    std::vector<std::string> env;
+    std::vector<char*> envp;
+    if (!envs_.empty()) {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        for (char** e = environ; e != nullptr && *e != nullptr; ++e) {
+            std::string_view kv{*e};
+            if (!envs_.contains(std::string{kv.substr(0, kv.find('='))})) {
+                env.emplace_back(kv);
+            }
+        }
+        for (auto const& [k, v] : envs_) {
+            env.push_back(k + '=' + v);
+        }
+        envp = collection_to_c_array(env);
+    }
+
     Pipe out;
     Pipe err;
 
@@ -302,12 +328,6 @@ inline Child Command::spawn() {
             }
         }
 
-        LOG(TRACE) << "Running command: " << string_join(args_, ' ');
-
-        for (auto& [k, v] : envs_) {
-            ::setenv(k.c_str(), v.c_str(), 1);
-        }
-
         if (*stdout_setting_ == Stdio::Pipe) {
             ::dup2(out.write(), STDOUT_FILENO);
         } else if (*stdout_setting_ == Stdio::Merge) {
@@ -325,9 +345,11 @@ inline Child Command::spawn() {
         out.close();
         err.close();
 
-        std::vector<char*> argv = collection_to_c_array(args_);
-
-        ::execvp(argv.front(), argv.data());
+        if (envp.empty()) {
+            ::execvp(argv.front(), argv.data());
+        } else {
+            ::execvpe(argv.front(), argv.data(), envp.data());
+        }
         _exit(127);
     }
 
@@ -0,0 +1,342 @@
+#ifndef PROCESS_TREE_H
+#define PROCESS_TREE_H
+
+#include "common.h"
+#include "json.h"
+#include "util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unordered_map>
+#include <vector>
+
+// A single process (or thread) observed while tracing.
+// The times are relative to the start of the tracing.
+struct ProcessInfo {
+    using Duration = std::chrono::microseconds;
+
+    pid_t pid{};
+    pid_t ppid{};
+    std::string exe;
+    std::vector<std::string> argv;
+    Duration start{};
+    std::optional<Duration> end;
+    std::optional<int> exit_code;
+    std::optional<int> signal;
+    Duration user_time{};
+    Duration system_time{};
+    // in kilobytes as reported by getrusage(2)
+    long max_rss{};
+    // the number of syscalls stops
+    std::uint64_t syscalls{};
+    // the number of files that were first touched by this process
+    std::size_t files{};
+
+    [[nodiscard]] Duration cpu_time() const { return user_time + system_time; }
+};
+
+// Keeps a tree of processes spawned by the traced program.
+// It is fed by the SyscallListener callbacks.
+class ProcessTree {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit ProcessTree(Clock::time_point origin = Clock::now())
+        : origin_{origin} {}
+
+    void on_spawn(pid_t parent, pid_t child);
+    void on_exec(pid_t pid, std::string exe, std::vector<std::string> argv);
+    void on_exit(pid_t pid, int status, rusage const& usage);
+
+    void on_syscall(pid_t pid) { get(pid).syscalls++; }
+    void on_file(pid_t pid) { get(pid).files++; }
+
+    // marks all the processes that are still running as finished now
+    void finish();
+
+    [[nodiscard]] std::vector<ProcessInfo> const& processes() const {
+        return processes_;
+    }
+
+    // returns the currently running process with the given pid
+    [[nodiscard]] ProcessInfo const* find(pid_t pid) const;
+
+    [[nodiscard]] std::size_t running() const { return running_.size(); }
+
+    // the processes with the most syscall stops
+    [[nodiscard]] std::vector<ProcessInfo const*>
+    top_by_syscalls(std::size_t n) const;
+
+    // What the traced program needed, for sizing the container that runs it.
+    struct ResourceUsage {
+        // the peak RSS of the largest process in kilobytes
+        long max_rss{};
+        // the CPU time over the wall time of the program, i.e. the number
+        // of the CPUs it kept busy on average
+        double cpus{};
+    };
+
+    [[nodiscard]] ResourceUsage resource_usage() const;
+
+    // nested JSON tree rooted at the first process
+    [[nodiscard]] JsonValue to_json() const;
+
+    // Chrome trace event format (chrome://tracing, ui.perfetto.dev)
+    [[nodiscard]] JsonValue to_chrome_trace() const;
+
+  private:
+    ProcessInfo& get(pid_t pid);
+    ProcessInfo& add(pid_t pid, pid_t ppid);
+    [[nodiscard]] ProcessInfo::Duration now() const;
+    [[nodiscard]] JsonObject
+    to_json(std::size_t idx,
+            std::vector<std::vector<std::size_t>> const& children) const;
+
+    Clock::time_point origin_;
+    std::vector<ProcessInfo> processes_;
+    // pid -> index into processes_ for the processes that are still running
+    std::unordered_map<pid_t, std::size_t> running_;
+    // cache for the last lookup as syscalls usually come in bursts
+    pid_t last_pid_{-1};
+    std::size_t last_idx_{};
+};
+
+inline ProcessInfo::Duration ProcessTree::now() const {
+    return std::chrono::duration_cast<ProcessInfo::Duration>(Clock::now() -
+                                                             origin_);
+}
+
+inline ProcessInfo& ProcessTree::add(pid_t pid, pid_t ppid) {
+    std::size_t idx = processes_.size();
+    auto& info = processes_.emplace_back();
+    info.pid = pid;
+    info.ppid = ppid;
+    info.start = now();
+    running_[pid] = idx;
+    last_pid_ = pid;
+    last_idx_ = idx;
+    return info;
+}
+
+inline ProcessInfo& ProcessTree::get(pid_t pid) {
+    if (pid == last_pid_) {
+        return processes_[last_idx_];
+    }
+
+    if (auto it = running_.find(pid); it != running_.end()) {
+        last_pid_ = pid;
+        last_idx_ = it->second;
+        return processes_[it->second];
+    }
+
+    // the child might report its first stop before its parent reports the
+    // fork event, its parent is filled in by on_spawn
+    return add(pid, 0);
+}
+
+inline ProcessInfo const* ProcessTree::find(pid_t pid) const {
+    if (auto it = running_.find(pid); it != running_.end()) {
+        return &processes_[it->second];
+    }
+    return nullptr;
+}
+
+inline std::vector<ProcessInfo const*>
+ProcessTree::top_by_syscalls(std::size_t n) const {
+    std::vector<ProcessInfo const*> result;
+    result.reserve(processes_.size());
+    for (auto const& p : processes_) {
+        result.push_back(&p);
+    }
+
+    n = std::min(n, result.size());
+    std::partial_sort(result.begin(), result.begin() + n, result.end(),
+                      [](auto const* lhs, auto const* rhs) {
+                          return lhs->syscalls > rhs->syscalls;
+                      });
+    result.resize(n);
+
+    return result;
+}
+
+inline ProcessTree::ResourceUsage ProcessTree::resource_usage() const {
+    ResourceUsage usage;
+    for (auto const& p : processes_) {
+        usage.max_rss = std::max(usage.max_rss, p.max_rss);
+    }
+
+    // the rusage of the first process includes the descendants it waited
+    // for, summing them up would count them twice
+    if (!processes_.empty()) {
+        auto const& root = processes_.front();
+        if (auto wall = root.end.value_or(root.start) - root.start;
+            wall.count() > 0) {
+            usage.cpus = static_cast<double>(root.cpu_time().count()) /
+                         static_cast<double>(wall.count());
+        }
+    }
+
+    return usage;
+}
+
+inline void ProcessTree::on_spawn(pid_t parent, pid_t child) {
+    auto it = running_.find(child);
+    if (it != running_.end()) {
+        processes_[it->second].ppid = parent;
+    } else {
+        add(child, parent);
+    }
+
+    auto& info = get(child);
+    if (auto const* p = find(parent); p != nullptr && info.exe.empty()) {
+        // until it execs, the child runs the parent program
+        info.exe = p->exe;
+        info.argv = p->argv;
+    }
+}
+
+inline void ProcessTree::on_exec(pid_t pid, std::string exe,
+                                 std::vector<std::string> argv) {
+    auto& info = get(pid);
+    info.exe = std::move(exe);
+    info.argv = std::move(argv);
+}
+
+inline void ProcessTree::on_exit(pid_t pid, int status, rusage const& usage) {
+    auto& info = get(pid);
+
+    info.end = now();
+    if (WIFEXITED(status)) {
+        info.exit_code = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        info.signal = WTERMSIG(status);
+    }
+
+    auto to_duration = [](timeval const& tv) {
+        return std::chrono::seconds{tv.tv_sec} +
+               std::chrono::microseconds{tv.tv_usec};
+    };
+
+    info.user_time = to_duration(usage.ru_utime);
+    info.system_time = to_duration(usage.ru_stime);
+    info.max_rss = usage.ru_maxrss;
+
+    running_.erase(pid);
+    last_pid_ = -1;
+}
+
+inline void ProcessTree::finish() {
+    auto end = now();
+    for (auto [_, idx] : running_) {
+        processes_[idx].end = end;
+    }
+    running_.clear();
+    last_pid_ = -1;
+}
+
+inline JsonObject ProcessTree::to_json(
+    std::size_t idx,
+    std::vector<std::vector<std::size_t>> const& children) const {
+    auto const& p = processes_[idx];
+
+    auto us = [](ProcessInfo::Duration d) {
+        return static_cast<double>(d.count());
+    };
+
+    JsonArray argv(p.argv.begin(), p.argv.end());
+    JsonObject obj{
+        {"pid", p.pid},
+        {"ppid", p.ppid},
+        {"exe", p.exe},
+        {"argv", std::move(argv)},
+        {"start_us", us(p.start)},
+        {"end_us", p.end ? JsonValue{us(*p.end)} : JsonValue{nullptr}},
+        {"wall_us", p.end ? JsonValue{us(*p.end - p.start)}
+                          : JsonValue{nullptr}},
+        {"user_us", us(p.user_time)},
+        {"system_us", us(p.system_time)},
+        {"cpu_us", us(p.cpu_time())},
+        {"max_rss_kb", static_cast<double>(p.max_rss)},
+        {"syscalls", static_cast<double>(p.syscalls)},
+        {"files", static_cast<double>(p.files)},
+        {"exit_code",
+         p.exit_code ? JsonValue{*p.exit_code} : JsonValue{nullptr}},
+        {"signal", p.signal ? JsonValue{*p.signal} : JsonValue{nullptr}},
+    };
+
+    JsonArray nested;
+    for (auto child : children[idx]) {
+        nested.emplace_back(to_json(child, children));
+    }
+    obj.emplace("children", std::move(nested));
+
+    return obj;
+}
+
+inline JsonValue ProcessTree::to_json() const {
+    if (processes_.empty()) {
+        return nullptr;
+    }
+
+    // processes are stored in the order of their creation so a parent always
+    // comes before its children; the latest process with the matching pid is
+    // the parent (pids can be reused)
+    std::vector<std::vector<std::size_t>> children(processes_.size());
+    std::unordered_map<pid_t, std::size_t> latest;
+    for (std::size_t i = 0; i < processes_.size(); ++i) {
+        auto const& p = processes_[i];
+        if (auto it = latest.find(p.ppid); it != latest.end()) {
+            children[it->second].push_back(i);
+        }
+        latest[p.pid] = i;
+    }
+
+    return to_json(0, children);
+}
+
+inline JsonValue ProcessTree::to_chrome_trace() const {
+    auto us = [](ProcessInfo::Duration d) {
+        return static_cast<double>(d.count());
+    };
+
+    JsonArray events;
+    events.reserve(processes_.size());
+
+    for (auto const& p : processes_) {
+        std::string name = p.exe.empty()
+                               ? STR("pid " << p.pid)
+                               : fs::path{p.exe}.filename().string();
+        auto end = p.end.value_or(p.start);
+
+        events.emplace_back(JsonObject{
+            {"name", name},
+            {"cat", "process"s},
+            {"ph", "X"s},
+            {"ts", us(p.start)},
+            {"dur", us(end - p.start)},
+            {"pid", p.pid},
+            {"tid", p.pid},
+            {"args",
+             JsonObject{
+                 {"ppid", p.ppid},
+                 {"argv", string_join(p.argv, ' ')},
+                 {"cpu_us", us(p.cpu_time())},
+                 {"max_rss_kb", static_cast<double>(p.max_rss)},
+                 {"syscalls", static_cast<double>(p.syscalls)},
+                 {"files", static_cast<double>(p.files)},
+             }},
+        });
+    }
+
+    return JsonObject{{"traceEvents", std::move(events)},
+                      {"displayTimeUnit", "ms"s}};
+}
+
+#endif // PROCESS_TREE_H
@@ -0,0 +1,209 @@
+#ifndef R_SOURCE_CACHE_H
+#define R_SOURCE_CACHE_H
+
+#include "common.h"
+#include "curl.h"
+#include "logger.h"
+#include "md5.h"
+#include "rpkg_database.h"
+#include "util_fs.h"
+#include <array>
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+
+// A content-addressed cache of R package source tarballs shared by all the
+// builds. The tarballs are stored by their md5sum (objects/<md5sum>) and
+// found by the URL they were downloaded from (urls/<md5sum of the URL>,
+// holding the md5sum of the tarball).
+class RSourceCache {
+  public:
+    explicit RSourceCache(fs::path dir, std::size_t parallel = 8)
+        : dir_{std::move(dir)}, parallel_{parallel} {}
+
+    // The cached tarballs of the packages, downloading the missing ones in
+    // parallel, trying their URLs in order. The downloads go straight to
+    // the disk and are checked to be gzipped and to match the md5sum, if
+    // known. The packages that failed are left out.
+    [[nodiscard]] std::unordered_map<RPackage const*, fs::path>
+    fetch(std::unordered_map<RPackage const*, RSourceTarball> const& tarballs)
+        const;
+
+  private:
+    [[nodiscard]] fs::path object(std::string const& md5sum) const {
+        return dir_ / "objects" / md5sum;
+    }
+
+    [[nodiscard]] fs::path url_key(std::string const& url) const {
+        return dir_ / "urls" / Md5::hash(url);
+    }
+
+    [[nodiscard]] std::optional<fs::path>
+    lookup(RSourceTarball const& tarball) const;
+
+    // where the download of the package goes before it is checked, the
+    // builds sharing the cache do not overwrite each other's
+    [[nodiscard]] fs::path download(RPackage const& pkg) const {
+        return dir_ / "tmp" /
+               STR(pkg.name << "_" << pkg.version << "." << getpid());
+    }
+
+    // Moves the checked download from the URL into the cache.
+    fs::path store(std::string const& url, fs::path const& file,
+                   std::string const& md5sum) const;
+
+    static void write_atomically(fs::path const& path, std::string_view data);
+
+    fs::path dir_;
+    std::size_t parallel_;
+};
+
+inline std::optional<fs::path>
+RSourceCache::lookup(RSourceTarball const& tarball) const {
+    std::error_code ec;
+
+    if (!tarball.md5sum.empty()) {
+        auto path = object(tarball.md5sum);
+        return fs::exists(path, ec) ? std::optional{path} : std::nullopt;
+    }
+
+    for (auto const& url : tarball.urls) {
+        auto key = url_key(url);
+        if (!fs::exists(key, ec)) {
+            continue;
+        }
+        try {
+            auto path = object(string_trim(read_from_file(key)));
+            if (fs::exists(path, ec)) {
+                return path;
+            }
+        } catch (std::system_error const& e) {
+            LOG(DEBUG) << "Failed to read " << key << ": " << e.what();
+        }
+    }
+
+    return {};
+}
+
+inline void RSourceCache::write_atomically(fs::path const& path,
+                                           std::string_view data) {
+    auto tmp = path;
+    tmp += ".tmp";
+    fs::create_directories(path.parent_path());
+    write_to_file(tmp, data);
+    fs::rename(tmp, path);
+}
+
+inline fs::path RSourceCache::store(std::string const& url,
+                                    fs::path const& file,
+                                    std::string const& md5sum) const {
+    auto path = object(md5sum);
+
+    std::error_code ec;
+    if (fs::exists(path, ec)) {
+        fs::remove(file, ec);
+    } else {
+        fs::create_directories(path.parent_path());
+        fs::rename(file, path);
+    }
+    write_atomically(url_key(url), md5sum);
+
+    return path;
+}
+
+inline std::unordered_map<RPackage const*, fs::path> RSourceCache::fetch(
+    std::unordered_map<RPackage const*, RSourceTarball> const& tarballs)
+    const {
+    std::unordered_map<RPackage const*, fs::path> files;
+
+    std::unordered_map<RPackage const*, RSourceTarball const*> missing;
+    for (auto const& [p, tarball] : tarballs) {
+        if (auto path = lookup(tarball)) {
+            files.emplace(p, std::move(*path));
+        } else if (!tarball.urls.empty()) {
+            missing.emplace(p, &tarball);
+        }
+    }
+
+    LOG(DEBUG) << "Found " << files.size() << " R package sources in "
+               << dir_ << ", downloading " << missing.size();
+
+    if (!missing.empty()) {
+        fs::create_directories(dir_ / "tmp");
+    }
+
+    std::string buffer;
+    for (std::size_t attempt = 0; !missing.empty(); ++attempt) {
+        CURLMultipleTransfer<RPackage const*> curl{parallel_};
+        for (auto it = missing.begin(); it != missing.end();) {
+            auto const& urls = it->second->urls;
+            if (attempt < urls.size()) {
+                curl.add(it->first, urls[attempt], download(*it->first));
+                ++it;
+            } else {
+                LOG(WARN) << "Failed to download the sources of "
+                          << it->first->name << " " << it->first->version;
+                it = missing.erase(it);
+            }
+        }
+
+        for (auto& [p, r] : curl.run()) {
+            auto const& tarball = *missing.at(p);
+            auto const& url = tarball.urls[attempt];
+            auto file = download(*p);
+            std::error_code ec;
+
+            std::string md5sum;
+            try {
+                auto* hr = std::get_if<HttpResult>(&r);
+                if (!hr || hr->http_code != 200) {
+                    throw std::runtime_error(
+                        hr ? STR("HTTP " << hr->http_code)
+                           : std::get<std::string>(r));
+                }
+
+                std::array<char, 2> magic{};
+                std::ifstream{file, std::ios::binary}.read(magic.data(),
+                                                           magic.size());
+                if (magic != std::array<char, 2>{'\x1f', '\x8b'}) {
+                    throw std::runtime_error("Not a gzipped tarball");
+                }
+
+                md5sum = md5_file(file, buffer);
+            } catch (std::exception const& e) {
+                LOG(DEBUG) << "Failed to download " << url << ": " << e.what();
+                fs::remove(file, ec);
+                continue;
+            }
+
+            if (!tarball.md5sum.empty() && md5sum != tarball.md5sum) {
+                LOG(WARN) << "The md5sum of " << url << " does not match "
+                          << tarball.md5sum;
+                fs::remove(file, ec);
+                continue;
+            }
+
+            try {
+                files.emplace(p, store(url, file, md5sum));
+                missing.erase(p);
+            } catch (std::exception const& e) {
+                LOG(WARN) << "Failed to cache " << url << ": " << e.what();
+                fs::remove(file, ec);
+            }
+        }
+    }
+
+    return files;
+}
+
+#endif // R_SOURCE_CACHE_H
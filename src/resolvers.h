@@ -1,13 +1,19 @@
 #ifndef RESOLVERS_H
 #define RESOLVERS_H
 
+#include "deb_file_verifier.h"
 #include "dpkg_database.h"
 #include "file_tracer.h"
 #include "logger.h"
 #include "manifest.h"
 #include "rpkg_database.h"
 #include "util_fs.h"
+#include <algorithm>
+#include <cstddef>
 #include <filesystem>
+#include <iterator>
+#include <span>
+#include <string_view>
 #include <system_error>
 #include <vector>
 
@@ -22,55 +28,185 @@ class Resolver {
                          Manifest& manifest) = 0;
 };
 
+// Looks up the given paths together with all their symlink aliases in one
+// batch. The aliases are sorted so the package tries are walked only once
+// for the common directory prefixes. Returns for each path its aliases, in
+// the order resolve_symlinks gives them, with the packages found for them
+// (nullptr for the ones not owned by any package).
+template <typename Package, typename Lookup>
+std::vector<std::vector<std::pair<fs::path, Package const*>>>
+lookup_with_aliases(std::vector<fs::path const*> const& paths,
+                    Lookup const& lookup) {
+    SymlinkResolver symlink_resolver;
+    std::vector<std::vector<std::pair<fs::path, Package const*>>> result(
+        paths.size());
+    // the path and the position in its aliases of each of the aliases
+    std::vector<std::pair<std::size_t, std::size_t>> aliases;
+
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        for (auto& p : symlink_resolver.resolve_symlinks(*paths[i])) {
+            aliases.emplace_back(i, result[i].size());
+            result[i].emplace_back(p, nullptr);
+        }
+    }
+
+    auto alias = [&](std::pair<std::size_t, std::size_t> const& a)
+        -> std::pair<fs::path, Package const*>& {
+        return result[a.first][a.second];
+    };
+
+    std::ranges::sort(aliases, {}, [&](auto const& a) -> std::string const& {
+        return alias(a).first.native();
+    });
+
+    std::vector<std::string_view> sorted;
+    sorted.reserve(aliases.size());
+    for (auto const& a : aliases) {
+        sorted.emplace_back(alias(a).first.native());
+    }
+
+    std::vector<Package const*> found = lookup(sorted);
+
+    for (std::size_t i = 0; i < aliases.size(); ++i) {
+        alias(aliases[i]).second = found[i];
+    }
+
+    return result;
+}
+
+// Removes the files marked in resolved, the marks of the files start at the
+// given position.
+inline void erase_resolved(Resolver::Files& files,
+                           std::vector<bool> const& resolved,
+                           std::size_t first = 0) {
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (!resolved[first + i]) {
+            if (kept != i) {
+                files[kept] = std::move(files[i]);
+            }
+            ++kept;
+        }
+    }
+    files.erase(files.begin() + static_cast<std::ptrdiff_t>(kept),
+                files.end());
+}
+
+inline void erase_resolved(Resolver::Symlinks& symlinks,
+                           std::vector<bool> const& resolved,
+                           std::size_t first = 0) {
+    auto i = first;
+    for (auto it = symlinks.begin(); it != symlinks.end(); ++i) {
+        it = resolved[i] ? symlinks.erase(it) : std::next(it);
+    }
+}
+
+// If a verifier is given, the files that differ from the ones installed by
+// their package are left unresolved (to be copied).
 class DebPackageResolver : public Resolver {
   public:
-    explicit DebPackageResolver(DpkgDatabase const* dpkg_database)
-        : dpkg_database_(dpkg_database) {}
+    explicit DebPackageResolver(DpkgDatabase const* dpkg_database,
+                                DebFileVerifier* verifier = nullptr)
+        : dpkg_database_(dpkg_database), verifier_{verifier} {}
 
     void resolve(Files& files, Symlinks& symlinks, Manifest& manifest) override;
 
   private:
     DpkgDatabase const* dpkg_database_;
+    DebFileVerifier* verifier_;
 };
 
 inline void DebPackageResolver::resolve(Files& files, Symlinks& symlinks,
                                         Manifest& manifest) {
-    SymlinkResolver symlink_resolver;
     std::unordered_set<DebPackage const*> resolved_packages;
     size_t resolved_files{};
 
-    auto resolved = [&](fs::path const& path) {
-        for (auto const& p : symlink_resolver.resolve_symlinks(path)) {
-            if (!fs::is_regular_file(p)) {
-                LOG(DEBUG) << "Skipping: " << path
-                           << " as it is not a regular file ("
-                           << file_type_str(path) << ")";
+    std::vector<fs::path const*> paths;
+    paths.reserve(files.size() + symlinks.size());
+    for (auto const& info : files) {
+        paths.push_back(&info.path);
+    }
+    for (auto const& [link, _] : symlinks) {
+        paths.push_back(&link);
+    }
+
+    auto packages = lookup_with_aliases<DebPackage>(
+        paths, [&](std::span<std::string_view const> sorted) {
+            return dpkg_database_->lookup_by_paths(sorted);
+        });
+
+    // the first of the aliases owned by a package
+    std::vector<std::pair<fs::path const*, DebPackage const*>> owners(
+        paths.size());
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        for (auto const& [alias, pkg] : packages[i]) {
+            if (pkg == nullptr) {
+                continue;
             }
-            if (auto const* pkg = dpkg_database_->lookup_by_path(p); pkg) {
-                if (pkg->name.find("rstudio") != std::string::npos ||
-                    pkg->name.find("bslib") != std::string::npos) {
-                    //  TODO: GET RID OF THIS!! THIS IS A HACK TO MAKE TRACING PASS FROM RSTUDIO   
-                    continue;
-                }
-                
-                LOG(DEBUG) << "Resolved: " << path << " to: " << pkg->name;
+            if (pkg->name.find("rstudio") != std::string::npos ||
+                pkg->name.find("bslib") != std::string::npos) {
+                //  TODO: GET RID OF THIS!! THIS IS A HACK TO MAKE TRACING PASS FROM RSTUDIO   
+                continue;
+            }
+            owners[i] = {&alias, pkg};
+            break;
+        }
+    }
 
-                // TODO: check that the file size is the same
-                
-                resolved_packages.insert(pkg);
-                resolved_files++;
-                return true;
+    // only the files are verified, dpkg has no md5sums for symlinks
+    std::vector<bool> unchanged(paths.size(), true);
+    if (verifier_ != nullptr) {
+        std::vector<DebFileVerifier::File> owned;
+        std::vector<std::size_t> owned_files;
+        for (std::size_t i = 0; i < files.size(); ++i) {
+            if (auto [alias, pkg] = owners[i]; pkg != nullptr) {
+                owned.push_back({.path = &files[i].path,
+                                 .dpkg_path = alias->native(),
+                                 .package = pkg});
+                owned_files.push_back(i);
             }
         }
-        return false;
-    };
 
-    std::erase_if(files, [&](auto const& info) { return resolved(info.path); });
-    std::erase_if(symlinks,
-                  [&](auto const& entry) { return resolved(entry.first); });
+        auto verified = verifier_->verify(owned);
+        for (std::size_t i = 0; i < owned.size(); ++i) {
+            unchanged[owned_files[i]] = verified[i];
+        }
+    }
+
+    std::size_t modified_files{};
+    std::vector<bool> resolved(paths.size());
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        auto const* pkg = owners[i].second;
+        if (pkg == nullptr) {
+            continue;
+        }
+
+        if (!unchanged[i]) {
+            LOG(DEBUG) << "Resolved: " << *paths[i] << " to: " << pkg->name
+                       << ", but it has been modified";
+            modified_files++;
+            continue;
+        }
+
+        LOG(DEBUG) << "Resolved: " << *paths[i] << " to: " << pkg->name;
+
+        resolved_packages.insert(pkg);
+        resolved_files++;
+        resolved[i] = true;
+    }
+
+    // the files come first in the paths, then the symlinks
+    auto file_count = files.size();
+    erase_resolved(files, resolved);
+    erase_resolved(symlinks, resolved, file_count);
 
     LOG(INFO) << "Resolved " << resolved_files << " files and symlinks to "
               << resolved_packages.size() << " deb packages";
+    if (modified_files > 0) {
+        LOG(INFO) << modified_files
+                  << " files differ from the ones in their deb packages, they "
+                     "will be copied";
+    }
 
     if (Logger::get().is_enabled(DEBUG)) {
         for (auto const* p : resolved_packages) {
@@ -215,26 +351,35 @@ class RPackageResolver : public Resolver {
 
 inline void RPackageResolver::resolve(Files& files, Symlinks& /*symlinks*/,
                                       Manifest& manifest) {
-    SymlinkResolver symlink_resolved;
     std::unordered_set<RPackage const*> resolved_packages;
     size_t resolved_files{};
 
-    auto resolved = [&](FileInfo const& info) {
-        auto& path = info.path;
-        for (auto const& p : symlink_resolved.resolve_symlinks(path)) {
-            if (auto const* pkg = rpkg_database_->lookup_by_path(p); pkg) {
+    std::vector<fs::path const*> paths;
+    paths.reserve(files.size());
+    for (auto const& info : files) {
+        paths.push_back(&info.path);
+    }
+
+    auto packages = lookup_with_aliases<RPackage>(
+        paths, [&](std::span<std::string_view const> sorted) {
+            return rpkg_database_->lookup_by_paths(sorted);
+        });
 
-                LOG(DEBUG) << "Resolved: " << path << " to: " << pkg->name;
+    std::vector<bool> resolved(paths.size());
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        for (auto const& [_, pkg] : packages[i]) {
+            if (pkg != nullptr) {
+                LOG(DEBUG) << "Resolved: " << *paths[i] << " to: " << pkg->name;
 
                 resolved_packages.insert(pkg);
                 resolved_files++;
-                return true;
+                resolved[i] = true;
+                break;
             }
         }
-        return false;
-    };
+    }
 
-    std::erase_if(files, resolved);
+    erase_resolved(files, resolved);
 
     LOG(INFO) << "Resolved " << resolved_files << " files to "
               << resolved_packages.size() << " R packages";
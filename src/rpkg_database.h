@@ -4,16 +4,24 @@
 #include "common.h"
 #include "curl.h"
 #include "filesystem_trie.h"
-#include "json.h"
+#include "json_view.h"
 #include "logger.h"
 #include "process.h"
 #include "util.h"
+#include "util_fs.h"
+#include <algorithm>
 #include <cctype>
+#include <cstdint>
+#include <exception>
+#include <fstream>
 #include <iostream>
 #include <optional>
 #include <set>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <variant>
 #include <vector>
@@ -53,13 +61,16 @@ struct RPackage {
     bool is_base{false};
     bool needs_compilation{false};
     Repository repository{CRAN{}};
+    // the SystemRequirements field, unknown when not read from DESCRIPTION
+    std::optional<std::string> system_requirements{};
 
+    // system_requirements is not part of the identity of a package
     bool operator==(RPackage const& other) const {
         return std::tie(name, lib_path, version, dependencies, is_base,
                         needs_compilation, repository) ==
                std::tie(other.name, other.lib_path, other.version,
                         other.dependencies, other.is_base,
-                        other.needs_compilation, repository);
+                        other.needs_compilation, other.repository);
     }
 };
 
@@ -116,13 +127,93 @@ class RPackageBuilder {
     [[nodiscard]] RPackage build() const { return pkg_; }
 };
 
+// Parses a DCF file (e.g. a package DESCRIPTION) into its fields. The
+// continuation lines are joined with a space.
+inline std::unordered_map<std::string, std::string>
+parse_dcf(std::string_view data) {
+    std::unordered_map<std::string, std::string> fields;
+    std::string* value = nullptr;
+
+    while (!data.empty()) {
+        auto line = string_pop_line(data);
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        if (line.front() == ' ' || line.front() == '\t') {
+            if (value != nullptr) {
+                auto start = line.find_first_not_of(" \t");
+                if (start != std::string_view::npos) {
+                    *value += ' ';
+                    *value += line.substr(start);
+                }
+            }
+            continue;
+        }
+
+        auto colon = line.find(':');
+        if (colon == std::string_view::npos) {
+            value = nullptr;
+            continue;
+        }
+
+        auto v = line.substr(colon + 1);
+        auto start = v.find_first_not_of(" \t");
+        v = start == std::string_view::npos ? std::string_view{}
+                                            : v.substr(start);
+        while (!v.empty() && (v.back() == ' ' || v.back() == '\t')) {
+            v.remove_suffix(1);
+        }
+
+        value = &(fields[std::string{line.substr(0, colon)}] = v);
+    }
+
+    return fields;
+}
+
+// Where the R package database is loaded from.
+enum class RpkgDatabaseSource {
+    // the DESCRIPTION files of the packages in the R library paths
+    Native,
+    // installed.packages() in R
+    R,
+    // both, reporting the differences (the R one is used)
+    Verify,
+};
+
+struct RSourceTarball {
+    // in the order to try them, empty if it is already in place
+    std::vector<std::string> urls;
+    // empty if unknown
+    std::string md5sum{};
+};
+
 class RpkgDatabase {
   public:
     using RPackages =
         std::unordered_map<std::string, std::unique_ptr<RPackage>>;
 
+    // Loads the installed packages from the given source. The native load
+    // uses the given library paths, or the .libPaths() of R if there are
+    // none, and falls back to from_R if it fails.
+    static RpkgDatabase
+    system_database(fs::path const& R_bin,
+                    std::vector<fs::path> const& lib_paths = {},
+                    RpkgDatabaseSource source = RpkgDatabaseSource::Native);
+
     static RpkgDatabase from_R(fs::path const& R_bin);
 
+    // Reads <lib>/<pkg>/DESCRIPTION of all the packages in the library paths
+    // using the given number of threads (0 means one per core). A package
+    // installed in more than one library comes from the first one, as in R.
+    static RpkgDatabase from_lib_paths(std::vector<fs::path> const& lib_paths,
+                                       unsigned jobs = 0);
+
+    static std::vector<fs::path> lib_paths_from_R(fs::path const& R_bin);
+
     static RpkgDatabase from_stream(std::istream& input) {
         RPackages packages;
         parse_r_packages(input, packages);
@@ -136,11 +227,36 @@ class RpkgDatabase {
     }
 
     RPackage const* lookup_by_path(fs::path const& path) const;
+    // lookup_by_path of each of the paths, faster if they are sorted
+    std::vector<RPackage const*>
+    lookup_by_paths(std::span<std::string_view const> paths) const;
 
+    // Queries the Posit package manager, the successful responses are kept
+    // in cache_dir (if given) so each package version is only queried once.
     static std::unordered_set<std::string>
     get_system_dependencies(std::unordered_set<RPackage const*> const& pkgs,
                             std::string const& distrib,
-                            std::string const& release);
+                            std::string const& release,
+                            fs::path const& cache_dir = {});
+
+    // The CRAN packages whose exact versions the (binary) repository has,
+    // according to its src/contrib/PACKAGES index.
+    static std::unordered_set<RPackage const*>
+    get_binary_packages(std::unordered_set<RPackage const*> const& pkgs,
+                        std::string const& repository);
+
+    // The source tarballs of the packages: the current CRAN release if it
+    // is the version (with its md5sum), otherwise its archive, or both if
+    // the CRAN index is not available.
+    static std::unordered_map<RPackage const*, RSourceTarball>
+    get_source_tarballs(std::unordered_set<RPackage const*> const& pkgs,
+                        std::string const& cran_mirror);
+
+    // The same with the PACKAGES index of the mirror already fetched.
+    static std::unordered_map<RPackage const*, RSourceTarball>
+    get_source_tarballs(std::unordered_set<RPackage const*> const& pkgs,
+                        std::string const& cran_mirror,
+                        std::optional<std::string> const& index);
 
     template <typename Collection>
     std::vector<RPackage const*>
@@ -154,7 +270,38 @@ class RpkgDatabase {
 
     RPackage const* find(std::string const& name) const;
 
+    // Describes the packages that are not the same in the other database.
+    [[nodiscard]] std::vector<std::string>
+    differences(RpkgDatabase const& other) const;
+
   private:
+    // The fields of an installed package, "NA" when missing (as in the
+    // output of installed.packages()).
+    struct PackageFields {
+        std::string name;
+        std::string lib_path;
+        std::string version;
+        std::string depends{"NA"};
+        std::string imports{"NA"};
+        std::string linking_to{"NA"};
+        std::string priority{"NA"};
+        std::string needs_compilation{"NA"};
+        std::string remote_type{"NA"};
+        std::string remote_username{"NA"};
+        std::string remote_repo{"NA"};
+        std::string remote_ref{"NA"};
+        std::optional<std::string> system_requirements{};
+    };
+
+    // below this, the threads are not worth it
+    static constexpr std::size_t kMinPackagesPerJob = 32;
+
+    static void add_package(PackageFields const& fields, RPackages& packages);
+    static void remove_missing_dependencies(RPackages& packages);
+    static std::optional<PackageFields>
+    read_description(fs::path const& lib_path, std::string const& name,
+                     std::string& buffer);
+
     static FileSystemTrie<RPackage const*>
     build_files_db(RPackages const& packages);
 
@@ -215,15 +362,346 @@ inline RpkgDatabase RpkgDatabase::from_R(fs::path const& R_bin) {
     return from_stream(stream);
 }
 
+inline std::vector<fs::path>
+RpkgDatabase::lib_paths_from_R(fs::path const& R_bin) {
+    auto out = Command(R_bin)
+                   .arg("-s")
+                   .arg("-q")
+                   .arg("-e")
+                   .arg(R"(cat(.libPaths(), sep = "\n"))")
+                   .output();
+
+    out.check_success("Unable to get the R library paths");
+
+    std::vector<fs::path> lib_paths;
+    for (auto const& line : string_split(out.stdout_data, '\n')) {
+        if (auto path = string_trim(line); !path.empty()) {
+            lib_paths.emplace_back(path);
+        }
+    }
+    return lib_paths;
+}
+
+inline RpkgDatabase
+RpkgDatabase::system_database(fs::path const& R_bin,
+                              std::vector<fs::path> const& lib_paths,
+                              RpkgDatabaseSource source) {
+    if (source == RpkgDatabaseSource::R) {
+        return from_R(R_bin);
+    }
+
+    std::optional<RpkgDatabase> native;
+    try {
+        native = from_lib_paths(lib_paths.empty() ? lib_paths_from_R(R_bin)
+                                                  : lib_paths);
+    } catch (std::exception const& e) {
+        LOG(WARN) << "Failed to load the R packages from their DESCRIPTION "
+                     "files, falling back to R: "
+                  << e.what();
+        return from_R(R_bin);
+    }
+
+    if (source == RpkgDatabaseSource::Native) {
+        return std::move(*native);
+    }
+
+    auto db = from_R(R_bin);
+    auto differences = db.differences(*native);
+    for (auto const& d : differences) {
+        LOG(WARN) << "R package database mismatch: " << d;
+    }
+    LOG(INFO) << "Verified the native R package database against R: "
+              << differences.size() << " difference(s)";
+
+    return db;
+}
+
+inline std::optional<RpkgDatabase::PackageFields>
+RpkgDatabase::read_description(fs::path const& lib_path,
+                               std::string const& name, std::string& buffer) {
+    auto file = lib_path / name / "DESCRIPTION";
+    try {
+        read_from_file(file, buffer);
+    } catch (std::system_error const&) {
+        // not a package
+        return std::nullopt;
+    }
+
+    auto dcf = parse_dcf(buffer);
+    // only the installed ones, like installed.packages()
+    if (!dcf.contains("Built") || dcf["Package"] != name ||
+        dcf["Version"].empty()) {
+        LOG(DEBUG) << "Skipping " << file << ", not an installed package";
+        return std::nullopt;
+    }
+
+    PackageFields fields{.name = name,
+                         .lib_path = lib_path.string(),
+                         .version = std::move(dcf["Version"])};
+    auto set = [&](std::string& field, char const* key) {
+        if (auto it = dcf.find(key); it != dcf.end()) {
+            field = std::move(it->second);
+        }
+    };
+    set(fields.depends, "Depends");
+    set(fields.imports, "Imports");
+    set(fields.linking_to, "LinkingTo");
+    set(fields.priority, "Priority");
+    set(fields.needs_compilation, "NeedsCompilation");
+    set(fields.remote_type, "RemoteType");
+    set(fields.remote_username, "RemoteUsername");
+    set(fields.remote_repo, "RemoteRepo");
+    set(fields.remote_ref, "RemoteRef");
+    if (auto it = dcf.find("SystemRequirements"); it != dcf.end()) {
+        fields.system_requirements = std::move(it->second);
+    } else {
+        // known to have none
+        fields.system_requirements.emplace();
+    }
+
+    return fields;
+}
+
+inline RpkgDatabase
+RpkgDatabase::from_lib_paths(std::vector<fs::path> const& lib_paths,
+                             unsigned jobs) {
+    // in the order of the library paths
+    std::vector<std::pair<fs::path const*, std::string>> candidates;
+    for (auto const& lib_path : lib_paths) {
+        std::error_code ec;
+        std::vector<std::string> names;
+        for (auto const& entry : fs::directory_iterator{lib_path, ec}) {
+            names.push_back(entry.path().filename().string());
+        }
+        if (ec) {
+            LOG(WARN) << "Failed to list R library " << lib_path << ": "
+                      << ec.message();
+            continue;
+        }
+        std::ranges::sort(names);
+        for (auto& name : names) {
+            candidates.emplace_back(&lib_path, std::move(name));
+        }
+    }
+
+    if (jobs == 0) {
+        jobs = std::max(1U, std::thread::hardware_concurrency());
+    }
+    jobs = static_cast<unsigned>(std::clamp<std::size_t>(
+        candidates.size() / kMinPackagesPerJob, 1, jobs));
+
+    std::vector<std::optional<PackageFields>> fields(candidates.size());
+    std::vector<std::exception_ptr> errors(jobs);
+
+    auto load = [&](unsigned job) {
+        try {
+            std::string buffer;
+            auto begin = candidates.size() * job / jobs;
+            auto end = candidates.size() * (job + 1) / jobs;
+
+            for (auto i = begin; i < end; ++i) {
+                auto const& [lib_path, name] = candidates[i];
+                fields[i] = read_description(*lib_path, name, buffer);
+            }
+        } catch (...) {
+            errors[job] = std::current_exception();
+        }
+    };
+
+    {
+        std::vector<std::jthread> threads;
+        for (unsigned job = 1; job < jobs; ++job) {
+            threads.emplace_back(load, job);
+        }
+        load(0);
+    }
+
+    for (auto const& e : errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+
+    RPackages packages;
+    for (auto const& f : fields) {
+        if (f && !packages.contains(f->name)) {
+            add_package(*f, packages);
+        }
+    }
+    remove_missing_dependencies(packages);
+
+    LOG(DEBUG) << "Loaded " << packages.size() << " R packages from "
+               << lib_paths.size() << " libraries";
+
+    return RpkgDatabase{std::move(packages)};
+}
+
 inline RPackage const*
 RpkgDatabase::lookup_by_path(fs::path const& path) const {
-    auto const* r = files_.find_last_matching(path);
+    auto const* r = files_.find_last_matching(path.native());
     return r != nullptr ? *r : nullptr;
 }
 
+inline std::vector<RPackage const*>
+RpkgDatabase::lookup_by_paths(std::span<std::string_view const> paths) const {
+    std::vector<RPackage const*> result;
+    result.reserve(paths.size());
+    for (auto const* r : files_.find_last_matching_sorted(paths)) {
+        result.push_back(r != nullptr ? *r : nullptr);
+    }
+    return result;
+}
+
+// The dated binary snapshot of CRAN for the distribution release in the
+// layout of the Posit package manager, e.g.
+// https://packagemanager.posit.co/cran/__linux__/jammy/2024-06-03
+inline std::string r_binary_repository(std::string_view mirror,
+                                       std::string_view codename,
+                                       std::string_view snapshot) {
+    while (mirror.ends_with('/')) {
+        mirror.remove_suffix(1);
+    }
+    return STR(mirror << "/__linux__/" << codename << "/" << snapshot);
+}
+
+// A field (e.g. Version or MD5sum) of the packages in a repository PACKAGES
+// index, by name.
+inline std::unordered_map<std::string, std::string>
+parse_packages_index(std::string_view data,
+                     std::string_view field = "Version") {
+    std::unordered_map<std::string, std::string> values;
+    std::string name;
+
+    while (!data.empty()) {
+        auto line = string_pop_line(data);
+        if (line.starts_with("Package:")) {
+            name = string_trim(std::string{line.substr(8)});
+        } else if (line.starts_with(field) && line.size() > field.size() &&
+                   line[field.size()] == ':' && !name.empty()) {
+            values[name] =
+                string_trim(std::string{line.substr(field.size() + 1)});
+        } else if (string_trim(std::string{line}).empty()) {
+            name.clear();
+        }
+    }
+
+    return values;
+}
+
+// The PACKAGES index of the repository, nullopt if it failed.
+inline std::optional<std::string>
+fetch_packages_index(std::string const& repository) {
+    CURLMultipleTransfer<int> curl{1};
+    curl.add(0, repository + "/src/contrib/PACKAGES");
+    auto res = curl.run();
+
+    auto* hr = std::get_if<HttpResult>(&res.at(0));
+    if (!hr) {
+        LOG(WARN) << "Failed to get the packages of " << repository << ": "
+                  << std::get<std::string>(res.at(0));
+        return {};
+    }
+    if (hr->http_code != 200) {
+        LOG(WARN) << "Failed to get the packages of " << repository
+                  << ": Unexpected HTTP error: " << hr->http_code;
+        return {};
+    }
+
+    return std::move(hr->message);
+}
+
+inline std::unordered_set<RPackage const*> RpkgDatabase::get_binary_packages(
+    std::unordered_set<RPackage const*> const& pkgs,
+    std::string const& repository) {
+    std::unordered_set<RPackage const*> binaries;
+
+    auto index = fetch_packages_index(repository);
+    if (!index) {
+        return binaries;
+    }
+
+    auto versions = parse_packages_index(*index);
+    for (auto const* p : pkgs) {
+        if (!std::holds_alternative<RPackage::CRAN>(p->repository)) {
+            continue;
+        }
+        if (auto it = versions.find(p->name);
+            it != versions.end() && it->second == p->version) {
+            binaries.insert(p);
+        }
+    }
+
+    return binaries;
+}
+
+inline std::unordered_map<RPackage const*, RSourceTarball>
+RpkgDatabase::get_source_tarballs(
+    std::unordered_set<RPackage const*> const& pkgs,
+    std::string const& cran_mirror) {
+    std::string_view mirror{cran_mirror};
+    while (mirror.ends_with('/')) {
+        mirror.remove_suffix(1);
+    }
+
+    return get_source_tarballs(pkgs, cran_mirror,
+                               fetch_packages_index(std::string{mirror}));
+}
+
+inline std::unordered_map<RPackage const*, RSourceTarball>
+RpkgDatabase::get_source_tarballs(
+    std::unordered_set<RPackage const*> const& pkgs,
+    std::string const& cran_mirror, std::optional<std::string> const& index) {
+    std::unordered_map<RPackage const*, RSourceTarball> tarballs;
+
+    std::string_view mirror{cran_mirror};
+    while (mirror.ends_with('/')) {
+        mirror.remove_suffix(1);
+    }
+
+    std::optional<std::unordered_map<std::string, std::string>> versions;
+    std::unordered_map<std::string, std::string> md5sums;
+    if (index) {
+        versions = parse_packages_index(*index);
+        md5sums = parse_packages_index(*index, "MD5sum");
+    }
+
+    for (auto const* p : pkgs) {
+        std::visit(
+            overloaded{
+                [&](RPackage::GitHub const& gh) {
+                    tarballs[p].urls.push_back(STR("https://github.com/"
+                                                   << gh.org << "/" << gh.name
+                                                   << "/archive/" << gh.ref
+                                                   << ".tar.gz"));
+                },
+                [&](RPackage::CRAN const&) {
+                    auto tarball = p->name + "_" + p->version + ".tar.gz";
+                    auto current = STR(mirror << "/src/contrib/" << tarball);
+                    auto archive = STR(mirror << "/src/contrib/Archive/"
+                                              << p->name << "/" << tarball);
+
+                    auto& t = tarballs[p];
+                    if (!versions) {
+                        t.urls = {current, archive};
+                    } else if (auto it = versions->find(p->name);
+                               it != versions->end() &&
+                               it->second == p->version) {
+                        t.urls = {current};
+                        t.md5sum = md5sums[p->name];
+                    } else {
+                        t.urls = {archive};
+                    }
+                },
+            },
+            p->repository);
+    }
+
+    return tarballs;
+}
+
 inline std::unordered_set<std::string> RpkgDatabase::get_system_dependencies(
     std::unordered_set<RPackage const*> const& pkgs, std::string const& distrib,
-    std::string const& release) {
+    std::string const& release, fs::path const& cache_dir) {
     std::unordered_set<std::string> dependencies;
 
     CURLMultipleTransfer<RPackage const*> curl{10};
@@ -233,7 +711,26 @@ inline std::unordered_set<std::string> RpkgDatabase::get_system_dependencies(
     auto posit_release =
         (distrib == "debian" && release.empty()) ? "12" : release;
 
+    auto cache_file = [&](RPackage const* p) {
+        return cache_dir / "sysreqs" / (distrib + "-" + posit_release) /
+               (p->name + "_" + p->version + ".json");
+    };
+
+    std::vector<std::pair<RPackage const*, std::string>> responses;
+
     for (auto const* p : pkgs) {
+        if (!cache_dir.empty()) {
+            if (auto file = cache_file(p); fs::exists(file)) {
+                try {
+                    responses.emplace_back(p, read_from_file(file));
+                    continue;
+                } catch (std::system_error const& e) {
+                    LOG(DEBUG) << "Failed to read " << file << ": "
+                               << e.what();
+                }
+            }
+        }
+
         // TODO: parameterize distribution and release
         std::string url =
             STR("https://packagemanager.posit.co"
@@ -244,32 +741,59 @@ inline std::unordered_set<std::string> RpkgDatabase::get_system_dependencies(
         curl.add(p, url);
     }
 
+    LOG(DEBUG) << "Got cached system dependencies for " << responses.size()
+               << " packages";
+
     auto res = curl.run();
 
     LOG(DEBUG) << "Got system dependencies for " << res.size() << " packages";
 
     for (auto& [p, r] : res) {
-        try {
-            auto* hr = std::get_if<HttpResult>(&r);
-            if (!hr) {
-                throw std::runtime_error(
-                    STR("Failed to query: " << std::get<std::string>(r)));
-            }
+        auto* hr = std::get_if<HttpResult>(&r);
+        if (!hr) {
+            LOG(WARN) << "Failed to get system dependencies for " << p->name
+                      << " : Failed to query: " << std::get<std::string>(r);
+            continue;
+        }
 
-            if (hr->http_code != 200) {
-                throw std::runtime_error(
-                    STR("Unexpected HTTP error: " << hr->http_code << "\n"
-                                                  << hr->message));
+        if (hr->http_code != 200) {
+            LOG(WARN) << "Failed to get system dependencies for " << p->name
+                      << " : Unexpected HTTP error: " << hr->http_code << "\n"
+                      << hr->message;
+            continue;
+        }
+
+        if (!cache_dir.empty()) {
+            auto file = cache_file(p);
+            auto tmp = file;
+            tmp += ".tmp";
+            try {
+                fs::create_directories(file.parent_path());
+                std::ofstream{tmp} << hr->message;
+                fs::rename(tmp, file);
+            } catch (std::exception const& e) {
+                LOG(DEBUG) << "Failed to cache " << file << ": " << e.what();
             }
+        }
 
-            auto json = JsonParser::parse(hr->message);
-            auto reqs = json_query<JsonArray>(json, "requirements");
-            for (auto const& req : reqs) {
-                auto deps = json_query<JsonArray>(req, "requirements.packages");
+        responses.emplace_back(p, std::move(hr->message));
+    }
 
-                for (auto const& dep : deps) {
-                    dependencies.insert(std::get<std::string>(dep));
-                }
+    // the packages and the requirements themselves, which might be empty
+    static JsonPathQuery const kPackages{
+        "requirements.*.requirements.packages.*", "requirements"};
+    constexpr std::uint64_t kRequirements = 1 << 1;
+
+    for (auto const& [p, response] : responses) {
+        try {
+            auto matched = kPackages.run(
+                response, [&](std::size_t path, JsonScalar const& package) {
+                    if (path == 0) {
+                        dependencies.insert(package.string());
+                    }
+                });
+            if ((matched & kRequirements) == 0) {
+                throw std::runtime_error("No requirements in the response");
             }
         } catch (std::exception const& e) {
             LOG(WARN) << "Failed to get system dependencies for " << p->name
@@ -329,11 +853,38 @@ inline RPackage const* RpkgDatabase::find(std::string const& name) const {
     return {};
 }
 
+inline std::vector<std::string>
+RpkgDatabase::differences(RpkgDatabase const& other) const {
+    std::vector<std::string> result;
+
+    for (auto const& [name, pkg] : packages_) {
+        auto const* o = other.find(name);
+        if (o == nullptr) {
+            result.push_back(STR(name << " is missing"));
+        } else if (*pkg != *o) {
+            result.push_back(
+                STR(name << " " << pkg->version << " from " << pkg->lib_path
+                         << " (" << pkg->repository << ") differs from "
+                         << o->version << " from " << o->lib_path << " ("
+                         << o->repository << ")"));
+        }
+    }
+
+    for (auto const& [name, _] : other.packages_) {
+        if (!packages_.contains(name)) {
+            result.push_back(STR(name << " is extra"));
+        }
+    }
+
+    std::ranges::sort(result);
+    return result;
+}
+
 inline FileSystemTrie<RPackage const*>
 RpkgDatabase::build_files_db(RPackages const& packages) {
     FileSystemTrie<RPackage const*> files;
     for (auto const& [_, pkg] : packages) {
-        files.insert(pkg->lib_path / pkg->name, pkg.get());
+        files.insert((pkg->lib_path / pkg->name).native(), pkg.get());
     }
     return files;
 }
@@ -357,43 +908,55 @@ inline void RpkgDatabase::parse_r_packages(std::istream& input,
             continue;
         }
 
-        std::string name = tokens->at(0);
-        std::string lib_path = tokens->at(1);
-        std::string version = tokens->at(2);
-
-        // we want them in order
-        std::set<std::string> dependencies;
-        // Depends
-        parse_dependency_field(tokens->at(3), dependencies);
-        // Imports
-        parse_dependency_field(tokens->at(4), dependencies);
-        // LinkingTo
-        parse_dependency_field(tokens->at(5), dependencies);
-
-        bool is_base = tokens->at(6) == "base";
-        bool needs_compilation = tokens->at(7) == "yes";
-
-        RPackage::Repository repo = RPackage::CRAN{};
-        auto repo_type = tokens->at(8);
-        if (string_iequals(repo_type, "github")) {
-            std::string r_org = tokens->at(9);
-            std::string r_name = tokens->at(10);
-            std::string ref = tokens->at(11);
-
-            if (auto gh = parse_github_repo(r_org, r_name, ref); gh) {
-                repo = *gh;
-            } else {
-                continue;
-            }
-        }
+        auto& t = *tokens;
+        add_package({.name = t[0],
+                     .lib_path = t[1],
+                     .version = t[2],
+                     .depends = t[3],
+                     .imports = t[4],
+                     .linking_to = t[5],
+                     .priority = t[6],
+                     .needs_compilation = t[7],
+                     .remote_type = t[8],
+                     .remote_username = t[9],
+                     .remote_repo = t[10],
+                     .remote_ref = t[11]},
+                    packages);
+    }
+
+    remove_missing_dependencies(packages);
+}
 
-        auto pkg =
-            std::make_unique<RPackage>(name, lib_path, version, dependencies,
-                                       is_base, needs_compilation, repo);
-        packages.emplace(pkg->name, std::move(pkg));
+inline void RpkgDatabase::add_package(PackageFields const& fields,
+                                      RPackages& packages) {
+    // we want them in order
+    std::set<std::string> dependencies;
+    parse_dependency_field(fields.depends, dependencies);
+    parse_dependency_field(fields.imports, dependencies);
+    parse_dependency_field(fields.linking_to, dependencies);
+
+    bool is_base = fields.priority == "base";
+    bool needs_compilation = fields.needs_compilation == "yes";
+
+    RPackage::Repository repo = RPackage::CRAN{};
+    if (string_iequals(fields.remote_type, "github")) {
+        if (auto gh = parse_github_repo(fields.remote_username,
+                                        fields.remote_repo, fields.remote_ref);
+            gh) {
+            repo = *gh;
+        } else {
+            return;
+        }
     }
 
-    // make sure we have all the dependencies
+    auto pkg = std::make_unique<RPackage>(
+        fields.name, fields.lib_path, fields.version, dependencies, is_base,
+        needs_compilation, repo, fields.system_requirements);
+    packages.emplace(pkg->name, std::move(pkg));
+}
+
+// makes sure we have all the dependencies
+inline void RpkgDatabase::remove_missing_dependencies(RPackages& packages) {
     for (auto& [_, pkg] : packages) {
         std::erase_if(pkg->dependencies, [&](auto const& dep) {
             if (!packages.contains(dep)) {
@@ -7,18 +7,28 @@
 #include "util.h"
 #include "util_io.h"
 
+#include <chrono>
+#include <csignal>
 #include <cstdint>
 #include <cstring>
+#include <ctime>
 #include <functional>
 #include <iostream>
 #include <optional>
 #include <sys/ptrace.h>
+#include <sys/resource.h>
 #include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <utility>
 #include <vector>
 
+// the name the kernel headers give to the thread of SIGEV_THREAD_ID, which
+// the older glibc versions leave out
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
 using SyscallArgs = std::uint64_t[6];
 using SyscallRet = std::int64_t;
 
@@ -29,6 +39,20 @@ class SyscallListener {
     virtual void on_syscall_entry(pid_t pid, std::uint64_t syscall,
                                   SyscallArgs args) = 0;
     virtual void on_syscall_exit(pid_t pid, SyscallRet args, bool is_error) = 0;
+
+    // a new tracee was created by fork, vfork or clone
+    // (the initial tracee is reported with the tracer as its parent)
+    virtual void on_process_spawn([[maybe_unused]] pid_t parent,
+                                  [[maybe_unused]] pid_t child) {}
+
+    // a tracee has exited or was killed, the usage comes from wait4(2)
+    virtual void on_process_exit([[maybe_unused]] pid_t pid,
+                                 [[maybe_unused]] int status,
+                                 [[maybe_unused]] rusage const& usage) {}
+
+    // called every tick interval of the monitor, also while all the tracees
+    // are blocked
+    virtual void on_tick() {}
 };
 
 class SyscallMonitor {
@@ -51,6 +75,11 @@ class SyscallMonitor {
 
     void redirect_stderr(std::ostream& os) { stderr_ = &os; }
 
+    // how often to call the on_tick of the listener, 0 means never
+    void set_tick_interval(std::chrono::milliseconds interval) {
+        tick_interval_ = interval;
+    }
+
     void stop() const;
 
     Result start();
@@ -61,6 +90,11 @@ class SyscallMonitor {
     static std::string read_string_from_process(pid_t pid, uint64_t remote_addr,
                                                 size_t max_len);
 
+    // reads a NULL-terminated array of strings (e.g. argv of execve)
+    static std::vector<std::string>
+    read_string_array_from_process(pid_t pid, uint64_t remote_addr,
+                                   size_t max_count, size_t max_len);
+
   private:
     static int const kSpawnErrorExitCode{254};
     static long const kPtraceOptions{
@@ -94,13 +128,87 @@ class SyscallMonitor {
     static std::function<int()>
     spawn_process(std::vector<std::string> const& cmd);
 
+    // Interrupts the wait4 of the monitor thread with a signal every
+    // interval so the ticks come even if no tracee makes any progress.
+    class TickTimer {
+      public:
+        explicit TickTimer(std::chrono::milliseconds interval);
+        ~TickTimer();
+
+        TickTimer(TickTimer const&) = delete;
+        TickTimer& operator=(TickTimer const&) = delete;
+
+        // whether the timer fired since the last call, the wait4 is also
+        // interrupted by the other signals
+        [[nodiscard]] bool fired() {
+            bool fired = fired_ != 0;
+            fired_ = 0;
+            return fired;
+        }
+
+      private:
+        static inline std::sig_atomic_t volatile fired_ = 0;
+
+        timer_t timer_{};
+        struct sigaction old_action_ {};
+        bool armed_{false};
+    };
+
     std::function<int()> tracee_;
     SyscallListener& listener_;
     std::ostream* stdout_{&std::cout};
     std::ostream* stderr_{&std::cerr};
     pid_t tracee_pid_{-1};
+    std::chrono::milliseconds tick_interval_{0};
 };
 
+inline SyscallMonitor::TickTimer::TickTimer(
+    std::chrono::milliseconds interval) {
+    if (interval.count() <= 0) {
+        return;
+    }
+
+    // without SA_RESTART so the wait4 fails with EINTR
+    struct sigaction action {};
+    action.sa_handler = [](int) { fired_ = 1; };
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGRTMIN, &action, &old_action_) < 0) {
+        throw make_system_error(errno, "sigaction");
+    }
+
+    // to the monitor thread only, not to the ones forwarding the output
+    sigevent event{};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGRTMIN;
+    event.sigev_notify_thread_id = gettid();
+    if (timer_create(CLOCK_MONOTONIC, &event, &timer_) < 0) {
+        auto error = errno;
+        sigaction(SIGRTMIN, &old_action_, nullptr);
+        throw make_system_error(error, "timer_create");
+    }
+
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(interval);
+    auto nsecs =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(interval - secs);
+    timespec period{.tv_sec = secs.count(), .tv_nsec = nsecs.count()};
+    itimerspec spec{.it_interval = period, .it_value = period};
+    if (timer_settime(timer_, 0, &spec, nullptr) < 0) {
+        // the destructor does not run for a throwing constructor
+        auto error = errno;
+        timer_delete(timer_);
+        sigaction(SIGRTMIN, &old_action_, nullptr);
+        throw make_system_error(error, "timer_settime");
+    }
+    armed_ = true;
+}
+
+inline SyscallMonitor::TickTimer::~TickTimer() {
+    if (armed_) {
+        timer_delete(timer_);
+        sigaction(SIGRTMIN, &old_action_, nullptr);
+    }
+}
+
 inline void SyscallMonitor::stop() const {
     if (tracee_pid_ != -1) {
         kill(tracee_pid_, SIGKILL);
@@ -166,6 +274,8 @@ inline SyscallMonitor::Result SyscallMonitor::process_tracer(Pipe& out,
 
     wait_for_initial_stop();
 
+    listener_.on_process_spawn(getpid(), tracee_pid_);
+
     set_ptrace_options(tracee_pid_);
 
     trace_syscalls(tracee_pid_);
@@ -258,6 +368,39 @@ SyscallMonitor::read_string_from_process(pid_t pid, uint64_t remote_addr,
     return {buffer, read_total};
 }
 
+inline std::vector<std::string>
+SyscallMonitor::read_string_array_from_process(pid_t pid, uint64_t remote_addr,
+                                               size_t max_count,
+                                               size_t max_len) {
+    std::vector<std::string> result;
+    if (remote_addr == 0) {
+        return result;
+    }
+
+    std::vector<uint64_t> pointers(max_count);
+    iovec local_iov{.iov_base = pointers.data(),
+                    .iov_len = pointers.size() * sizeof(uint64_t)};
+    // NOLINTNEXTLINE(performance-no-int-to-ptr)
+    iovec remote_iov{.iov_base = reinterpret_cast<void*>(remote_addr),
+                     .iov_len = local_iov.iov_len};
+
+    // the read can be partial if the array is near the end of the mapping
+    ssize_t read = process_vm_readv(pid, &local_iov, 1, &remote_iov, 1, 0);
+    if (read < 0) {
+        if (errno == EFAULT) {
+            return result;
+        }
+        throw make_system_error(errno, "process_vm_readv");
+    }
+
+    size_t count = static_cast<size_t>(read) / sizeof(uint64_t);
+    for (size_t i = 0; i < count && pointers[i] != 0; ++i) {
+        result.push_back(read_string_from_process(pid, pointers[i], max_len));
+    }
+
+    return result;
+}
+
 inline void SyscallMonitor::trace_syscalls(pid_t pid) {
     if (ptrace(PTRACE_SYSCALL, pid, nullptr, nullptr) == -1) {
         if (errno == ESRCH) {
@@ -302,23 +445,35 @@ inline void SyscallMonitor::wait_for_initial_stop() const {
 }
 
 inline SyscallMonitor::Result SyscallMonitor::monitor() {
+    TickTimer timer{tick_interval_};
+
     while (true) {
         int status = 0;
-        pid_t wpid = waitpid(-1, &status, __WALL);
+        rusage usage{};
+        // only the tracees, not the children spawned by the other threads
+        // (e.g. the background database loads)
+        pid_t wpid = wait4(-1, &status, __WALL | __WNOTHREAD, &usage);
 
         if (wpid < 0) {
             if (errno == ECHILD) {
                 // this should never happen as we should exit before
                 // when tracee exists
                 throw make_system_error(errno,
-                                        "waitpid - no more childer to trace");
+                                        "wait4 - no more childer to trace");
             }
             if (errno == EINTR) {
-                // interrupted by a signal, continue
+                // interrupted by a signal (e.g. the tick), continue
+                if (timer.fired()) {
+                    listener_.on_tick();
+                }
                 continue;
             }
 
-            throw make_system_error(errno, "waitpid");
+            throw make_system_error(errno, "wait4");
+        }
+
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            listener_.on_process_exit(wpid, status, usage);
         }
 
         if (WIFEXITED(status)) {
@@ -357,6 +512,7 @@ inline void SyscallMonitor::handle_stop(pid_t pid, int status) {
                       << strerror(errno);
         } else {
             set_ptrace_options(child_pid);
+            listener_.on_process_spawn(pid, child_pid);
         }
 
         trace_syscalls(child_pid);
@@ -388,7 +544,7 @@ inline void SyscallMonitor::handle_syscall(pid_t pid) {
 
 inline std::function<int()>
 SyscallMonitor::spawn_process(std::vector<std::string> const& cmd) {
-    return [&cmd]() -> int {
+    return [cmd]() -> int {
         auto c_args = collection_to_c_array(cmd);
         auto const& program = cmd.front();
         execvp(program.c_str(), c_args.data());
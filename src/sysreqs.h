@@ -0,0 +1,587 @@
+#ifndef SYSREQS_H
+#define SYSREQS_H
+
+#include "common.h"
+#include "dpkg_database.h"
+#include "elf_dynamic.h"
+#include "json.h"
+#include "logger.h"
+#include "rpkg_database.h"
+#include "sysreqs_rules.h"
+#include "util.h"
+#include "util_fs.h"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <queue>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Maps the SystemRequirements field of R packages to deb packages using
+// rules in the format of sysreqs_rules.h. All the patterns are compiled into
+// one Aho-Corasick automaton, so a field is scanned once regardless of the
+// number of rules.
+class SysreqsRules {
+  public:
+    // Throws JsonParseError or std::invalid_argument for malformed rules.
+    explicit SysreqsRules(std::string const& json);
+
+    // The rules shipped with r4r, parsed on the first use.
+    static SysreqsRules const& bundled() {
+        static SysreqsRules const rules{std::string{kBundledSysreqsRules}};
+        return rules;
+    }
+
+    // Whether the packages of the rules are meant for the distribution.
+    [[nodiscard]] bool supports(std::string const& distribution) const {
+        return std::ranges::find(distributions_, distribution) !=
+               distributions_.end();
+    }
+
+    // The text is a list of requirements separated by commas or semicolons.
+    // Returns nullopt if no rule matches one of them, otherwise the packages
+    // of all the matching rules (which might be none, e.g. for C++17).
+    [[nodiscard]] std::optional<std::vector<std::string>>
+    match(std::string_view text, OsRelease const& os_release) const;
+
+  private:
+    struct Override {
+        std::string distribution;
+        // all the releases if empty
+        std::vector<std::string> releases;
+        std::vector<std::string> packages;
+    };
+
+    struct Rule {
+        std::vector<std::string> packages;
+        std::vector<Override> overrides;
+    };
+
+    struct Output {
+        std::size_t rule;
+        std::size_t length;
+    };
+
+    static std::string normalize(std::string_view text);
+    static bool is_word_char(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) != 0;
+    }
+    // whether the character at i belongs to a word, - . + only do inside a
+    // token (libcurl4-openssl-dev) so next is the index past them
+    static bool in_word(std::string_view text, std::size_t i,
+                        std::size_t next) {
+        auto c = text[i];
+        if (c == '-' || c == '.' || c == '+') {
+            return next < text.size() && is_word_char(text[next]);
+        }
+        return is_word_char(c);
+    }
+
+    void add_pattern(std::string const& pattern, std::size_t rule);
+    void build();
+
+    std::vector<std::string> distributions_;
+    std::vector<Rule> rules_;
+
+    // the characters used in the patterns get classes 1.., the rest is 0
+    std::array<std::uint8_t, 256> classes_{};
+    std::size_t alphabet_{1};
+    // the transitions of the automaton, node * alphabet_ + class
+    std::vector<std::int32_t> transitions_;
+    std::vector<std::vector<Output>> outputs_;
+};
+
+// lowercase with the runs of whitespace squeezed into a single space
+inline std::string SysreqsRules::normalize(std::string_view text) {
+    std::string result;
+    result.reserve(text.size());
+    bool space = false;
+    for (char c : text) {
+        if (std::isspace(static_cast<unsigned char>(c)) != 0) {
+            space = !result.empty();
+            continue;
+        }
+        if (space) {
+            result += ' ';
+            space = false;
+        }
+        result +=
+            static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return result;
+}
+
+inline SysreqsRules::SysreqsRules(std::string const& json) {
+    auto root = JsonParser::parse(json);
+
+    auto strings = [](JsonValue const& value, std::string_view path) {
+        std::vector<std::string> result;
+        for (auto const& s : json_query<JsonArray>(value, path)) {
+            result.push_back(std::get<std::string>(s));
+        }
+        return result;
+    };
+
+    distributions_ = strings(root, "distributions");
+
+    // first all the patterns, the alphabet is needed for the automaton
+    std::vector<std::pair<std::string, std::size_t>> patterns;
+    for (auto const& r : json_query<JsonArray>(root, "rules")) {
+        auto const& object = std::get<JsonObject>(r);
+
+        Rule rule{.packages = strings(r, "packages"), .overrides = {}};
+        if (object.contains("overrides")) {
+            for (auto const& o : json_query<JsonArray>(r, "overrides")) {
+                auto const& fields = std::get<JsonObject>(o);
+                Override over{
+                    .distribution = json_query<std::string>(o, "distribution"),
+                    .releases = {},
+                    .packages = strings(o, "packages")};
+                if (fields.contains("releases")) {
+                    over.releases = strings(o, "releases");
+                }
+                rule.overrides.push_back(std::move(over));
+            }
+        }
+
+        for (auto& pattern : strings(r, "patterns")) {
+            pattern = normalize(pattern);
+            if (pattern.empty()) {
+                throw std::invalid_argument(
+                    "Empty system requirement pattern");
+            }
+            patterns.emplace_back(std::move(pattern), rules_.size());
+        }
+        rules_.push_back(std::move(rule));
+    }
+
+    for (auto const& [pattern, _] : patterns) {
+        for (auto c : pattern) {
+            auto& cls = classes_[static_cast<unsigned char>(c)];
+            if (cls == 0) {
+                cls = static_cast<std::uint8_t>(alphabet_++);
+            }
+        }
+    }
+
+    transitions_.assign(alphabet_, -1);
+    outputs_.emplace_back();
+    for (auto const& [pattern, rule] : patterns) {
+        add_pattern(pattern, rule);
+    }
+    build();
+}
+
+inline void SysreqsRules::add_pattern(std::string const& pattern,
+                                      std::size_t rule) {
+    std::size_t node = 0;
+    for (auto c : pattern) {
+        auto index =
+            node * alphabet_ + classes_[static_cast<unsigned char>(c)];
+        if (transitions_[index] < 0) {
+            transitions_[index] = static_cast<std::int32_t>(outputs_.size());
+            transitions_.resize(transitions_.size() + alphabet_, -1);
+            outputs_.emplace_back();
+        }
+        node = static_cast<std::size_t>(transitions_[index]);
+    }
+    outputs_[node].push_back({.rule = rule, .length = pattern.size()});
+}
+
+// Turns the trie into a complete automaton: the missing transitions go where
+// the failure links would lead and each node gets the outputs of the nodes
+// on its failure chain.
+inline void SysreqsRules::build() {
+    std::vector<std::size_t> fail(outputs_.size(), 0);
+    std::queue<std::size_t> queue;
+
+    for (std::size_t c = 0; c < alphabet_; ++c) {
+        auto& next = transitions_[c];
+        if (next < 0) {
+            next = 0;
+        } else {
+            queue.push(static_cast<std::size_t>(next));
+        }
+    }
+
+    while (!queue.empty()) {
+        auto node = queue.front();
+        queue.pop();
+
+        for (std::size_t c = 0; c < alphabet_; ++c) {
+            auto fallback = transitions_[fail[node] * alphabet_ + c];
+            auto& next = transitions_[node * alphabet_ + c];
+            if (next < 0) {
+                next = fallback;
+                continue;
+            }
+
+            auto child = static_cast<std::size_t>(next);
+            fail[child] = static_cast<std::size_t>(fallback);
+            auto const& inherited = outputs_[fail[child]];
+            outputs_[child].insert(outputs_[child].end(), inherited.begin(),
+                                   inherited.end());
+            queue.push(child);
+        }
+    }
+}
+
+inline std::optional<std::vector<std::string>>
+SysreqsRules::match(std::string_view text, OsRelease const& os_release) const {
+    auto normalized = normalize(text);
+
+    std::vector<bool> matched(rules_.size());
+    // the requirements without a matching rule so far
+    std::size_t unmatched = 0;
+    bool clause_empty = true;
+    bool clause_matched = false;
+    auto end_clause = [&] {
+        if (!clause_empty && !clause_matched) {
+            ++unmatched;
+        }
+        clause_empty = true;
+        clause_matched = false;
+    };
+
+    std::size_t node = 0;
+    for (std::size_t i = 0; i < normalized.size(); ++i) {
+        if (normalized[i] == ',' || normalized[i] == ';') {
+            end_clause();
+        } else if (normalized[i] != ' ') {
+            clause_empty = false;
+        }
+
+        auto c = classes_[static_cast<unsigned char>(normalized[i])];
+        node = static_cast<std::size_t>(transitions_[node * alphabet_ + c]);
+
+        // only whole tokens, libpng must not match png and neither must
+        // libcurl4-openssl-dev match openssl
+        auto end = i + 1;
+        if (end < normalized.size() && in_word(normalized, end, end + 1)) {
+            continue;
+        }
+        for (auto const& output : outputs_[node]) {
+            auto start = end - output.length;
+            if (start == 0 ||
+                !in_word(normalized, start - 1,
+                         start >= 2 ? start - 2 : normalized.size())) {
+                matched[output.rule] = true;
+                clause_matched = true;
+            }
+        }
+    }
+    end_clause();
+
+    if (unmatched > 0 || std::ranges::find(matched, true) == matched.end()) {
+        return std::nullopt;
+    }
+
+    std::vector<std::string> packages;
+    for (std::size_t i = 0; i < rules_.size(); ++i) {
+        if (!matched[i]) {
+            continue;
+        }
+
+        auto const* selected = &rules_[i].packages;
+        for (auto const& o : rules_[i].overrides) {
+            if (o.distribution == os_release.distribution &&
+                (o.releases.empty() ||
+                 std::ranges::find(o.releases, os_release.release) !=
+                     o.releases.end())) {
+                selected = &o.packages;
+                break;
+            }
+        }
+
+        for (auto const& p : *selected) {
+            if (std::ranges::find(packages, p) == packages.end()) {
+                packages.push_back(p);
+            }
+        }
+    }
+
+    return packages;
+}
+
+// Resolves the system dependencies of R packages locally from the rules and
+// falls back to querying the Posit package manager for the packages the
+// rules know nothing about: those loaded without their SystemRequirements
+// (from R) and those with a requirement no rule matches.
+class SystemDependencyResolver {
+  public:
+    explicit SystemDependencyResolver(
+        OsRelease os_release, fs::path cache_dir = {}, bool query = true,
+        SysreqsRules const& rules = SysreqsRules::bundled())
+        : os_release_{std::move(os_release)},
+          cache_dir_{std::move(cache_dir)}, query_{query}, rules_{&rules} {}
+
+    // The packages in known (e.g. resolved from their shared objects) are
+    // matched against the rules, but never queried.
+    [[nodiscard]] std::unordered_set<std::string>
+    resolve(std::unordered_set<RPackage const*> const& pkgs,
+            std::unordered_set<RPackage const*> const& known = {}) const;
+
+  private:
+    OsRelease os_release_;
+    fs::path cache_dir_;
+    bool query_;
+    SysreqsRules const* rules_;
+};
+
+inline std::unordered_set<std::string> SystemDependencyResolver::resolve(
+    std::unordered_set<RPackage const*> const& pkgs,
+    std::unordered_set<RPackage const*> const& known) const {
+    std::unordered_set<std::string> dependencies;
+    std::unordered_set<RPackage const*> unresolved;
+
+    bool supported = rules_->supports(os_release_.distribution);
+    for (auto const* p : pkgs) {
+        if (!supported || !p->system_requirements) {
+            unresolved.insert(p);
+            continue;
+        }
+
+        auto const& text = *p->system_requirements;
+        if (string_trim(text).empty()) {
+            continue;
+        }
+
+        auto packages = rules_->match(text, os_release_);
+        if (!packages) {
+            LOG(DEBUG) << "No rule for the system requirements of " << p->name
+                       << ": " << text;
+            unresolved.insert(p);
+            continue;
+        }
+
+        LOG(DEBUG) << "System requirements of " << p->name << ": "
+                   << string_join(*packages, ", ");
+        dependencies.insert(packages->begin(), packages->end());
+    }
+
+    std::erase_if(unresolved, [&](auto const* p) { return known.contains(p); });
+
+    if (unresolved.empty()) {
+        return dependencies;
+    }
+
+    if (!query_) {
+        std::set<std::string> names;
+        for (auto const* p : unresolved) {
+            names.insert(p->name);
+        }
+        LOG(WARN) << "Unknown system dependencies of R packages: "
+                  << string_join(names, ", ");
+        return dependencies;
+    }
+
+    LOG(INFO) << "Querying system dependencies of " << unresolved.size()
+              << " R packages";
+    dependencies.merge(RpkgDatabase::get_system_dependencies(
+        unresolved, os_release_.distribution, os_release_.release,
+        cache_dir_));
+
+    return dependencies;
+}
+
+// Derives the system dependencies of compiled R packages from their shared
+// objects (<lib>/<pkg>/libs/*.so). Each DT_NEEDED library is resolved the
+// way ld.so would and mapped to the development package of the deb that
+// owns it: the owner of its unversioned link (libfoo.so, the one the linker
+// used when the package was built) or else a -dev package built from the
+// same source. Libraries of the toolchain and R itself are left to
+// r-base-dev. Packages installed as binaries only need the runtime debs.
+class SharedLibraryDependencyResolver {
+  public:
+    struct Result {
+        std::unordered_set<std::string> packages;
+        // the R packages with shared objects whose libraries were all found
+        std::unordered_set<RPackage const*> resolved;
+    };
+
+    SharedLibraryDependencyResolver(DpkgDatabase const& dpkg_database,
+                                    LdSoCache const& ld_so_cache,
+                                    bool development = true)
+        : dpkg_database_{dpkg_database}, ld_so_cache_{ld_so_cache},
+          development_{development} {}
+
+    [[nodiscard]] Result
+    resolve(std::unordered_set<RPackage const*> const& pkgs) const;
+
+  private:
+    static constexpr std::array<std::string_view, 7> kToolchainPackages{
+        "libc6",       "libgcc-s1",    "libstdc++6", "libgfortran5",
+        "libquadmath0", "libgomp1",    "r-base-core"};
+
+    // the package name without the architecture
+    static std::string_view base_name(DebPackage const& pkg) {
+        std::string_view name{pkg.name};
+        return name.substr(0, name.find(':'));
+    }
+
+    [[nodiscard]] DebPackage const* owner(fs::path const& path) const;
+    // the package to install for the library, nullptr if none owns it
+    [[nodiscard]] DebPackage const* package(fs::path const& library) const;
+    [[nodiscard]] DebPackage const*
+    development_package(fs::path const& library, DebPackage const& owner) const;
+
+    DpkgDatabase const& dpkg_database_;
+    LdSoCache const& ld_so_cache_;
+    bool development_;
+    SymlinkResolver symlink_resolver_;
+};
+
+inline DebPackage const*
+SharedLibraryDependencyResolver::owner(fs::path const& path) const {
+    std::error_code ec;
+    auto aliases = symlink_resolver_.resolve_symlinks(path);
+    if (auto canonical = fs::weakly_canonical(path, ec); !ec) {
+        aliases.insert(canonical);
+    }
+
+    for (auto const& alias : aliases) {
+        if (auto const* pkg = dpkg_database_.lookup_by_path(alias)) {
+            return pkg;
+        }
+    }
+    return nullptr;
+}
+
+inline DebPackage const* SharedLibraryDependencyResolver::development_package(
+    fs::path const& library, DebPackage const& owner) const {
+    auto name = library.filename().string();
+    if (auto so = name.find(".so"); so != std::string::npos) {
+        auto link = library.parent_path() / name.substr(0, so + 3);
+        if (auto const* pkg = this->owner(link); pkg && pkg != &owner) {
+            return pkg;
+        }
+    }
+
+    // the one with the longest common prefix, e.g. libfoo1 -> libfoo-dev
+    auto owner_name = base_name(owner);
+    auto const& source = owner.source.empty() ? std::string{owner_name}
+                                              : owner.source;
+    DebPackage const* best = nullptr;
+    std::size_t best_prefix = 0;
+    for (auto const& [_, pkg] : dpkg_database_.packages()) {
+        auto pkg_name = base_name(*pkg);
+        auto const& pkg_source = pkg->source.empty() ? std::string{pkg_name}
+                                                     : pkg->source;
+        if (pkg_source != source || !pkg_name.ends_with("-dev")) {
+            continue;
+        }
+
+        auto prefix = static_cast<std::size_t>(
+            std::ranges::mismatch(pkg_name, owner_name).in1 - pkg_name.begin());
+        if (best == nullptr || prefix > best_prefix ||
+            (prefix == best_prefix && pkg->name < best->name)) {
+            best = pkg.get();
+            best_prefix = prefix;
+        }
+    }
+    return best;
+}
+
+inline DebPackage const*
+SharedLibraryDependencyResolver::package(fs::path const& library) const {
+    auto const* pkg = owner(library);
+    if (pkg == nullptr || !development_ ||
+        std::ranges::find(kToolchainPackages, base_name(*pkg)) !=
+            kToolchainPackages.end()) {
+        return pkg;
+    }
+    if (auto const* dev = development_package(library, *pkg)) {
+        return dev;
+    }
+    LOG(DEBUG) << "No development package installed for " << pkg->name
+               << ", using it instead";
+    return pkg;
+}
+
+inline SharedLibraryDependencyResolver::Result
+SharedLibraryDependencyResolver::resolve(
+    std::unordered_set<RPackage const*> const& pkgs) const {
+    Result result;
+    // library -> the deb package to install, nullptr if not found; keyed by
+    // the path as the same soname resolves differently for the objects
+    // with their own runpath
+    std::unordered_map<fs::path, DebPackage const*> found;
+
+    for (auto const* p : pkgs) {
+        std::error_code ec;
+        auto libs = p->lib_path / p->name / "libs";
+        std::vector<fs::path> objects;
+        for (fs::recursive_directory_iterator it{libs, ec}, end;
+             !ec && it != end; it.increment(ec)) {
+            if (it->path().extension() == ".so" && it->is_regular_file(ec)) {
+                objects.push_back(it->path());
+            }
+        }
+        if (objects.empty()) {
+            continue;
+        }
+
+        bool complete = true;
+        for (auto const& object : objects) {
+            std::optional<ElfDynamicInfo> info;
+            try {
+                info = read_elf_dynamic(object);
+            } catch (std::exception const& e) {
+                LOG(DEBUG) << "Failed to read " << object << ": " << e.what();
+            }
+            if (!info) {
+                complete = false;
+                continue;
+            }
+
+            for (auto const& soname : info->needed) {
+                auto library = ld_so_cache_.resolve(soname, *info, object);
+                if (!library) {
+                    LOG(DEBUG) << "Library " << soname << " needed by "
+                               << object << " not found";
+                    complete = false;
+                    continue;
+                }
+
+                auto [it, inserted] = found.try_emplace(*library, nullptr);
+                if (inserted) {
+                    it->second = package(*library);
+                    if (it->second == nullptr) {
+                        LOG(DEBUG) << "No deb package provides " << *library
+                                   << " needed by " << object;
+                    }
+                }
+
+                auto const* pkg = it->second;
+                if (pkg == nullptr) {
+                    complete = false;
+                } else if (std::ranges::find(kToolchainPackages,
+                                             base_name(*pkg)) ==
+                           kToolchainPackages.end()) {
+                    LOG(DEBUG) << p->name << " needs " << soname << " from "
+                               << pkg->name;
+                    result.packages.insert(pkg->name);
+                }
+            }
+        }
+
+        if (complete) {
+            result.resolved.insert(p);
+        }
+    }
+
+    return result;
+}
+
+#endif // SYSREQS_H
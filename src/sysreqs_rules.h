@@ -0,0 +1,110 @@
+#ifndef SYSREQS_RULES_H
+#define SYSREQS_RULES_H
+
+#include <string_view>
+
+// The bundled rules mapping the SystemRequirements of R packages to deb
+// packages. A rule matches if any of its patterns (lowercase words or
+// phrases) occurs in the field as a whole word. The overrides replace the
+// packages for a distribution, optionally only for some of its releases.
+// Rules without packages are requirements r-base-dev already covers.
+// clang-format off
+constexpr std::string_view kBundledSysreqsRules = R"({
+  "distributions": ["debian", "ubuntu"],
+  "rules": [
+    {"patterns": ["libcurl", "curl"], "packages": ["libcurl4-openssl-dev"]},
+    {"patterns": ["openssl", "libssl"], "packages": ["libssl-dev"]},
+    {"patterns": ["libxml2", "libxml-2.0", "libxml"], "packages": ["libxml2-dev"]},
+    {"patterns": ["libxslt"], "packages": ["libxslt1-dev"]},
+    {"patterns": ["zlib", "zlib1g"], "packages": ["zlib1g-dev"]},
+    {"patterns": ["bzip2", "libbz2"], "packages": ["libbz2-dev"]},
+    {"patterns": ["liblzma", "lzma", "xz-utils"], "packages": ["liblzma-dev"]},
+    {"patterns": ["zstd", "libzstd"], "packages": ["libzstd-dev"]},
+    {"patterns": ["libarchive"], "packages": ["libarchive-dev"]},
+    {"patterns": ["libpq", "postgresql"], "packages": ["libpq-dev"]},
+    {"patterns": ["mariadb", "mysql", "libmysqlclient"], "packages": ["libmariadb-dev"]},
+    {"patterns": ["sqlite", "sqlite3", "libsqlite3"], "packages": ["libsqlite3-dev"]},
+    {"patterns": ["unixodbc", "odbc"], "packages": ["unixodbc-dev"]},
+    {"patterns": ["gdal"], "packages": ["libgdal-dev", "gdal-bin"]},
+    {"patterns": ["geos"], "packages": ["libgeos-dev"]},
+    {"patterns": ["proj", "proj.4", "libproj"], "packages": ["libproj-dev"]},
+    {"patterns": ["udunits", "udunits2", "udunits-2"], "packages": ["libudunits2-dev"]},
+    {"patterns": ["netcdf"], "packages": ["libnetcdf-dev"]},
+    {"patterns": ["hdf5"], "packages": ["libhdf5-dev"]},
+    {"patterns": ["fontconfig"], "packages": ["libfontconfig1-dev"]},
+    {
+      "patterns": ["freetype", "freetype2"],
+      "packages": ["libfreetype-dev"],
+      "overrides": [
+        {"distribution": "ubuntu", "releases": ["18.04", "20.04"], "packages": ["libfreetype6-dev"]}
+      ]
+    },
+    {"patterns": ["harfbuzz"], "packages": ["libharfbuzz-dev"]},
+    {"patterns": ["fribidi"], "packages": ["libfribidi-dev"]},
+    {"patterns": ["libpng", "png"], "packages": ["libpng-dev"]},
+    {"patterns": ["libjpeg", "jpeg", "libjpeg-turbo"], "packages": ["libjpeg-dev"]},
+    {"patterns": ["libtiff", "tiff"], "packages": ["libtiff-dev"]},
+    {"patterns": ["libwebp", "webp"], "packages": ["libwebp-dev"]},
+    {"patterns": ["cairo"], "packages": ["libcairo2-dev"]},
+    {"patterns": ["librsvg", "librsvg2"], "packages": ["librsvg2-dev"]},
+    {"patterns": ["imagemagick", "magick++", "imagemagick++"], "packages": ["libmagick++-dev"]},
+    {"patterns": ["poppler", "poppler-cpp"], "packages": ["libpoppler-cpp-dev"]},
+    {"patterns": ["qpdf"], "packages": ["libqpdf-dev"]},
+    {"patterns": ["ghostscript"], "packages": ["ghostscript"]},
+    {"patterns": ["tesseract"], "packages": ["libtesseract-dev", "libleptonica-dev"]},
+    {"patterns": ["leptonica"], "packages": ["libleptonica-dev"]},
+    {"patterns": ["libsndfile"], "packages": ["libsndfile1-dev"]},
+    {"patterns": ["ffmpeg", "libavfilter"], "packages": ["libavfilter-dev"]},
+    {"patterns": ["x11", "libx11"], "packages": ["libx11-dev"]},
+    {"patterns": ["opengl", "glu", "mesa"], "packages": ["libglu1-mesa-dev"]},
+    {"patterns": ["glib", "glib-2.0", "glib2"], "packages": ["libglib2.0-dev"]},
+    {"patterns": ["tcl/tk", "tcltk", "tk"], "packages": ["tcl-dev", "tk-dev"]},
+    {"patterns": ["glpk"], "packages": ["libglpk-dev"]},
+    {"patterns": ["gmp", "libgmp"], "packages": ["libgmp-dev"]},
+    {"patterns": ["mpfr"], "packages": ["libmpfr-dev"]},
+    {"patterns": ["fftw", "fftw3"], "packages": ["libfftw3-dev"]},
+    {"patterns": ["gsl", "gnu gsl"], "packages": ["libgsl-dev"]},
+    {"patterns": ["nlopt"], "packages": ["libnlopt-dev"]},
+    {"patterns": ["blas", "libblas"], "packages": ["libblas-dev"]},
+    {"patterns": ["lapack", "liblapack"], "packages": ["liblapack-dev"]},
+    {"patterns": ["tbb", "intel tbb"], "packages": ["libtbb-dev"]},
+    {"patterns": ["boost"], "packages": ["libboost-dev"]},
+    {"patterns": ["openmpi", "open mpi", "mpi"], "packages": ["libopenmpi-dev"]},
+    {"patterns": ["jags"], "packages": ["jags"]},
+    {"patterns": ["icu", "libicu", "icu4c"], "packages": ["libicu-dev"]},
+    {"patterns": ["pcre2", "libpcre2"], "packages": ["libpcre2-dev"]},
+    {"patterns": ["pcre", "libpcre"], "packages": ["libpcre3-dev"]},
+    {"patterns": ["libsodium", "sodium"], "packages": ["libsodium-dev"]},
+    {"patterns": ["libgit2"], "packages": ["libgit2-dev"]},
+    {"patterns": ["libssh2"], "packages": ["libssh2-1-dev"]},
+    {"patterns": ["libssh"], "packages": ["libssh-dev"]},
+    {"patterns": ["libsasl2", "cyrus sasl"], "packages": ["libsasl2-dev"]},
+    {"patterns": ["libsecret", "libsecret-1"], "packages": ["libsecret-1-dev"]},
+    {"patterns": ["gpgme"], "packages": ["libgpgme-dev"]},
+    {"patterns": ["apparmor", "libapparmor"], "packages": ["libapparmor-dev"]},
+    {"patterns": ["libuv"], "packages": ["libuv1-dev"]},
+    {"patterns": ["zeromq", "libzmq", "zmq"], "packages": ["libzmq3-dev"]},
+    {"patterns": ["protobuf", "protocol buffers"], "packages": ["libprotobuf-dev", "protobuf-compiler"]},
+    {"patterns": ["jq", "libjq"], "packages": ["libjq-dev"]},
+    {
+      "patterns": ["v8", "libv8", "libnode"],
+      "packages": ["libnode-dev"],
+      "overrides": [
+        {"distribution": "ubuntu", "releases": ["18.04"], "packages": ["libv8-dev"]}
+      ]
+    },
+    {"patterns": ["java", "jdk", "openjdk", "jre"], "packages": ["default-jdk"]},
+    {"patterns": ["python", "python3"], "packages": ["python3"]},
+    {"patterns": ["perl"], "packages": ["perl"]},
+    {"patterns": ["cargo", "rustc", "rust"], "packages": ["cargo", "rustc"]},
+    {"patterns": ["cmake"], "packages": ["cmake"]},
+    {"patterns": ["gnu make", "make"], "packages": ["make"]},
+    {"patterns": ["pkg-config", "pkgconfig"], "packages": ["pkg-config"]},
+    {"patterns": ["git"], "packages": ["git"]},
+    {"patterns": ["pandoc"], "packages": ["pandoc"]},
+    {"patterns": ["c++11", "c++14", "c++17", "c++20", "c++23", "c99", "c11"], "packages": []}
+  ]
+})";
+// clang-format on
+
+#endif // SYSREQS_RULES_H
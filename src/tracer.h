@@ -4,32 +4,44 @@
 #include "archive.h"
 #include "common.h"
 #include "config.h"
+#include "deb_archives.h"
 #include "default_image_files.h"
 #include "dockerfile.h"
 #include "dpkg_database.h"
 #include "file_tracer.h"
+#include "filesystem_trie.h"
 #include "ignore_file_map.h"
 #include "install_r_package_builder.h"
+#include "json.h"
 #include "logger.h"
 #include "manifest.h"
 #include "manifest_format.h"
 #include "manifest_section.h"
+#include "mapped_filesystem_trie.h"
 #include "process.h"
+#include "process_tree.h"
+#include "r_source_cache.h"
 #include "resolvers.h"
 #include "rpkg_database.h"
 #include "syscall_monitor.h"
+#include "sysreqs.h"
 #include "user.h"
 #include "util.h"
 #include "util_fs.h"
 #include "util_io.h"
 
-#include <cassert>
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
 
+#include <cmath>
 #include <cstdlib>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <optional>
 #include <ostream>
 #include <sstream>
 #include <stdexcept>
@@ -43,27 +55,80 @@ struct Options {
     OsRelease os_release;
     LogLevel log_level = LogLevel::Warning;
     fs::path R_bin{"R"};
+    // the R library paths, empty means the .libPaths() of R_bin
+    std::vector<fs::path> r_lib_paths;
+    RpkgDatabaseSource rpkg_database_source{RpkgDatabaseSource::Native};
     std::vector<std::string> cmd;
     std::string docker_base_image;
     std::string docker_image_tag{STR(kBinaryName << "/test")};
     std::string docker_container_name{STR(kBinaryName << "-test")};
     fs::path output_dir{"."};
     fs::path makefile;
+    // empty means no status file
+    fs::path status_file;
+    // where the caches shared between runs are kept, empty disables them
+    fs::path cache_dir{get_user_cache_dir() / kBinaryName};
     fs::path default_image_file{get_user_cache_dir() / kBinaryName /
                                 (docker_base_image + ".cache")};
     AbsolutePathSet results;
     bool docker_sudo_access{true};
     bool run_make{true};
     bool skip_manifest{false};
+    // check the files resolved to deb packages against the dpkg md5sums
+    bool verify_deb_files{true};
+    // query the system dependencies the bundled rules cannot resolve
+    bool query_sysreqs{true};
+    // the seconds installing each R package took, empty means none
+    fs::path r_install_times;
+    // the Posit package manager (compatible) CRAN mirror and its snapshot
+    // (a date or latest) to install binary R packages from, empty snapshot
+    // means all are built from source
+    std::string r_binary_mirror{"https://packagemanager.posit.co/cran"};
+    std::string r_binary_snapshot;
+    // where the source tarballs of the R packages are downloaded from
+    std::string cran_mirror{"https://cloud.r-project.org"};
+    // download the R package sources on the host into the build context
+    bool prefetch_r_sources{false};
+    // ship the R packages installed on the host instead of installing them
+    // in the image, the base image must run the same release
+    bool ship_r_binaries{false};
+    // ship the .deb archives of the host packages instead of downloading
+    // them in the image
+    bool ship_deb_archives{false};
+    // generate the Dockerfile for BuildKit, keeping the apt and R downloads
+    // and the compiler cache in cache mounts between the builds
+    bool buildkit{false};
     IgnoreFileMap ignore_file_map;
 };
 
 struct TracerState {
-    DpkgDatabase dpkg_database;
-    std::unique_ptr<RpkgDatabase> rpkg_database;
+    // loaded in the background while the program is being traced, a task
+    // waits for them only once it needs them
+    std::shared_future<MappedFileSystemTrie<bool>> default_image_files;
+    std::shared_future<DpkgDatabase> dpkg_database;
+    std::shared_future<RpkgDatabase> rpkg_database;
 
     std::vector<FileInfo> traced_files;
     std::map<fs::path, fs::path> traced_symlinks;
+    // the number of traced files resolved by each of the resolvers
+    std::map<std::string, std::size_t> resolved_files;
+    // the R packages to install from the binary repository
+    std::unordered_set<RPackage const*> r_binary_packages;
+    // the source tarballs of the rest of the R packages
+    std::unordered_map<RPackage const*, RSourceTarball> r_source_tarballs;
+    // the directory of the build context with the prefetched tarballs,
+    // empty if they are downloaded in the image
+    fs::path r_sources_dir;
+    // the R packages shipped from the host library
+    std::unordered_set<RPackage const*> r_host_binaries;
+    // the directory of the build context with their binary tarballs
+    fs::path r_binaries_dir;
+    // the deb packages whose archives are in the build context
+    std::unordered_set<DebPackage const*> deb_archives;
+    // the directory of the build context with the archives
+    fs::path deb_archives_dir;
+    // what the traced program needed, for sizing its container
+    ProcessTree::ResourceUsage resource_usage;
 
     Manifest manifest;
 };
@@ -94,28 +159,52 @@ static constexpr std::string_view kDefaultTimezone{"UTC"};
 
 class FileTracingTask : public Task {
   public:
-    explicit FileTracingTask(IgnoreFileMap const* ignore_file_map)
-        : Task("Trace files"), ignore_file_map_{ignore_file_map} {}
+    FileTracingTask(IgnoreFileMap const* ignore_file_map, fs::path output_dir,
+                    fs::path status_file)
+        : Task("Trace files"), ignore_file_map_{ignore_file_map},
+          process_tree_file_{output_dir / "process-tree.json"},
+          process_trace_file_{output_dir / "process-trace.json"},
+          status_file_{std::move(status_file)} {}
 
     void run(TracerState& state) override;
     void stop() override;
 
   private:
+    void save_process_tree(ProcessTree const& tree) const;
+
     IgnoreFileMap const* ignore_file_map_;
+    fs::path process_tree_file_;
+    fs::path process_trace_file_;
+    fs::path status_file_;
     SyscallMonitor* monitor_{};
 };
 
 inline void FileTracingTask::run(TracerState& state) {
     LOG(INFO) << "Tracing program: " << string_join(state.manifest.cmd, ' ');
 
+    auto ignore_file_map = *ignore_file_map_;
+    ignore_file_map.add_files(state.default_image_files.get());
+
     // silent the log while running the program not to interfere with the
     // output of the traced program
     auto old_log_sink = Logger::get().set_sink(std::make_unique<StoreSink>());
 
-    FileTracer tracer{ignore_file_map_};
+    FileTracer tracer{&ignore_file_map};
+
+    std::optional<TracingStatusFile> status_file;
+    if (!status_file_.empty()) {
+        LOG(INFO) << "Tracing status will be written to: " << status_file_;
+        status_file.emplace(status_file_);
+        tracer.set_status_file(&*status_file);
+    }
+
     SyscallMonitor monitor{state.manifest.cmd, tracer};
     monitor.redirect_stdout(std::cout);
     monitor.redirect_stderr(std::cerr);
+    if (status_file) {
+        // a blocked tracee makes no syscalls
+        monitor.set_tick_interval(status_file->interval());
+    }
 
     // this is just to support the stop()
     monitor_ = &monitor;
@@ -129,6 +218,11 @@ inline void FileTracingTask::run(TracerState& state) {
               << tracer.files().size() << " files, " << tracer.symlinks().size()
               << " symlinks";
 
+    tracer.process_tree().finish();
+    tracer.report_status(false);
+    save_process_tree(tracer.process_tree());
+    state.resource_usage = tracer.process_tree().resource_usage();
+
     // print the postponed messages
     auto sink = Logger::get().set_sink(std::move(old_log_sink));
     auto const& events = dynamic_cast<StoreSink*>(sink.get())->get_messages();
@@ -171,6 +265,21 @@ inline void FileTracingTask::run(TracerState& state) {
     }
 }
 
+inline void
+FileTracingTask::save_process_tree(ProcessTree const& tree) const {
+    LOG(INFO) << "Traced " << tree.processes().size()
+              << " process(es), saving the process tree to "
+              << process_tree_file_ << " and the timeline to "
+              << process_trace_file_;
+
+    try {
+        std::ofstream{process_tree_file_} << tree.to_json();
+        std::ofstream{process_trace_file_} << tree.to_chrome_trace();
+    } catch (std::exception const& e) {
+        LOG(WARN) << "Failed to save the process tree: " << e.what();
+    }
+}
+
 inline void FileTracingTask::stop() {
     if (monitor_) {
         monitor_->stop();
@@ -180,26 +289,35 @@ inline void FileTracingTask::stop() {
 // We do not need this composition, each of the resolver can now be a task
 class ResolveFileTask : public Task {
   public:
-    explicit ResolveFileTask(fs::path R_bin)
-        : Task("Resolve files"), R_bin_{std::move(R_bin)} {}
+    // empty cache_dir disables the file hash cache
+    ResolveFileTask(bool verify_deb_files, fs::path cache_dir)
+        : Task("Resolve files"), verify_deb_files_{verify_deb_files},
+          cache_dir_{std::move(cache_dir)} {}
 
     void run(TracerState& state) override;
 
   private:
-    fs::path R_bin_;
+    bool verify_deb_files_;
+    fs::path cache_dir_;
 };
 
 inline void ResolveFileTask::run(TracerState& state) {
     std::vector<std::pair<std::string, std::unique_ptr<Resolver>>> resolvers;
 
-    state.rpkg_database =
-        std::make_unique<RpkgDatabase>(RpkgDatabase::from_R(R_bin_));
+    std::optional<DebFileVerifier> verifier;
+    if (verify_deb_files_) {
+        verifier.emplace(fs::path{kDpkgInfoDir},
+                         cache_dir_.empty() ? fs::path{}
+                                            : cache_dir_ / "md5sums.cache");
+    }
 
     resolvers.emplace_back(
-        "deb", std::make_unique<DebPackageResolver>(&state.dpkg_database));
+        "deb", std::make_unique<DebPackageResolver>(
+                   &state.dpkg_database.get(),
+                   verifier.has_value() ? &*verifier : nullptr));
 
-    resolvers.emplace_back(
-        "R", std::make_unique<RPackageResolver>(state.rpkg_database.get()));
+    resolvers.emplace_back("R", std::make_unique<RPackageResolver>(
+                                    &state.rpkg_database.get()));
 
     resolvers.emplace_back("copy", std::make_unique<CopyFileResolver>());
 
@@ -212,8 +330,9 @@ inline void ResolveFileTask::run(TracerState& state) {
         size_t count = state.traced_files.size();
         resolver->resolve(state.traced_files, state.traced_symlinks,
                           state.manifest);
-        summary +=
-            STR(name << "(" << (count - state.traced_files.size()) << ") ");
+        auto resolved = count - state.traced_files.size();
+        state.resolved_files[name] = resolved;
+        summary += STR(name << "(" << resolved << ") ");
     }
 
     LOG(INFO) << "Resolver summary: " << total_count << " file(s): " << summary;
@@ -343,60 +462,290 @@ inline bool EditManifestTask::open_manifest(fs::path const& path) {
     return true;
 }
 
+// Finds the R packages the binary repository has in their exact versions so
+// they need not to be compiled.
+class ResolveRBinaryPackagesTask : public Task {
+  public:
+    explicit ResolveRBinaryPackagesTask(std::string repository)
+        : Task("Resolve binary R packages"),
+          repository_{std::move(repository)} {}
+
+    void run(TracerState& state) override {
+        auto deps = state.rpkg_database.get().get_dependencies(
+            state.manifest.r_packages);
+        std::unordered_set<RPackage const*> pkgs;
+        std::ranges::copy_if(deps, std::inserter(pkgs, pkgs.end()),
+                             [](auto const* pkg) { return !pkg->is_base; });
+
+        state.r_binary_packages =
+            RpkgDatabase::get_binary_packages(pkgs, repository_);
+
+        LOG(INFO) << state.r_binary_packages.size() << " of " << pkgs.size()
+                  << " R packages will be installed from " << repository_;
+    }
+
+  private:
+    std::string repository_;
+};
+
+// Resolves the URLs of the source tarballs of the R packages that are not
+// installed as binaries so the image need not to look them up.
+class ResolveRPackageSourcesTask : public Task {
+  public:
+    explicit ResolveRPackageSourcesTask(std::string cran_mirror)
+        : Task("Resolve R package sources"),
+          cran_mirror_{std::move(cran_mirror)} {}
+
+    void run(TracerState& state) override {
+        std::unordered_set<RPackage const*> pkgs;
+        for (auto const* pkg : state.manifest.r_packages) {
+            if (!pkg->is_base && !state.r_binary_packages.contains(pkg) &&
+                !state.r_host_binaries.contains(pkg)) {
+                pkgs.insert(pkg);
+            }
+        }
+        if (pkgs.empty()) {
+            return;
+        }
+
+        // the packed host binaries are already there
+        state.r_source_tarballs.merge(
+            RpkgDatabase::get_source_tarballs(pkgs, cran_mirror_));
+    }
+
+  private:
+    std::string cran_mirror_;
+};
+
+// Downloads the source tarballs of the R packages into the shared cache and
+// puts them into the build context so the image needs no network for them.
+class PrefetchRPackageSourcesTask : public Task {
+  public:
+    // Without a cache_dir, the tarballs are downloaded for each build into
+    // a temporary directory (outside of the build context).
+    PrefetchRPackageSourcesTask(fs::path cache_dir, fs::path output_dir)
+        : Task("Prefetch R package sources"), cache_dir_{std::move(cache_dir)},
+          sources_dir_{std::move(output_dir) / "r-sources"} {}
+
+    void run(TracerState& state) override;
+
+  private:
+    fs::path cache_dir_;
+    fs::path sources_dir_;
+};
+
+inline void PrefetchRPackageSourcesTask::run(TracerState& state) {
+    std::unordered_map<RPackage const*, RSourceTarball> tarballs;
+    for (auto const& [pkg, tarball] : state.r_source_tarballs) {
+        if (state.manifest.r_packages.contains(pkg) && !tarball.urls.empty()) {
+            tarballs.emplace(pkg, tarball);
+        }
+    }
+    if (tarballs.empty()) {
+        return;
+    }
+
+    std::optional<TempDir> tmp;
+    auto cache_dir = cache_dir_;
+    if (cache_dir.empty()) {
+        tmp.emplace("r4r-r-sources-");
+        cache_dir = **tmp;
+    }
+    auto files = RSourceCache{cache_dir}.fetch(tarballs);
+
+    fs::remove_all(sources_dir_);
+    fs::create_directories(sources_dir_);
+    for (auto const& [pkg, file] : files) {
+        auto dest =
+            sources_dir_ / InstallRPackageScriptBuilder::tarball_name(*pkg);
+        std::error_code ec;
+        fs::create_hard_link(file, dest, ec);
+        if (ec) {
+            fs::copy_file(file, dest);
+        }
+        // already in place
+        state.r_source_tarballs[pkg].urls.clear();
+    }
+    state.r_sources_dir = sources_dir_;
+
+    LOG(INFO) << "Prefetched " << files.size() << " of " << tarballs.size()
+              << " R package sources into " << sources_dir_;
+}
+
+// Picks the R packages installed in the host library to be shipped as they
+// are, taking precedence over the binary repository.
+class ResolveRHostBinariesTask : public Task {
+  public:
+    ResolveRHostBinariesTask() : Task("Resolve host R binaries") {}
+
+    void run(TracerState& state) override {
+        auto deps = state.rpkg_database.get().get_dependencies(
+            state.manifest.r_packages);
+        std::size_t total = 0;
+        for (auto const* pkg : deps) {
+            if (pkg->is_base) {
+                continue;
+            }
+            ++total;
+
+            std::error_code ec;
+            if (!fs::exists(pkg->lib_path / pkg->name / "DESCRIPTION", ec)) {
+                LOG(DEBUG) << "R package: " << pkg->name
+                           << " is not installed in " << pkg->lib_path;
+                continue;
+            }
+            state.r_host_binaries.insert(pkg);
+            state.r_binary_packages.erase(pkg);
+        }
+
+        LOG(INFO) << state.r_host_binaries.size() << " of " << total
+                  << " R packages will be shipped from the host";
+    }
+};
+
+// Packs the R packages shipped from the host into binary tarballs in the
+// build context, installed in the image with R CMD INSTALL without any
+// compilation. It runs before the system dependencies and the sources are
+// resolved so the packages that failed to pack get both and are installed
+// from source instead.
+class PackRHostBinariesTask : public Task {
+  public:
+    explicit PackRHostBinariesTask(fs::path output_dir,
+                                   std::size_t parallel = 8)
+        : Task("Pack host R binaries"),
+          binaries_dir_{std::move(output_dir) / "r-binaries"},
+          parallel_{parallel} {}
+
+    void run(TracerState& state) override;
+
+  private:
+    fs::path binaries_dir_;
+    std::size_t parallel_;
+};
+
+inline void PackRHostBinariesTask::run(TracerState& state) {
+    std::vector<RPackage const*> pkgs;
+    std::vector<std::pair<fs::path, fs::path>> tarballs;
+    for (auto const* pkg : state.r_host_binaries) {
+        pkgs.push_back(pkg);
+        tarballs.emplace_back(pkg->lib_path / pkg->name,
+                              binaries_dir_ /
+                                  InstallRPackageScriptBuilder::tarball_name(
+                                      *pkg));
+    }
+    if (pkgs.empty()) {
+        return;
+    }
+
+    fs::remove_all(binaries_dir_);
+    fs::create_directories(binaries_dir_);
+    auto created = create_r_binary_tarballs(tarballs, parallel_);
+
+    for (std::size_t i = 0; i < pkgs.size(); ++i) {
+        auto const* pkg = pkgs[i];
+        std::error_code ec;
+        if (fs::exists(tarballs[i].second, ec)) {
+            // already in place
+            state.r_source_tarballs[pkg] = {};
+        } else {
+            LOG(WARN) << "R package: " << pkg->name
+                      << " will be installed from source";
+            state.r_host_binaries.erase(pkg);
+        }
+    }
+    state.r_binaries_dir = binaries_dir_;
+
+    LOG(INFO) << "Packed " << created << " of " << pkgs.size()
+              << " host R packages into " << binaries_dir_;
+}
+
 class ResolveRPackageSystemDependencies : public Task {
   public:
-    explicit ResolveRPackageSystemDependencies(OsRelease os_release)
+    // empty cache_dir disables the cache of the queried system dependencies
+    ResolveRPackageSystemDependencies(OsRelease os_release, fs::path cache_dir,
+                                      bool query_sysreqs)
         : Task("Resolve R package system dependencies"),
-          os_release_{std::move(os_release)} {}
+          os_release_{std::move(os_release)}, cache_dir_{std::move(cache_dir)},
+          query_sysreqs_{query_sysreqs} {}
 
     void run(TracerState& state) override;
 
   private:
     OsRelease os_release_;
+    fs::path cache_dir_;
+    bool query_sysreqs_;
 };
 
 inline void ResolveRPackageSystemDependencies::run(TracerState& state) {
-    assert(state.rpkg_database);
-
     auto& manifest = state.manifest;
 
     std::unordered_set<RPackage const*> compiled_packages;
+    std::unordered_set<RPackage const*> binary_packages;
     for (auto const* pkg :
-         state.rpkg_database->get_dependencies(manifest.r_packages)) {
+         state.rpkg_database.get().get_dependencies(manifest.r_packages)) {
         if (pkg->is_base) {
             continue;
         }
 
         if (pkg->needs_compilation) {
-            compiled_packages.insert(pkg);
-            LOG(DEBUG) << "R package: " << pkg->name << " " << pkg->version
-                       << " needs compilation";
+            if (state.r_binary_packages.contains(pkg) ||
+                state.r_host_binaries.contains(pkg)) {
+                binary_packages.insert(pkg);
+            } else {
+                compiled_packages.insert(pkg);
+                LOG(DEBUG) << "R package: " << pkg->name << " "
+                           << pkg->version << " needs compilation";
+            }
         }
 
         manifest.r_packages.insert(pkg);
     }
 
-    if (compiled_packages.empty()) {
+    if (compiled_packages.empty() && binary_packages.empty()) {
         return;
     }
 
-    LOG(INFO) << "There are " << compiled_packages.size()
-              << " R packages that needs compilation, need to "
-                 "pull system dependencies";
+    auto const& dpkg_database = state.dpkg_database.get();
+    LdSoCache ld_so_cache;
+    std::unordered_set<std::string> deb_packages;
 
-    auto deb_packages = RpkgDatabase::get_system_dependencies(
-        compiled_packages, os_release_.distribution, os_release_.release);
+    // the binaries only need the libraries they link against
+    if (!binary_packages.empty()) {
+        deb_packages =
+            SharedLibraryDependencyResolver{dpkg_database, ld_so_cache, false}
+                .resolve(binary_packages)
+                .packages;
+    }
 
-    // bring in R headers and R development dependencies (includes
-    // build-essential, gfortran, ...)
-    deb_packages.insert("r-base-dev");
+    if (!compiled_packages.empty()) {
+        LOG(INFO) << "There are " << compiled_packages.size()
+                  << " R packages that needs compilation, need to "
+                     "pull system dependencies";
+
+        // the packages whose shared objects tell what they link against
+        // need not to be looked up
+        auto [dev_packages, resolved] =
+            SharedLibraryDependencyResolver{dpkg_database, ld_so_cache}
+                .resolve(compiled_packages);
+        LOG(DEBUG) << "Resolved system dependencies of " << resolved.size()
+                   << " R packages from their shared objects";
+        deb_packages.merge(dev_packages);
+
+        auto sysreqs =
+            SystemDependencyResolver{os_release_, cache_dir_, query_sysreqs_}
+                .resolve(compiled_packages, resolved);
+        deb_packages.merge(sysreqs);
+
+        // bring in R headers and R development dependencies (includes
+        // build-essential, gfortran, ...)
+        deb_packages.insert("r-base-dev");
+    }
 
     for (auto const& name : deb_packages) {
-        auto const* pkg = state.dpkg_database.lookup_by_name(name);
+        auto const* pkg = dpkg_database.lookup_by_name(name);
         if (pkg == nullptr) {
             LOG(WARN) << "Failed to find " << name
-                      << " package needed "
-                         "by R packages to be built from source";
+                      << " package needed by R packages";
         } else {
             auto it = manifest.deb_packages.insert(pkg);
             if (it.second) {
@@ -407,10 +756,34 @@ inline void ResolveRPackageSystemDependencies::run(TracerState& state) {
     }
 }
 
+// Collects the archives of the traced deb packages and of the ones the image
+// setup installs (installed on the host) so the image can install them all
+// offline.
+class CollectDebArchivesTask : public Task {
+  public:
+    CollectDebArchivesTask(fs::path output_dir, bool docker_sudo_access,
+                           bool buildkit)
+        : Task("Collect deb archives"),
+          archives_dir_{std::move(output_dir) / "debs"},
+          docker_sudo_access_{docker_sudo_access}, buildkit_{buildkit} {}
+
+    void run(TracerState& state) override;
+
+  private:
+    fs::path archives_dir_;
+    bool docker_sudo_access_;
+    bool buildkit_;
+};
+
 class DockerFileBuilderTask : public Task {
   public:
+    // empty r_install_times means no history of the R package install times,
+    // empty r_binary_repository that all R packages are built from source
     explicit DockerFileBuilderTask(fs::path output_dir, std::string base_image,
-                                   bool docker_sudo_access)
+                                   bool docker_sudo_access,
+                                   fs::path r_install_times = {},
+                                   std::string r_binary_repository = {},
+                                   bool buildkit = false)
         : Task("Create Dockerfile"), output_dir_{std::move(output_dir)},
           archive_{output_dir_ / "archive.tar"},
           pre_file_copy_script_{output_dir_ / "pre_file_copy.sh"},
@@ -418,13 +791,26 @@ class DockerFileBuilderTask : public Task {
           cran_install_script_{output_dir_ / "install_r_packages.R"},
           dockerfile_{output_dir_ / "Dockerfile"},
           base_image_{std::move(base_image)},
-          docker_sudo_access_{docker_sudo_access} {}
+          docker_sudo_access_{docker_sudo_access},
+          r_install_times_{std::move(r_install_times)},
+          r_binary_repository_{std::move(r_binary_repository)},
+          buildkit_{buildkit} {}
 
     void run(TracerState& state) override;
 
+    // the deb packages the rest of the image setup installs
+    static std::vector<std::string>
+    setup_deb_packages(TracerState const& state, bool docker_sudo_access,
+                       bool buildkit);
+
   private:
-    static void install_deb_packages(DockerFileBuilder& builder,
-                                     Manifest const& manifest);
+    static constexpr char const* kCcacheDir = "/var/cache/r4r-ccache";
+
+    // whether some of the R packages are compiled in the image
+    static bool compiles_r_packages(TracerState const& state);
+
+    void install_deb_packages(DockerFileBuilder& builder,
+                              TracerState const& state) const;
 
     static void
     generate_pre_file_copy_script(std::vector<fs::path> const& directories,
@@ -446,8 +832,7 @@ class DockerFileBuilderTask : public Task {
     void copy_files(DockerFileBuilder& builder, Manifest const& manifest) const;
 
     void install_r_packages(DockerFileBuilder& builder,
-                            Manifest const& manifest,
-                            RpkgDatabase const& rpkg_database) const;
+                            TracerState const& state) const;
 
     void create_user(DockerFileBuilder& builder,
                      Manifest const& manifest) const;
@@ -460,24 +845,26 @@ class DockerFileBuilderTask : public Task {
     fs::path dockerfile_;
     fs::path base_image_;
     bool docker_sudo_access_{false};
+    fs::path r_install_times_;
+    std::string r_binary_repository_;
+    bool buildkit_{false};
 };
 
 inline void DockerFileBuilderTask::run(TracerState& state) {
-    assert(state.rpkg_database);
-
     LOG(INFO) << "Generating Dockerfile: " << dockerfile_;
 
-    DockerFileBuilder builder{base_image_, output_dir_};
+    DockerFileBuilder builder{base_image_, output_dir_, buildkit_};
 
     builder.env("DEBIAN_FRONTEND", "noninteractive");
 
     Manifest const& manifest{state.manifest};
 
+    // a single apt step installs the packages the rest of the setup needs
+    install_deb_packages(builder, state);
     set_lang_and_timezone(builder, manifest);
     create_user(builder, manifest);
 
-    install_deb_packages(builder, manifest);
-    install_r_packages(builder, manifest, *state.rpkg_database);
+    install_r_packages(builder, state);
     copy_files(builder, manifest);
 
     set_environment(builder, manifest);
@@ -582,9 +969,11 @@ inline void DockerFileBuilderTask::generate_post_file_copy_script(
     }
 }
 
-inline void DockerFileBuilderTask::install_r_packages(
-    DockerFileBuilder& builder, Manifest const& manifest,
-    RpkgDatabase const& rpkg_database) const {
+inline void
+DockerFileBuilderTask::install_r_packages(DockerFileBuilder& builder,
+                                          TracerState const& state) const {
+    auto const& manifest = state.manifest;
+    auto const& rpkg_database = state.rpkg_database.get();
     if (manifest.r_packages.empty()) {
         return;
     }
@@ -597,21 +986,101 @@ inline void DockerFileBuilderTask::install_r_packages(
 
     auto plan = rpkg_database.get_installation_plan(manifest.r_packages);
 
+    RInstallTimes install_times;
+    if (!r_install_times_.empty()) {
+        try {
+            install_times = load_r_install_times(r_install_times_);
+        } catch (std::exception const& e) {
+            LOG(WARN) << "Failed to load the R package install times: "
+                      << e.what();
+        }
+    }
+
+    InstallRPackageScriptBuilder script;
     {
         std::ofstream script_out(cran_install_script_);
 
-        InstallRPackageScriptBuilder script;
+        // as many jobs as the cores and memory of the build machine allow
         script.set_plan(plan)
             .set_output(script_out)
-            // TODO: make it an option
-            .set_max_parallel(24)
+            .set_schedule(InstallSchedule::CriticalPath)
+            .set_install_times(std::move(install_times))
+            .set_binary_repository(r_binary_repository_,
+                                   state.r_binary_packages)
+            .set_source_tarballs(state.r_source_tarballs)
+            .set_max_parallel(0)
             .build();
     }
 
+    // the shipped tarballs are linked into the directory the script takes
+    // them from
+    std::vector<BindMount> mounts;
+    if (!state.r_sources_dir.empty()) {
+        mounts.push_back(
+            {.source = state.r_sources_dir, .target = "/tmp/r4r-r-sources"});
+    }
+    if (!state.r_binaries_dir.empty()) {
+        mounts.push_back(
+            {.source = state.r_binaries_dir, .target = "/tmp/r4r-r-binaries"});
+    }
+    bool shipped_tarballs = !mounts.empty();
     builder.copy({cran_install_script_}, "/");
+
+    std::string env;
+    std::vector<std::string> cache_dirs;
+    if (buildkit_ && compiles_r_packages(state)) {
+        // the compilers are picked from the PATH
+        env = STR("PATH=/usr/lib/ccache:$PATH CCACHE_DIR=" << kCcacheDir
+                                                            << " ");
+        cache_dirs.emplace_back(kCcacheDir);
+    }
+    // the downloaded tarballs are kept unless the shipped ones are linked
+    // into the cache
+    bool cache_tarballs = buildkit_ && !shipped_tarballs;
+    if (cache_tarballs) {
+        cache_dirs.push_back(script.tarball_dir());
+    }
+
     // TODO: simplify
-    builder.run({STR("Rscript /" << cran_install_script_.filename().string()),
-                 STR("rm -f /" << cran_install_script_.filename().string())});
+    std::vector<std::string> commands;
+    if (shipped_tarballs) {
+        commands.push_back(STR("mkdir -p " << script.tarball_dir()));
+    }
+    for (auto const& mount : mounts) {
+        commands.push_back(STR("cp -rs " << mount.target << "/. "
+                                         << script.tarball_dir() << "/"));
+    }
+    commands.push_back(
+        STR(env << "Rscript /" << cran_install_script_.filename().string()));
+    commands.push_back(
+        STR("rm -f /" << cran_install_script_.filename().string()));
+    if (!cache_tarballs) {
+        commands.push_back(STR("rm -rf " << script.tarball_dir()));
+    }
+    builder.run(commands, cache_dirs, mounts);
+}
+
+inline std::vector<std::string>
+DockerFileBuilderTask::setup_deb_packages(TracerState const& state,
+                                          bool docker_sudo_access,
+                                          bool buildkit) {
+    std::vector<std::string> pkgs{"locales", "tzdata"};
+    if (docker_sudo_access) {
+        pkgs.emplace_back("sudo");
+    }
+    if (buildkit && compiles_r_packages(state)) {
+        pkgs.emplace_back("ccache");
+    }
+    return pkgs;
+}
+
+inline bool
+DockerFileBuilderTask::compiles_r_packages(TracerState const& state) {
+    return std::ranges::any_of(state.manifest.r_packages, [&](auto const* pkg) {
+        return !pkg->is_base && pkg->needs_compilation &&
+               !state.r_binary_packages.contains(pkg) &&
+               !state.r_host_binaries.contains(pkg);
+    });
 }
 
 inline void
@@ -626,11 +1095,10 @@ DockerFileBuilderTask::set_lang_and_timezone(DockerFileBuilder& builder,
         tz = it->second;
     }
 
+    // locales and tzdata are installed with the deb packages
     builder.env("LANG", lang);
     builder.env("TZ", tz);
-    builder.run({"apt-get update -y",
-                 "apt-get install -y --no-install-recommends locales tzdata",
-                 "echo $LANG >> /etc/locale.gen", "locale-gen $LANG",
+    builder.run({"echo $LANG >> /etc/locale.gen", "locale-gen $LANG",
                  "update-locale LANG=$LANG"});
 }
 
@@ -679,10 +1147,8 @@ inline void DockerFileBuilderTask::create_user(DockerFileBuilder& builder,
     cmds.push_back(STR("chown " << user.username << ":" << user.group.name
                                 << " " << user.home_directory));
 
-    // sudo?
+    // sudo? (installed with the deb packages)
     if (docker_sudo_access_) {
-        cmds.emplace_back("apt-get update -y");
-        cmds.emplace_back("apt-get install -y sudo");
         cmds.push_back(STR("echo '"
                            << user.username
                            << " ALL=(ALL) NOPASSWD:ALL' > /etc/sudoers.d/"
@@ -750,55 +1216,140 @@ inline void DockerFileBuilderTask::prepare_command(DockerFileBuilder& builder,
 
 inline void
 DockerFileBuilderTask::install_deb_packages(DockerFileBuilder& builder,
-                                            Manifest const& manifest) {
+                                            TracerState const& state) const {
+    auto const& manifest = state.manifest;
+
     // TODO: the main problem with this implementation is that
     // it ignores the fact a package can come from multiple repos
     // and that these repos need to be installed.
 
-    if (manifest.deb_packages.empty()) {
-        return;
-    }
-
     std::vector<std::string> pkgs;
     std::unordered_set<std::string> seen;
+    std::unordered_set<std::string> names;
     pkgs.reserve(manifest.deb_packages.size());
 
     for (auto const& pkg : manifest.deb_packages) {
+        names.insert(pkg->name.substr(0, pkg->name.find(':')));
+        if (state.deb_archives.contains(pkg)) {
+            continue;
+        }
         std::string p = pkg->name + "=" + pkg->version;
         if (seen.insert(p).second) {
             pkgs.push_back(p);
         }
     }
+    // including the setup ones which need not to be in the manifest
+    for (auto const* pkg : state.deb_archives) {
+        names.insert(pkg->name.substr(0, pkg->name.find(':')));
+    }
+
+    // the ones the rest of the setup needs, unless already pinned
+    for (auto const& name :
+         setup_deb_packages(state, docker_sudo_access_, buildkit_)) {
+        if (!names.contains(name)) {
+            pkgs.push_back(name);
+        }
+    }
 
     std::sort(pkgs.begin(), pkgs.end());
+    // all of them are in the archives
+    bool offline = !state.deb_archives.empty() && pkgs.empty();
+
+    std::string const debs_dir = "/tmp/r4r-debs";
+    std::vector<BindMount> mounts;
+    if (!state.deb_archives.empty()) {
+        mounts.push_back(
+            {.source = state.deb_archives_dir, .target = debs_dir});
+        pkgs.insert(pkgs.begin(), debs_dir + "/*.deb");
+    }
 
     std::string line = string_join(pkgs, " \\\n      ");
+    std::string install = "apt-get install -y --no-install-recommends " + line;
+
+    std::vector<std::string> commands;
+    if (buildkit_) {
+        // the images clean the downloaded archives which would leave the
+        // cache empty
+        commands = {"rm -f /etc/apt/apt.conf.d/docker-clean",
+                    "echo 'Binary::apt::APT::Keep-Downloaded-Packages "
+                    "\"true\";' > /etc/apt/apt.conf.d/keep-cache"};
+    }
+    if (!offline) {
+        commands.emplace_back("apt-get update -y");
+        commands.push_back(install);
+    } else {
+        // offline unless the base image misses some of their dependencies
+        commands.push_back(
+            STR(install << " || (apt-get update -y && " << install << ")"));
+    }
+    builder.run(commands, {"/var/cache/apt", "/var/lib/apt/lists"}, mounts);
+}
 
-    builder.run({
-        "apt-get update -y",
-        "apt-get install -y --no-install-recommends " + line,
-    });
+inline void CollectDebArchivesTask::run(TracerState& state) {
+    auto const& deb_packages = state.manifest.deb_packages;
+    if (deb_packages.empty()) {
+        return;
+    }
+
+    std::vector<DebPackage const*> packages{deb_packages.begin(),
+                                            deb_packages.end()};
+    auto const& dpkg_database = state.dpkg_database.get();
+    for (auto const& name : DockerFileBuilderTask::setup_deb_packages(
+             state, docker_sudo_access_, buildkit_)) {
+        auto const* pkg = dpkg_database.lookup_by_name(name);
+        if (pkg != nullptr && !deb_packages.contains(pkg)) {
+            packages.push_back(pkg);
+        }
+    }
+
+    fs::remove_all(archives_dir_);
+    state.deb_archives = DebArchives{}.collect(packages, archives_dir_);
+    state.deb_archives_dir = archives_dir_;
+
+    LOG(INFO) << "Collected " << state.deb_archives.size() << " of "
+              << packages.size() << " deb archives into " << archives_dir_;
 }
 
 class MakefileBuilderTask : public Task {
   public:
     explicit MakefileBuilderTask(fs::path makefile,
                                  std::string docker_image_tag,
-                                 std::string docker_container_name)
+                                 std::string docker_container_name,
+                                 bool buildkit = false)
         : Task("Create Makefile"), makefile_{std::move(makefile)},
           docker_image_tag_{std::move(docker_image_tag)},
-          docker_container_name_{std::move(docker_container_name)} {}
+          docker_container_name_{std::move(docker_container_name)},
+          buildkit_{buildkit} {}
 
     void run(TracerState& state) override {
         std::ofstream stream{makefile_};
 
-        generate_makefile(stream, state.manifest);
+        generate_makefile(stream, state.manifest, state.resource_usage);
 
         LOG(INFO) << "Generated Makefile: " << makefile_;
     }
 
   private:
-    void generate_makefile(std::ostream& makefile, Manifest const& manifest) {
+    // Limits the container to twice the peak memory of the traced program
+    // and to the CPUs it kept busy, the host it ran on might be a lot
+    // bigger than the one running the image.
+    static std::string
+    docker_run_options(ProcessTree::ResourceUsage const& usage) {
+        std::vector<std::string> opts;
+        if (usage.max_rss > 0) {
+            // in MiB, at least the 6 docker allows
+            auto memory = std::max(6L, (2 * usage.max_rss + 1023) / 1024);
+            opts.push_back(STR("--memory=" << memory << "m"));
+        }
+        if (usage.cpus > 0) {
+            auto cpus = std::max(1.0, std::ceil(usage.cpus));
+            opts.push_back(STR("--cpus=" << cpus));
+        }
+        return string_join(opts, ' ');
+    }
+
+    void generate_makefile(std::ostream& makefile, Manifest const& manifest,
+                           ProcessTree::ResourceUsage const& usage) {
         // TODO: make sure it executes in the same dir as the makefile
         // MAKEFILE_DIR := $(dir $(realpath $(lastword $(MAKEFILE_LIST))))
 
@@ -816,6 +1367,10 @@ class MakefileBuilderTask : public Task {
                  << "\n"
                  // TODO: add to settings
                  << "TARGET_DIR = result"
+                 << "\n"
+                 << "# sized from the traced run, override it if the program "
+                    "needs more\n"
+                 << "DOCKER_RUN_OPTS = " << docker_run_options(usage)
                  << "\n\n"
 
                  << "SHELL := /bin/bash\n"
@@ -831,7 +1386,8 @@ class MakefileBuilderTask : public Task {
                  // clang-format off
                  << "build:\n"
                  << "\t@echo 'Building docker image $(IMAGE_TAG)'\n"
-                 << "\t@docker build " << (progress ? "--progress=plain" : " ") << " -t $(IMAGE_TAG) . 2>&1"
+                 << "\t@" << (buildkit_ ? "DOCKER_BUILDKIT=1 " : "")
+                 << "docker build " << (progress ? "--progress=plain" : " ") << " -t $(IMAGE_TAG) . 2>&1"
                  << " | tee docker-build.log"
                  << "\n\n"
                  // clang-format on
@@ -839,7 +1395,7 @@ class MakefileBuilderTask : public Task {
                  // clang-format off
                  << "run: build\n"
                  << "\t@echo 'Running container $(CONTAINER_NAME)'\n"
-                 << "\t@docker run -t --name $(CONTAINER_NAME) $(IMAGE_TAG) 2>&1"
+                 << "\t@docker run -t $(DOCKER_RUN_OPTS) --name $(CONTAINER_NAME) $(IMAGE_TAG) 2>&1"
                  << " | tee docker-run.log"
                  << "\n\n"
                  // clang-format on
@@ -893,6 +1449,7 @@ class MakefileBuilderTask : public Task {
     fs::path makefile_;
     std::string docker_image_tag_;
     std::string docker_container_name_;
+    bool buildkit_;
 };
 
 class RunMakefileTask : public Task {
@@ -932,6 +1489,62 @@ class RunMakefileTask : public Task {
     fs::path makefile_;
 };
 
+// Brings the R package install times the built image recorded back to the
+// host and merges them into the ones of the previous builds, so the next
+// installation scripts start the slow packages first.
+class SaveRInstallTimesTask : public Task {
+  public:
+    SaveRInstallTimesTask(std::string docker_image_tag, fs::path file)
+        : Task("Save R package install times"),
+          docker_image_tag_{std::move(docker_image_tag)},
+          file_{std::move(file)} {}
+
+    void run(TracerState& state) override;
+
+  private:
+    std::string docker_image_tag_;
+    fs::path file_;
+};
+
+inline void SaveRInstallTimesTask::run(TracerState& state) {
+    if (state.manifest.r_packages.empty()) {
+        return;
+    }
+
+    try {
+        auto created =
+            Command("docker").arg("create").arg(docker_image_tag_).output();
+        created.check_success("Failed to create a container");
+        auto container = string_trim(created.stdout_data);
+
+        TempFile recorded{"r4r-install-times-", ".tsv"};
+        auto copied = Command("docker")
+                          .arg("cp")
+                          .arg(STR(container << ":" << kRInstallTimesFile))
+                          .arg(recorded->string())
+                          .output();
+        Command("docker").arg("rm").arg(container).output();
+        copied.check_success(
+            STR("Failed to copy " << kRInstallTimesFile << " from the image"));
+
+        RInstallTimes times;
+        if (fs::exists(file_)) {
+            times = load_r_install_times(file_);
+        }
+        for (auto& [name, seconds] : load_r_install_times(*recorded)) {
+            times[name] = seconds;
+        }
+        fs::create_directories(file_.parent_path());
+        save_r_install_times(times, file_);
+
+        LOG(INFO) << "Saved the install times of " << times.size()
+                  << " R packages to " << file_;
+    } catch (std::exception const& e) {
+        LOG(WARN) << "Failed to save the R package install times: "
+                  << e.what();
+    }
+}
+
 class CaptureEnvironmentTask : public Task {
   public:
     CaptureEnvironmentTask() : Task("Capture environment") {}
@@ -1019,9 +1632,23 @@ class Tracer {
         map.add_custom(ignore_font_uuid_files);
     }
 
-    static void load_image_default_files(fs::path const& default_image_file,
-                                         std::string const& docker_base_image,
-                                         IgnoreFileMap& map) {
+    static MappedFileSystemTrie<bool>
+    load_image_default_files(fs::path const& default_image_file,
+                             std::string const& docker_base_image) {
+        // the file list is also kept as a trie that can be mapped directly
+        auto trie_file = default_image_file;
+        trie_file += ".trie";
+
+        if (fs::exists(default_image_file)) {
+            auto fingerprint = file_fingerprint({default_image_file});
+            if (auto files =
+                    MappedFileSystemTrie<bool>::load(trie_file, fingerprint)) {
+                LOG(DEBUG) << "Loaded " << files->size()
+                           << " default files from " << trie_file;
+                return std::move(*files);
+            }
+        }
+
         auto default_files = [&]() {
 
             if (fs::exists(default_image_file)) {
@@ -1047,9 +1674,39 @@ class Tracer {
 
         LOG(DEBUG) << "Loaded " << default_files.size() << " default files";
 
+        FileSystemTrie<bool> trie;
         for (auto const& info : default_files.files()) {
-            map.add_file(info.path);
+            trie.insert(info.path, true);
+        }
+        auto files = MappedFileSystemTrie<bool>::from_trie(trie);
+
+        if (fs::exists(default_image_file)) {
+            try {
+                files.save(trie_file, file_fingerprint({default_image_file}));
+            } catch (std::exception const& e) {
+                LOG(WARN) << "Failed to store default image file trie to "
+                          << trie_file << ": " << e.what();
+            }
         }
+
+        return files;
+    }
+
+    // empty if the R packages are all built from source
+    [[nodiscard]] std::string r_binary_repository() const {
+        if (options_.r_binary_snapshot.empty()) {
+            return {};
+        }
+        if (options_.os_release.codename.empty()) {
+            LOG(WARN) << "Unknown codename of "
+                      << options_.os_release.distribution << " "
+                      << options_.os_release.release
+                      << ", building all R packages from source";
+            return {};
+        }
+        return ::r_binary_repository(options_.r_binary_mirror,
+                                     options_.os_release.codename,
+                                     options_.r_binary_snapshot);
     }
 
     void run_pipeline() {
@@ -1057,35 +1714,104 @@ class Tracer {
 
         tasks.push_back(std::make_unique<CaptureEnvironmentTask>());
 
-        tasks.push_back(
-            std::make_unique<FileTracingTask>(&options_.ignore_file_map));
+        tasks.push_back(std::make_unique<FileTracingTask>(
+            &options_.ignore_file_map, options_.output_dir,
+            options_.status_file));
 
-        tasks.push_back(std::make_unique<ResolveFileTask>(options_.R_bin));
+        tasks.push_back(std::make_unique<ResolveFileTask>(
+            options_.verify_deb_files, options_.cache_dir));
+
+        auto r_binary_repository = this->r_binary_repository();
+        if (!r_binary_repository.empty()) {
+            tasks.push_back(std::make_unique<ResolveRBinaryPackagesTask>(
+                r_binary_repository));
+        }
+
+        if (options_.ship_r_binaries) {
+            tasks.push_back(std::make_unique<ResolveRHostBinariesTask>());
+            tasks.push_back(
+                std::make_unique<PackRHostBinariesTask>(options_.output_dir));
+        }
 
         tasks.push_back(std::make_unique<ResolveRPackageSystemDependencies>(
-            options_.os_release));
+            options_.os_release, options_.cache_dir, options_.query_sysreqs));
+
+        tasks.push_back(
+            std::make_unique<ResolveRPackageSourcesTask>(options_.cran_mirror));
 
         tasks.push_back(std::make_unique<EditManifestTask>(
             options_.output_dir / "manifest.conf", !options_.skip_manifest));
 
+        if (options_.prefetch_r_sources) {
+            auto cache_dir = options_.cache_dir.empty()
+                                 ? fs::path{}
+                                 : options_.cache_dir / "r-sources";
+            tasks.push_back(std::make_unique<PrefetchRPackageSourcesTask>(
+                cache_dir, options_.output_dir));
+        }
+
+        if (options_.ship_deb_archives) {
+            tasks.push_back(std::make_unique<CollectDebArchivesTask>(
+                options_.output_dir, options_.docker_sudo_access,
+                options_.buildkit));
+        }
+
+        // the ones the previous builds recorded unless given
+        auto r_install_times = options_.r_install_times;
+        auto cached_r_install_times =
+            options_.cache_dir.empty()
+                ? fs::path{}
+                : options_.cache_dir / "r-install-times.tsv";
+        if (r_install_times.empty() && !cached_r_install_times.empty() &&
+            fs::exists(cached_r_install_times)) {
+            r_install_times = cached_r_install_times;
+        }
+
         tasks.push_back(std::make_unique<DockerFileBuilderTask>(
             options_.output_dir, options_.docker_base_image,
-            options_.docker_sudo_access));
+            options_.docker_sudo_access, r_install_times, r_binary_repository,
+            options_.buildkit));
 
         tasks.push_back(std::make_unique<MakefileBuilderTask>(
             options_.makefile, options_.docker_image_tag,
-            options_.docker_container_name));
+            options_.docker_container_name, options_.buildkit));
 
         if (options_.run_make) {
             tasks.push_back(
                 std::make_unique<RunMakefileTask>(options_.makefile));
+
+            if (!cached_r_install_times.empty()) {
+                tasks.push_back(std::make_unique<SaveRInstallTimesTask>(
+                    options_.docker_image_tag, cached_r_install_times));
+            }
         }
 
+        // none of these depend on the traced program, they are loaded while
+        // it runs
         TracerState state{
-            .dpkg_database = DpkgDatabase::system_database(),
-            .rpkg_database = nullptr,
+            .default_image_files = start_async([this] {
+                return load_image_default_files(options_.default_image_file,
+                                                options_.docker_base_image);
+            }),
+            .dpkg_database = start_async([this] {
+                return DpkgDatabase::system_database(options_.cache_dir);
+            }),
+            .rpkg_database = start_async([this] {
+                return RpkgDatabase::system_database(
+                    options_.R_bin, options_.r_lib_paths,
+                    options_.rpkg_database_source);
+            }),
             .traced_files = {},
             .traced_symlinks = {},
+            .resolved_files = {},
+            .r_binary_packages = {},
+            .r_source_tarballs = {},
+            .r_sources_dir = {},
+            .r_host_binaries = {},
+            .r_binaries_dir = {},
+            .deb_archives = {},
+            .deb_archives_dir = {},
+            .resource_usage = {},
             .manifest = {},
         };
 
@@ -1098,6 +1824,59 @@ class Tracer {
         for (auto& task : tasks) {
             run(*task, state);
         }
+
+        save_stats(state);
+    }
+
+    // Machine readable summary of the run used by the integration benchmarks
+    // to track performance regressions.
+    void save_stats(TracerState const& state) const {
+        auto stats_file = options_.output_dir / "stats.json";
+
+        JsonArray tasks;
+        for (auto const& [name, elapsed] : task_durations_) {
+            tasks.emplace_back(JsonObject{
+                {"name", name},
+                {"duration_ms",
+                 std::chrono::duration<double, std::milli>(elapsed).count()},
+            });
+        }
+
+        JsonObject resolved;
+        std::size_t traced = state.traced_files.size();
+        for (auto const& [name, count] : state.resolved_files) {
+            resolved.emplace(name, static_cast<double>(count));
+            traced += count;
+        }
+
+        auto copied = std::ranges::count_if(
+            state.manifest.copy_files,
+            [](auto const& f) { return f.second == FileStatus::Copy; });
+
+        JsonObject stats{
+            {"tasks", std::move(tasks)},
+            {"files",
+             JsonObject{
+                 {"traced", static_cast<double>(traced)},
+                 {"resolved", std::move(resolved)},
+                 {"unresolved",
+                  static_cast<double>(state.traced_files.size())},
+                 {"copied", static_cast<double>(copied)},
+                 {"symlinks",
+                  static_cast<double>(state.manifest.symlinks.size())},
+             }},
+            {"deb_packages",
+             static_cast<double>(state.manifest.deb_packages.size())},
+            {"r_packages",
+             static_cast<double>(state.manifest.r_packages.size())},
+        };
+
+        LOG(DEBUG) << "Saving stats to " << stats_file;
+        try {
+            std::ofstream{stats_file} << JsonValue{std::move(stats)} << '\n';
+        } catch (std::exception const& e) {
+            LOG(WARN) << "Failed to save stats: " << e.what();
+        }
     }
 
     void configure() {
@@ -1110,9 +1889,6 @@ class Tracer {
         }
 
         Tracer::configure_default_ignore_pattern(options_.ignore_file_map);
-        Tracer::load_image_default_files(options_.default_image_file,
-                                         options_.docker_base_image,
-                                         options_.ignore_file_map);
     }
 
     void run(Task& task, TracerState& state) {
@@ -1123,6 +1899,7 @@ class Tracer {
         auto elapsed = stopwatch([&] { task.run(state); });
 
         current_task_ = nullptr;
+        task_durations_.emplace_back(task.name(), elapsed);
 
         LOG(INFO) << task.name() << " finished in "
                   << format_elapsed_time(elapsed);
@@ -1130,6 +1907,8 @@ class Tracer {
 
     Options options_;
     Task* current_task_{};
+    std::vector<std::pair<std::string, std::chrono::steady_clock::duration>>
+        task_durations_;
 };
 
 #endif // TRACER_H
@@ -0,0 +1,66 @@
+#ifndef TRACING_STATUS_H
+#define TRACING_STATUS_H
+
+#include "common.h"
+#include "json.h"
+#include "logger.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+// A status file that is periodically rewritten while tracing so one can
+// follow the progress of long traces (e.g., `watch cat status.json`).
+// It is written from the tracer loop (on the syscalls and on a timer while
+// the tracees are idle) so it only touches the disk once per interval.
+// The file is replaced atomically so readers never see a partial content.
+class TracingStatusFile {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit TracingStatusFile(
+        fs::path path,
+        std::chrono::milliseconds interval = std::chrono::seconds{1})
+        : path_{std::move(path)}, tmp_path_{path_.string() + ".tmp"},
+          interval_{interval} {}
+
+    [[nodiscard]] bool due(Clock::time_point now) const { return now >= next_; }
+
+    void write(JsonValue const& status, Clock::time_point now);
+
+    [[nodiscard]] fs::path const& path() const { return path_; }
+
+    [[nodiscard]] std::chrono::milliseconds interval() const {
+        return interval_;
+    }
+
+  private:
+    fs::path path_;
+    fs::path tmp_path_;
+    std::chrono::milliseconds interval_;
+    Clock::time_point next_{};
+};
+
+inline void TracingStatusFile::write(JsonValue const& status,
+                                     Clock::time_point now) {
+    next_ = now + interval_;
+
+    {
+        std::ofstream out{tmp_path_, std::ios::trunc};
+        if (!out) {
+            LOG(WARN) << "Failed to write tracing status to: " << tmp_path_;
+            return;
+        }
+        out << status << '\n';
+    }
+
+    std::error_code ec;
+    fs::rename(tmp_path_, path_, ec);
+    if (ec) {
+        LOG(WARN) << "Failed to update tracing status: " << path_ << " - "
+                  << ec.message();
+    }
+}
+
+#endif // TRACING_STATUS_H
@@ -7,6 +7,7 @@
 #include <charconv>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <ranges>
 #include <regex>
 #include <sstream>
@@ -334,6 +335,8 @@ inline std::unordered_map<std::string, std::string> load_os_release_map() {
 struct OsRelease {
     std::string distribution;
     std::string release;
+    // VERSION_CODENAME, e.g. bookworm or jammy
+    std::string codename{};
 };
 
 inline std::optional<OsRelease> load_os_release() {
@@ -346,6 +349,9 @@ inline std::optional<OsRelease> load_os_release() {
         if (auto it = map.find("VERSION_ID"); it != map.end()) {
             res.release = string_tolowercase(it->second);
         }
+        if (auto it = map.find("VERSION_CODENAME"); it != map.end()) {
+            res.codename = string_tolowercase(it->second);
+        }
         return res;
     }
 
@@ -362,6 +368,15 @@ std::optional<T> to_number(std::string_view const& s) {
     return {};
 }
 
+// Removes the first line (without the new line) from the data and returns
+// it.
+inline std::string_view string_pop_line(std::string_view& data) {
+    auto eol = data.find('\n');
+    auto line = data.substr(0, eol);
+    data.remove_prefix(eol == std::string_view::npos ? data.size() : eol + 1);
+    return line;
+}
+
 template <typename Func>
 auto stopwatch(Func&& func) {
     using clock = std::chrono::steady_clock;
@@ -381,4 +396,12 @@ auto stopwatch(Func&& func) {
     }
 }
 
+// Starts computing the value on a new thread. The first get() of the returned
+// future joins it (rethrowing its exception if it failed), the later ones
+// return the same value.
+template <typename Func>
+auto start_async(Func&& func) {
+    return std::async(std::launch::async, std::forward<Func>(func)).share();
+}
+
 #endif // UTIL_H
@@ -2,14 +2,23 @@
 #define UTIL_FS_H
 
 #include "common.h"
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
+#include <initializer_list>
 #include <optional>
 #include <queue>
 #include <random>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <system_error>
+#include <unistd.h>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 
 namespace fs = std::filesystem;
 
@@ -156,6 +165,42 @@ inline fs::path TempFile::create_temp_file(std::string const& prefix,
         errno, STR("Failed to create a unique temporary file in " << temp_dir));
 }
 
+// A fresh directory in the temp directory that is removed with all its
+// contents on destruction.
+class TempDir {
+  public:
+    explicit TempDir(std::string const& prefix)
+        : path_{create_temp_dir(prefix)} {}
+
+    ~TempDir() {
+        std::error_code ec;
+        fs::remove_all(path_, ec);
+    }
+
+    TempDir(TempDir const&) = delete;
+    TempDir& operator=(TempDir const&) = delete;
+    TempDir(TempDir&& other) = delete;
+    TempDir& operator=(TempDir&& other) = delete;
+
+    fs::path const& operator*() const noexcept { return path_; }
+    fs::path const* operator->() const noexcept { return &path_; }
+    [[nodiscard]] fs::path const& path() const noexcept { return path_; }
+
+    static fs::path create_temp_dir(std::string const& prefix);
+
+  private:
+    fs::path path_;
+};
+
+inline fs::path TempDir::create_temp_dir(std::string const& prefix) {
+    auto tmpl = (fs::temp_directory_path() / (prefix + "XXXXXX")).string();
+    if (mkdtemp(tmpl.data()) == nullptr) {
+        throw make_system_error(
+            errno, STR("Failed to create a temporary directory " << tmpl));
+    }
+    return tmpl;
+}
+
 enum class AccessStatus { Accessible, DoesNotExist, InsufficientPermission };
 
 inline AccessStatus check_accessibility(fs::path const& p) {
@@ -249,6 +294,50 @@ inline std::string read_from_file(fs::path const& path) {
     return buffer.str();
 }
 
+// Reads the whole file into the buffer with plain read(2)s, reusing its
+// capacity. For many small files (e.g. the dpkg .list files) this is
+// cheaper than both streams and mmap.
+inline void read_from_file(fs::path const& path, std::string& buffer) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw make_system_error(
+            errno, STR("Failed to open file for reading: " << path));
+    }
+
+    struct stat st{};
+    if (::fstat(fd, &st) == -1) {
+        auto e = make_system_error(errno, STR("Failed to stat file: " << path));
+        ::close(fd);
+        throw e;
+    }
+
+    buffer.resize(static_cast<std::size_t>(st.st_size));
+    std::size_t size = 0;
+    while (true) {
+        if (size == buffer.size()) {
+            // the file might have grown
+            buffer.resize(buffer.size() + 4096);
+        }
+        auto n = ::read(fd, buffer.data() + size, buffer.size() - size);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            auto e = make_system_error(
+                errno, STR("Failed to read from file: " << path));
+            ::close(fd);
+            throw e;
+        }
+        if (n == 0) {
+            break;
+        }
+        size += static_cast<std::size_t>(n);
+    }
+    buffer.resize(size);
+
+    ::close(fd);
+}
+
 inline std::optional<fs::path> resolve_symlink(fs::path const& path) {
     std::error_code ec;
     fs::path target = fs::read_symlink(path, ec);
@@ -292,4 +381,102 @@ inline std::string file_type_str(fs::path const& p) {
     }
 }
 
+// A read-only memory mapping of a whole file.
+class MappedFile {
+  public:
+    MappedFile() = default;
+    explicit MappedFile(fs::path const& path);
+
+    ~MappedFile() { unmap(); }
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept
+        : data_{std::exchange(other.data_, nullptr)},
+          size_{std::exchange(other.size_, 0)} {}
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    [[nodiscard]] char const* data() const { return data_; }
+    [[nodiscard]] std::size_t size() const { return size_; }
+    [[nodiscard]] std::string_view view() const { return {data_, size_}; }
+
+  private:
+    void unmap() {
+        if (data_ != nullptr) {
+            ::munmap(const_cast<char*>(data_), size_);
+            data_ = nullptr;
+            size_ = 0;
+        }
+    }
+
+    char const* data_{};
+    std::size_t size_{};
+};
+
+inline MappedFile::MappedFile(fs::path const& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw make_system_error(errno, STR("Failed to open file: " << path));
+    }
+
+    struct stat st{};
+    if (::fstat(fd, &st) == -1) {
+        auto e =
+            make_system_error(errno, STR("Failed to stat file: " << path));
+        ::close(fd);
+        throw e;
+    }
+
+    size_ = static_cast<std::size_t>(st.st_size);
+    if (size_ > 0) {
+        void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            auto e =
+                make_system_error(errno, STR("Failed to map file: " << path));
+            ::close(fd);
+            throw e;
+        }
+        data_ = static_cast<char const*>(data);
+    }
+
+    ::close(fd);
+}
+
+// A cheap fingerprint of the state of the given files or directories (their
+// size and modification time) used to tell whether a cache built from them
+// is still valid.
+inline std::uint64_t file_fingerprint(std::initializer_list<fs::path> paths) {
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    auto mix = [&h](void const* data, std::size_t size) {
+        auto const* bytes = static_cast<unsigned char const*>(data);
+        for (std::size_t i = 0; i < size; ++i) {
+            h ^= bytes[i];
+            h *= 0x100000001b3ULL;
+        }
+    };
+
+    for (auto const& path : paths) {
+        mix(path.c_str(), path.native().size());
+
+        struct stat st{};
+        if (::stat(path.c_str(), &st) == 0) {
+            mix(&st.st_size, sizeof(st.st_size));
+            mix(&st.st_mtim.tv_sec, sizeof(st.st_mtim.tv_sec));
+            mix(&st.st_mtim.tv_nsec, sizeof(st.st_mtim.tv_nsec));
+            mix(&st.st_ino, sizeof(st.st_ino));
+        }
+    }
+
+    return h;
+}
+
 #endif // UTIL_FS_H
@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+"""End-to-end performance benchmark of the integration test scenarios.
+
+Each scenario is traced several times (`make clean trace`) and for every run
+the following is recorded:
+
+- the wall time of the whole run,
+- the per-task durations reported by r4r (stats.json in the output dir),
+- the docker build step durations (docker-build.log, BuildKit plain output),
+- the size of the final image and of the archive with the copied files,
+- the number of copied files versus the files resolved by packages.
+
+The medians over the runs are appended to a JSON history file and compared
+against a baseline. The script fails if any of the tracked metrics grows
+beyond the allowed ratio.
+"""
+
+import argparse
+import datetime
+import json
+import os
+import re
+import statistics
+import subprocess
+import sys
+import time
+
+ROOT_DIR = os.path.dirname(os.path.realpath(__file__))
+
+# metric -> kind, the kind selects the allowed ratio
+TRACKED_METRICS = {
+    "wall_s": "time",
+    "docker_build_s": "time",
+    "image_size": "size",
+    "archive_size": "size",
+    "copied_files": "size",
+}
+
+STEP_RE = re.compile(r"^#(\d+) \[([^\]]+)\] (.*)$")
+DONE_RE = re.compile(r"^#(\d+) DONE ([0-9.]+)s$")
+
+
+def log(msg):
+    print(msg, file=sys.stderr, flush=True)
+
+
+def parse_docker_build_log(path):
+    """Returns {step: seconds} for the steps of a BuildKit plain log."""
+    if not os.path.exists(path):
+        return {}
+
+    names = {}
+    steps = {}
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.rstrip("\n")
+            m = STEP_RE.match(line)
+            if m:
+                names[m.group(1)] = f"[{m.group(2)}] {m.group(3)}"[:80]
+                continue
+            m = DONE_RE.match(line)
+            if m and m.group(1) in names:
+                steps[names[m.group(1)]] = float(m.group(2))
+    return steps
+
+
+def read_stats(path):
+    if not os.path.exists(path):
+        log(f"Warning: missing {path}")
+        return {}
+    with open(path) as f:
+        return json.load(f)
+
+
+def image_tag(scenario_dir):
+    out = subprocess.run(
+        ["make", "-s", "-C", scenario_dir, "image-tag"],
+        check=True,
+        capture_output=True,
+        text=True,
+    )
+    return out.stdout.strip()
+
+
+def image_size(tag):
+    out = subprocess.run(
+        ["docker", "image", "inspect", "--format", "{{.Size}}", tag],
+        capture_output=True,
+        text=True,
+    )
+    if out.returncode != 0:
+        log(f"Warning: unable to inspect image {tag}")
+        return None
+    return int(out.stdout.strip())
+
+
+def run_once(scenario_dir, r4r):
+    start = time.monotonic()
+    subprocess.run(
+        ["make", "-C", scenario_dir, "clean", "trace", f"R4R={r4r}"],
+        check=True,
+        stdout=subprocess.DEVNULL,
+    )
+    wall = time.monotonic() - start
+
+    actual = os.path.join(scenario_dir, "actual")
+    stats = read_stats(os.path.join(actual, "stats.json"))
+    files = stats.get("files", {})
+    resolved = files.get("resolved", {})
+    steps = parse_docker_build_log(os.path.join(actual, "docker-build.log"))
+    archive = os.path.join(actual, "archive.tar")
+
+    return {
+        "wall_s": wall,
+        "tasks": {t["name"]: t["duration_ms"] / 1000 for t in stats.get("tasks", [])},
+        "docker_steps": steps,
+        "docker_build_s": sum(steps.values()) if steps else None,
+        "image_size": image_size(image_tag(scenario_dir)),
+        "archive_size": os.path.getsize(archive) if os.path.exists(archive) else 0,
+        "traced_files": files.get("traced"),
+        "copied_files": files.get("copied"),
+        "package_files": resolved.get("deb", 0) + resolved.get("R", 0),
+        "deb_packages": stats.get("deb_packages"),
+        "r_packages": stats.get("r_packages"),
+    }
+
+
+def median(values):
+    values = [v for v in values if v is not None]
+    return statistics.median(values) if values else None
+
+
+def aggregate(runs):
+    """Medians of all the (nested) metrics over the runs."""
+    result = {}
+    for key in runs[0]:
+        if isinstance(runs[0][key], dict):
+            names = {n for r in runs for n in r[key]}
+            result[key] = {n: median([r[key].get(n) for r in runs]) for n in sorted(names)}
+        else:
+            result[key] = median([r[key] for r in runs])
+    return result
+
+
+def git_commit():
+    out = subprocess.run(
+        ["git", "-C", ROOT_DIR, "rev-parse", "--short", "HEAD"],
+        capture_output=True,
+        text=True,
+    )
+    return out.stdout.strip() if out.returncode == 0 else None
+
+
+def load_json(path, default):
+    if not os.path.exists(path):
+        return default
+    with open(path) as f:
+        return json.load(f)
+
+
+def save_json(path, value):
+    with open(path, "w") as f:
+        json.dump(value, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+
+def compare(entry, baseline, ratios):
+    """Prints the tracked metrics next to the baseline, returns the regressions."""
+    regressions = []
+
+    for scenario, current in entry["scenarios"].items():
+        base = baseline.get("scenarios", {}).get(scenario)
+        if base is None:
+            log(f"{scenario}: no baseline")
+            continue
+
+        for metric, kind in TRACKED_METRICS.items():
+            value, reference = current.get(metric), base.get(metric)
+            if value is None or not reference:
+                continue
+
+            ratio = value / reference
+            limit = ratios[kind]
+            status = "ok" if ratio <= limit else "REGRESSION"
+            log(f"{scenario:16} {metric:16} {reference:14.1f} -> {value:14.1f} ({ratio:5.2f}x, max {limit:.2f}x) {status}")
+            if ratio > limit:
+                regressions.append((scenario, metric, ratio))
+
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("scenarios", nargs="*", help="scenarios to run (all by default)")
+    parser.add_argument("--r4r", default="r4r", help="the r4r binary")
+    parser.add_argument("--runs", type=int, default=3, help="runs per scenario")
+    parser.add_argument("--commit", default=None, help="the commit being measured (git HEAD by default)")
+    parser.add_argument("--history", default=os.path.join(ROOT_DIR, "bench-history.json"))
+    parser.add_argument("--baseline", default=os.path.join(ROOT_DIR, "bench-baseline.json"))
+    parser.add_argument("--update-baseline", action="store_true", help="store the results as the new baseline")
+    parser.add_argument("--max-time-ratio", type=float, default=1.5, help="allowed growth of the durations")
+    parser.add_argument("--max-size-ratio", type=float, default=1.2, help="allowed growth of the sizes and file counts")
+    args = parser.parse_args()
+
+    scenarios = args.scenarios or sorted(
+        d for d in os.listdir(ROOT_DIR) if os.path.exists(os.path.join(ROOT_DIR, d, "Makefile"))
+    )
+
+    entry = {
+        "timestamp": datetime.datetime.now(datetime.timezone.utc).isoformat(timespec="seconds"),
+        "commit": args.commit or git_commit(),
+        "runs": args.runs,
+        "scenarios": {},
+    }
+
+    for scenario in scenarios:
+        scenario_dir = os.path.join(ROOT_DIR, scenario)
+        runs = []
+        for i in range(args.runs):
+            log(f"{scenario}: run {i + 1}/{args.runs}")
+            runs.append(run_once(scenario_dir, args.r4r))
+        entry["scenarios"][scenario] = aggregate(runs)
+
+    history = load_json(args.history, [])
+    history.append(entry)
+    save_json(args.history, history)
+    log(f"Results appended to {args.history}")
+
+    if args.update_baseline:
+        save_json(args.baseline, entry)
+        log(f"Baseline updated: {args.baseline}")
+        return 0
+
+    baseline = load_json(args.baseline, None)
+    if baseline is None:
+        log(f"No baseline {args.baseline}, run with --update-baseline to create one")
+        return 0
+
+    regressions = compare(entry, baseline, {"time": args.max_time_ratio, "size": args.max_size_ratio})
+    if regressions:
+        log(f"{len(regressions)} regression(s) against the baseline from {baseline.get('commit')}")
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -23,6 +23,10 @@ trace:
 		--docker-container-name $(CONTAINER_NAME) \
 		$(COMMAND)
 
+.PHONY: image-tag
+image-tag:
+	@echo $(IMAGE_TAG)
+
 .PHONY: check
 check:
 	pwd
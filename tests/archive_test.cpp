@@ -37,3 +37,31 @@ TEST(UtilTest, CreateTarArchiveTest) {
 
     fs::remove_all(temp_dir);
 }
+
+TEST(UtilTest, CreateRBinaryTarballsTest) {
+    TempDir tmp{"r4r-r-binary-tarballs-test-"};
+    auto const& temp_dir = *tmp;
+    fs::create_directories(temp_dir / "library" / "abc" / "R");
+    fs::create_directories(temp_dir / "out");
+    std::ofstream(temp_dir / "library" / "abc" / "DESCRIPTION")
+        << "Package: abc\nBuilt: R 4.4.1; ; 2024-06-03; unix\n";
+
+    std::vector<std::pair<fs::path, fs::path>> packages{
+        {temp_dir / "library" / "abc", temp_dir / "out" / "abc_1.0.tar.gz"},
+        {temp_dir / "library" / "missing",
+         temp_dir / "out" / "missing_1.0.tar.gz"},
+    };
+
+    EXPECT_EQ(create_r_binary_tarballs(packages, 1), 1);
+    EXPECT_FALSE(fs::exists(temp_dir / "out" / "missing_1.0.tar.gz"));
+
+    auto out = Command("tar")
+                   .arg("tzf")
+                   .arg((temp_dir / "out" / "abc_1.0.tar.gz").string())
+                   .output();
+
+    EXPECT_EQ(out.exit_code, 0);
+    // the package directory as R CMD INSTALL --build packs it
+    EXPECT_TRUE(out.stdout_data.starts_with("abc/\n"));
+    EXPECT_NE(out.stdout_data.find("abc/DESCRIPTION\n"), std::string::npos);
+}
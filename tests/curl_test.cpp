@@ -0,0 +1,112 @@
+#include "curl.h"
+#include "local_http_server.h"
+#include "util_fs.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <utility>
+
+namespace {
+
+CURLRetryPolicy const kFastRetries{.max_retries = 2,
+                                   .initial_backoff =
+                                       std::chrono::milliseconds{1},
+                                   .max_backoff = std::chrono::milliseconds{4}};
+
+} // namespace
+
+TEST(CURLMultipleTransferTest, Parallel) {
+    LocalHttpServer server{[](auto const& path, int) {
+        return std::pair{200, path.substr(1)};
+    }};
+
+    CURLMultipleTransfer<int> curl{4};
+    for (int i = 0; i < 20; ++i) {
+        curl.add(i, server.url("/" + std::to_string(i)));
+    }
+    auto results = curl.run();
+
+    ASSERT_EQ(results.size(), 20);
+    for (int i = 0; i < 20; ++i) {
+        auto const* hr = std::get_if<HttpResult>(&results.at(i));
+        ASSERT_NE(hr, nullptr);
+        EXPECT_EQ(hr->http_code, 200);
+        EXPECT_EQ(hr->message, std::to_string(i));
+    }
+}
+
+TEST(CURLMultipleTransferTest, Retries) {
+    LocalHttpServer server{[](std::string const& path, int hit) {
+        if (path == "/flaky") {
+            return hit < 3 ? std::pair{503, std::string{"busy"}}
+                           : std::pair{200, std::string{"ok"}};
+        }
+        if (path == "/broken") {
+            return std::pair{500, std::string{"error"}};
+        }
+        return std::pair{404, std::string{"not found"}};
+    }};
+
+    CURLMultipleTransfer<std::string> curl{2, kFastRetries};
+    curl.add("flaky", server.url("/flaky"));
+    curl.add("broken", server.url("/broken"));
+    curl.add("missing", server.url("/missing"));
+    auto results = curl.run();
+
+    auto http_code = [&](std::string const& key) {
+        return std::get<HttpResult>(results.at(key)).http_code;
+    };
+    EXPECT_EQ(http_code("flaky"), 200);
+    EXPECT_EQ(std::get<HttpResult>(results.at("flaky")).message, "ok");
+    EXPECT_EQ(http_code("broken"), 500);
+    EXPECT_EQ(http_code("missing"), 404);
+
+    EXPECT_EQ(server.hits("/flaky"), 3);
+    // the first attempt and max_retries more
+    EXPECT_EQ(server.hits("/broken"), 3);
+    EXPECT_EQ(server.hits("/missing"), 1);
+}
+
+TEST(CURLMultipleTransferTest, ToFile) {
+    LocalHttpServer server{[](std::string const& path, int hit) {
+        if (path == "/flaky" && hit < 2) {
+            return std::pair{503, std::string{"busy"}};
+        }
+        return std::pair{200, std::string(100'000, 'x')};
+    }};
+    TempDir dir{"r4r-curl-test-"};
+
+    CURLMultipleTransfer<int> curl{2, kFastRetries};
+    curl.add(1, server.url("/big"), *dir / "big");
+    // the retry replaces what the failed attempt wrote
+    curl.add(2, server.url("/flaky"), *dir / "flaky");
+    curl.add(3, server.url("/big"), *dir / "missing" / "big");
+    auto results = curl.run();
+
+    for (int i : {1, 2}) {
+        auto const& hr = std::get<HttpResult>(results.at(i));
+        EXPECT_EQ(hr.http_code, 200);
+        EXPECT_EQ(hr.message, "");
+    }
+    EXPECT_EQ(read_from_file(*dir / "big"), std::string(100'000, 'x'));
+    EXPECT_EQ(read_from_file(*dir / "flaky"), std::string(100'000, 'x'));
+    // the file cannot be written
+    EXPECT_TRUE(std::holds_alternative<std::string>(results.at(3)));
+}
+
+TEST(CURLMultipleTransferTest, ConnectionRefused) {
+    std::string url;
+    {
+        // nothing listens on the port once the server is gone
+        LocalHttpServer server{[](auto const&, int) {
+            return std::pair{200, std::string{}};
+        }};
+        url = server.url("/");
+    }
+
+    CURLMultipleTransfer<int> curl{1, kFastRetries};
+    curl.add(1, url);
+    auto results = curl.run();
+
+    ASSERT_EQ(results.size(), 1);
+    EXPECT_TRUE(std::holds_alternative<std::string>(results.at(1)));
+}
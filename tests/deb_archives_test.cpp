@@ -0,0 +1,138 @@
+#include "deb_archives.h"
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+TEST(DebArchivesTest, ArchiveName) {
+    EXPECT_EQ(DebArchives::archive_name({.name = "libc6:amd64",
+                                         .version = "2.36-9+deb12u4",
+                                         .architecture = "amd64"}),
+              "libc6_2.36-9+deb12u4_amd64.deb");
+    EXPECT_EQ(DebArchives::archive_name({.name = "tzdata",
+                                         .version = "1:2024a-0+deb12u1",
+                                         .architecture = "all"}),
+              "tzdata_1%3a2024a-0+deb12u1_all.deb");
+}
+
+TEST(DebArchivesTest, Cached) {
+    TempDir tmp{"r4r-deb-archives-test-"};
+    auto const& dir = *tmp;
+    fs::create_directories(dir / "archives");
+    DebPackage pkg{.name = "abc", .version = "1.0", .architecture = "all"};
+    write_to_file(dir / "archives" / "abc_1.0_all.deb", "abc archive");
+
+    auto collected = DebArchives{dir / "archives", dir / "info", 1}.collect(
+        {&pkg}, dir / "debs");
+
+    EXPECT_TRUE(collected.contains(&pkg));
+    EXPECT_EQ(read_from_file(dir / "debs" / "abc_1.0_all.deb"),
+              "abc archive");
+}
+
+TEST(DebArchivesTest, Repack) {
+    auto status = Command("dpkg-query")
+                      .arg("--showformat=${Version} ${Architecture}")
+                      .arg("--show")
+                      .arg("hostname")
+                      .output();
+    if (status.exit_code != 0) {
+        GTEST_SKIP() << "hostname is not installed";
+    }
+    auto sep = status.stdout_data.find(' ');
+    DebPackage pkg{.name = "hostname",
+                   .version = status.stdout_data.substr(0, sep),
+                   .architecture = status.stdout_data.substr(sep + 1)};
+    DebPackage missing{
+        .name = "r4r-missing", .version = "1.0", .architecture = "all"};
+
+    TempDir tmp{"r4r-deb-archives-test-"};
+    auto const& dir = *tmp;
+    auto collected = DebArchives{dir / "archives", fs::path{kDpkgInfoDir}, 2}
+                         .collect({&pkg, &missing}, dir / "debs");
+
+    EXPECT_TRUE(collected.contains(&pkg));
+    EXPECT_FALSE(collected.contains(&missing));
+
+    auto archive = dir / "debs" / DebArchives::archive_name(pkg);
+    auto fields = Command("dpkg-deb")
+                      .arg("--field")
+                      .arg(archive.string())
+                      .arg("Package")
+                      .arg("Version")
+                      .output();
+    EXPECT_EQ(fields.exit_code, 0);
+    EXPECT_EQ(fields.stdout_data,
+              "Package: hostname\nVersion: " + pkg.version + "\n");
+
+    auto contents =
+        Command("dpkg-deb").arg("--contents").arg(archive.string()).output();
+    EXPECT_NE(contents.stdout_data.find("bin/hostname"), std::string::npos);
+    EXPECT_FALSE(fs::exists(dir / "debs" / "r4r-missing_1.0_all.deb"));
+}
+
+TEST(DebArchivesTest, RepackKeepsOwners) {
+    auto status = Command("dpkg-query")
+                      .arg("--showformat=${Version} ${Architecture}")
+                      .arg("--show")
+                      .arg("hostname")
+                      .output();
+    if (status.exit_code != 0) {
+        GTEST_SKIP() << "hostname is not installed";
+    }
+    if (geteuid() != 0 && Command("fakeroot").arg("true").output().exit_code) {
+        GTEST_SKIP() << "fakeroot is not installed";
+    }
+    auto sep = status.stdout_data.find(' ');
+    DebPackage pkg{.name = "hostname",
+                   .version = status.stdout_data.substr(0, sep),
+                   .architecture = status.stdout_data.substr(sep + 1)};
+
+    TempDir tmp{"r4r-deb-archives-test-"};
+    auto const& dir = *tmp;
+    fs::create_directories(dir / "info");
+    fs::create_directories(dir / "files");
+    write_to_file(dir / "files" / "tool", "tool");
+    // e.g. the setgid shadow tools
+    if (geteuid() == 0) {
+        ASSERT_EQ(chown((dir / "files" / "tool").c_str(), 1, 1), 0);
+    }
+    ASSERT_EQ(chmod((dir / "files" / "tool").c_str(), 02755), 0);
+    write_to_file(dir / "info" / "hostname.list",
+                  (dir / "files").string() + "\n" +
+                      (dir / "files" / "tool").string() + "\n");
+
+    struct stat info {};
+    ASSERT_EQ(stat((dir / "files" / "tool").c_str(), &info), 0);
+    struct stat dir_info {};
+    ASSERT_EQ(stat((dir / "files").c_str(), &dir_info), 0);
+
+    auto archive = dir / "hostname.deb";
+    DebArchives{dir / "archives", dir / "info", 1}.repack(pkg, archive);
+
+    auto contents = Command("sh")
+                        .arg("-c")
+                        .arg("dpkg-deb --fsys-tarfile \"$0\" | "
+                             "tar -tv --numeric-owner")
+                        .arg(archive.string())
+                        .output();
+    ASSERT_EQ(contents.exit_code, 0) << contents.stderr_data;
+    std::istringstream lines{contents.stdout_data};
+    bool found = false;
+    for (std::string line; std::getline(lines, line);) {
+        if (line.ends_with("/files/tool")) {
+            found = true;
+            EXPECT_TRUE(line.starts_with(STR("-rwxr-sr-x " << info.st_uid
+                                                           << "/"
+                                                           << info.st_gid)))
+                << line;
+        } else if (line.ends_with("/files/")) {
+            EXPECT_NE(line.find(STR(' ' << dir_info.st_uid << "/"
+                                        << dir_info.st_gid << ' ')),
+                      std::string::npos)
+                << line;
+        }
+    }
+    EXPECT_TRUE(found) << contents.stdout_data;
+}
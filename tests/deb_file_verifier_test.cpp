@@ -0,0 +1,146 @@
+#include "deb_file_verifier.h"
+#include "md5.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace {
+
+class DebFileVerifierTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        fs::create_directories(dir_ / "info");
+        fs::create_directories(dir_ / "root/etc");
+        fs::create_directories(dir_ / "root/usr/lib");
+
+        write("usr/lib/same.so", "same");
+        write("usr/lib/modified.so", "modified");
+        write("usr/lib/unknown.so", "unknown");
+        write("etc/same.conf", "conf");
+        write("etc/modified.conf", "modified conf");
+
+        std::ofstream{dir_ / "info/pkg.md5sums"}
+            << Md5::hash("same") << "  " << relative("usr/lib/same.so")
+            << '\n'
+            << Md5::hash("original") << "  "
+            << relative("usr/lib/modified.so") << '\n';
+
+        pkg_.name = "pkg";
+        pkg_.conffiles = {
+            {.path = path("etc/same.conf").string(),
+             .md5sum = Md5::hash("conf")},
+            {.path = path("etc/modified.conf").string(),
+             .md5sum = Md5::hash("original conf")},
+        };
+
+        for (auto const* p :
+             {"usr/lib/same.so", "usr/lib/modified.so", "usr/lib/unknown.so",
+              "etc/same.conf", "etc/modified.conf", "usr/lib"}) {
+            paths_.push_back(path(p));
+        }
+    }
+
+    [[nodiscard]] fs::path path(std::string const& p) const {
+        return dir_ / "root" / p;
+    }
+
+    // as in the md5sums files, without the leading /
+    [[nodiscard]] std::string relative(std::string const& p) const {
+        return path(p).string().substr(1);
+    }
+
+    void write(std::string const& p, std::string const& content) const {
+        std::ofstream{path(p)} << content;
+    }
+
+    [[nodiscard]] std::vector<DebFileVerifier::File> files() const {
+        std::vector<DebFileVerifier::File> files;
+        for (auto const& p : paths_) {
+            files.push_back(
+                {.path = &p, .dpkg_path = p.native(), .package = &pkg_});
+        }
+        return files;
+    }
+
+    TempDir tmp_{"r4r-deb-verifier-test-"};
+    fs::path const& dir_{*tmp_};
+    DebPackage pkg_;
+    std::vector<fs::path> paths_;
+};
+
+} // namespace
+
+TEST_F(DebFileVerifierTest, DetectsModifiedFiles) {
+    DebFileVerifier verifier{dir_ / "info"};
+
+    auto result = verifier.verify(files());
+
+    // files without md5sum and directories are taken as they are
+    EXPECT_EQ(result,
+              (std::vector<bool>{true, false, true, true, false, true}));
+}
+
+TEST_F(DebFileVerifierTest, ParallelIsTheSame) {
+    std::vector<DebFileVerifier::File> many;
+    for (int i = 0; i < 100; ++i) {
+        auto f = files();
+        many.insert(many.end(), f.begin(), f.end());
+    }
+
+    auto sequential = DebFileVerifier{dir_ / "info", {}, 1}.verify(many);
+    auto parallel = DebFileVerifier{dir_ / "info", {}, 4}.verify(many);
+
+    EXPECT_EQ(sequential, parallel);
+}
+
+TEST_F(DebFileVerifierTest, UsesTheHashCache) {
+    auto cache_file = dir_ / "cache/md5sums";
+    EXPECT_EQ(DebFileVerifier(dir_ / "info", cache_file).verify(files())[0],
+              true);
+    ASSERT_TRUE(fs::exists(cache_file));
+
+    // same size and mtime, the cached hash is used
+    auto same = path("usr/lib/same.so");
+    struct stat st{};
+    ASSERT_EQ(::stat(same.c_str(), &st), 0);
+    write("usr/lib/same.so", "SAME");
+    std::array<timespec, 2> times{st.st_atim, st.st_mtim};
+    ASSERT_EQ(::utimensat(AT_FDCWD, same.c_str(), times.data(), 0), 0);
+
+    EXPECT_EQ(DebFileVerifier(dir_ / "info", cache_file).verify(files())[0],
+              true);
+    EXPECT_EQ(DebFileVerifier(dir_ / "info").verify(files())[0], false);
+}
+
+TEST_F(DebFileVerifierTest, ExpiresTheHashCache) {
+    auto cache_file = dir_ / "cache/md5sums";
+    auto entries = [&] {
+        auto data = read_from_file(cache_file);
+        return std::ranges::count(data, '\n');
+    };
+
+    DebFileVerifier(dir_ / "info", cache_file).verify(files());
+    // the files with a md5sum
+    EXPECT_EQ(entries(), 4);
+
+    auto first = files();
+    first.resize(1);
+    // the hashes of the other files are kept for the next runs
+    DebFileVerifier(dir_ / "info", cache_file).verify(first);
+    EXPECT_EQ(entries(), 4);
+
+    // until they are not used for too long
+    std::istringstream in{read_from_file(cache_file)};
+    std::ostringstream out;
+    for (std::string line; std::getline(in, line);) {
+        out << line.substr(0, line.rfind(' ')) << " 0\n";
+    }
+    write_to_file(cache_file, out.str());
+    DebFileVerifier(dir_ / "info", cache_file).verify(first);
+    EXPECT_EQ(entries(), 1);
+}
@@ -22,3 +22,70 @@ ENV MAKEOVERRIDES='${-*-command-variables-*-}'
 
     EXPECT_EQ(dockerfile.dockerfile(), expected);
 }
+
+TEST(DockerFileBuilderTest, RunCacheMounts) {
+    std::vector<std::string> const commands{"apt-get update -y",
+                                            "apt-get install -y curl"};
+    std::vector<std::string> const cache_dirs{"/var/cache/apt",
+                                              "/var/lib/apt/lists"};
+
+    DockerFileBuilder buildkit("ubuntu:latest", fs::path("/tmp/context"),
+                               true);
+    buildkit.run(commands, cache_dirs);
+    std::string expected = R"(# syntax=docker/dockerfile:1
+FROM ubuntu:latest
+RUN --mount=type=cache,target=/var/cache/apt,sharing=locked \
+  --mount=type=cache,target=/var/lib/apt/lists,sharing=locked \
+  apt-get update -y && \
+  apt-get install -y curl
+
+)";
+    EXPECT_EQ(buildkit.build().dockerfile(), expected);
+
+    // the classic builder has no cache mounts
+    DockerFileBuilder classic("ubuntu:latest", fs::path("/tmp/context"));
+    classic.run(commands, cache_dirs);
+    expected = R"(FROM ubuntu:latest
+RUN apt-get update -y && \
+  apt-get install -y curl
+
+)";
+    EXPECT_EQ(classic.build().dockerfile(), expected);
+}
+
+TEST(DockerFileBuilderTest, RunBindMounts) {
+    std::vector<std::string> const commands{"dpkg -i /tmp/debs/*.deb"};
+    std::vector<BindMount> const mounts{
+        {.source = "/tmp/context/debs", .target = "/tmp/debs"}};
+
+    DockerFileBuilder buildkit("ubuntu:latest", fs::path("/tmp/context"),
+                               true);
+    buildkit.run(commands, {"/var/cache/apt"}, mounts);
+    std::string expected = R"(# syntax=docker/dockerfile:1
+FROM ubuntu:latest
+RUN --mount=type=bind,source=debs,target=/tmp/debs,rw \
+  --mount=type=cache,target=/var/cache/apt,sharing=locked \
+  dpkg -i /tmp/debs/*.deb
+
+)";
+    auto dockerfile = buildkit.build();
+    EXPECT_EQ(dockerfile.dockerfile(), expected);
+    EXPECT_EQ(dockerfile.copied_files(),
+              std::vector<fs::path>{"/tmp/context/debs"});
+
+    // the classic builder copies them in
+    DockerFileBuilder classic("ubuntu:latest", fs::path("/tmp/context"));
+    classic.run(commands, {"/var/cache/apt"}, mounts);
+    expected = R"(FROM ubuntu:latest
+COPY debs /tmp/debs/
+
+RUN dpkg -i /tmp/debs/*.deb && \
+  rm -rf /tmp/debs
+
+)";
+    EXPECT_EQ(classic.build().dockerfile(), expected);
+
+    EXPECT_THROW(
+        classic.run(commands, {}, {{.source = "/elsewhere", .target = "/x"}}),
+        std::runtime_error);
+}
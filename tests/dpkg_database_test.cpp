@@ -1,7 +1,11 @@
 #include "dpkg_database.h"
+#include <fstream>
+#include <memory>
 #include <gtest/gtest.h>
 #include <sstream>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 // Common dpkg output header for reuse in tests
 // clang-format off
@@ -69,3 +73,191 @@ TEST(ParseInstalledPackagesTest, ReturnsEmptyMapForEmptyInput) {
     auto packages = parse_installed_packages("");
     EXPECT_TRUE(packages.empty());
 }
+
+TEST(DpkgDatabaseTest, Cache) {
+    TempDir tmp{"r4r-dpkg-test-"};
+    auto const& info_dir = *tmp;
+    {
+        std::ofstream{info_dir / "libfoo.list"}
+            << "/.\n/usr\n/usr/lib/libfoo.so\n";
+        std::ofstream{info_dir / "bar.list"} << "/usr/bin/bar\n";
+    }
+
+    DebPackages packages;
+    packages.emplace("libfoo", std::make_unique<DebPackage>("libfoo", "1.0"));
+    packages.emplace("bar", std::make_unique<DebPackage>("bar", "2.0"));
+    packages.emplace("baz", std::make_unique<DebPackage>("baz", "3.0"));
+
+    auto db = DpkgDatabase::from_path(info_dir, std::move(packages));
+    db.save(info_dir / "dpkg.trie", 1);
+
+    EXPECT_FALSE(DpkgDatabase::from_cache(info_dir / "dpkg.trie", 2));
+
+    auto cached = DpkgDatabase::from_cache(info_dir / "dpkg.trie", 1);
+    ASSERT_TRUE(cached.has_value());
+
+    for (auto const* d : {&db, &*cached}) {
+        ASSERT_NE(d->lookup_by_path("/usr/lib/libfoo.so"), nullptr);
+        EXPECT_EQ(*d->lookup_by_path("/usr/lib/libfoo.so"),
+                  (DebPackage{"libfoo", "1.0"}));
+        EXPECT_EQ(d->lookup_by_path("/usr/bin/bar")->version, "2.0");
+        EXPECT_EQ(d->lookup_by_path("/usr/bin/baz"), nullptr);
+        ASSERT_NE(d->lookup_by_name("baz"), nullptr);
+        EXPECT_EQ(d->lookup_by_name("baz")->version, "3.0");
+    }
+}
+
+TEST(DpkgDatabaseTest, ParallelLoadIsTheSame) {
+    TempDir tmp{"r4r-dpkg-jobs-test-"};
+    auto const& info_dir = *tmp;
+
+    auto packages = [] {
+        DebPackages packages;
+        for (int i = 0; i < 500; i++) {
+            auto name = "pkg" + std::to_string(i);
+            packages.emplace(name, std::make_unique<DebPackage>(name, "1.0"));
+        }
+        return packages;
+    };
+
+    for (int i = 0; i < 500; i++) {
+        std::ofstream out{info_dir / ("pkg" + std::to_string(i) + ".list")};
+        // shared directories, the last package reading them owns them
+        out << "/.\n/usr\n/usr/lib\n/usr/lib/pkg" << i << ".so\n";
+        if (i % 2 == 0) {
+            // no trailing new line
+            out << "/usr/share/doc/pkg" << i;
+        }
+    }
+
+    auto sequential = DpkgDatabase::from_path(info_dir, packages(), 1);
+    auto parallel = DpkgDatabase::from_path(info_dir, packages(), 8);
+
+    auto name = [](DebPackage const* pkg) {
+        return pkg != nullptr ? pkg->name : "";
+    };
+
+    std::vector<std::string> paths{"/.", "/usr", "/usr/lib", "/usr/share"};
+    for (int i = 0; i < 500; i++) {
+        paths.push_back("/usr/lib/pkg" + std::to_string(i) + ".so");
+        paths.push_back("/usr/share/doc/pkg" + std::to_string(i));
+    }
+
+    for (auto const& path : paths) {
+        EXPECT_EQ(name(sequential.lookup_by_path(path)),
+                  name(parallel.lookup_by_path(path)))
+            << path;
+    }
+    EXPECT_EQ(name(parallel.lookup_by_path("/usr/lib/pkg42.so")), "pkg42");
+    EXPECT_EQ(name(parallel.lookup_by_path("/usr/share/doc/pkg42")), "pkg42");
+    EXPECT_EQ(parallel.lookup_by_path("/usr/share/doc/pkg43"), nullptr);
+}
+
+// clang-format off
+std::string const kDpkgStatus = R"(Package: libc6
+Status: install ok installed
+Priority: optional
+Section: libs
+Installed-Size: 13036
+Maintainer: GNU Libc Maintainers <debian-glibc@lists.debian.org>
+Architecture: arm64
+Multi-Arch: same
+Source: glibc
+Version: 2.36-9+deb12u4
+Depends: libgcc-s1
+Conffiles:
+ /etc/ld.so.conf.d/aarch64-linux-gnu.conf d4e7a7b88a71b5ffd9e2644e71a0cfab
+Description: GNU C Library: Shared libraries
+ Contains the standard libraries that are used by nearly all programs on
+ the system.
+
+Package: dpkg
+Essential: yes
+Status: install ok installed
+Installed-Size: 6492
+Architecture: arm64
+Multi-Arch: foreign
+Version: 1.21.22
+Depends: tar (>= 1.28-1)
+Conffiles:
+ /etc/alternatives/README 7be88b21f7e386c8d5a8790c2461c92b
+ /etc/cron.daily/dpkg 94bb6c1363245e46256908a5d52ba4fb obsolete
+Description: Debian package management system
+
+Package: r-base-core
+Status: hold ok installed
+Architecture: arm64
+Version: 4.4.2-1~bookworm
+
+Package: removed
+Status: deinstall ok config-files
+Architecture: all
+Version: 1.0
+
+Package: half
+Status: install reinstreq half-installed
+Architecture: all
+Version: 1.0
+)";
+// clang-format on
+
+TEST(ParseDpkgStatusTest, ParsesInstalledPackages) {
+    auto packages = parse_dpkg_status(kDpkgStatus);
+    ASSERT_EQ(packages.size(), 3);
+
+    auto const& libc = *packages.at("libc6:arm64");
+    EXPECT_EQ(libc.name, "libc6:arm64");
+    EXPECT_EQ(libc.version, "2.36-9+deb12u4");
+    EXPECT_EQ(libc.architecture, "arm64");
+    EXPECT_EQ(libc.multi_arch, "same");
+    EXPECT_EQ(libc.installed_size, 13036);
+    EXPECT_EQ(libc.depends, "libgcc-s1");
+    EXPECT_EQ(libc.source, "glibc");
+    EXPECT_EQ(libc.conffiles,
+              (std::vector<DebConffile>{
+                  {.path = "/etc/ld.so.conf.d/aarch64-linux-gnu.conf",
+                   .md5sum = "d4e7a7b88a71b5ffd9e2644e71a0cfab"}}));
+
+    auto const& dpkg = *packages.at("dpkg");
+    EXPECT_EQ(dpkg.multi_arch, "foreign");
+    EXPECT_EQ(dpkg.depends, "tar (>= 1.28-1)");
+    EXPECT_EQ(dpkg.source, "");
+    EXPECT_EQ(dpkg.conffiles,
+              (std::vector<DebConffile>{
+                  {.path = "/etc/alternatives/README",
+                   .md5sum = "7be88b21f7e386c8d5a8790c2461c92b"},
+                  {.path = "/etc/cron.daily/dpkg",
+                   .md5sum = "94bb6c1363245e46256908a5d52ba4fb"}}));
+
+    EXPECT_EQ(packages.at("r-base-core")->version, "4.4.2-1~bookworm");
+    EXPECT_FALSE(packages.contains("removed"));
+    EXPECT_FALSE(packages.contains("half"));
+}
+
+TEST(ParseDpkgStatusTest, NoTrailingNewLine) {
+    auto packages = parse_dpkg_status("Package: a\n"
+                                      "Status: install ok installed\n"
+                                      "Version: 1");
+    ASSERT_EQ(packages.size(), 1);
+    EXPECT_EQ(packages.at("a")->version, "1");
+    EXPECT_TRUE(parse_dpkg_status("").empty());
+}
+
+TEST(DpkgDatabaseTest, MultiArchLookupByName) {
+    TempDir tmp{"r4r-dpkg-status-test-"};
+    auto const& info_dir = *tmp;
+
+    auto db = DpkgDatabase::from_path(info_dir, parse_dpkg_status(kDpkgStatus));
+
+    // the native architecture is the one of dpkg
+    ASSERT_NE(db.lookup_by_name("libc6"), nullptr);
+    EXPECT_EQ(db.lookup_by_name("libc6")->name, "libc6:arm64");
+    EXPECT_EQ(db.lookup_by_name("dpkg")->installed_size, 6492);
+
+    // the cache keeps all the fields
+    db.save(info_dir / "dpkg.trie", 1);
+    auto cached = DpkgDatabase::from_cache(info_dir / "dpkg.trie", 1);
+    ASSERT_TRUE(cached.has_value());
+    EXPECT_EQ(*cached->lookup_by_name("libc6"), *db.lookup_by_name("libc6"));
+    EXPECT_EQ(*cached->lookup_by_name("dpkg"), *db.lookup_by_name("dpkg"));
+}
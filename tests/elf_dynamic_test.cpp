@@ -0,0 +1,133 @@
+#include "elf_dynamic.h"
+#include "sysreqs.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+
+namespace {
+
+template <typename T>
+void write_at(std::string& data, std::size_t offset, T value) {
+    std::memcpy(data.data() + offset, &value, sizeof(T));
+}
+
+} // namespace
+
+TEST(ElfDynamicTest, ReadSelf) {
+    auto info = read_elf_dynamic(fs::path{"/proc/self/exe"});
+    ASSERT_TRUE(info.has_value());
+
+    EXPECT_TRUE(std::ranges::find(info->needed, "libc.so.6") !=
+                info->needed.end());
+    EXPECT_EQ(info->is_64bit, sizeof(void*) == 8);
+
+    EXPECT_FALSE(read_elf_dynamic(std::string_view{"#!/bin/sh\n"}));
+    EXPECT_FALSE(read_elf_dynamic(std::string_view{}));
+}
+
+TEST(ElfDynamicTest, ExpandOrigin) {
+    EXPECT_EQ(elf::expand_origin("$ORIGIN/../lib:${ORIGIN}/x", "/pkg/libs"),
+              "/pkg/libs/../lib:/pkg/libs/x");
+    EXPECT_EQ(elf::expand_origin("$ORIGIN/$ORIGIN", "/o"), "/o//o");
+    EXPECT_EQ(elf::expand_origin("/usr/lib/R/lib", "/o"), "/usr/lib/R/lib");
+    EXPECT_EQ(elf::expand_origin("${ORIGIN", "/o"), "${ORIGIN");
+}
+
+TEST(LdSoCacheTest, System) {
+    auto self = fs::path{"/proc/self/exe"};
+    auto info = read_elf_dynamic(self);
+    ASSERT_TRUE(info.has_value());
+
+    LdSoCache cache;
+    auto libc = cache.resolve("libc.so.6", *info, self);
+    ASSERT_TRUE(libc.has_value());
+    EXPECT_EQ(libc->filename(), "libc.so.6");
+
+    EXPECT_FALSE(cache.resolve("libr4r-missing.so.1", *info, self));
+}
+
+TEST(LdSoCacheTest, FromData) {
+    // the new format: header, one entry and the strings
+    std::string data(48 + 24, '\0');
+    std::memcpy(data.data(), "glibc-ld.so.cache1.1", 20);
+    write_at<std::uint32_t>(data, 20, 1);
+    auto key = static_cast<std::uint32_t>(data.size());
+    data += "libfoo.so.1";
+    data += '\0';
+    auto value = static_cast<std::uint32_t>(data.size());
+    data += "/usr/lib/libfoo.so.1";
+    data += '\0';
+    write_at<std::int32_t>(data, 48, 0x0303);
+    write_at<std::uint32_t>(data, 48 + 4, key);
+    write_at<std::uint32_t>(data, 48 + 8, value);
+
+    EXPECT_EQ(LdSoCache::from_data(data).size(), 1);
+
+    // behind the old format header without any entries
+    std::string old(16, '\0');
+    std::memcpy(old.data(), "ld.so-1.7.0", 11);
+    EXPECT_EQ(LdSoCache::from_data(old + data).size(), 1);
+
+    EXPECT_THROW((void)LdSoCache::from_data("garbage"), std::runtime_error);
+}
+
+TEST(SharedLibraryDependencyResolverTest, Resolve) {
+    auto self = fs::path{"/proc/self/exe"};
+    auto info = read_elf_dynamic(self);
+    ASSERT_TRUE(info.has_value());
+
+    // the test binary links libcurl so a copy of it serves as a compiled R
+    // package
+    LdSoCache cache;
+    auto libcurl = cache.resolve("libcurl.so.4", *info, self);
+    if (!libcurl) {
+        GTEST_SKIP() << "libcurl.so.4 is not in the ld.so cache";
+    }
+
+    TempDir tmp{"r4r-shlib-test-"};
+    auto const& dir = *tmp;
+    auto info_dir = dir / "info";
+    auto lib_path = dir / "library";
+    fs::create_directories(info_dir);
+    fs::create_directories(lib_path / "curl" / "libs");
+    fs::create_directories(lib_path / "pure" / "R");
+    fs::copy_file(self, lib_path / "curl" / "libs" / "curl.so");
+    {
+        // the dev package owns the link the package was linked against,
+        // the rest is left to the toolchain
+        std::ofstream{info_dir / "libcurl4-openssl-dev.list"}
+            << (libcurl->parent_path() / "libcurl.so").string() << "\n";
+        std::ofstream libcurl4{info_dir / "libcurl4.list"};
+        std::ofstream libc6{info_dir / "libc6.list"};
+        for (auto const& soname : info->needed) {
+            auto library = cache.resolve(soname, *info, self);
+            ASSERT_TRUE(library.has_value()) << soname;
+            auto& list = soname == "libcurl.so.4" ? libcurl4 : libc6;
+            list << library->string() << "\n"
+                 << fs::weakly_canonical(*library).string() << "\n";
+        }
+    }
+
+    DebPackages packages;
+    for (auto const* name : {"libcurl4", "libcurl4-openssl-dev", "libc6"}) {
+        packages.emplace(name, std::make_unique<DebPackage>(
+                                   DebPackage{.name = name,
+                                              .version = "1.0",
+                                              .source = "curl"}));
+    }
+    auto db = DpkgDatabase::from_path(info_dir, std::move(packages));
+
+    auto curl = RPackageBuilder{"curl", "5.0"}.lib_path(lib_path).build();
+    auto pure = RPackageBuilder{"pure", "1.0"}.lib_path(lib_path).build();
+    auto result = SharedLibraryDependencyResolver{db, cache}.resolve(
+        {&curl, &pure});
+
+    EXPECT_TRUE(result.packages.contains("libcurl4-openssl-dev"));
+    EXPECT_FALSE(result.packages.contains("libcurl4"));
+    EXPECT_FALSE(result.packages.contains("libc6"));
+    EXPECT_TRUE(result.resolved.contains(&curl));
+    EXPECT_FALSE(result.resolved.contains(&pure));
+}
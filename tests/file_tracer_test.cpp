@@ -2,6 +2,7 @@
 #include "file_tracer.h"
 #include "ignore_file_map.h"
 #include "syscall_monitor.h"
+#include "tracing_status.h"
 #include "util_fs.h"
 #include <fstream>
 #include <gtest/gtest.h>
@@ -264,3 +265,37 @@ TEST(FileTracerTest, ReadlinkAtSyscall) {
     EXPECT_EQ(symlinks.find(*symlink_path)->second, *symlink_target_path);
     ASSERT_TRUE(symlinks.find(*nonexistent_symlink) == symlinks.end());
 }
+
+TEST(FileTracerTest, StatusFile) {
+    TempFile status_path{"r4r-test-status", ".json"};
+    fs::remove(*status_path);
+    TracingStatusFile status_file{*status_path, std::chrono::milliseconds{0}};
+
+    FileTracer tracer{};
+    tracer.set_status_file(&status_file);
+
+    SyscallMonitor monitor(
+        []() {
+            for (int i = 0; i < 1000; i++) {
+                syscall(SYS_getpid); // NOLINT(*-pro-type-vararg)
+            }
+            return 0;
+        },
+        tracer);
+
+    auto result = monitor.start();
+    ASSERT_EQ(result.kind, SyscallMonitor::Result::Exit);
+
+    // written while tracing
+    ASSERT_TRUE(fs::exists(*status_path));
+    auto running = JsonParser::parse(read_from_file(*status_path));
+    EXPECT_TRUE(json_query<bool>(running, "running"));
+
+    tracer.report_status(false);
+    auto final = JsonParser::parse(read_from_file(*status_path));
+    EXPECT_FALSE(json_query<bool>(final, "running"));
+    EXPECT_GE(json_query<int>(final, "syscalls"), 1000);
+    EXPECT_EQ(json_query<int>(final, "processes"), 1);
+    EXPECT_EQ(json_query<int>(final, "top_processes.0.pid"),
+              tracer.process_tree().processes().front().pid);
+}
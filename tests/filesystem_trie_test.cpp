@@ -1,5 +1,7 @@
 #include "filesystem_trie.h"
 #include <gtest/gtest.h>
+#include <memory>
+#include <string_view>
 #include <vector>
 #include <algorithm>
 
@@ -223,3 +225,116 @@ TEST(FileSystemTrieTest, SizeMethod) {
     trie.insert("/a/b/c", "new_value3");
     EXPECT_EQ(trie.size(), 4);
 }
+
+TEST(FileSystemTrieCopyConstructorTest, CopyOutlivesOriginal) {
+    auto orig = std::make_unique<FileSystemTrie<std::string>>();
+    orig->insert("/a/b", "value1");
+    orig->insert("/a/c", "value2");
+
+    FileSystemTrie<std::string> copy(*orig);
+    orig.reset();
+
+    ASSERT_NE(copy.find("/a/b"), nullptr);
+    EXPECT_EQ(*copy.find("/a/b"), "value1");
+    EXPECT_EQ(*copy.find("/a/c"), "value2");
+    EXPECT_EQ(copy.size(), 2);
+}
+
+TEST(FileSystemTrieTest, ManyPaths) {
+    FileSystemTrie<int> trie;
+
+    auto path = [](int i) {
+        return "/usr/lib/pkg" + std::to_string(i % 100) + "/file" +
+               std::to_string(i);
+    };
+
+    for (int i = 0; i < 10000; i++) {
+        trie.insert(path(i), i);
+    }
+
+    EXPECT_EQ(trie.size(), 10000);
+    for (int i = 0; i < 10000; i++) {
+        auto const* r = trie.find(path(i));
+        ASSERT_NE(r, nullptr);
+        EXPECT_EQ(*r, i);
+    }
+    EXPECT_EQ(trie.find("/usr/lib/pkg1/file2"), nullptr);
+    EXPECT_EQ(trie.find_last_matching("/usr/lib/pkg1/file1/x"),
+              trie.find("/usr/lib/pkg1/file1"));
+    EXPECT_EQ(std::distance(trie.begin(), trie.end()), 10000);
+}
+
+TEST(FileSystemTrieTest, StringViewLookup) {
+    FileSystemTrie<int> trie;
+    trie.insert("/usr/lib/", 1);
+    trie.insert("usr/share", 2);
+
+    std::string buffer = "/usr//lib/libc.so.6";
+    std::string_view dir{buffer.data(), 10};
+
+    EXPECT_EQ(*trie.find(dir), 1);
+    EXPECT_EQ(*trie.find_last_matching(buffer), 1);
+    EXPECT_EQ(*trie.find("usr/share/"), 2);
+    // absolute and relative paths are different
+    EXPECT_EQ(trie.find("/usr/share"), nullptr);
+    EXPECT_EQ(trie.find("usr/lib"), nullptr);
+}
+
+TEST(FileSystemTrieTest, FindSorted) {
+    FileSystemTrie<int> trie;
+    trie.insert("/usr/lib/R/site-library/cli", 1);
+    trie.insert("/usr/lib/R/site-library/cli/libs/cli.so", 2);
+    trie.insert("/usr/lib/R/site-library/rlang", 3);
+    trie.insert("/usr/bin/R", 4);
+
+    std::vector<std::string_view> paths{
+        "/usr/bin/R",
+        "/usr/bin/Rscript",
+        "/usr/lib/R/site-library/cli",
+        "/usr/lib/R/site-library/cli/DESCRIPTION",
+        "/usr/lib/R/site-library/cli/libs/cli.so",
+        "/usr/lib/R/site-library/rlang/R/rlang",
+        "/usr/lib/R/site-library/rlang/R/rlang.rdb",
+        "/usr/lib/x",
+        "relative",
+    };
+
+    auto found = trie.find_sorted(paths);
+    auto last_matching = trie.find_last_matching_sorted(paths);
+    ASSERT_EQ(found.size(), paths.size());
+    ASSERT_EQ(last_matching.size(), paths.size());
+
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        EXPECT_EQ(found[i], trie.find(paths[i])) << paths[i];
+        EXPECT_EQ(last_matching[i], trie.find_last_matching(paths[i]))
+            << paths[i];
+    }
+
+    // the order only matters for the speed
+    std::ranges::reverse(paths);
+    auto reversed = trie.find_last_matching_sorted(paths);
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        EXPECT_EQ(reversed[i], trie.find_last_matching(paths[i])) << paths[i];
+    }
+}
+
+TEST(FileSystemTrieTest, Merge) {
+    FileSystemTrie<std::string> a;
+    a.insert("/usr/bin/R", "r-base");
+    a.insert("/usr", "a");
+
+    FileSystemTrie<std::string> b;
+    b.insert("/usr/bin/Rscript", "r-base-core");
+    b.insert("/usr/lib/libR.so", "libr");
+    b.insert("/usr", "b");
+
+    a.merge(b);
+
+    EXPECT_EQ(a.size(), 4);
+    EXPECT_EQ(*a.find("/usr/bin/R"), "r-base");
+    EXPECT_EQ(*a.find("/usr/bin/Rscript"), "r-base-core");
+    EXPECT_EQ(*a.find("/usr/lib/libR.so"), "libr");
+    // the merged values win
+    EXPECT_EQ(*a.find("/usr"), "b");
+    EXPECT_EQ(a.find("/usr/bin"), nullptr);
+}
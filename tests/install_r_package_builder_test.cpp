@@ -1,10 +1,13 @@
 #include "install_r_package_builder.h"
 #include "rpkg_database.h"
+#include "util_fs.h"
 
 #include <gtest/gtest.h>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <system_error>
+#include <utility>
 #include <vector>
 
 class InstallRPackageScriptBuilderTest : public ::testing::Test {
@@ -125,3 +128,137 @@ TEST_F(InstallRPackageScriptBuilderTest, ParallelLimitExpandsCorrectly) {
     EXPECT_TRUE(
         string_contains(result, "Installing batch 3/3 with 1 packages"));
 }
+
+TEST_F(InstallRPackageScriptBuilderTest, CriticalPathOrder) {
+    // slow <- app, base <- fast <- app, base <- leaf
+    auto base = RPackageBuilder{"base", "1.0"}.build();
+    auto fast = RPackageBuilder{"fast", "1.0"}.with_dependency("base").build();
+    auto slow = RPackageBuilder{"slow", "1.0"}.needs_compilation(true).build();
+    auto app = RPackageBuilder{"app", "1.0"}
+                   .with_dependency("fast")
+                   .with_dependency("slow")
+                   .with_dependency("utils")
+                   .build();
+    auto leaf = RPackageBuilder{"leaf", "1.0"}.with_dependency("base").build();
+    auto utils = RPackageBuilder{"utils", "4.4"}.isBase(true).build();
+
+    std::vector<std::vector<RPackage const*>> plan = {
+        {&base, &slow, &utils}, {&fast, &leaf}, {&app}};
+
+    auto builder = create_builder();
+    builder.set_plan(plan);
+
+    auto names = [](auto const& order) {
+        std::vector<std::string> names;
+        for (auto const& [pkg, _] : order) {
+            names.push_back(pkg->name);
+        }
+        return names;
+    };
+
+    auto order = builder.critical_path_order();
+    // ties in the order of the plan
+    EXPECT_EQ(names(order), (std::vector<std::string>{"slow", "base", "fast",
+                                                      "leaf", "app"}));
+    // app needs slow and fast
+    EXPECT_EQ(order[4].second, (std::vector<std::size_t>{0, 2}));
+    EXPECT_TRUE(order[0].second.empty());
+
+    // the history tells base is the slow one
+    builder.set_install_times({{"base", 600}, {"slow", 1}});
+    EXPECT_EQ(
+        names(builder.critical_path_order()),
+        (std::vector<std::string>{"base", "fast", "slow", "leaf", "app"}));
+}
+
+TEST_F(InstallRPackageScriptBuilderTest, CriticalPathScript) {
+    std::vector<std::vector<RPackage const*>> plan = {
+        {cran_pkg1_.get(), github_pkg_.get()}, {cran_pkg2_.get()}};
+
+    auto builder = create_builder();
+    builder.set_plan(plan)
+        .set_schedule(InstallSchedule::CriticalPath)
+        .set_max_parallel(0)
+        .build();
+
+    std::string result = output_.str();
+
+    EXPECT_TRUE(string_contains(result, "#!/usr/bin/env Rscript"));
+    EXPECT_TRUE(string_contains(result, "parallel::mcparallel"));
+    EXPECT_TRUE(string_contains(result, "MemAvailable"));
+    EXPECT_TRUE(string_contains(result, "remotes::install_github('user/repo'"));
+    EXPECT_TRUE(string_contains(result, "remotes::install_version('pkg2'"));
+    EXPECT_FALSE(string_contains(result, "Installing batch"));
+    EXPECT_TRUE(
+        string_contains(result, "All 3 packages installed successfully"));
+
+    // the control characters in the R strings are escaped
+    EXPECT_FALSE(string_contains(result, "\t"));
+    EXPECT_TRUE(string_contains(result, R"(sprintf('%s\t%.1f')"));
+    EXPECT_TRUE(string_contains(result, R"(pkg_version[i], '\n'))"));
+    EXPECT_TRUE(string_contains(result, R"(sep = '\n'))"));
+}
+
+TEST_F(InstallRPackageScriptBuilderTest, BinaryRepository) {
+    std::vector<std::vector<RPackage const*>> plan = {
+        {cran_pkg1_.get(), cran_pkg2_.get()}};
+
+    auto builder = create_builder();
+    builder.set_plan(plan)
+        .set_max_parallel(2)
+        .set_binary_repository("https://ppm/cran/__linux__/jammy/2024-06-03",
+                               {cran_pkg1_.get()})
+        .build();
+
+    std::string result = output_.str();
+
+    EXPECT_TRUE(string_contains(
+        result, "install.packages('pkg1', repos = "
+                "'https://ppm/cran/__linux__/jammy/2024-06-03'"));
+    EXPECT_TRUE(string_contains(result, "HTTPUserAgent"));
+    EXPECT_FALSE(string_contains(result, "install_version('pkg1'"));
+    EXPECT_TRUE(string_contains(result, "install_version('pkg2'"));
+}
+
+TEST_F(InstallRPackageScriptBuilderTest, SourceTarballs) {
+    std::vector<std::vector<RPackage const*>> plan = {
+        {cran_pkg1_.get(), github_pkg_.get()}};
+
+    auto builder = create_builder();
+    builder.set_plan(plan)
+        .set_schedule(InstallSchedule::CriticalPath)
+        .set_source_tarballs(
+            {{cran_pkg1_.get(),
+              {.urls = {"https://cran/src/contrib/pkg1_1.0.0.tar.gz",
+                        "https://cran/src/contrib/Archive/pkg1/"
+                        "pkg1_1.0.0.tar.gz"}}}})
+        .build();
+
+    std::string result = output_.str();
+
+    EXPECT_TRUE(string_contains(
+        result, "c('https://cran/src/contrib/pkg1_1.0.0.tar.gz', "
+                "'https://cran/src/contrib/Archive/pkg1/pkg1_1.0.0.tar.gz')"));
+    EXPECT_TRUE(string_contains(result, "download.file"));
+    EXPECT_TRUE(string_contains(result, "'CMD', 'INSTALL'"));
+    EXPECT_FALSE(string_contains(result, "install_version('pkg1'"));
+    // the GitHub package without a tarball still needs remotes
+    EXPECT_TRUE(string_contains(result, "install.packages('remotes'"));
+    EXPECT_TRUE(string_contains(result, "install_github('user/repo'"));
+}
+
+TEST(RInstallTimesTest, LoadAndSave) {
+    TempFile file{"r4r-install-times-", ".tsv"};
+    // as the installation script records them
+    write_to_file(*file, "# comment 1\npkg2\t12.5\npkg1\t3\nbroken\n\n");
+
+    auto times = load_r_install_times(*file);
+    EXPECT_EQ(times, (RInstallTimes{{"pkg1", 3}, {"pkg2", 12.5}}));
+
+    times["pkg3"] = 0.5;
+    save_r_install_times(times, *file);
+    EXPECT_EQ(read_from_file(*file), "pkg1\t3\npkg2\t12.5\npkg3\t0.5\n");
+    EXPECT_EQ(load_r_install_times(*file), times);
+
+    EXPECT_THROW(load_r_install_times(*file / "missing"), std::system_error);
+}
@@ -97,4 +97,10 @@ TEST(JsonQuery, SimpleQuery) {
     auto res =
         json_query<std::string>(json, "requirements.0.requirements.packages.0");
     EXPECT_EQ(res, "libpq-dev");
-}
\ No newline at end of file
+}
+
+TEST(JsonPrinter, IntegralDoubles) {
+    JsonValue json = JsonObject{{"big", 12345678901.0}, {"pi", 3.5}};
+
+    EXPECT_EQ(STR(json), R"({"big":12345678901,"pi":3.5})");
+}
@@ -0,0 +1,122 @@
+#include "json_view.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+TEST(JsonDocumentTest, Values) {
+    std::string input = R"({
+        "name": "RPostgres",
+        "version": 1.5,
+        "count": -42,
+        "ok": true,
+        "nothing": null,
+        "tags": ["a", "b\nc", "é😀"],
+        "nested": {"empty": {}, "list": []}
+    })";
+
+    auto doc = JsonDocument::parse(input);
+    auto root = doc.root();
+
+    EXPECT_EQ(root.type(), JsonType::Object);
+    EXPECT_EQ(root.size(), 7);
+    EXPECT_EQ(root.at("name").as_string(), "RPostgres");
+    EXPECT_EQ(root.at("version").as_number<double>(), 1.5);
+    EXPECT_EQ(root.at("count").as_number<int>(), -42);
+    EXPECT_TRUE(root.at("ok").as_bool());
+    EXPECT_TRUE(root.at("nothing").is_null());
+    EXPECT_FALSE(root.find("missing").has_value());
+
+    auto tags = root.at("tags");
+    ASSERT_EQ(tags.size(), 3);
+    EXPECT_EQ(tags[0].as_string(), "a");
+    EXPECT_EQ(tags[1].as_string(), "b\nc");
+    EXPECT_EQ(tags[2].as_string(), "\xc3\xa9\xf0\x9f\x98\x80");
+    EXPECT_THROW((void)tags[3], std::out_of_range);
+
+    EXPECT_EQ(root.at("nested").at("empty").size(), 0);
+    EXPECT_EQ(root.at("nested").at("list").size(), 0);
+
+    EXPECT_THROW((void)root.at("name").as_bool(), std::invalid_argument);
+    EXPECT_THROW((void)root.at("count").as_number<unsigned>(),
+                 std::invalid_argument);
+
+    // the unescaped strings are views into the input
+    auto name = root.at("name").as_string();
+    EXPECT_GE(name.data(), input.data());
+    EXPECT_LT(name.data(), input.data() + input.size());
+
+    std::vector<std::string> keys;
+    root.at("nested").for_each_member(
+        [&](std::string_view key, JsonElement) { keys.emplace_back(key); });
+    EXPECT_EQ(keys, (std::vector<std::string>{"empty", "list"}));
+}
+
+TEST(JsonDocumentTest, Invalid) {
+    for (auto const* input :
+         {"", "{", "[1,]", R"({"a" 1})", R"({"a":1,})", "\"abc", "01a",
+          "1.", "-", "tru", "[1] 2", R"(["\x"])", "{1:2}"}) {
+        EXPECT_THROW(
+            {
+                auto doc = JsonDocument::parse(input);
+                doc.root().for_each_item([](JsonElement e) {
+                    if (e.type() == JsonType::String) {
+                        (void)e.as_string();
+                    }
+                });
+            },
+            std::exception)
+            << input;
+    }
+}
+
+TEST(JsonPathQueryTest, Extract) {
+    std::string input = R"({
+        "name": "pkg",
+        "ignored": {"requirements": [{"packages": ["no"]}]},
+        "requirements": [
+            {"name": "libpq", "requirements": {"packages": ["libpq-dev"]}},
+            {"name": "libxml2",
+             "requirements": {"packages": ["libxml2-dev", "pkg-config"]}}
+        ]
+    })";
+
+    JsonPathQuery query{"requirements.*.requirements.packages.*", "name",
+                        "requirements.1.name"};
+
+    std::vector<std::pair<std::size_t, std::string>> found;
+    query.run(input, [&](std::size_t path, JsonScalar const& value) {
+        found.emplace_back(path, value.string());
+    });
+
+    EXPECT_EQ(found, (std::vector<std::pair<std::size_t, std::string>>{
+                         {1, "pkg"},
+                         {0, "libpq-dev"},
+                         {2, "libxml2"},
+                         {0, "libxml2-dev"},
+                         {0, "pkg-config"},
+                     }));
+}
+
+TEST(JsonPathQueryTest, Scalars) {
+    JsonPathQuery query{"a.*"};
+
+    std::vector<JsonType> types;
+    query.run(R"({"a": [1, true, null, "x", [2], {"b": 3}]})",
+              [&](std::size_t, JsonScalar const& value) {
+                  types.push_back(value.type);
+              });
+
+    EXPECT_EQ(types, (std::vector<JsonType>{JsonType::Number,
+                                            JsonType::Boolean, JsonType::Null,
+                                            JsonType::String}));
+
+    // the containers are not given to the callback, but count as matches
+    JsonPathQuery containers{"a", "b.*", "c"};
+    EXPECT_EQ(containers.run(R"({"a": [], "b": [{}]})", [&](auto, auto&) {}),
+              0b011);
+
+    EXPECT_THROW(JsonPathQuery{"a..b"}, std::invalid_argument);
+    EXPECT_THROW(query.run(R"({"a": [1, 2)", [](auto, auto const&) {}),
+                 JsonParseError);
+}
@@ -0,0 +1,110 @@
+#ifndef TESTS_LOCAL_HTTP_SERVER_H
+#define TESTS_LOCAL_HTTP_SERVER_H
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+// A minimal HTTP/1.1 server on localhost, one request per connection.
+class LocalHttpServer {
+  public:
+    using Handler = std::function<std::pair<int, std::string>(
+        std::string const& path, int hit)>;
+
+    explicit LocalHttpServer(Handler handler) : handler_{std::move(handler)} {
+        fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (fd_ < 0 ||
+            ::bind(fd_, reinterpret_cast<sockaddr*>(&addr), len) != 0 ||
+            ::listen(fd_, 64) != 0 ||
+            ::getsockname(fd_, reinterpret_cast<sockaddr*>(&addr), &len) !=
+                0) {
+            throw std::runtime_error("Failed to start the HTTP server");
+        }
+        port_ = ntohs(addr.sin_port);
+        thread_ = std::thread{[this] { serve(); }};
+    }
+
+    ~LocalHttpServer() {
+        stop_ = true;
+        thread_.join();
+        ::close(fd_);
+    }
+
+    [[nodiscard]] std::string url(std::string const& path) const {
+        return "http://127.0.0.1:" + std::to_string(port_) + path;
+    }
+
+    int hits(std::string const& path) {
+        std::lock_guard lock{mutex_};
+        return hits_[path];
+    }
+
+  private:
+    void serve() {
+        while (!stop_) {
+            pollfd pfd{.fd = fd_, .events = POLLIN, .revents = 0};
+            if (::poll(&pfd, 1, 20) <= 0) {
+                continue;
+            }
+            int client = ::accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0) {
+                handle(client);
+                ::close(client);
+            }
+        }
+    }
+
+    void handle(int client) {
+        std::string request;
+        char buffer[4096];
+        while (request.find("\r\n\r\n") == std::string::npos) {
+            auto n = ::read(client, buffer, sizeof(buffer));
+            if (n <= 0) {
+                return;
+            }
+            request.append(buffer, static_cast<size_t>(n));
+        }
+
+        // GET <path> HTTP/1.1
+        auto start = request.find(' ') + 1;
+        auto path = request.substr(start, request.find(' ', start) - start);
+
+        int hit = 0;
+        {
+            std::lock_guard lock{mutex_};
+            hit = ++hits_[path];
+        }
+
+        auto [code, body] = handler_(path, hit);
+        auto response = "HTTP/1.1 " + std::to_string(code) +
+                        " Status\r\nContent-Length: " +
+                        std::to_string(body.size()) +
+                        "\r\nConnection: close\r\n\r\n" + body;
+        auto written = ::write(client, response.data(), response.size());
+        (void)written;
+    }
+
+    Handler handler_;
+    int fd_{-1};
+    int port_{0};
+    std::atomic<bool> stop_{false};
+    std::mutex mutex_;
+    std::map<std::string, int> hits_;
+    std::thread thread_;
+};
+
+#endif // TESTS_LOCAL_HTTP_SERVER_H
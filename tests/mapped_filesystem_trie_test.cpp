@@ -0,0 +1,226 @@
+#include "mapped_filesystem_trie.h"
+#include "util_fs.h"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+FileSystemTrie<std::uint32_t> make_trie() {
+    FileSystemTrie<std::uint32_t> trie;
+    trie.insert("/usr/lib/libc.so.6", 1);
+    trie.insert("/usr/lib/libm.so.6", 2);
+    trie.insert("/usr/share/doc", 3);
+    trie.insert("/etc", 4);
+    trie.insert("relative/path", 5);
+    return trie;
+}
+
+} // namespace
+
+TEST(MappedFileSystemTrieTest, Empty) {
+    MappedFileSystemTrie<bool> trie;
+    EXPECT_EQ(trie.find("/a"), nullptr);
+    EXPECT_EQ(trie.find_last_matching("/a/b"), nullptr);
+    EXPECT_EQ(trie.size(), 0);
+
+    auto empty = MappedFileSystemTrie<bool>::from_trie({});
+    EXPECT_EQ(empty.find("/a"), nullptr);
+    EXPECT_EQ(empty.size(), 0);
+}
+
+TEST(MappedFileSystemTrieTest, SameLookupsAsTrie) {
+    auto trie = make_trie();
+    auto mapped = MappedFileSystemTrie<std::uint32_t>::from_trie(trie, "meta");
+
+    EXPECT_EQ(mapped.size(), 5);
+    EXPECT_EQ(mapped.metadata(), "meta");
+
+    for (auto const* path :
+         {"/usr/lib/libc.so.6", "/usr//lib/libm.so.6", "/usr/share/doc/",
+          "/etc", "relative/path", "/usr/lib", "/usr/lib/libz.so", "/",
+          "relative", "/relative/path", ""}) {
+        auto const* expected = trie.find(path);
+        auto const* actual = mapped.find(path);
+        ASSERT_EQ(expected == nullptr, actual == nullptr) << path;
+        if (expected != nullptr) {
+            EXPECT_EQ(*expected, *actual) << path;
+        }
+    }
+
+    EXPECT_EQ(*mapped.find_last_matching("/usr/share/doc/r/README"), 3);
+    EXPECT_EQ(*mapped.find_last_matching("/etc/passwd"), 4);
+    EXPECT_EQ(mapped.find_last_matching("/usr/lib/x"), nullptr);
+}
+
+TEST(MappedFileSystemTrieTest, SaveAndLoad) {
+    TempFile file{"r4r-trie-", ".trie"};
+
+    make_trie().save(*file, 42, "meta");
+
+    auto loaded = MappedFileSystemTrie<std::uint32_t>::load(*file, 42);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->size(), 5);
+    EXPECT_EQ(loaded->metadata(), "meta");
+    EXPECT_EQ(*loaded->find("/usr/lib/libm.so.6"), 2);
+    EXPECT_EQ(*loaded->find("relative/path"), 5);
+    EXPECT_EQ(loaded->find("/usr/lib/libz.so"), nullptr);
+
+    // moving keeps the mapping
+    auto moved = std::move(*loaded);
+    EXPECT_EQ(*moved.find("/etc"), 4);
+}
+
+TEST(MappedFileSystemTrieTest, SaveMapped) {
+    TempFile file{"r4r-trie-", ".trie"};
+
+    auto mapped =
+        MappedFileSystemTrie<std::uint32_t>::from_trie(make_trie(), "meta");
+    mapped.save(*file, 7);
+
+    auto loaded = MappedFileSystemTrie<std::uint32_t>::load(*file, 7);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->metadata(), "meta");
+    EXPECT_EQ(*loaded->find("/usr/share/doc"), 3);
+}
+
+TEST(MappedFileSystemTrieTest, RejectsStaleOrInvalidFiles) {
+    TempFile file{"r4r-trie-", ".trie"};
+
+    EXPECT_FALSE(MappedFileSystemTrie<std::uint32_t>::load(*file));
+
+    make_trie().save(*file, 42);
+    EXPECT_FALSE(MappedFileSystemTrie<std::uint32_t>::load(*file, 43));
+    // different value type
+    EXPECT_FALSE(MappedFileSystemTrie<bool>::load(*file));
+    EXPECT_TRUE(MappedFileSystemTrie<std::uint32_t>::load(*file));
+
+    fs::resize_file(*file, fs::file_size(*file) - 1);
+    EXPECT_FALSE(MappedFileSystemTrie<std::uint32_t>::load(*file));
+
+    {
+        std::ofstream out{*file, std::ios::trunc};
+        out << "not a trie";
+    }
+    EXPECT_FALSE(MappedFileSystemTrie<std::uint32_t>::load(*file));
+}
+
+TEST(MappedFileSystemTrieTest, RejectsOutOfRangeReferences) {
+    namespace format = filesystem_trie::file;
+    TempFile file{"r4r-trie-", ".trie"};
+
+    auto corrupt = [&](auto update) {
+        make_trie().save(*file, 42);
+        std::fstream io{*file, std::ios::in | std::ios::out |
+                                   std::ios::binary};
+        format::Header header{};
+        io.read(reinterpret_cast<char*>(&header), sizeof(header));
+        update(io, header);
+    };
+    auto write_at = [](std::fstream& io, std::uint64_t offset,
+                       auto const& value) {
+        io.seekp(static_cast<std::streamoff>(offset));
+        io.write(reinterpret_cast<char const*>(&value), sizeof(value));
+    };
+
+    // children past the last node
+    corrupt([&](std::fstream& io, format::Header const& header) {
+        format::Node root{};
+        io.seekg(static_cast<std::streamoff>(header.nodes.offset));
+        io.read(reinterpret_cast<char*>(&root), sizeof(root));
+        root.child_count = header.node_count;
+        write_at(io, header.nodes.offset, root);
+    });
+    EXPECT_FALSE(MappedFileSystemTrie<std::uint32_t>::load(*file, 42));
+
+    // a value past the last one
+    corrupt([&](std::fstream& io, format::Header const& header) {
+        format::Node root{};
+        io.seekg(static_cast<std::streamoff>(header.nodes.offset));
+        io.read(reinterpret_cast<char*>(&root), sizeof(root));
+        root.value = header.value_count;
+        write_at(io, header.nodes.offset, root);
+    });
+    EXPECT_FALSE(MappedFileSystemTrie<std::uint32_t>::load(*file, 42));
+
+    // a component name past the strings
+    corrupt([&](std::fstream& io, format::Header const& header) {
+        write_at(io, header.components.offset,
+                 format::Component{.offset = 0,
+                                 .length = static_cast<std::uint32_t>(
+                                     header.strings.size + 1)});
+    });
+    EXPECT_FALSE(MappedFileSystemTrie<std::uint32_t>::load(*file, 42));
+
+    // an index without empty slots would never end a failed lookup
+    corrupt([&](std::fstream& io, format::Header const& header) {
+        for (std::uint32_t i = 0; i < header.index_size; ++i) {
+            write_at(io, header.index.offset + i * sizeof(std::uint32_t),
+                     std::uint32_t{1});
+        }
+    });
+    EXPECT_FALSE(MappedFileSystemTrie<std::uint32_t>::load(*file, 42));
+
+    corrupt([](std::fstream&, format::Header const&) {});
+    EXPECT_TRUE(MappedFileSystemTrie<std::uint32_t>::load(*file, 42));
+}
+
+TEST(MappedFileSystemTrieTest, ManyPaths) {
+    FileSystemTrie<std::uint32_t> trie;
+
+    auto path = [](std::uint32_t i) {
+        return "/usr/lib/pkg" + std::to_string(i % 100) + "/file" +
+               std::to_string(i);
+    };
+
+    for (std::uint32_t i = 0; i < 10000; i++) {
+        trie.insert(path(i), i);
+    }
+
+    auto mapped = MappedFileSystemTrie<std::uint32_t>::from_trie(trie);
+    EXPECT_EQ(mapped.size(), 10000);
+    for (std::uint32_t i = 0; i < 10000; i++) {
+        auto const* r = mapped.find(path(i));
+        ASSERT_NE(r, nullptr);
+        EXPECT_EQ(*r, i);
+    }
+    EXPECT_EQ(mapped.find("/usr/lib/pkg1/file2"), nullptr);
+}
+
+TEST(MappedFileSystemTrieTest, FindSorted) {
+    auto trie = make_trie();
+    auto mapped = MappedFileSystemTrie<std::uint32_t>::from_trie(trie);
+
+    std::vector<std::string_view> paths{
+        "/etc",
+        "/etc/passwd",
+        "/usr/lib/libc.so.6",
+        "/usr/lib/libc.so.6/x",
+        "/usr/lib/libm.so.6",
+        "/usr/share/doc/r",
+        "relative/path",
+    };
+
+    auto found = mapped.find_sorted(paths);
+    auto last_matching = mapped.find_last_matching_sorted(paths);
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        auto const* expected = trie.find(paths[i]);
+        ASSERT_EQ(found[i] == nullptr, expected == nullptr) << paths[i];
+        if (expected != nullptr) {
+            EXPECT_EQ(*found[i], *expected) << paths[i];
+        }
+
+        expected = trie.find_last_matching(paths[i]);
+        ASSERT_EQ(last_matching[i] == nullptr, expected == nullptr)
+            << paths[i];
+        if (expected != nullptr) {
+            EXPECT_EQ(*last_matching[i], *expected) << paths[i];
+        }
+    }
+
+    EXPECT_EQ(MappedFileSystemTrie<std::uint32_t>{}.find_sorted(paths),
+              std::vector<std::uint32_t const*>(paths.size(), nullptr));
+}
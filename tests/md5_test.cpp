@@ -0,0 +1,44 @@
+#include "md5.h"
+#include "util_fs.h"
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+
+TEST(Md5Test, KnownDigests) {
+    EXPECT_EQ(Md5::hash(""), "d41d8cd98f00b204e9800998ecf8427e");
+    EXPECT_EQ(Md5::hash("abc"), "900150983cd24fb0d6963f7d28e17f72");
+    EXPECT_EQ(Md5::hash("The quick brown fox jumps over the lazy dog"),
+              "9e107d9d372bb6826bd81d3542a419d6");
+    // exactly one block and the padding in its own block
+    EXPECT_EQ(Md5::hash(std::string(64, 'a')),
+              "014842d480b571495a4a0363793f7367");
+    EXPECT_EQ(Md5::hash(std::string(56, 'a')),
+              "3b0c8ac703f828b04c6c197006d17218");
+}
+
+TEST(Md5Test, IncrementalUpdate) {
+    std::string data(1000, 'x');
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>('a' + i % 26);
+    }
+
+    Md5 md5;
+    for (std::size_t i = 0; i < data.size(); i += 7) {
+        auto chunk = std::string_view{data}.substr(i, 7);
+        md5.update(chunk.data(), chunk.size());
+    }
+
+    EXPECT_EQ(Md5::to_hex(md5.finish()), Md5::hash(data));
+}
+
+TEST(Md5Test, File) {
+    TempDir dir{"r4r-md5-test-"};
+    auto file = *dir / "abc";
+    std::ofstream{file} << "abc";
+
+    std::string buffer;
+    EXPECT_EQ(md5_file(file, buffer), "900150983cd24fb0d6963f7d28e17f72");
+    fs::remove(file);
+
+    EXPECT_THROW(md5_file(file, buffer), std::system_error);
+}
@@ -16,6 +16,18 @@ TEST(CommandTest, TestEnvAndWorkingDir) {
     EXPECT_EQ(0, out.exit_code);
 }
 
+TEST(CommandTest, TestEnv) {
+    auto out = Command("sh")
+                   .arg("-c")
+                   .arg("echo $R4R_TEST_VAR:$HOME")
+                   .env("R4R_TEST_VAR", "value")
+                   .env("HOME", "/nonexistent")
+                   .output();
+
+    EXPECT_EQ(out.stdout_data, "value:/nonexistent\n");
+    EXPECT_EQ(0, out.exit_code);
+}
+
 TEST(CommandTest, TestMergeStderrToStdout) {
     auto out = Command("sh")
                    .arg("-c")
@@ -0,0 +1,146 @@
+#include "file_tracer.h"
+#include "json.h"
+#include "process_tree.h"
+#include "syscall_monitor.h"
+#include <chrono>
+#include <gtest/gtest.h>
+#include <thread>
+
+TEST(ProcessTreeTest, BuildTree) {
+    ProcessTree tree;
+    rusage usage{};
+    usage.ru_utime = {.tv_sec = 1, .tv_usec = 500};
+    usage.ru_stime = {.tv_sec = 0, .tv_usec = 250};
+    usage.ru_maxrss = 1024;
+
+    tree.on_spawn(1, 10);
+    tree.on_exec(10, "/bin/sh", {"sh", "-c", "true"});
+    tree.on_spawn(10, 11);
+    tree.on_syscall(11);
+    tree.on_syscall(11);
+    tree.on_file(11);
+    tree.on_exec(11, "/bin/true", {"true"});
+    EXPECT_EQ(tree.running(), 2);
+
+    tree.on_exit(11, 0, usage);
+    EXPECT_EQ(tree.running(), 1);
+    EXPECT_EQ(tree.find(11), nullptr);
+
+    tree.finish();
+    EXPECT_EQ(tree.running(), 0);
+
+    auto const& processes = tree.processes();
+    ASSERT_EQ(processes.size(), 2);
+
+    auto const& child = processes[1];
+    EXPECT_EQ(child.pid, 11);
+    EXPECT_EQ(child.ppid, 10);
+    EXPECT_EQ(child.exe, "/bin/true");
+    EXPECT_EQ(child.syscalls, 2);
+    EXPECT_EQ(child.files, 1);
+    EXPECT_EQ(child.exit_code, 0);
+    EXPECT_EQ(child.max_rss, 1024);
+    EXPECT_EQ(child.cpu_time(), std::chrono::microseconds{1000750});
+
+    auto json = tree.to_json();
+    EXPECT_EQ(json_query<int>(json, "pid"), 10);
+    EXPECT_EQ(json_query<std::string>(json, "argv.2"), "true");
+    EXPECT_EQ(json_query<int>(json, "children.0.pid"), 11);
+    EXPECT_EQ(json_query<double>(json, "children.0.cpu_us"), 1000750);
+
+    auto trace = tree.to_chrome_trace();
+    EXPECT_EQ(json_query<JsonArray>(trace, "traceEvents").size(), 2);
+    EXPECT_EQ(json_query<std::string>(trace, "traceEvents.1.name"), "true");
+    EXPECT_EQ(json_query<std::string>(trace, "traceEvents.1.ph"), "X");
+}
+
+TEST(ProcessTreeTest, ResourceUsage) {
+    ProcessTree tree;
+    EXPECT_EQ(tree.resource_usage().max_rss, 0);
+    EXPECT_EQ(tree.resource_usage().cpus, 0);
+
+    tree.on_spawn(1, 10);
+    tree.on_spawn(10, 11);
+    // still running
+    EXPECT_EQ(tree.resource_usage().cpus, 0);
+
+    rusage child{};
+    child.ru_utime = {.tv_sec = 5, .tv_usec = 0};
+    child.ru_maxrss = 4096;
+    tree.on_exit(11, 0, child);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+
+    // including the CPU time of the child it waited for
+    rusage root{};
+    root.ru_utime = {.tv_sec = 5, .tv_usec = 0};
+    root.ru_stime = {.tv_sec = 1, .tv_usec = 0};
+    root.ru_maxrss = 1024;
+    tree.on_exit(10, 0, root);
+
+    auto usage = tree.resource_usage();
+    EXPECT_EQ(usage.max_rss, 4096);
+    // 6s of CPU time in a wall time a lot shorter
+    EXPECT_GT(usage.cpus, 1);
+    EXPECT_LE(usage.cpus, 600);
+}
+
+TEST(ProcessTreeTest, ChildStopBeforeForkEvent) {
+    ProcessTree tree;
+
+    tree.on_spawn(1, 10);
+    tree.on_exec(10, "/bin/sh", {"sh"});
+    // the child can be reported before its parent gets the fork event
+    tree.on_syscall(11);
+    tree.on_spawn(10, 11);
+
+    auto const* child = tree.find(11);
+    ASSERT_NE(child, nullptr);
+    EXPECT_EQ(child->ppid, 10);
+    EXPECT_EQ(child->exe, "/bin/sh");
+    EXPECT_EQ(child->syscalls, 1);
+}
+
+TEST(ProcessTreeTest, TraceForkAndExec) {
+    char const* executable = "/bin/true";
+
+    FileTracer tracer{};
+
+    SyscallMonitor monitor(
+        [&executable]() {
+            pid_t pid = fork();
+            if (pid == 0) {
+                execl(executable, executable, "arg",
+                      nullptr); // NOLINT(*-pro-type-vararg)
+                _exit(127);
+            }
+            int status{};
+            waitpid(pid, &status, 0);
+            return WEXITSTATUS(status);
+        },
+        tracer);
+
+    auto result = monitor.start();
+    ASSERT_EQ(result.kind, SyscallMonitor::Result::Exit);
+    ASSERT_EQ(result.detail.value(), 0);
+
+    auto const& processes = tracer.process_tree().processes();
+    ASSERT_EQ(processes.size(), 2);
+
+    auto const& root = processes[0];
+    auto const& child = processes[1];
+
+    EXPECT_EQ(root.ppid, getpid());
+    EXPECT_EQ(root.exit_code, 0);
+    EXPECT_TRUE(root.end.has_value());
+    EXPECT_GT(root.syscalls, 0);
+
+    EXPECT_EQ(child.ppid, root.pid);
+    EXPECT_EQ(child.exe, executable);
+    EXPECT_EQ(child.argv, (std::vector<std::string>{executable, "arg"}));
+    EXPECT_EQ(child.exit_code, 0);
+    EXPECT_GT(child.max_rss, 0);
+    EXPECT_GE(child.files, 1);
+    EXPECT_GE(child.start, root.start);
+    EXPECT_LE(*child.end, *root.end);
+}
@@ -0,0 +1,64 @@
+#include "local_http_server.h"
+#include "md5.h"
+#include "r_source_cache.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <utility>
+
+TEST(RSourceCacheTest, Fetch) {
+    std::string const abc{"\x1f\x8b abc tarball"};
+    std::string const def{"\x1f\x8b def tarball"};
+
+    LocalHttpServer server{[&](std::string const& path, int) {
+        if (path == "/src/contrib/Archive/abc/abc_1.0.tar.gz") {
+            return std::pair{200, abc};
+        }
+        if (path == "/src/contrib/def_2.0.tar.gz") {
+            return std::pair{200, def};
+        }
+        if (path == "/src/contrib/bad_1.0.tar.gz") {
+            return std::pair{200, std::string{"<html>not found</html>"}};
+        }
+        return std::pair{404, std::string{"not found"}};
+    }};
+
+    TempDir tmp{"r4r-r-source-cache-test-"};
+    // the cache creates its directory
+    auto dir = *tmp / "cache";
+
+    auto abc_pkg = RPackageBuilder{"abc", "1.0"}.build();
+    auto def_pkg = RPackageBuilder{"def", "2.0"}.build();
+    auto bad_pkg = RPackageBuilder{"bad", "1.0"}.build();
+    auto wrong_pkg = RPackageBuilder{"wrong", "1.0"}.build();
+
+    std::unordered_map<RPackage const*, RSourceTarball> tarballs{
+        // the current release is gone, the archive has it
+        {&abc_pkg,
+         {.urls = {server.url("/src/contrib/abc_1.0.tar.gz"),
+                   server.url("/src/contrib/Archive/abc/abc_1.0.tar.gz")}}},
+        {&def_pkg,
+         {.urls = {server.url("/src/contrib/def_2.0.tar.gz")},
+          .md5sum = Md5::hash(def)}},
+        {&bad_pkg, {.urls = {server.url("/src/contrib/bad_1.0.tar.gz")}}},
+        {&wrong_pkg,
+         {.urls = {server.url("/src/contrib/def_2.0.tar.gz")},
+          .md5sum = Md5::hash("something else")}},
+    };
+
+    RSourceCache cache{dir};
+    auto files = cache.fetch(tarballs);
+
+    ASSERT_EQ(files.size(), 2);
+    EXPECT_EQ(read_from_file(files.at(&abc_pkg)), abc);
+    EXPECT_EQ(files.at(&def_pkg), dir / "objects" / Md5::hash(def));
+    EXPECT_EQ(server.hits("/src/contrib/def_2.0.tar.gz"), 2);
+
+    // the second time all comes from the cache
+    auto cached = RSourceCache{dir}.fetch(tarballs);
+    EXPECT_EQ(cached, files);
+    EXPECT_EQ(server.hits("/src/contrib/Archive/abc/abc_1.0.tar.gz"), 1);
+    EXPECT_EQ(server.hits("/src/contrib/def_2.0.tar.gz"), 3);
+
+    // the failed downloads are not left behind
+    EXPECT_TRUE(fs::is_empty(dir / "tmp"));
+}
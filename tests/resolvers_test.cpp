@@ -0,0 +1,86 @@
+#include "resolvers.h"
+#include "util_fs.h"
+#include <fstream>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+TEST(DebPackageResolverTest, ResolvesFilesAndSymlinksByAliases) {
+    TempDir tmp{"r4r-resolvers-test-"};
+    auto root = *tmp / "root";
+    fs::create_directories(root / "real");
+    fs::create_directories(*tmp / "info");
+    std::ofstream{root / "real" / "a"} << "a";
+    std::ofstream{root / "real" / "b"} << "b";
+    std::ofstream{root / "other"} << "other";
+    fs::create_directory_symlink(root / "real", root / "link");
+    fs::create_symlink(root / "real" / "a", root / "a-link");
+    fs::create_symlink(root / "real" / "b", root / "b-link");
+
+    // the links are known only by their targets
+    std::ofstream{*tmp / "info" / "pkg-a.list"}
+        << (root / "real" / "a").string() << '\n';
+    std::ofstream{*tmp / "info" / "pkg-b.list"}
+        << (root / "real" / "b").string() << '\n';
+
+    DebPackages packages;
+    packages.emplace("pkg-a", std::make_unique<DebPackage>("pkg-a", "1.0"));
+    packages.emplace("pkg-b", std::make_unique<DebPackage>("pkg-b", "1.0"));
+    auto db = DpkgDatabase::from_path(*tmp / "info", std::move(packages));
+
+    Resolver::Files files{
+        {.path = root / "real" / "a", .size = {}, .existed_before = true},
+        {.path = root / "other", .size = {}, .existed_before = true},
+        {.path = root / "b-link", .size = {}, .existed_before = true},
+    };
+    Resolver::Symlinks symlinks{
+        {root / "a-link", root / "real" / "a"},
+        {root / "link", root / "real"},
+    };
+    Manifest manifest;
+
+    DebPackageResolver{&db}.resolve(files, symlinks, manifest);
+
+    ASSERT_EQ(files.size(), 1);
+    EXPECT_EQ(files[0].path, root / "other");
+    ASSERT_EQ(symlinks.size(), 1);
+    EXPECT_EQ(symlinks.begin()->first, root / "link");
+    EXPECT_EQ(manifest.deb_packages,
+              (std::unordered_set<DebPackage const*>{
+                  db.lookup_by_name("pkg-a"), db.lookup_by_name("pkg-b")}));
+}
+
+TEST(LookupWithAliasesTest, KeepsTheAliasOrder) {
+    TempDir tmp{"r4r-aliases-test-"};
+    std::ofstream{*tmp / "f"} << "f";
+    fs::create_symlink(*tmp / "f", *tmp / "link");
+
+    auto path = *tmp / "link";
+    auto expected = SymlinkResolver{}.resolve_symlinks(path);
+    ASSERT_EQ(expected.size(), 2);
+
+    int const owner = 0;
+    auto real = (*tmp / "f").string();
+    std::vector<fs::path const*> paths{&path, &path};
+    auto result = lookup_with_aliases<int>(
+        paths, [&](std::span<std::string_view const> sorted) {
+            EXPECT_TRUE(std::ranges::is_sorted(sorted));
+            std::vector<int const*> found;
+            for (auto p : sorted) {
+                found.push_back(p == real ? &owner : nullptr);
+            }
+            return found;
+        });
+
+    ASSERT_EQ(result.size(), 2);
+    for (auto const& aliases : result) {
+        ASSERT_EQ(aliases.size(), expected.size());
+        auto it = expected.begin();
+        for (auto const& [alias, pkg] : aliases) {
+            EXPECT_EQ(alias, *it++);
+            EXPECT_EQ(pkg, alias == real ? &owner : nullptr);
+        }
+    }
+}
@@ -1,5 +1,8 @@
 #include "rpkg_database.h"
+#include <fstream>
 #include <gtest/gtest.h>
+#include <sstream>
+#include <unordered_map>
 #include <unordered_set>
 #include <variant>
 
@@ -103,6 +106,180 @@ TEST(RPackagesTest, Parsing) {
     }
 }
 
+TEST(ParseDcfTest, Fields) {
+    auto fields = parse_dcf("Package: sass\n"
+                            "Version: 0.4.9 \n"
+                            "Imports: fs (>= 1.2.4), rlang (>= 0.4.10),\n"
+                            "        htmltools (>= 0.5.1),\r\n"
+                            "\tR6\n"
+                            "Empty:\n"
+                            "NeedsCompilation: yes");
+
+    EXPECT_EQ(fields.size(), 5);
+    EXPECT_EQ(fields["Package"], "sass");
+    EXPECT_EQ(fields["Version"], "0.4.9");
+    EXPECT_EQ(fields["Imports"], "fs (>= 1.2.4), rlang (>= 0.4.10), "
+                                 "htmltools (>= 0.5.1), R6");
+    EXPECT_EQ(fields["Empty"], "");
+    EXPECT_EQ(fields["NeedsCompilation"], "yes");
+}
+
+namespace {
+
+void write_description(fs::path const& lib, std::string const& name,
+                       std::string const& fields) {
+    fs::create_directories(lib / name);
+    std::ofstream{lib / name / "DESCRIPTION"}
+        << "Package: " << name << '\n'
+        << fields << "Built: R 4.4.2; ; 2025-01-01 00:00:00 UTC; unix\n";
+}
+
+} // namespace
+
+TEST(ParsePackagesIndexTest, Versions) {
+    std::string_view index = "Package: A3\n"
+                             "Version: 1.0.0\n"
+                             "Depends: R (>= 2.15.0), xtable,\n"
+                             "        pbapply\n"
+                             "MD5sum: 027ebdd8affce8f0effaecfcd5f5ade2\n"
+                             "\n"
+                             "Package: abc\r\n"
+                             "Version: 2.2.1\r\n"
+                             "\r\n"
+                             "Version: 9.9\n";
+
+    EXPECT_EQ(parse_packages_index(index),
+              (std::unordered_map<std::string, std::string>{
+                  {"A3", "1.0.0"}, {"abc", "2.2.1"}}));
+    EXPECT_EQ(parse_packages_index(index, "MD5sum"),
+              (std::unordered_map<std::string, std::string>{
+                  {"A3", "027ebdd8affce8f0effaecfcd5f5ade2"}}));
+
+    EXPECT_EQ(r_binary_repository("https://packagemanager.posit.co/cran/",
+                                  "jammy", "2024-06-03"),
+              "https://packagemanager.posit.co/cran/__linux__/jammy/"
+              "2024-06-03");
+}
+
+TEST(RPackagesTest, SourceTarballs) {
+    auto cran = RPackageBuilder{"abc", "1.2"}.build();
+    auto old = RPackageBuilder{"old", "1.0"}.build();
+    auto gh = RPackageBuilder{"def", "0.1"}
+                  .repository(RPackage::GitHub{
+                      .org = "org", .name = "def", .ref = "main"})
+                  .build();
+    std::string const mirror = "https://cran.example.org/";
+
+    // without the index, the archive is tried after the current release
+    auto tarballs = RpkgDatabase::get_source_tarballs({&cran, &gh}, mirror,
+                                                      std::nullopt);
+
+    EXPECT_EQ(tarballs[&cran].urls,
+              (std::vector<std::string>{
+                  "https://cran.example.org/src/contrib/abc_1.2.tar.gz",
+                  "https://cran.example.org/src/contrib/Archive/abc/"
+                  "abc_1.2.tar.gz"}));
+    EXPECT_EQ(tarballs[&cran].md5sum, "");
+    EXPECT_EQ(tarballs[&gh].urls,
+              (std::vector<std::string>{
+                  "https://github.com/org/def/archive/main.tar.gz"}));
+
+    // with it, only the one that has the version
+    std::string const index = "Package: abc\nVersion: 1.2\n"
+                              "MD5sum: 027ebdd8affce8f0effaecfcd5f5ade2\n\n"
+                              "Package: old\nVersion: 2.0\n";
+    tarballs = RpkgDatabase::get_source_tarballs({&cran, &old}, mirror, index);
+
+    EXPECT_EQ(tarballs[&cran].urls,
+              (std::vector<std::string>{
+                  "https://cran.example.org/src/contrib/abc_1.2.tar.gz"}));
+    EXPECT_EQ(tarballs[&cran].md5sum, "027ebdd8affce8f0effaecfcd5f5ade2");
+    EXPECT_EQ(tarballs[&old].urls,
+              (std::vector<std::string>{"https://cran.example.org/src/"
+                                        "contrib/Archive/old/old_1.0.tar.gz"}));
+    EXPECT_EQ(tarballs[&old].md5sum, "");
+}
+
+TEST(RPackagesTest, FromLibPaths) {
+    TempDir tmp{"r4r-rpkg-lib-test-"};
+    auto const& dir = *tmp;
+    auto user_lib = dir / "user";
+    auto system_lib = dir / "system";
+
+    write_description(user_lib, "bslib",
+                      "Version: 0.4.2\n"
+                      "Depends: R (>= 2.10)\n"
+                      "Imports: htmltools (>= 0.5.4), jsonlite,\n"
+                      "    jquerylib (>= 0.1.3)\n");
+    write_description(user_lib, "rlang",
+                      "Version: 1.1.4\n"
+                      "NeedsCompilation: yes\n"
+                      "RemoteType: github\n"
+                      "RemoteUsername: r-lib\n"
+                      "RemoteRepo: rlang\n"
+                      "RemoteRef: main\n");
+    write_description(user_lib, "htmltools",
+                      "Version: 0.5.8\nLinkingTo: rlang\n");
+    write_description(system_lib, "htmltools", "Version: 0.5.4\n");
+    write_description(system_lib, "jsonlite", "Version: 1.8.9\n");
+    write_description(system_lib, "tools", "Version: 4.4.2\nPriority: base\n");
+    // not installed packages
+    fs::create_directories(system_lib / "empty");
+    fs::create_directories(system_lib / "source");
+    std::ofstream{system_lib / "source/DESCRIPTION"}
+        << "Package: source\nVersion: 1.0\n";
+
+    RpkgDatabase db{{}};
+    auto log_sink = Logger::get().with_sink(std::make_unique<StoreSink>(), [&] {
+        db = RpkgDatabase::from_lib_paths({user_lib, system_lib, dir / "none"},
+                                          2);
+    });
+
+    ASSERT_EQ(db.size(), 5);
+
+    auto const* bslib = db.find("bslib");
+    ASSERT_NE(bslib, nullptr);
+    EXPECT_EQ(bslib->lib_path, user_lib);
+    EXPECT_EQ(bslib->version, "0.4.2");
+    // jquerylib is missing
+    EXPECT_EQ(bslib->dependencies,
+              (std::set<std::string>{"htmltools", "jsonlite"}));
+    EXPECT_FALSE(bslib->needs_compilation);
+
+    // the first library wins
+    EXPECT_EQ(db.find("htmltools")->version, "0.5.8");
+    EXPECT_EQ(db.find("htmltools")->dependencies,
+              std::set<std::string>{"rlang"});
+
+    auto const* rlang = db.find("rlang");
+    EXPECT_TRUE(rlang->needs_compilation);
+    EXPECT_EQ(rlang->repository,
+              (RPackage::Repository{RPackage::GitHub{
+                  .org = "r-lib", .name = "rlang", .ref = "main"}}));
+
+    EXPECT_TRUE(db.find("tools")->is_base);
+    EXPECT_EQ(db.find("source"), nullptr);
+
+    // the same as from installed.packages(), without tools
+    std::ostringstream out;
+    for (auto const* name : {"bslib", "htmltools", "jsonlite", "rlang"}) {
+        auto const* p = db.find(name);
+        auto const* gh = std::get_if<RPackage::GitHub>(&p->repository);
+        out << p->name << NBSP << p->lib_path.string() << NBSP << p->version
+            << NBSP
+            << (p->dependencies.empty() ? "NA"
+                                        : string_join(p->dependencies, ", "))
+            << NBSP "NA" NBSP "NA" NBSP "NA" NBSP
+            << (p->needs_compilation ? "yes" : "no") << NBSP
+            << (gh ? "github" : "NA") << NBSP << (gh ? gh->org : "NA") << NBSP
+            << (gh ? gh->name : "NA") << NBSP << (gh ? gh->ref : "NA") << '\n';
+    }
+    std::istringstream in{out.str()};
+    auto from_R = RpkgDatabase::from_stream(in);
+    EXPECT_EQ(from_R.differences(db),
+              std::vector<std::string>{"tools is extra"});
+}
+
 TEST(RPackagesTest, SystemDependencies) {
     // Synthetic data
     // RPostgres package depends on libpq-dev
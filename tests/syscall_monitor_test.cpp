@@ -7,6 +7,7 @@
 
 #include <cerrno>
 #include <cstring>
+#include <future>
 #include <stdexcept>
 #include <string>
 
@@ -94,9 +95,12 @@ class TestSyscallListener : public SyscallListener {
         std::uint64_t syscall;
     };
 
+    void on_tick() override { ++ticks; }
+
     std::vector<EntryCall> entries;
     std::vector<ExitCall> exits;
     std::unordered_map<pid_t, std::uint64_t> state;
+    int ticks{0};
 };
 
 TEST(SyscallMonitorTest, OpenSyscall) {
@@ -208,3 +212,42 @@ TEST(SyscallMonitorTest, OpenSyscallFromChild) {
 
     ASSERT_TRUE(fs::exists(*temp_file));
 }
+
+TEST(SyscallMonitorTest, DoesNotReapChildrenOfOtherThreads) {
+    // the processes spawned concurrently (e.g. R loading the package
+    // database) must be left to their own waitpid
+    auto tracee = []() {
+        ::usleep(200'000);
+        return 0;
+    };
+
+    TestSyscallListener listener;
+    SyscallMonitor monitor{tracee, listener};
+
+    auto other = std::async(std::launch::async, [] {
+        return Command("sh").arg("-c").arg("sleep 0.05; exit 3").output();
+    });
+
+    auto result = monitor.start();
+    ASSERT_EQ(result.kind, SyscallMonitor::Result::Exit);
+    ASSERT_EQ(result.detail, 0);
+
+    auto out = other.get();
+    EXPECT_EQ(out.exit_code, 3);
+}
+
+TEST(SyscallMonitorTest, TicksWhileBlocked) {
+    // a single syscall blocking for a while
+    auto tracee = []() {
+        ::usleep(300'000);
+        return 0;
+    };
+
+    TestSyscallListener listener;
+    SyscallMonitor monitor{tracee, listener};
+    monitor.set_tick_interval(std::chrono::milliseconds{50});
+
+    auto result = monitor.start();
+    ASSERT_EQ(result.kind, SyscallMonitor::Result::Exit);
+    EXPECT_GE(listener.ticks, 3);
+}
@@ -0,0 +1,119 @@
+#include "sysreqs.h"
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+std::string const kRules = R"({
+  "distributions": ["debian", "ubuntu"],
+  "rules": [
+    {"patterns": ["libcurl"], "packages": ["libcurl4-openssl-dev"]},
+    {"patterns": ["png"], "packages": ["libpng-dev"]},
+    {"patterns": ["openssl"], "packages": ["libssl-dev"]},
+    {"patterns": ["gnu make"], "packages": ["make"]},
+    {"patterns": ["c++17"], "packages": []},
+    {
+      "patterns": ["v8", "libnode"],
+      "packages": ["libnode-dev"],
+      "overrides": [
+        {"distribution": "ubuntu", "releases": ["18.04"], "packages": ["libv8-dev"]}
+      ]
+    }
+  ]
+})";
+
+OsRelease const kDebian{.distribution = "debian", .release = "12"};
+
+} // namespace
+
+TEST(SysreqsRulesTest, Match) {
+    SysreqsRules rules{kRules};
+
+    EXPECT_EQ(rules.match("libcurl: libcurl-devel (rpm) or\n"
+                          "    libcurl4-openssl-dev (deb)",
+                          kDebian),
+              std::vector<std::string>{"libcurl4-openssl-dev"});
+    EXPECT_EQ(rules.match("GNU   Make, PNG", kDebian),
+              (std::vector<std::string>{"libpng-dev", "make"}));
+    EXPECT_EQ(rules.match("C++17", kDebian), std::vector<std::string>{});
+
+    EXPECT_EQ(rules.match("GNU make; png,\n", kDebian),
+              (std::vector<std::string>{"libpng-dev", "make"}));
+
+    // only whole words
+    EXPECT_EQ(rules.match("libpng16, make", kDebian), std::nullopt);
+    EXPECT_EQ(rules.match("libcurl: libcurl-devel (rpm) or "
+                          "libcurl4-openssl-dev (deb)",
+                          kDebian),
+              std::vector<std::string>{"libcurl4-openssl-dev"});
+    EXPECT_EQ(rules.match("OpenSSL >= 1.0.2", kDebian),
+              std::vector<std::string>{"libssl-dev"});
+    EXPECT_EQ(rules.match("png.", kDebian),
+              std::vector<std::string>{"libpng-dev"});
+    EXPECT_EQ(rules.match("", kDebian), std::nullopt);
+    // each of the requirements has to match
+    EXPECT_EQ(rules.match("GNU make, hiredis", kDebian), std::nullopt);
+    EXPECT_EQ(rules.match("libcurl; hiredis", kDebian), std::nullopt);
+}
+
+TEST(SysreqsRulesTest, Overrides) {
+    SysreqsRules rules{kRules};
+
+    EXPECT_EQ(rules.match("V8 engine", kDebian),
+              std::vector<std::string>{"libnode-dev"});
+    EXPECT_EQ(rules.match("V8 engine", {.distribution = "ubuntu",
+                                        .release = "22.04"}),
+              std::vector<std::string>{"libnode-dev"});
+    EXPECT_EQ(rules.match("V8 engine", {.distribution = "ubuntu",
+                                        .release = "18.04"}),
+              std::vector<std::string>{"libv8-dev"});
+
+    EXPECT_TRUE(rules.supports("ubuntu"));
+    EXPECT_FALSE(rules.supports("fedora"));
+}
+
+TEST(SysreqsRulesTest, Bundled) {
+    auto const& rules = SysreqsRules::bundled();
+
+    EXPECT_EQ(rules.match("GDAL (>= 2.0.1), GEOS (>= 3.4.0), PROJ (>= 4.8.0)",
+                          kDebian),
+              (std::vector<std::string>{"libgdal-dev", "gdal-bin",
+                                        "libgeos-dev", "libproj-dev"}));
+}
+
+TEST(SystemDependencyResolverTest, Resolve) {
+    TempDir tmp{"r4r-sysreqs-test-"};
+    auto const& dir = *tmp;
+
+    RPackage curl{.name = "curl",
+                  .version = "5.2.0",
+                  .system_requirements = "libcurl: libcurl-devel (rpm)"};
+    RPackage none{.name = "none", .version = "1.0", .system_requirements = ""};
+    RPackage unknown{.name = "unknown",
+                     .version = "1.0",
+                     .system_requirements = "something else"};
+    // loaded from R, so the requirements are not known
+    RPackage cached{.name = "cached", .version = "0.1"};
+
+    auto cache = dir / "sysreqs" / "debian-12" / "cached_0.1.json";
+    fs::create_directories(cache.parent_path());
+    std::ofstream{cache} << R"({"requirements": [
+        {"requirements": {"packages": ["libfoo-dev"]}}
+    ]})";
+
+    SysreqsRules rules{kRules};
+    std::unordered_set<RPackage const*> pkgs{&curl, &none, &cached};
+
+    EXPECT_EQ(SystemDependencyResolver(kDebian, dir, true, rules).resolve(pkgs),
+              (std::unordered_set<std::string>{"libcurl4-openssl-dev",
+                                               "libfoo-dev"}));
+    EXPECT_EQ(
+        SystemDependencyResolver(kDebian, dir, false, rules).resolve(pkgs),
+        std::unordered_set<std::string>{"libcurl4-openssl-dev"});
+    EXPECT_EQ(SystemDependencyResolver(kDebian, dir, false, rules)
+                  .resolve({&unknown}),
+              std::unordered_set<std::string>{});
+}
@@ -35,3 +35,19 @@ TEST(TempFileTest, GeneratesUniqueFiles) {
     EXPECT_NE(*temp1, *temp2)
         << "Generated temp files should have unique names";
 }
+
+TEST(TempDirTest, RemovesContentsOnDestruction) {
+    fs::path dir;
+    {
+        TempDir temp("test_dir_");
+        dir = *temp;
+        ASSERT_TRUE(fs::is_directory(dir));
+        fs::create_directories(dir / "a" / "b");
+        std::ofstream{dir / "a" / "file"} << "content";
+
+        TempDir other("test_dir_");
+        EXPECT_NE(*temp, *other);
+    }
+    EXPECT_FALSE(fs::exists(dir))
+        << "Directory should be deleted after TempDir object is destroyed";
+}